@@ -5,11 +5,15 @@
 #include <cctype> // for tolower
 #include <cstdlib> // for system()
 #include <algorithm> // for find_if
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
 
 using namespace std;
 
-#define MAX_USERS 1000
-
 enum UserRole {
     ROLE_ADMIN,
     ROLE_EMPLOYEE
@@ -27,25 +31,208 @@ struct LoginCredential {
     string password;
 };
 
+// Growable user store. Users are kept ordered by id so listings stay stable,
+// with a username index so lookups and duplicate checks don't scan every user.
+// Memory grows with the number of users actually loaded; there is no cap.
+//
+// Username, full name and email are also covered by a trigram index: every
+// 3-byte substring maps to the sorted ids of users containing it, so a
+// substring search only has to verify users present in all of its trigrams.
+struct UserStore {
+    map<int, User> byId;
+    unordered_map<string, int> idByUsername;
+    unordered_map<uint32_t, vector<int>> trigramPostings;
+
+    static uint32_t packTrigram(const string& s, size_t i) {
+        return ((uint32_t)(unsigned char)s[i] << 16) |
+               ((uint32_t)(unsigned char)s[i + 1] << 8) |
+               (uint32_t)(unsigned char)s[i + 2];
+    }
+
+    // Appends every trigram of s (duplicates included) to out
+    static void collectTrigrams(const string& s, vector<uint32_t>& out) {
+        for (size_t i = 0; i + 3 <= s.size(); i++) {
+            out.push_back(packTrigram(s, i));
+        }
+    }
+
+    static vector<uint32_t> userTrigrams(const User& user) {
+        vector<uint32_t> grams;
+        collectTrigrams(user.username, grams);
+        collectTrigrams(user.fullName, grams);
+        collectTrigrams(user.email, grams);
+        sort(grams.begin(), grams.end());
+        grams.erase(unique(grams.begin(), grams.end()), grams.end());
+        return grams;
+    }
+
+    void indexUser(const User& user) {
+        for (uint32_t gram : userTrigrams(user)) {
+            vector<int>& ids = trigramPostings[gram];
+            // Ids are usually handed out in increasing order, so this is an append
+            if (ids.empty() || ids.back() < user.id) {
+                ids.push_back(user.id);
+            } else {
+                ids.insert(lower_bound(ids.begin(), ids.end(), user.id), user.id);
+            }
+        }
+    }
+
+    void unindexUser(const User& user) {
+        for (uint32_t gram : userTrigrams(user)) {
+            auto posting = trigramPostings.find(gram);
+            if (posting == trigramPostings.end()) continue;
+            vector<int>& ids = posting->second;
+            auto it = lower_bound(ids.begin(), ids.end(), user.id);
+            if (it != ids.end() && *it == user.id) ids.erase(it);
+            if (ids.empty()) trigramPostings.erase(posting);
+        }
+    }
+
+    static bool matches(const User& user, const string& term) {
+        return user.username.find(term) != string::npos ||
+               user.fullName.find(term) != string::npos ||
+               user.email.find(term) != string::npos;
+    }
+
+    int count() const { return (int)byId.size(); }
+
+    User* findById(int id) {
+        auto it = byId.find(id);
+        return it == byId.end() ? nullptr : &it->second;
+    }
+
+    bool hasUsername(const string& username) const {
+        return idByUsername.count(username) > 0;
+    }
+
+    // Returns false if the id or username is already taken
+    bool insert(const User& user) {
+        if (byId.count(user.id) || hasUsername(user.username)) return false;
+        byId.emplace(user.id, user);
+        idByUsername.emplace(user.username, user.id);
+        indexUser(user);
+        return true;
+    }
+
+    bool erase(int id) {
+        auto it = byId.find(id);
+        if (it == byId.end()) return false;
+        unindexUser(it->second);
+        idByUsername.erase(it->second.username);
+        byId.erase(it);
+        return true;
+    }
+
+    // Keeps the username index in sync when a user is renamed
+    bool rename(int id, const string& newUsername) {
+        User* user = findById(id);
+        if (user == nullptr) return false;
+        if (user->username == newUsername) return true;
+        if (hasUsername(newUsername)) return false;
+        unindexUser(*user);
+        idByUsername.erase(user->username);
+        idByUsername.emplace(newUsername, id);
+        user->username = newUsername;
+        indexUser(*user);
+        return true;
+    }
+
+    // Full name and email are searchable, so edits go through here to reindex
+    void setFullName(int id, const string& fullName) {
+        User* user = findById(id);
+        if (user == nullptr) return;
+        unindexUser(*user);
+        user->fullName = fullName;
+        indexUser(*user);
+    }
+
+    void setEmail(int id, const string& email) {
+        User* user = findById(id);
+        if (user == nullptr) return;
+        unindexUser(*user);
+        user->email = email;
+        indexUser(*user);
+    }
+
+    // Ids of users whose username, full name or email contains term, in id order
+    vector<int> search(const string& term) const {
+        vector<int> result;
+        
+        // Terms shorter than a trigram can't use the index
+        if (term.size() < 3) {
+            for (const auto& entry : byId) {
+                if (matches(entry.second, term)) result.push_back(entry.first);
+            }
+            return result;
+        }
+
+        vector<uint32_t> grams;
+        collectTrigrams(term, grams);
+        sort(grams.begin(), grams.end());
+        grams.erase(unique(grams.begin(), grams.end()), grams.end());
+
+        vector<const vector<int>*> lists;
+        for (uint32_t gram : grams) {
+            auto posting = trigramPostings.find(gram);
+            if (posting == trigramPostings.end()) return result;
+            lists.push_back(&posting->second);
+        }
+        
+        // Intersect starting from the rarest trigram so the candidate set stays small
+        sort(lists.begin(), lists.end(),
+             [](const vector<int>* a, const vector<int>* b) { return a->size() < b->size(); });
+
+        vector<int> candidates = *lists[0];
+        vector<int> next;
+        for (size_t i = 1; i < lists.size() && !candidates.empty(); i++) {
+            next.clear();
+            set_intersection(candidates.begin(), candidates.end(),
+                             lists[i]->begin(), lists[i]->end(), back_inserter(next));
+            candidates.swap(next);
+        }
+
+        // Trigrams may come from different fields or positions, so verify each candidate
+        for (int id : candidates) {
+            auto it = byId.find(id);
+            if (it != byId.end() && matches(it->second, term)) result.push_back(id);
+        }
+        return result;
+    }
+
+    int maxId() const {
+        return byId.empty() ? 0 : byId.rbegin()->first;
+    }
+};
+
 // Function prototypes
-void loadUsers(User users[], int& count, const string& filename);
-void saveUsers(User users[], int count, const string& filename);
-void addUser(User users[], int& count, const string& filename);
-void deleteUser(User users[], int& count, const string& filename);
-void editUser(User users[], int count, const string& filename);
-int getNextId(User users[], int count);
+void loadUsers(UserStore& users, const string& filename);
+void saveUsers(const UserStore& users, const string& filename);
+void addUser(UserStore& users, const string& filename);
+void deleteUser(UserStore& users, const string& filename);
+void editUser(UserStore& users, const string& filename);
+int getNextId(const UserStore& users);
 void clearScreen();
 void waitForKeypress();
-bool usernameExists(User users[], int count, const string& username);
+bool usernameExists(const UserStore& users, const string& username);
 bool isValidUsername(const string& username);
 bool login(UserRole& role);
 void initializeCredentials();
-void adminMenu(User users[], int& userCount);
-void employeeMenu(User users[], int& userCount);
+void adminMenu(UserStore& users);
+void employeeMenu(UserStore& users);
 void manageAdminCredentials();
 void manageEmployeeCredentials();
+void searchUser(const UserStore& users);
+void benchmarkSearch(int userCount);
+
+int main(int argc, char* argv[]) {
+    // Search latency benchmark: manage-users --bench-search [user count]
+    if (argc > 1 && strcmp(argv[1], "--bench-search") == 0) {
+        benchmarkSearch(argc > 2 ? atoi(argv[2]) : 1000000);
+        return 0;
+    }
+    
 
-int main() {
     // Initialize admin and employee credentials if they don't exist
     initializeCredentials();
     
@@ -56,16 +243,15 @@ int main() {
         // Keep trying until successful login
     }
     
-    User users[MAX_USERS];
-    int userCount = 0;
+    UserStore users;
     string filename = "users.txt";
     
-    loadUsers(users, userCount, filename);
+    loadUsers(users, filename);
     
     if (currentRole == ROLE_ADMIN) {
-        adminMenu(users, userCount);
+        adminMenu(users);
     } else {
-        employeeMenu(users, userCount);
+        employeeMenu(users);
     }
     
     cout << "Thank you for using the System. Goodbye!" << endl;
@@ -156,7 +342,7 @@ bool login(UserRole& role) {
     }
 }
 
-void adminMenu(User users[], int& userCount) {
+void adminMenu(UserStore& users) {
     string filename = "users.txt";
     int choice;
 
@@ -167,6 +353,7 @@ void adminMenu(User users[], int& userCount) {
         cout << "2. Add New User" << endl;
         cout << "3. Delete User" << endl;
         cout << "4. Edit User" << endl;
+        cout << "5. Search User" << endl;
         cout << "0. Exit" << endl;
 
         string input;
@@ -199,9 +386,10 @@ void adminMenu(User users[], int& userCount) {
 
         switch (choice) {
             case 1: manageAdminCredentials(); break;
-            case 2: addUser(users, userCount, filename); break;
-            case 3: deleteUser(users, userCount, filename); break;
-            case 4: editUser(users, userCount, filename); break;
+            case 2: addUser(users, filename); break;
+            case 3: deleteUser(users, filename); break;
+            case 4: editUser(users, filename); break;
+            case 5: searchUser(users); break;
             case 0: 
                 cout << "Are you sure you want to exit? Press Enter to confirm..." << endl; 
                 cin.ignore(numeric_limits<streamsize>::max(), '\n');
@@ -213,7 +401,7 @@ void adminMenu(User users[], int& userCount) {
     }
 }
 
-void employeeMenu(User users[], int& userCount) {
+void employeeMenu(UserStore& users) {
     int choice;
 
     while (true) {
@@ -263,37 +451,42 @@ void employeeMenu(User users[], int& userCount) {
     }
 }
 
-void loadUsers(User users[], int& count, const string& filename) {
+void loadUsers(UserStore& users, const string& filename) {
     ifstream file(filename);
     if (!file) return;
 
     string line;
     while (getline(file, line)) {
-        if (count >= MAX_USERS) break;
-        users[count].id = stoi(line);
-        getline(file, users[count].username);
-        getline(file, users[count].password);
-        getline(file, users[count].fullName);
-        getline(file, users[count].email);
-        count++;
+        User user;
+        user.id = stoi(line);
+        getline(file, user.username);
+        getline(file, user.password);
+        getline(file, user.fullName);
+        getline(file, user.email);
+        
+        // Skip entries whose id or username collides with one already loaded
+        if (!users.insert(user)) {
+            cout << "Warning: skipping duplicate user entry with ID " << user.id << "." << endl;
+        }
     }
 
     file.close();
 }
 
-void saveUsers(User users[], int count, const string& filename) {
+void saveUsers(const UserStore& users, const string& filename) {
     ofstream file(filename);
     if (!file) {
         cout << "Error opening file for writing!" << endl;
         return;
     }
 
-    for (int i = 0; i < count; i++) {
-        file << users[i].id << endl;
-        file << users[i].username << endl;
-        file << users[i].password << endl;
-        file << users[i].fullName << endl;
-        file << users[i].email << endl;
+    for (const auto& entry : users.byId) {
+        const User& user = entry.second;
+        file << user.id << '\n';
+        file << user.username << '\n';
+        file << user.password << '\n';
+        file << user.fullName << '\n';
+        file << user.email << '\n';
     }
 
     file.close();
@@ -453,12 +646,8 @@ void manageEmployeeCredentials() {
     waitForKeypress();
 }
 
-bool usernameExists(User users[], int count, const string& username) {
-    for (int i = 0; i < count; i++) {
-        if (users[i].username == username)
-            return true;
-    }
-    return false;
+bool usernameExists(const UserStore& users, const string& username) {
+    return users.hasUsername(username);
 }
 
 // Function to validate username (no spaces allowed)
@@ -483,17 +672,12 @@ bool isValidUsername(const string& username) {
     return true;
 }
 
-void addUser(User users[], int& count, const string& filename) {
+void addUser(UserStore& users, const string& filename) {
     clearScreen();
-    if (count >= MAX_USERS) {
-        cout << "User limit reached. Cannot add more users." << endl;
-        waitForKeypress();
-        return;
-    }
 
     User newUser;
     cout << "===== Add New Employee =====" << endl;
-    newUser.id = getNextId(users, count);
+    newUser.id = getNextId(users);
 
     while (true) {
         cout << "Enter username (alphanumeric and '@' only): ";
@@ -517,7 +701,7 @@ void addUser(User users[], int& count, const string& filename) {
             continue;
         }
 
-        if (usernameExists(users, count, newUser.username)) {
+        if (usernameExists(users, newUser.username)) {
             cout << "Username already exists. Please choose another." << endl;
             continue;
         }
@@ -534,26 +718,26 @@ void addUser(User users[], int& count, const string& filename) {
     cout << "Enter email: ";
     getline(cin, newUser.email);
 
-    users[count++] = newUser;
-    saveUsers(users, count, filename);
+    users.insert(newUser);
+    saveUsers(users, filename);
     cout << "User added successfully!" << endl;
     waitForKeypress();
 }
 
-void deleteUser(User users[], int& count, const string& filename) {
+void deleteUser(UserStore& users, const string& filename) {
     clearScreen();
     int idToDelete;
     cout << "===== DELETE USER =====" << endl;
 
-    if (count == 0) {
+    if (users.count() == 0) {
         cout << "No users found." << endl;
         waitForKeypress();
         return;
     }
 
     cout << "Current users:\nID\tUsername\n----------------" << endl;
-    for (int i = 0; i < count; i++) {
-        cout << users[i].id << "\t" << users[i].username << endl;
+    for (const auto& entry : users.byId) {
+        cout << entry.first << "\t" << entry.second.username << '\n';
     }
 
     cout << "\nEnter ID of user to delete: ";
@@ -566,26 +750,17 @@ void deleteUser(User users[], int& count, const string& filename) {
     }
     cin.ignore(numeric_limits<streamsize>::max(), '\n');
 
-    int index = -1;
-    for (int i = 0; i < count; i++) {
-        if (users[i].id == idToDelete) {
-            index = i;
-            break;
-        }
-    }
+    User* user = users.findById(idToDelete);
 
-    if (index != -1) {
+    if (user != nullptr) {
         char confirm;
-        cout << "Are you sure you want to delete user '" << users[index].username << "'? (y/n): ";
+        cout << "Are you sure you want to delete user '" << user->username << "'? (y/n): ";
         cin >> confirm;
         cin.ignore(numeric_limits<streamsize>::max(), '\n');
 
         if (tolower(confirm) == 'y') {
-            for (int i = index; i < count - 1; i++) {
-                users[i] = users[i + 1];
-            }
-            count--;
-            saveUsers(users, count, filename);
+            users.erase(idToDelete);
+            saveUsers(users, filename);
             cout << "User deleted successfully!" << endl;
         } else {
             cout << "Deletion cancelled." << endl;
@@ -597,20 +772,20 @@ void deleteUser(User users[], int& count, const string& filename) {
     waitForKeypress();
 }
 
-void editUser(User users[], int count, const string& filename) {
+void editUser(UserStore& users, const string& filename) {
     clearScreen();
     int idToEdit;
     cout << "===== EDIT USER =====" << endl;
 
-    if (count == 0) {
+    if (users.count() == 0) {
         cout << "No users found." << endl;
         waitForKeypress();
         return;
     }
 
     cout << "Current users:\nID\tUsername\n----------------" << endl;
-    for (int i = 0; i < count; i++) {
-        cout << users[i].id << "\t" << users[i].username << endl;
+    for (const auto& entry : users.byId) {
+        cout << entry.first << "\t" << entry.second.username << '\n';
     }
 
     cout << "\nEnter ID of user to edit: ";
@@ -623,21 +798,15 @@ void editUser(User users[], int count, const string& filename) {
     }
     cin.ignore(numeric_limits<streamsize>::max(), '\n');
 
-    int index = -1;
-    for (int i = 0; i < count; i++) {
-        if (users[i].id == idToEdit) {
-            index = i;
-            break;
-        }
-    }
+    User* user = users.findById(idToEdit);
 
-    if (index != -1) {
+    if (user != nullptr) {
         int field;
         string newValue;
-        cout << "1. Username: " << users[index].username << endl;
-        cout << "2. Password: " << users[index].password << endl;
-        cout << "3. Full Name: " << users[index].fullName << endl;
-        cout << "4. Email: " << users[index].email << endl;
+        cout << "1. Username: " << user->username << endl;
+        cout << "2. Password: " << user->password << endl;
+        cout << "3. Full Name: " << user->fullName << endl;
+        cout << "4. Email: " << user->email << endl;
 
         cout << "Enter field number to edit (1-4): ";
         if (!(cin >> field)) {
@@ -658,10 +827,9 @@ void editUser(User users[], int count, const string& filename) {
                     // Validate username
                     if (!isValidUsername(newValue)) {
                         cout << "Invalid username. Only letters, numbers, and '@' are allowed." << endl;
-                    } else if (usernameExists(users, count, newValue) && newValue != users[index].username) {
+                    } else if (!users.rename(idToEdit, newValue)) {
                         cout << "Username already exists. Please choose another." << endl;
                     } else {
-                        users[index].username = newValue;
                         break;
                     }
                 } while (true);
@@ -669,22 +837,22 @@ void editUser(User users[], int count, const string& filename) {
             case 2: 
                 cout << "Enter new value: ";
                 getline(cin, newValue);
-                if (newValue == users[index].password) { 
+                if (newValue == user->password) { 
                     cout << "PLEASE? New password cannot be the same as the current password. ^^" << endl; 
                     waitForKeypress(); 
                     return;
                 }
-                users[index].password = newValue; 
+                user->password = newValue; 
                 break; 
             case 3: 
                 cout << "Enter new value: ";
                 getline(cin, newValue);
-                users[index].fullName = newValue; 
+                users.setFullName(idToEdit, newValue); 
                 break;
             case 4: 
                 cout << "Enter new value: ";
                 getline(cin, newValue);
-                users[index].email = newValue; 
+                users.setEmail(idToEdit, newValue); 
                 break;
             default:
                 cout << "Invalid field." << endl;
@@ -692,7 +860,7 @@ void editUser(User users[], int count, const string& filename) {
                 return;
         }
 
-        saveUsers(users, count, filename);
+        saveUsers(users, filename);
         cout << "User updated successfully!" << endl;
     } else {
         cout << "User ID not found." << endl;
@@ -701,11 +869,11 @@ void editUser(User users[], int count, const string& filename) {
     waitForKeypress();
 }
 
-void searchUser(User users[], int count) {
+void searchUser(const UserStore& users) {
     clearScreen();
     cout << "===== SEARCH USER =====" << endl;
 
-    if (count == 0) {
+    if (users.count() == 0) {
         cout << "No users found." << endl;
         waitForKeypress();
         return;
@@ -719,14 +887,11 @@ void searchUser(User users[], int count) {
     cout << "ID\tUsername\tFull Name\tEmail\n";
     cout << "------------------------------------------------\n";
 
-    for (int i = 0; i < count; i++) {
-        if (users[i].username.find(term) != string::npos ||
-            users[i].fullName.find(term) != string::npos ||
-            users[i].email.find(term) != string::npos) {
-            cout << users[i].id << "\t" << users[i].username << "\t\t"
-                 << users[i].fullName << "\t\t" << users[i].email << endl;
-            found = true;
-        }
+    for (int id : users.search(term)) {
+        const User& user = users.byId.at(id);
+        cout << user.id << "\t" << user.username << "\t\t"
+             << user.fullName << "\t\t" << user.email << endl;
+        found = true;
     }
 
     if (!found) {
@@ -736,10 +901,10 @@ void searchUser(User users[], int count) {
     waitForKeypress();
 }
 
-void displayAllUsers(User users[], int count) {
+void displayAllUsers(const UserStore& users) {
     clearScreen();
     cout << "===== ALL USERS =====" << endl;
-    if (count == 0) {
+    if (users.count() == 0) {
         cout << "No users found." << endl;
         waitForKeypress();
         return;
@@ -747,22 +912,58 @@ void displayAllUsers(User users[], int count) {
 
     cout << "ID\tUsername\tFull Name\tEmail" << endl;
     cout << "------------------------------------------------" << endl;
-    for (int i = 0; i < count; i++) {
-        cout << users[i].id << "\t" 
-             << users[i].username << "\t\t" 
-             << users[i].fullName << "\t\t" 
-             << users[i].email << endl;
+    for (const auto& entry : users.byId) {
+        const User& user = entry.second;
+        cout << user.id << "\t" 
+             << user.username << "\t\t" 
+             << user.fullName << "\t\t" 
+             << user.email << '\n';
     }
     waitForKeypress();
 }
 
-int getNextId(User users[], int count) {
-    int maxId = 0;
-    for (int i = 0; i < count; i++) {
-        if (users[i].id > maxId)
-            maxId = users[i].id;
+// Fills a store with synthetic users and compares indexed search against a full scan
+void benchmarkSearch(int userCount) {
+    const char* firstNames[] = {"Maria", "Jose", "Ana", "Juan", "Carlo", "Liza", "Paolo", "Grace"};
+    const char* lastNames[] = {"Santos", "Reyes", "Cruz", "Bautista", "Garcia", "Mendoza", "Torres"};
+    const char* domains[] = {"mail.com", "ims.local", "company.ph"};
+
+    UserStore users;
+    auto buildStart = chrono::steady_clock::now();
+    for (int i = 1; i <= userCount; i++) {
+        User user;
+        user.id = i;
+        user.username = "user" + to_string(i);
+        user.password = "pass";
+        user.fullName = string(firstNames[i % 8]) + " " + lastNames[(i / 8) % 7];
+        user.email = user.username + "@" + domains[i % 3];
+        users.insert(user);
+    }
+    double buildMs = chrono::duration<double, milli>(chrono::steady_clock::now() - buildStart).count();
+
+    cout << "Users: " << users.count() << ", trigrams: " << users.trigramPostings.size()
+         << ", build: " << buildMs << " ms" << endl;
+
+    const string terms[] = {"user12345", "99999@", "Bautista", "ims.local", "Grace Cruz", "zzz"};
+    for (const string& term : terms) {
+        auto start = chrono::steady_clock::now();
+        size_t indexedHits = users.search(term).size();
+        double indexedMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        start = chrono::steady_clock::now();
+        size_t scanHits = 0;
+        for (const auto& entry : users.byId) {
+            if (UserStore::matches(entry.second, term)) scanHits++;
+        }
+        double scanMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        cout << "'" << term << "': " << indexedHits << " hits, indexed " << indexedMs
+             << " ms, scan " << scanMs << " ms" << (indexedHits == scanHits ? "" : " (MISMATCH)") << endl;
     }
-    return maxId + 1;
+}
+
+int getNextId(const UserStore& users) {
+    return users.maxId() + 1;
 }
 
 void clearScreen() {
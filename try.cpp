@@ -10,6 +10,46 @@
 #include <algorithm>
 #include <memory>
 #include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <queue>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <optional>
+#include <coroutine>
+#include <atomic>
+#include <csignal>
+#include <cstring>
+#include <cstdio>
+#include <climits>
+#include <chrono>
+#include <random>
+#include <bit>
+#include <cmath>
+#include <charconv>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#endif
+#else
+#include <direct.h>
+#endif
 
 using namespace std;
 
@@ -40,6 +80,27 @@ int getValidIntInput(const string& prompt, int minValue) {
     return input;
 }
 
+double getValidDoubleInput(const string& prompt, double minValue) {
+    double input;
+    bool isValid = false;
+    do {
+        cout << prompt;
+        if (cin >> input) {
+            if (input >= minValue) {
+                isValid = true;
+            } else {
+                cout << "Invalid input. Value must be " << minValue << " or greater." << endl;
+            }
+        } else {
+            cout << "Invalid input. Please enter a number." << endl;
+            cin.clear();
+            clearInputBuffer();
+        }
+    } while (!isValid);
+    clearInputBuffer();
+    return input;
+}
+
 bool getConfirmation(const string& prompt) {
     char response;
     cout << prompt << " (y/n): ";
@@ -231,1070 +292,10065 @@ UserManager* UserManager::instance = nullptr;
 
 // ================= INVENTORY SECTION (STRATEGY PATTERN) =================
 
-// Record structure used by all inventory types
+// Stock level and edit version of one record, packed into one word so both
+// change together: the high 32 bits are the version, the low 32 the quantity.
+// Kept on its own cache line so threads adjusting different records don't
+// slow each other down.
+// The top bit is a lock held briefly by a StockTransaction while it changes
+// several cells as one unit; other writers wait for it to clear.
+struct alignas(64) StockCell {
+    static const uint64_t LOCK_BIT = 1ull << 63;
+
+    atomic<uint64_t> state;
+    // Set while the record waits for its store to publish a stock movement;
+    // only used by stores that aren't shared between processes
+    atomic<uint32_t> queued;
+
+    explicit StockCell(int qty) : state(pack(1, qty)), queued(0) {}
+
+    static uint64_t pack(uint32_t version, int qty) {
+        return ((uint64_t)(version & 0x7FFFFFFF) << 32) | (uint32_t)qty;
+    }
+    static uint32_t versionOf(uint64_t word) { return (uint32_t)(word >> 32) & 0x7FFFFFFF; }
+    static int quantityOf(uint64_t word) { return (int)(uint32_t)word; }
+    static bool isLocked(uint64_t word) { return (word & LOCK_BIT) != 0; }
+
+    // Current state once no transaction holds the cell
+    uint64_t loadUnlocked() const {
+        uint64_t word = state.load(memory_order_acquire);
+        while (isLocked(word)) {
+            this_thread::yield();
+            word = state.load(memory_order_acquire);
+        }
+        return word;
+    }
+};
+
+// Record structure used by all inventory types. A published record is never
+// modified: every change, stock movements included, publishes a new copy, so
+// a record read from a snapshot keeps its quantity. Stock is changed through
+// the StockCell shared by every copy of the record, which orders concurrent
+// changes without a lock; the store copies the new quantity and version into
+// a new copy of the record before the next snapshot. The version goes up on every change and lets an edit detect
+// that someone else changed the record since it was read.
 struct Record {
     int id;
     string name;
-    int quantity;
     double price;
-    Record* next;
-    
-    Record(int _id, const string& _name, int _qty, double _price) 
-        : id(_id), name(_name), quantity(_qty), price(_price), next(nullptr) {}
+    int qty;
+    uint32_t ver;
+    shared_ptr<StockCell> stock;
+
+    Record(int _id, const string& _name, int _qty, double _price)
+        : id(_id), name(_name), price(_price), qty(_qty), ver(1), stock(make_shared<StockCell>(_qty)) {}
+
+    // For records whose stock cell lives elsewhere, such as a shared-memory segment
+    Record(int _id, const string& _name, double _price, shared_ptr<StockCell> cell)
+        : id(_id), name(_name), price(_price), stock(move(cell)) {
+        uint64_t word = stock->loadUnlocked();
+        qty = StockCell::quantityOf(word);
+        ver = StockCell::versionOf(word);
+    }
+
+    int quantity() const { return qty; }
+    uint32_t version() const { return ver; }
 };
 
-// Strategy interface for inventory operations
-class InventoryType {
-public:
-    std::function<void()> onModified; // Callback to notify modifications
-    virtual ~InventoryType() = default;
-    virtual void addRecord(Record*& head, int& nextId, bool isAdmin) = 0;
-    virtual void editRecord(Record* head, bool isAdmin) = 0;
-    virtual void deleteRecord(Record*& head, bool isAdmin) = 0;
-    virtual void displayInventory(Record* head) = 0;
-    virtual void displayMenu(Record*& head, int& nextId, bool isAdmin) = 0;
+// Outcome of a non-interactive inventory operation
+enum OpResult {
+    OP_OK,
+    OP_DENIED,
+    OP_NOT_FOUND,
+    OP_DUPLICATE_NAME,
+    OP_INVALID_NAME,
+    OP_INVALID_VALUE,
+    OP_INSUFFICIENT_STOCK,
+    OP_CONFLICT,
+    OP_STORE_FULL,
+    OP_NO_BOM
 };
 
-// Concrete class for Raw Material inventory
-class RawMaterialInventory : public InventoryType {
-public:
-    void addRecord(Record*& head, int& nextId, bool isAdmin) override {
-        if (!isAdmin) {
-            cout << "Access denied. Only administrators can add new raw materials." << endl;
-            return;
+const char* describeResult(OpResult result) {
+    switch (result) {
+        case OP_OK: return "OK";
+        case OP_DENIED: return "Access denied";
+        case OP_NOT_FOUND: return "Record not found";
+        case OP_DUPLICATE_NAME: return "A record with this name already exists";
+        case OP_INVALID_NAME: return "Invalid name";
+        case OP_INVALID_VALUE: return "Invalid quantity or price";
+        case OP_INSUFFICIENT_STOCK: return "Not enough stock";
+        case OP_CONFLICT: return "Record was changed by someone else; reload and try again";
+        case OP_STORE_FULL: return "Shared inventory is full";
+        case OP_NO_BOM: return "Product has no bill of materials";
+    }
+    return "Unknown error";
+}
+
+// Adds delta to a stock cell without taking any lock. Fails with
+// OP_INSUFFICIENT_STOCK instead of letting the quantity drop below zero.
+OpResult adjustCell(StockCell& stock, int delta) {
+    uint64_t current = stock.loadUnlocked();
+    while (true) {
+        if (StockCell::isLocked(current)) {
+            current = stock.loadUnlocked();
+            continue;
         }
-        
-        string name;
-        cout << "Enter raw material name: ";
-        cin.ignore();
-        getline(cin, name);
-        
-        // Check for duplicate name
-        Record* current = head;
-        while (current != nullptr) {
-            if (current->name == name) {
-                cout << "A raw material with this name already exists!" << endl;
-                return;
-            }
-            current = current->next;
+        long long next = (long long)StockCell::quantityOf(current) + delta;
+        if (next < 0) return OP_INSUFFICIENT_STOCK;
+        if (next > INT_MAX) return OP_INVALID_VALUE;
+        uint64_t updated = StockCell::pack(StockCell::versionOf(current) + 1, (int)next);
+        if (stock.state.compare_exchange_weak(current, updated, memory_order_acq_rel, memory_order_relaxed)) {
+            return OP_OK;
         }
-        
-        bool isValidName = true;
-        for (char c : name) {
-            if (isdigit(c)) {
-                isValidName = false;
-                break;
-            }
+    }
+}
+
+// Kind of change reported through InventoryType::onModified
+enum MutationKind {
+    MUTATION_ADD,
+    MUTATION_EDIT,
+    MUTATION_STOCK,
+    MUTATION_DELETE
+};
+
+// Why a quantity changed, as recorded in the stock ledger
+enum MovementReason {
+    MOVE_ADD,         // opening stock of a new record
+    MOVE_EDIT,        // quantity overwritten by an edit
+    MOVE_ADJUST,
+    MOVE_RESERVE,
+    MOVE_PRODUCTION,  // consumed or made by a production run
+    MOVE_DELETE,      // stock removed with its record
+    MOVE_RECONCILE,   // correction where the ledger disagreed with the inventory file
+    MOVE_BATCH,       // batch quantity update, e.g. an end-of-shift count
+    MOVE_UNDO,        // an earlier change taken back from a session's undo journal
+    MOVE_REDO,
+    MOVE_TRANSFER,    // moved to or from another warehouse location
+    MOVE_RECEIVE      // a lot received at a known unit cost
+};
+
+const char* describeReason(int reason) {
+    switch (reason) {
+        case MOVE_ADD: return "add";
+        case MOVE_EDIT: return "edit";
+        case MOVE_ADJUST: return "adjust";
+        case MOVE_RESERVE: return "reserve";
+        case MOVE_PRODUCTION: return "production";
+        case MOVE_DELETE: return "delete";
+        case MOVE_RECONCILE: return "reconcile";
+        case MOVE_BATCH: return "batch";
+        case MOVE_UNDO: return "undo";
+        case MOVE_REDO: return "redo";
+        case MOVE_TRANSFER: return "transfer";
+        case MOVE_RECEIVE: return "receive";
+    }
+    return "unknown";
+}
+
+// Names are stored as "id name|qty price", so they can't hold digits, '|' or line breaks
+bool isValidRecordName(const string& name) {
+    if (name.empty()) return false;
+    for (char c : name) {
+        if (isdigit(c) || c == '|' || c == '\n' || c == '\r') return false;
+    }
+    return true;
+}
+
+// Epoch-based reclamation for data that lock-free readers may still be using.
+// A reader announces the epoch it started in; retired objects are only freed
+// once every active reader has moved past the epoch they were retired in.
+class EpochManager {
+private:
+    static const int MAX_READERS = 128;
+
+    atomic<uint64_t> globalEpoch;
+    atomic<uint64_t> readerEpochs[MAX_READERS]; // 0 means the slot is free
+
+    // Every COLLECT_EVERY-th retirement also frees what has become safe to free
+    static const uint64_t COLLECT_EVERY = 32;
+
+    struct Retired {
+        uint64_t epoch;
+        function<void()> reclaim;
+        Retired* next;  // in the pending list
+    };
+    atomic<Retired*> pending;  // retired since the last collection, newest first
+    mutex retiredMutex;        // guards waiting
+    deque<Retired*> waiting;   // collected but maybe still in use, oldest first
+
+    uint64_t oldestActiveEpoch() const {
+        uint64_t oldest = UINT64_MAX;
+        for (int i = 0; i < MAX_READERS; i++) {
+            uint64_t epoch = readerEpochs[i].load();
+            if (epoch != 0 && epoch < oldest) oldest = epoch;
         }
-        
-        if (!isValidName) {
-            cout << "Invalid name. Name should not contain numbers." << endl;
-            return;
+        return oldest;
+    }
+
+    // Moves the pending list to the back of waiting and frees the items at
+    // its front that every reader has moved past. Epochs are handed out
+    // before items are pushed, so waiting is only roughly in epoch order;
+    // an item behind one that is still in use just waits a little longer.
+    void collect() {
+        unique_lock<mutex> lock(retiredMutex, try_to_lock);
+        if (!lock.owns_lock()) return;
+        vector<Retired*> newestFirst;
+        for (Retired* item = pending.exchange(nullptr); item; item = item->next) newestFirst.push_back(item);
+        waiting.insert(waiting.end(), newestFirst.rbegin(), newestFirst.rend());
+
+        uint64_t oldest = oldestActiveEpoch();
+        while (!waiting.empty() && waiting.front()->epoch < oldest) {
+            waiting.front()->reclaim();
+            delete waiting.front();
+            waiting.pop_front();
         }
-        
-        int quantity = getValidIntInput("Enter quantity: ", 1);
-        
-        double price = 0;
-        bool isValidPrice = false;
-        do {
-            cout << "Enter unit price: ";
-            if (cin >> price) {
-                if (price > 0) {
-                    isValidPrice = true;
-                } else {
-                    cout << "Invalid price. Price must be positive." << endl;
+    }
+
+public:
+    EpochManager() : globalEpoch(1), pending(nullptr) {
+        for (int i = 0; i < MAX_READERS; i++) readerEpochs[i] = 0;
+    }
+
+    EpochManager(const EpochManager&) = delete;
+    EpochManager& operator=(const EpochManager&) = delete;
+
+    ~EpochManager() {
+        for (Retired* item = pending.load(); item;) {
+            Retired* next = item->next;
+            waiting.push_back(item);
+            item = next;
+        }
+        for (Retired* item : waiting) {
+            item->reclaim();
+            delete item;
+        }
+    }
+
+    // Claims a reader slot; the caller must pass it back to exit(). Each thread
+    // starts looking at the slot it used last, so threads rarely collide.
+    int enter() {
+        static thread_local int preferredSlot =
+            (int)(hash<thread::id>()(this_thread::get_id()) % MAX_READERS);
+        while (true) {
+            for (int n = 0; n < MAX_READERS; n++) {
+                int i = (preferredSlot + n) % MAX_READERS;
+                uint64_t expected = 0;
+                if (readerEpochs[i].compare_exchange_strong(expected, globalEpoch.load())) {
+                    preferredSlot = i;
+                    return i;
                 }
-            } else {
-                cout << "Invalid input. Please enter a number." << endl;
-                cin.clear();
-                clearInputBuffer();
             }
-        } while (!isValidPrice);
-        
-        if (!getConfirmation("Are you sure you want to add this raw material?")) {
-            cout << "Operation cancelled." << endl;
-            return;
+            this_thread::yield();
         }
-        
-        Record* newRecord = new Record(nextId++, name, quantity, price);
-        
-        if (head == nullptr) {
-            head = newRecord;
-        } else {
-            Record* current = head;
-            while (current->next != nullptr) {
-                current = current->next;
-            }
-            current->next = newRecord;
+    }
+
+    void exit(int slot) {
+        readerEpochs[slot].store(0);
+    }
+
+    // Schedules reclaim to run once no reader can still see the retired
+    // object. Takes no lock: the item is pushed onto a lock-free list, and
+    // collecting is skipped if another thread is already at it.
+    void retire(function<void()> reclaim) {
+        uint64_t epoch = globalEpoch.fetch_add(1);
+        Retired* item = new Retired{epoch, move(reclaim), pending.load()};
+        while (!pending.compare_exchange_weak(item->next, item)) {
         }
-        
-        cout << "Raw material added successfully." << endl;
-        if (onModified) onModified();
+        if (epoch % COLLECT_EVERY == 0) collect();
     }
+};
 
-    void editRecord(Record* head, bool isAdmin) override {
-        if (head == nullptr) {
-            cout << "No raw materials available to edit." << endl;
-            return;
+// Shared-memory inventory segment, used with "try --shm" so several IMS
+// processes on one host work on one live inventory. The layout holds no
+// pointers (records are found by slot index), so every process can map it at
+// a different address. A process-shared mutex guards names, prices and slot
+// allocation; quantities are the same lock-free StockCells used in-process.
+// Names are stored in place, so they can be at most SHARED_NAME_SIZE - 1
+// characters; longer ones are rejected, never cut short.
+const uint32_t SHARED_SEGMENT_MAGIC = 0x494D5332; // "IMS2"
+const int SHARED_NAME_SIZE = 96;
+const uint32_t SHARED_MOVEMENT_SLOTS = 4096;
+const uint32_t SHARED_CHANGE_SLOTS = 4096;
+
+struct SharedRecordSlot {
+    StockCell stock; // must stay first: a record's cell address is also its slot address
+    int id;
+    int inUse;       // 0 once deleted, until the slot is reused
+    uint32_t nextFree; // next slot on the free list, while deleted
+    double price;
+    char name[SHARED_NAME_SIZE];
+
+    SharedRecordSlot() : stock(0), id(0), inUse(0), nextFree(0), price(0) {
+        memset(name, 0, sizeof(name));
+    }
+};
+
+// A stock movement made by an attached process, queued in the segment for
+// the owner, which keeps the lots and demand statistics of the inventory
+struct QueuedMovement {
+    int id;
+    int delta;
+    int reason;     // MovementReason
+    int64_t micros;
+};
+
+// One place in the movement queue. The sequence says whose turn it is: a
+// producer may fill it when it equals the queue position, and the owner may
+// read it once it is one past that.
+struct SharedMovementSlot {
+    atomic<uint64_t> sequence;
+    QueuedMovement movement;
+};
+
+struct SharedSegmentHeader {
+    uint32_t magic;
+    uint32_t slotSize;
+    uint32_t capacity;
+    uint32_t usedSlots;   // slots ever used; the ones after it have never been touched
+    uint32_t freeSlots;   // deleted slots waiting to be reused, oldest first
+    uint32_t freeHead;
+    uint32_t freeTail;
+    int nextId;
+    atomic<int> ownerAlive;
+    atomic<uint64_t> generation;    // bumped when records are added, renamed, repriced or deleted
+    atomic<uint64_t> changeCounter; // bumped by every change, including stock movements
+    // Which record each change was to: position p of the counter is kept in
+    // changedIds[p % SHARED_CHANGE_SLOTS] as (p + 1) << 32 | id
+    atomic<uint64_t> changedIds[SHARED_CHANGE_SLOTS];
+    atomic<uint64_t> movementTail;  // next queue position an attached process fills
+    uint64_t movementHead;          // next queue position the owner reads; owner only
+    atomic<uint64_t> movementsLost; // movements dropped because the queue stayed full
+    SharedMovementSlot movements[SHARED_MOVEMENT_SLOTS];
+#ifndef _WIN32
+    pthread_mutex_t mutex;
+#endif
+};
+
+class SharedSegment {
+private:
+    string shmName;
+    char* base;
+    size_t length;
+    bool owner;
+
+    static size_t slotsOffset() {
+        return (sizeof(SharedSegmentHeader) + 63) & ~(size_t)63;
+    }
+
+    SharedSegment(const string& name, char* _base, size_t _length, bool _owner)
+        : shmName(name), base(_base), length(_length), owner(_owner) {}
+
+public:
+    SharedSegment(const SharedSegment&) = delete;
+    SharedSegment& operator=(const SharedSegment&) = delete;
+
+    // One segment per inventory file and working directory
+    static string segmentNameFor(const string& filename) {
+        char cwd[4096];
+        string directory = getcwd(cwd, sizeof(cwd)) ? cwd : ".";
+        string stem = filename.substr(0, filename.find('.'));
+        return "/ims_" + to_string(hash<string>()(directory) % 1000000007) + "_" + stem;
+    }
+
+    SharedSegmentHeader* header() const {
+        return reinterpret_cast<SharedSegmentHeader*>(base);
+    }
+
+    SharedRecordSlot* slot(uint32_t index) const {
+        return reinterpret_cast<SharedRecordSlot*>(base + slotsOffset()) + index;
+    }
+
+    bool isOwner() const { return owner; }
+
+    static bool fitsName(const string& name) { return name.size() < (size_t)SHARED_NAME_SIZE; }
+
+    // A slot for a new record: the one deleted longest ago, so a process
+    // still holding the old record has had the most time to move on, or
+    // else a fresh one. UINT32_MAX when full. Caller holds the lock.
+    uint32_t allocateSlot() {
+        SharedSegmentHeader* h = header();
+        if (h->freeSlots > 0) {
+            uint32_t index = h->freeHead;
+            h->freeHead = slot(index)->nextFree;
+            h->freeSlots--;
+            return index;
         }
-        
-        displayInventory(head);
-        int idToEdit = getValidIntInput("Enter ID of raw material to edit: ", 1);
-        
-        Record* current = head;
-        bool found = false;
-        
-        while (current != nullptr && !found) {
-            if (current->id == idToEdit) {
-                found = true;
-                break;
-            }
-            current = current->next;
+        return h->usedSlots < h->capacity ? h->usedSlots++ : UINT32_MAX;
+    }
+
+    // Marks a slot deleted and puts it at the back of the free list. Caller holds the lock.
+    void freeSlot(uint32_t index) {
+        SharedSegmentHeader* h = header();
+        slot(index)->inUse = 0;
+        if (h->freeSlots == 0) {
+            h->freeHead = index;
+        } else {
+            slot(h->freeTail)->nextFree = index;
         }
-        
-        if (!found) {
-            cout << "Raw material with ID " << idToEdit << " not found." << endl;
-            return;
+        h->freeTail = index;
+        h->freeSlots++;
+    }
+
+    uint32_t indexOf(const SharedRecordSlot* s) const {
+        return (uint32_t)(s - slot(0));
+    }
+
+    // Counts a change to the record with this id, and keeps the id where
+    // every process can find it, so each one updates only what changed
+    void noteChange(int id) {
+        SharedSegmentHeader* h = header();
+        uint64_t position = h->changeCounter.fetch_add(1);
+        h->changedIds[position % SHARED_CHANGE_SLOTS].store(((position + 1) << 32) | (uint32_t)id,
+                                                            memory_order_release);
+    }
+
+    // Adds the ids of the changes at counter positions [from, to) to ids.
+    // False if some of them were overwritten already, or aren't written yet;
+    // the caller then has to look at every record.
+    bool changesBetween(uint64_t from, uint64_t to, vector<int>& ids) const {
+        if (to - from > SHARED_CHANGE_SLOTS) return false;
+        SharedSegmentHeader* h = header();
+        for (uint64_t position = from; position < to; position++) {
+            uint64_t entry = h->changedIds[position % SHARED_CHANGE_SLOTS].load(memory_order_acquire);
+            if ((entry >> 32) != ((position + 1) & 0xFFFFFFFF)) return false;
+            ids.push_back((int)(uint32_t)entry);
         }
-        
-        cout << "Editing raw material with ID: " << idToEdit << endl;
-        cout << "Current name: " << current->name << endl;
-        cout << "Current quantity: " << current->quantity << endl;
-        cout << "Current unit price: $" << fixed << setprecision(2) << current->price << endl;
-        
-        if (isAdmin) {
-            cout << "Enter new name (or press Enter to keep current): ";
-            string newName;
-            cin.ignore();
-            getline(cin, newName);
-            
-            if (!newName.empty()) {
-                bool isValidName = true;
-                for (char c : newName) {
-                    if (isdigit(c)) {
-                        isValidName = false;
-                        break;
-                    }
-                }
-                
-                if (!isValidName) {
-                    cout << "Invalid name. Name should not contain numbers. Name not updated." << endl;
-                } else {
-                    current->name = newName;
+        return true;
+    }
+
+    // Attached processes: queues a stock movement for the owner. While the
+    // queue is full it waits for the owner to catch up, for up to two
+    // seconds; after that the movement is only counted in movementsLost.
+    bool pushMovement(const QueuedMovement& movement) {
+        SharedSegmentHeader* h = header();
+        int waits = 0;
+        uint64_t position = h->movementTail.load();
+        while (h->ownerAlive) {
+            SharedMovementSlot& s = h->movements[position % SHARED_MOVEMENT_SLOTS];
+            uint64_t sequence = s.sequence.load(memory_order_acquire);
+            if (sequence == position) {
+                if (h->movementTail.compare_exchange_weak(position, position + 1)) {
+                    s.movement = movement;
+                    s.sequence.store(position + 1, memory_order_release);
+                    return true;
                 }
+            } else if (sequence < position) {
+                if (++waits > 100) break;
+                this_thread::sleep_for(chrono::milliseconds(20));
+                position = h->movementTail.load();
+            } else {
+                position = h->movementTail.load();
             }
         }
-        
-        cout << "Enter new quantity (or 0 to keep current): ";
-        int newQuantity;
-        cin >> newQuantity;
-        
-        if (newQuantity > 0) {
-            current->quantity = newQuantity;
-        } else if (newQuantity < 0) {
-            cout << "Invalid quantity. Quantity must be positive. Quantity not updated." << endl;
-        }
-        
-        if (isAdmin) {
-            cout << "Enter new unit price (or 0 to keep current): ";
-            double newPrice;
-            cin >> newPrice;
-            
-            if (newPrice > 0) {
-                current->price = newPrice;
-            } else if (newPrice < 0) {
-                cout << "Invalid price. Price must be positive. Price not updated." << endl;
-            }
-        }
-        
-        if (!getConfirmation("Save these changes?")) {
-            cout << "Operation cancelled. No changes saved." << endl;
-            return;
-        }
-        
-        cout << "Raw material updated successfully." << endl;
-        if (onModified) onModified();
+        h->movementsLost++;
+        return false;
     }
 
-    void deleteRecord(Record*& head, bool isAdmin) override {
-        if (!isAdmin) {
-            cout << "Access denied. Only administrators can delete raw materials." << endl;
-            return;
+    // Owner only: takes the oldest queued movement, if there is one
+    bool popMovement(QueuedMovement& movement) {
+        SharedSegmentHeader* h = header();
+        SharedMovementSlot& s = h->movements[h->movementHead % SHARED_MOVEMENT_SLOTS];
+        if (s.sequence.load(memory_order_acquire) != h->movementHead + 1) return false;
+        movement = s.movement;
+        s.sequence.store(h->movementHead + SHARED_MOVEMENT_SLOTS, memory_order_release);
+        h->movementHead++;
+        return true;
+    }
+
+#ifndef _WIN32
+    // Creates a fresh segment holding records. The caller must own the data
+    // lock, so any segment left under this name by a crashed owner is stale.
+    static shared_ptr<SharedSegment> create(const string& name, uint32_t capacity,
+                                            const vector<Record>& records, int nextId) {
+        shm_unlink(name.c_str());
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0) return nullptr;
+
+        size_t length = slotsOffset() + (size_t)capacity * sizeof(SharedRecordSlot);
+        void* mapped = MAP_FAILED;
+        if (ftruncate(fd, (off_t)length) == 0) {
+            mapped = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
         }
-        
-        if (head == nullptr) {
-            cout << "No raw materials available to delete." << endl;
-            return;
+        close(fd);
+        if (mapped == MAP_FAILED) {
+            shm_unlink(name.c_str());
+            return nullptr;
         }
-        
-        displayInventory(head);
-        int idToDelete = getValidIntInput("Enter ID of raw material to delete: ", 1);
-        
-        if (!getConfirmation("Are you sure you want to delete this raw material?")) {
-            cout << "Operation cancelled." << endl;
-            return;
+
+        char* base = static_cast<char*>(mapped);
+        SharedSegmentHeader* h = new (base) SharedSegmentHeader();
+        h->slotSize = sizeof(SharedRecordSlot);
+        h->capacity = capacity;
+        h->usedSlots = 0;
+        h->freeSlots = 0;
+        h->freeHead = 0;
+        h->freeTail = 0;
+        h->nextId = nextId;
+        h->ownerAlive = 1;
+        h->generation = 1;
+        h->changeCounter = 0;
+        h->movementTail = 0;
+        h->movementHead = 0;
+        h->movementsLost = 0;
+        for (uint32_t i = 0; i < SHARED_MOVEMENT_SLOTS; i++) h->movements[i].sequence = i;
+        for (uint32_t i = 0; i < SHARED_CHANGE_SLOTS; i++) h->changedIds[i] = 0;
+
+        // Robust, so a process that dies holding the lock doesn't wedge the others
+        pthread_mutexattr_t attributes;
+        pthread_mutexattr_init(&attributes);
+        pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&h->mutex, &attributes);
+        pthread_mutexattr_destroy(&attributes);
+
+        shared_ptr<SharedSegment> segment(new SharedSegment(name, base, length, true));
+        for (const Record& record : records) {
+            if (h->usedSlots == capacity || !fitsName(record.name)) {
+                shm_unlink(name.c_str());
+                return nullptr;
+            }
+            SharedRecordSlot* s = new (segment->slot(h->usedSlots++)) SharedRecordSlot();
+            s->stock.state.store(StockCell::pack(record.version(), record.quantity()));
+            s->id = record.id;
+            s->inUse = 1;
+            s->price = record.price;
+            strncpy(s->name, record.name.c_str(), SHARED_NAME_SIZE - 1);
         }
-        
-        if (head->id == idToDelete) {
-            Record* temp = head;
-            head = head->next;
-            delete temp;
-            cout << "Raw material deleted successfully." << endl;
-            if (onModified) onModified();
-            return;
+
+        // Published last: attachers check the magic before trusting anything else
+        atomic_thread_fence(memory_order_release);
+        h->magic = SHARED_SEGMENT_MAGIC;
+        return segment;
+    }
+
+    // Maps a segment created by another process; nullptr if there is none
+    static shared_ptr<SharedSegment> attach(const string& name) {
+        int fd = shm_open(name.c_str(), O_RDWR, 0600);
+        if (fd < 0) return nullptr;
+
+        struct stat info;
+        void* mapped = MAP_FAILED;
+        if (fstat(fd, &info) == 0 && (size_t)info.st_size >= slotsOffset()) {
+            mapped = mmap(nullptr, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
         }
-        
-        Record* current = head;
-        Record* previous = nullptr;
-        bool found = false;
-        
-        while (current != nullptr && !found) {
-            if (current->id == idToDelete) {
-                found = true;
-                break;
-            }
-            previous = current;
-            current = current->next;
+        close(fd);
+        if (mapped == MAP_FAILED) return nullptr;
+
+        shared_ptr<SharedSegment> segment(
+            new SharedSegment(name, static_cast<char*>(mapped), (size_t)info.st_size, false));
+        SharedSegmentHeader* h = segment->header();
+        atomic_thread_fence(memory_order_acquire);
+        if (h->magic != SHARED_SEGMENT_MAGIC || h->slotSize != sizeof(SharedRecordSlot) ||
+            segment->length < slotsOffset() + (size_t)h->capacity * sizeof(SharedRecordSlot)) {
+            return nullptr;
         }
-        
-        if (!found) {
-            cout << "Raw material with ID " << idToDelete << " not found." << endl;
-            return;
+        return segment;
+    }
+
+    ~SharedSegment() {
+        if (owner) {
+            header()->ownerAlive = 0;
+            shm_unlink(shmName.c_str());
         }
-        
-        previous->next = current->next;
-        delete current;
-        cout << "Raw material deleted successfully." << endl;
-        if (onModified) onModified();
+        munmap(base, length);
     }
 
-    void displayInventory(Record* head) override {
-        if (head == nullptr) {
-            cout << "No raw materials available." << endl;
-            return;
+    void lock() const {
+        if (pthread_mutex_lock(&header()->mutex) == EOWNERDEAD) {
+            pthread_mutex_consistent(&header()->mutex);
         }
-        
-        cout << "\n------ Raw Material Inventory ------" << endl;
-        cout << left << setw(5) << "ID"
-             << setw(20) << "Name"
-             << setw(10) << "Quantity"
-             << "Price" << endl;
-        cout << string(50, '-') << endl;
-        
-        Record* current = head;
-        while (current != nullptr) {
-            cout << left << setw(5) << current->id
-                 << setw(20) << current->name
-                 << setw(10) << current->quantity
-                 << "$" << fixed << setprecision(2) << current->price << endl;
-            current = current->next;
-        }
-        
-        cout << string(50, '-') << endl;
     }
 
-    void displayMenu(Record*& head, int& nextId, bool isAdmin) override {
-        bool running = true;
-        while (running) {
-            cout << "\n" << string(30, '=') << endl;
-            cout << setw(25) << "Raw Material Inventory Menu" << endl;
-            cout << string(30, '=') << endl;
-            
-            if (isAdmin) {
-                cout << "1. Add Raw Material" << endl;
-                cout << "2. Edit Raw Material" << endl;
-                cout << "3. Delete Raw Material" << endl;
-                cout << "4. Display Raw Materials" << endl;
-                cout << "5. Return to Previous Menu" << endl;
-                
-                int choice = getValidIntInput("Enter your choice (1-5): ", 1);
-                switch (choice) {
-                    case 1: addRecord(head, nextId, isAdmin); break;
-                    case 2: editRecord(head, isAdmin); break;
-                    case 3: deleteRecord(head, isAdmin); break;
-                    case 4: displayInventory(head); break;
-                    case 5:
-                        if (getConfirmation("Are you sure you want to return to the previous menu?")) 
-                            running = false;
-                        break;
-                    default: cout << "Invalid choice. Please try again." << endl;
-                }
+    void unlock() const {
+        pthread_mutex_unlock(&header()->mutex);
+    }
+#else
+    static shared_ptr<SharedSegment> create(const string&, uint32_t, const vector<Record>&, int) {
+        return nullptr;
+    }
+
+    static shared_ptr<SharedSegment> attach(const string&) {
+        return nullptr;
+    }
+
+    void lock() const {}
+    void unlock() const {}
+#endif
+};
+
+// One node of the id trie that holds a version's records. Each level takes
+// BITS bits of the id, so no path is longer than MAX_HEIGHT nodes; the
+// bottom level points at records and the others at nodes. count is the
+// number of records below, so positions map to paths and back. A node is
+// never changed once published, and before that only by the edit that
+// created it.
+struct StoreNode {
+    static const int BITS = 6;
+    static const int FANOUT = 1 << BITS;
+    static const int MAX_HEIGHT = 6;  // 36 bits cover every id
+
+    uint64_t edit;  // the StoreEdit that created the node
+    size_t count;
+    const void* slots[FANOUT];
+
+    static int digitOf(uint32_t key, int level) {
+        return (int)(key >> (BITS * level)) & (FANOUT - 1);
+    }
+
+    // Whether a trie of this height has room for the key
+    static bool fits(uint32_t key, int height) {
+        return height >= MAX_HEIGHT || (key >> (BITS * height)) == 0;
+    }
+
+    // Slot of the child at a position in id order. Ids are keyed by their
+    // unsigned bit pattern, so at the top of a full-height trie the negative
+    // ids (digits 2 and 3) come first. Its own inverse.
+    static int slotAt(int level, int position) {
+        return level == MAX_HEIGHT - 1 ? position ^ 2 : position;
+    }
+
+    // Frees a whole trie and its records
+    static void destroy(const StoreNode* node, int level) {
+        if (node == nullptr) return;
+        for (const void* slot : node->slots) {
+            if (slot == nullptr) continue;
+            if (level == 0) {
+                delete static_cast<const Record*>(slot);
             } else {
-                cout << "1. Edit Raw Material Quantity" << endl;
-                cout << "2. Display Raw Materials" << endl;
-                cout << "3. Return to Previous Menu" << endl;
-                
-                int choice = getValidIntInput("Enter your choice (1-3): ", 1);
-                switch (choice) {
-                    case 1: editRecord(head, isAdmin); break;
-                    case 2: displayInventory(head); break;
-                    case 3:
-                        if (getConfirmation("Are you sure you want to return to the previous menu?")) 
-                            running = false;
-                        break;
-                    default: cout << "Invalid choice. Please try again." << endl;
-                }
+                destroy(static_cast<const StoreNode*>(slot), level - 1);
             }
         }
+        delete node;
     }
 };
 
-// Concrete class for Product inventory
-class ProductInventory : public InventoryType {
-public:
-    void addRecord(Record*& head, int& nextId, bool isAdmin) override {
-        if (!isAdmin) {
-            cout << "Access denied. Only administrators can add new products." << endl;
-            return;
+// One published state of a RecordStore. Versions, their nodes and the
+// records they point to are never modified after publishing; a writer
+// copies the nodes on the path to the record it changes and publishes a
+// new version that shares everything else with the old one.
+struct StoreVersion {
+    uint64_t number;
+    int nextId;
+    const StoreNode* root;  // nullptr when empty
+    int height;             // levels from the root down to the records
+
+    size_t size() const { return root ? root->count : 0; }
+
+    const Record* find(int id) const {
+        uint32_t key = (uint32_t)id;
+        if (!StoreNode::fits(key, height)) return nullptr;
+        const StoreNode* node = root;
+        for (int level = height - 1; node && level > 0; level--) {
+            node = static_cast<const StoreNode*>(node->slots[StoreNode::digitOf(key, level)]);
         }
-        
-        string name;
-        cout << "Enter product name: ";
-        cin.ignore();
-        getline(cin, name);
-        
-        bool isValidName = true;
-        for (char c : name) {
-            if (isdigit(c)) {
-                isValidName = false;
-                break;
+        return node ? static_cast<const Record*>(node->slots[StoreNode::digitOf(key, 0)]) : nullptr;
+    }
+
+    // Number of records with a smaller id
+    size_t rank(int id) const {
+        uint32_t key = (uint32_t)id;
+        if (!StoreNode::fits(key, height)) return id < 0 ? 0 : size();
+        size_t below = 0;
+        const StoreNode* node = root;
+        for (int level = height - 1; node; level--) {
+            int digit = StoreNode::digitOf(key, level);
+            for (int position = 0; position < StoreNode::slotAt(level, digit); position++) {
+                const void* slot = node->slots[StoreNode::slotAt(level, position)];
+                if (slot) below += level == 0 ? 1 : static_cast<const StoreNode*>(slot)->count;
             }
+            if (level == 0) break;
+            node = static_cast<const StoreNode*>(node->slots[digit]);
         }
-        
-        if (!isValidName) {
-            cout << "Invalid name. Name should not contain numbers." << endl;
-            return;
-        }
-        
-        int quantity = getValidIntInput("Enter quantity: ", 1);
-        
-        double price = 0;
-        bool isValidPrice = false;
-        do {
-            cout << "Enter unit price: ";
-            if (cin >> price) {
-                if (price > 0) {
-                    isValidPrice = true;
+        return below;
+    }
+
+    // Visits the records at positions [first, first + n) in id order,
+    // skipping whole subtrees before first by their counts
+    template <typename Visitor>
+    void visit(size_t first, size_t n, Visitor& visitor) const {
+        if (root && n > 0) visitNode(root, height - 1, first, n, visitor);
+    }
+
+    template <typename Visitor>
+    static void visitNode(const StoreNode* node, int level, size_t& skip, size_t& left, Visitor& visitor) {
+        for (int position = 0; position < StoreNode::FANOUT && left > 0; position++) {
+            const void* slot = node->slots[StoreNode::slotAt(level, position)];
+            if (slot == nullptr) continue;
+            if (level > 0) {
+                const StoreNode* child = static_cast<const StoreNode*>(slot);
+                if (skip >= child->count) {
+                    skip -= child->count;
                 } else {
-                    cout << "Invalid price. Price must be positive." << endl;
+                    visitNode(child, level - 1, skip, left, visitor);
                 }
+            } else if (skip > 0) {
+                skip--;
             } else {
-                cout << "Invalid input. Please enter a number." << endl;
-                cin.clear();
-                clearInputBuffer();
+                visitor(*static_cast<const Record*>(slot));
+                left--;
             }
-        } while (!isValidPrice);
-        
-        if (!getConfirmation("Are you sure you want to add this product?")) {
-            cout << "Operation cancelled." << endl;
+        }
+    }
+};
+
+// The next version of a store, built from the current one by path copying:
+// a change copies the nodes from the root down to its record, O(log n), and
+// the copies belong to the edit, which changes them in place if it passes
+// them again. Once the version is published, the nodes and records it no
+// longer uses are retired; if it never is, the edit frees what it made.
+class StoreEdit {
+private:
+    uint64_t tag;
+    StoreVersion* next;
+    const StoreNode* dropped;  // the base's whole trie, after clear
+    int droppedHeight;
+    bool replacedAll;          // cleared, so every record counts as changed
+    vector<int> changed;       // ids set, unless replacedAll
+    vector<StoreNode*> created;
+    vector<const StoreNode*> replaced;
+    vector<const Record*> added;
+    vector<const Record*> removed;
+
+    static uint64_t newTag() {
+        // 0 is never handed out, so nodes of a fresh trie belong to no edit
+        static atomic<uint64_t> tags(1);
+        return tags++;
+    }
+
+    StoreNode* own(const StoreNode* node) {
+        if (node && node->edit == tag) return const_cast<StoreNode*>(node);
+        StoreNode* copy = node ? new StoreNode(*node) : new StoreNode();
+        copy->edit = tag;
+        if (node) replaced.push_back(node);
+        created.push_back(copy);
+        return copy;
+    }
+
+    // Unlinks the nodes a removal left empty. They are the edit's own and
+    // are freed when it ends.
+    void prune(uint32_t key) {
+        if (next->root->count == 0) {
+            next->root = nullptr;
             return;
         }
-        
-        Record* newRecord = new Record(nextId++, name, quantity, price);
-        
-        if (head == nullptr) {
-            head = newRecord;
-        } else {
-            Record* current = head;
-            while (current->next != nullptr) {
-                current = current->next;
+        StoreNode* node = const_cast<StoreNode*>(next->root);
+        for (int level = next->height - 1; level > 0; level--) {
+            int digit = StoreNode::digitOf(key, level);
+            StoreNode* child = const_cast<StoreNode*>(static_cast<const StoreNode*>(node->slots[digit]));
+            if (child->count == 0) {
+                node->slots[digit] = nullptr;
+                return;
             }
-            current->next = newRecord;
+            node = child;
         }
-        
-        cout << "Product added successfully." << endl;
-        if (onModified) onModified();
     }
 
-    void editRecord(Record* head, bool isAdmin) override {
-        if (head == nullptr) {
-            cout << "No products available to edit." << endl;
-            return;
+public:
+    explicit StoreEdit(const StoreVersion* base)
+        : tag(newTag()), next(new StoreVersion(*base)), dropped(nullptr), droppedHeight(0), replacedAll(false) {
+        next->number = base->number + 1;
+    }
+
+    StoreEdit(const StoreEdit&) = delete;
+    StoreEdit& operator=(const StoreEdit&) = delete;
+
+    // Frees everything the edit made, unless it was published
+    ~StoreEdit() {
+        if (next == nullptr) return;
+        for (StoreNode* node : created) delete node;
+        for (const Record* record : added) delete record;
+        delete next;
+    }
+
+    const StoreVersion* version() const { return next; }
+    int& nextId() { return next->nextId; }
+    const Record* find(int id) const { return next->find(id); }
+    bool changedAll() const { return replacedAll; }
+    const vector<int>& changedIds() const { return changed; }
+
+    // Starts from an empty trie; the base's records are retired with it.
+    // Only as the first change.
+    void clear() {
+        dropped = next->root;
+        droppedHeight = next->height;
+        next->root = nullptr;
+        next->height = 1;
+        replacedAll = true;
+        changed.clear();
+    }
+
+    // Puts record under id, taking it over, or removes the record with
+    // that id when record is nullptr
+    void set(int id, const Record* record) {
+        uint32_t key = (uint32_t)id;
+        const Record* old = next->find(id);
+        if (old == nullptr && record == nullptr) return;
+        while (!StoreNode::fits(key, next->height)) {
+            if (next->root) {
+                StoreNode* top = own(nullptr);
+                top->count = next->root->count;
+                top->slots[0] = next->root;
+                next->root = top;
+            }
+            next->height++;
         }
-        
-        displayInventory(head);
-        int idToEdit = getValidIntInput("Enter ID of product to edit: ", 1);
-        
-        Record* current = head;
-        bool found = false;
-        
-        while (current != nullptr && !found) {
-            if (current->id == idToEdit) {
-                found = true;
+
+        long delta = (record ? 1 : 0) - (old ? 1 : 0);
+        StoreNode* node = own(next->root);
+        next->root = node;
+        for (int level = next->height - 1;; level--) {
+            node->count += delta;
+            int digit = StoreNode::digitOf(key, level);
+            if (level == 0) {
+                node->slots[digit] = record;
                 break;
             }
-            current = current->next;
+            StoreNode* child = own(static_cast<const StoreNode*>(node->slots[digit]));
+            node->slots[digit] = child;
+            node = child;
         }
-        
-        if (!found) {
-            cout << "Product with ID " << idToEdit << " not found." << endl;
-            return;
+        if (record) added.push_back(record);
+        if (old) removed.push_back(old);
+        if (!replacedAll) changed.push_back(id);
+        if (delta < 0) prune(key);
+    }
+
+    // Called once the version was published in place of base
+    void published(EpochManager& epochs, const StoreVersion* base) {
+        for (StoreNode* node : created) {
+            if (node->count == 0) delete node;  // pruned, never seen by anyone
         }
-        
-        cout << "Editing product with ID: " << idToEdit << endl;
-        cout << "Current name: " << current->name << endl;
-        cout << "Current quantity: " << current->quantity << endl;
-        cout << "Current unit price: $" << fixed << setprecision(2) << current->price << endl;
-        
-        if (isAdmin) {
-            cout << "Enter new name (or press Enter to keep current): ";
-            string newName;
-            cin.ignore();
-            getline(cin, newName);
-            
-            if (!newName.empty()) {
-                bool isValidName = true;
-                for (char c : newName) {
-                    if (isdigit(c)) {
-                        isValidName = false;
-                        break;
-                    }
-                }
-                
-                if (!isValidName) {
-                    cout << "Invalid name. Name should not contain numbers. Name not updated." << endl;
-                } else {
-                    current->name = newName;
-                }
+        epochs.retire([base, nodes = move(replaced), records = move(removed), trie = dropped,
+                       height = droppedHeight]() {
+            for (const StoreNode* node : nodes) delete node;
+            for (const Record* record : records) delete record;
+            StoreNode::destroy(trie, height - 1);
+            delete base;
+        });
+        next = nullptr;
+    }
+};
+
+// Multi-version record storage. Readers pin the current version without
+// taking a lock and keep seeing it unchanged, quantities included, until
+// they release it. A writer copies the path to the record it changes and
+// publishes the new version with a compare-and-swap, starting over on the
+// newer version if another writer got there first, so a write costs
+// O(log n) whatever the size of the store. Adding, editing and deleting
+// records are also serialized by writerMutex. Stock movements take no lock
+// and publish nothing: they change the record's cell and queue the record
+// (the first movement since the last version does), and the next snapshot
+// publishes every queued record in one version.
+// Old versions are freed through epoch-based reclamation. Every version
+// logs the ids it changed, so views built on one version can catch up with
+// a later one without reading the whole store.
+class RecordStore {
+private:
+    static const size_t STRIPES = 64;
+    static const size_t MAX_CHANGES = 1 << 16;
+
+    struct alignas(64) Stripe {
+        mutex lock;
+        vector<int> ids;
+    };
+
+    atomic<const StoreVersion*> current;
+    mutable EpochManager epochs;
+    mutable mutex writerMutex;
+    unordered_multimap<size_t, int> idsByNameHash;  // for unique names; guarded by writerMutex
+
+    // Records whose stock moved since they were last published, in striped
+    // lists. unpublished counts the queued records until their new version
+    // is out; stockMutex is held while publishing them.
+    unique_ptr<Stripe[]> moved;
+    mutable atomic<size_t> unpublished;
+    mutable mutex stockMutex;
+
+    // Set when the records live in a shared-memory segment. The local
+    // versions are then a cache of the segment, brought up to date whenever
+    // another process changes it.
+    shared_ptr<SharedSegment> shared;
+    mutable atomic<uint64_t> syncedGeneration;
+    mutable atomic<uint64_t> syncedChanges;
+
+    // Ids changed by each version, oldest first; id -1 stands for every
+    // record. Entries are logged before their version is published, so all
+    // entries of a version come before those of any later one, although a
+    // version that lost its compare-and-swap leaves extra entries behind.
+    // Positions count from the first entry ever logged.
+    struct Change {
+        uint64_t version;
+        int id;
+    };
+    mutable mutex changeMutex;
+    deque<Change> changes;
+    uint64_t changesTrimmed;       // entries dropped off the front
+    uint64_t trimmedUpToVersion;   // the newest version among them
+
+    void logChanges(const StoreEdit& edit) {
+        uint64_t version = edit.version()->number;
+        const vector<int>& ids = edit.changedIds();
+        lock_guard<mutex> lock(changeMutex);
+        if (edit.changedAll() || ids.size() > MAX_CHANGES / 2) {
+            changes.push_back({version, -1});
+        } else {
+            for (int id : ids) changes.push_back({version, id});
+        }
+        if (changes.size() > MAX_CHANGES) {
+            size_t drop = changes.size() - MAX_CHANGES / 2;
+            for (size_t i = 0; i < drop; i++) {
+                trimmedUpToVersion = max(trimmedUpToVersion, changes.front().version);
+                changes.pop_front();
             }
+            changesTrimmed += drop;
         }
-        
-        cout << "Enter new quantity (or 0 to keep current): ";
-        int newQuantity;
-        cin >> newQuantity;
-        
-        if (newQuantity > 0) {
-            current->quantity = newQuantity;
-        } else if (newQuantity < 0) {
-            cout << "Invalid quantity. Quantity must be positive. Quantity not updated." << endl;
+    }
+
+    // Publishes the next version. build makes the changes on an edit of the
+    // current version, or returns false to change nothing; if another writer
+    // published first, the edit is dropped and build runs again on the
+    // newer version.
+    template <typename Build>
+    void publish(Build build) {
+        int slot = epochs.enter();
+        while (true) {
+            const StoreVersion* base = current.load();
+            StoreEdit edit(base);
+            if (!build(edit)) break;
+            logChanges(edit);
+            if (current.compare_exchange_strong(base, edit.version())) {
+                edit.published(epochs, base);
+                break;
+            }
         }
-        
-        if (isAdmin) {
-            cout << "Enter new unit price (or 0 to keep current): ";
-            double newPrice;
-            cin >> newPrice;
-            
-            if (newPrice > 0) {
-                current->price = newPrice;
-            } else if (newPrice < 0) {
-                cout << "Invalid price. Price must be positive. Price not updated." << endl;
+        epochs.exit(slot);
+    }
+
+    // Copies the quantities of records from their stock cells into a new
+    // version, after stock was changed on the cells. Records that already
+    // show their cell's version, or were deleted meanwhile, are skipped.
+    void publishStock(const vector<int>& ids) {
+        publish([&](StoreEdit& edit) {
+            bool changed = false;
+            for (int id : ids) {
+                const Record* record = edit.find(id);
+                if (record == nullptr) continue;
+                uint64_t word = record->stock->loadUnlocked();
+                if (StockCell::versionOf(word) == record->version()) continue;
+                Record* updated = new Record(*record);
+                updated->qty = StockCell::quantityOf(word);
+                updated->ver = StockCell::versionOf(word);
+                edit.set(id, updated);
+                changed = true;
             }
+            return changed;
+        });
+    }
+
+    // Caller holds writerMutex
+    bool nameTakenLocked(const string& name) const {
+        Snapshot view(this);
+        auto range = idsByNameHash.equal_range(hash<string>()(name));
+        for (auto it = range.first; it != range.second; ++it) {
+            const Record* record = view.find(it->second);
+            if (record && record->name == name) return true;
         }
-        
-        if (!getConfirmation("Save these changes?")) {
-            cout << "Operation cancelled. No changes saved." << endl;
-            return;
+        return false;
+    }
+
+    void forgetNameLocked(const string& name, int id) {
+        auto range = idsByNameHash.equal_range(hash<string>()(name));
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second == id) {
+                idsByNameHash.erase(it);
+                return;
+            }
         }
-        
-        cout << "Product updated successfully." << endl;
-        if (onModified) onModified();
     }
 
-    void deleteRecord(Record*& head, bool isAdmin) override {
-        if (!isAdmin) {
-            cout << "Access denied. Only administrators can delete products." << endl;
+    void rebuildNamesLocked() {
+        Snapshot view(this);
+        idsByNameHash.clear();
+        idsByNameHash.reserve(view.size());
+        view.forEach([&](const Record& record) { idsByNameHash.emplace(hash<string>()(record.name), record.id); });
+    }
+
+    // Queues a record whose stock cell moved, unless it already waits. The
+    // count goes up first, so whoever sees the record queued also sees a
+    // count that its own movement will be published under.
+    void queueMoved(const Record& record) const {
+        if (shared) {
+            shared->noteChange(record.id);
             return;
         }
-        
-        if (head == nullptr) {
-            cout << "No products available to delete." << endl;
+        StockCell& cell = *record.stock;
+        if (cell.queued.load() != 0) return;
+        unpublished++;
+        if (cell.queued.exchange(1) != 0) {
+            unpublished--;
             return;
         }
-        
-        displayInventory(head);
-        int idToDelete = getValidIntInput("Enter ID of product to delete: ", 1);
-        
-        if (!getConfirmation("Are you sure you want to delete this product?")) {
-            cout << "Operation cancelled." << endl;
-            return;
+        Stripe& stripe = moved[(uint32_t)record.id % STRIPES];
+        lock_guard<mutex> lock(stripe.lock);
+        stripe.ids.push_back(record.id);
+    }
+
+    // Publishes the queued records in one version. Their flags are cleared
+    // before their cells are read, so a movement that comes later queues its
+    // record again.
+    void publishMoved() {
+        lock_guard<mutex> lock(stockMutex);
+        vector<int> ids;
+        for (size_t s = 0; s < STRIPES; s++) {
+            lock_guard<mutex> stripeLock(moved[s].lock);
+            ids.insert(ids.end(), moved[s].ids.begin(), moved[s].ids.end());
+            moved[s].ids.clear();
         }
-        
-        if (head->id == idToDelete) {
-            Record* temp = head;
-            head = head->next;
-            delete temp;
-            cout << "Product deleted successfully." << endl;
-            if (onModified) onModified();
-            return;
+        if (ids.empty()) return;
+        {
+            Snapshot view(this);
+            for (int id : ids) {
+                if (const Record* record = view.find(id)) record->stock->queued.store(0);
+            }
         }
-        
-        Record* current = head;
-        Record* previous = nullptr;
-        bool found = false;
-        
-        while (current != nullptr && !found) {
-            if (current->id == idToDelete) {
-                found = true;
-                break;
+        publishStock(ids);
+        unpublished -= ids.size();
+    }
+
+    // Rebuilds the local version from the shared segment. Records point their
+    // stock cells into the segment, where stock is changed; the quantities
+    // they show are the ones their cells held at the time.
+    // Caller holds writerMutex.
+    void syncFromSharedLocked() {
+        SharedSegmentHeader* h = shared->header();
+        uint64_t changes = h->changeCounter.load();
+        uint64_t generation = 0;
+        publish([&](StoreEdit& edit) {
+            edit.clear();
+            shared->lock();
+            generation = h->generation.load();
+            edit.nextId() = h->nextId;
+            for (uint32_t i = 0; i < h->usedSlots; i++) {
+                SharedRecordSlot* s = shared->slot(i);
+                if (!s->inUse) continue;
+                // Aliasing pointer: keeps the mapping alive while any record uses it
+                shared_ptr<StockCell> cell(shared, &s->stock);
+                edit.set(s->id, new Record(s->id, string(s->name), s->price, cell));
             }
-            previous = current;
-            current = current->next;
+            shared->unlock();
+            return true;
+        });
+        syncedGeneration = generation;
+        syncedChanges = changes;
+        rebuildNamesLocked();
+    }
+
+    // After stock movements only, by any process: publishes the records
+    // the segment lists as changed, or, if the list has moved on too far,
+    // the records whose cells moved on. Caller holds writerMutex.
+    void refreshStockLocked() {
+        uint64_t changes = shared->header()->changeCounter.load();
+        vector<int> ids;
+        if (!shared->changesBetween(syncedChanges, changes, ids)) {
+            ids.clear();
+            Snapshot view(this);
+            view.forEach([&](const Record& record) {
+                if (StockCell::versionOf(record.stock->state.load()) != record.version()) ids.push_back(record.id);
+            });
         }
-        
-        if (!found) {
-            cout << "Product with ID " << idToDelete << " not found." << endl;
-            return;
+        if (!ids.empty()) publishStock(ids);
+        syncedChanges = changes;
+    }
+
+    bool sharedIsStale() const {
+        if (!shared) return false;
+        SharedSegmentHeader* h = shared->header();
+        return h->generation.load() != syncedGeneration.load() || h->changeCounter.load() != syncedChanges.load();
+    }
+
+    // Caller holds writerMutex
+    void refreshLocked() {
+        if (shared->header()->generation.load() != syncedGeneration.load()) {
+            syncFromSharedLocked();
+        } else {
+            refreshStockLocked();
         }
-        
-        previous->next = current->next;
-        delete current;
-        cout << "Product deleted successfully." << endl;
-        if (onModified) onModified();
     }
 
-    void displayInventory(Record* head) override {
-        if (head == nullptr) {
-            cout << "No products available." << endl;
-            return;
+    void refreshIfStale() const {
+        if (!sharedIsStale()) return;
+        lock_guard<mutex> lock(writerMutex);
+        // Only the local cache changes; the logical contents are the segment's
+        if (sharedIsStale()) const_cast<RecordStore*>(this)->refreshLocked();
+    }
+
+    static SharedRecordSlot* slotOf(const Record* record) {
+        return reinterpret_cast<SharedRecordSlot*>(record->stock.get());
+    }
+
+    // Records a structural change to a record in the segment, which this
+    // process publishes in its own version as well. Caller holds the
+    // segment lock.
+    void markSharedChanged(int id) {
+        uint64_t generation = shared->header()->generation.fetch_add(1);
+        syncedGeneration.compare_exchange_strong(generation, generation + 1);
+        shared->noteChange(id);
+    }
+
+public:
+    // A pinned, immutable view of the store; valid until destroyed
+    class Snapshot {
+    private:
+        const RecordStore* store;
+        int slot;
+        const StoreVersion* version;
+
+    public:
+        explicit Snapshot(const RecordStore* _store)
+            : store(_store), slot(_store->epochs.enter()), version(_store->current.load()) {}
+
+        Snapshot(Snapshot&& other) : store(other.store), slot(other.slot), version(other.version) {
+            other.store = nullptr;
         }
-        
-        cout << "\n------ Product Inventory ------" << endl;
-        cout << left << setw(5) << "ID"
-             << setw(20) << "Name"
-             << setw(10) << "Quantity"
-             << "Price" << endl;
-        cout << string(50, '-') << endl;
-        
-        Record* current = head;
-        while (current != nullptr) {
-            cout << left << setw(5) << current->id
-                 << setw(20) << current->name
-                 << setw(10) << current->quantity
-                 << "$" << fixed << setprecision(2) << current->price << endl;
-            current = current->next;
+
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+        Snapshot& operator=(Snapshot&&) = delete;
+
+        ~Snapshot() {
+            if (store) store->epochs.exit(slot);
         }
-        
-        cout << string(50, '-') << endl;
-    }
 
-    void displayMenu(Record*& head, int& nextId, bool isAdmin) override {
-        bool running = true;
-        while (running) {
-            cout << "\n" << string(30, '=') << endl;
-            cout << setw(22) << "Product Inventory Menu" << endl;
-            cout << string(30, '=') << endl;
-            
-            if (isAdmin) {
-                cout << "1. Add Product" << endl;
-                cout << "2. Edit Product" << endl;
-                cout << "3. Delete Product" << endl;
-                cout << "4. Display Products" << endl;
-                cout << "5. Return to Previous Menu" << endl;
-                
-                int choice = getValidIntInput("Enter your choice (1-5): ", 1);
-                switch (choice) {
-                    case 1: addRecord(head, nextId, isAdmin); break;
-                    case 2: editRecord(head, isAdmin); break;
-                    case 3: deleteRecord(head, isAdmin); break;
-                    case 4: displayInventory(head); break;
-                    case 5:
-                        if (getConfirmation("Are you sure you want to return to the previous menu?")) 
-                            running = false;
-                        break;
-                    default: cout << "Invalid choice. Please try again." << endl;
-                }
-            } else {
-                cout << "1. Edit Product Quantity" << endl;
-                cout << "2. Display Products" << endl;
-                cout << "3. Return to Previous Menu" << endl;
-                
-                int choice = getValidIntInput("Enter your choice (1-3): ", 1);
-                switch (choice) {
-                    case 1: editRecord(head, isAdmin); break;
-                    case 2: displayInventory(head); break;
-                    case 3:
-                        if (getConfirmation("Are you sure you want to return to the previous menu?")) 
-                            running = false;
-                        break;
-                    default: cout << "Invalid choice. Please try again." << endl;
-                }
-            }
+        uint64_t versionNumber() const { return version->number; }
+        int nextId() const { return version->nextId; }
+        size_t size() const { return version->size(); }
+        bool empty() const { return version->size() == 0; }
+
+        const Record* find(int id) const {
+            return version->find(id);
+        }
+
+        // Number of records with a smaller id, which is where id is or
+        // would be in id order
+        size_t rank(int id) const {
+            return version->rank(id);
+        }
+
+        // Iterates the records at positions [first, last) in id order, so
+        // parallel loops can give each chunk its own range
+        template <typename Visitor>
+        void forRange(size_t first, size_t last, Visitor visit) const {
+            if (last > first) version->visit(first, last - first, visit);
+        }
+
+        // Iterates records in id order
+        template <typename Visitor>
+        void forEach(Visitor visit) const {
+            forRange(0, size(), visit);
         }
+    };
+
+    RecordStore()
+        : moved(new Stripe[STRIPES]), unpublished(0), syncedGeneration(0), syncedChanges(0), changesTrimmed(0),
+          trimmedUpToVersion(0) {
+        current.store(new StoreVersion{1, 1, nullptr, 1});
     }
-};
 
-// Inventory class that uses Strategy pattern
-class Inventory {
-private:
-    Record* head;
-    int nextId;
-    string filename;
-    bool isAdmin;
-    unique_ptr<InventoryType> strategy;
+    RecordStore(const RecordStore&) = delete;
+    RecordStore& operator=(const RecordStore&) = delete;
 
-    void loadFromFile() {
-        ifstream file(filename);
-        if (!file.is_open()) return;
-        
-        // Clear existing records
-        while (head != nullptr) {
-            Record* temp = head;
-            head = head->next;
-            delete temp;
+    ~RecordStore() {
+        const StoreVersion* last = current.load();
+        StoreNode::destroy(last->root, last->height - 1);
+        delete last;
+    }
+
+    // Stock movements made before the call are in the snapshot
+    Snapshot pin() const {
+        refreshIfStale();
+        if (unpublished.load() > 0) const_cast<RecordStore*>(this)->publishMoved();
+        return Snapshot(this);
+    }
+
+    // Switches the store over to a shared-memory segment; from here on every
+    // change goes to the segment and is seen by all attached processes
+    void attachShared(shared_ptr<SharedSegment> segment) {
+        lock_guard<mutex> lock(writerMutex);
+        shared = move(segment);
+        syncFromSharedLocked();
+    }
+
+    bool isShared() const { return shared != nullptr; }
+
+    // Bumped by every change made by any process attached to the segment
+    uint64_t sharedChangeCounter() const {
+        return shared ? shared->header()->changeCounter.load() : 0;
+    }
+
+    // Adds to ids the records changed by the versions after the one that
+    // position was taken at, up to and including version, and moves position
+    // past them. False if the log no longer holds them all or one of them
+    // replaced every record; ids are then incomplete.
+    bool changesUpTo(uint64_t version, uint64_t& position, vector<int>& ids) const {
+        lock_guard<mutex> lock(changeMutex);
+        if (position < changesTrimmed) return false;
+        bool complete = true;
+        size_t i = position - changesTrimmed;
+        for (; i < changes.size() && changes[i].version <= version; i++) {
+            if (changes[i].id < 0) complete = false;
+            else ids.push_back(changes[i].id);
         }
-        head = nullptr;
-        nextId = 1;
-        
-        int id;
-        string name;
-        int quantity;
-        double price;
-        string line;
-        
-        while (getline(file, line)) {
-            stringstream ss(line);
-            ss >> id;
-            ss.ignore();
-            getline(ss, name, '|');
-            ss >> quantity >> price;
-            
-            Record* newRecord = new Record(id, name, quantity, price);
-            
-            if (id >= nextId) nextId = id + 1;
-            
-            if (head == nullptr) {
-                head = newRecord;
-            } else {
-                Record* current = head;
-                while (current->next != nullptr) {
-                    current = current->next;
-                }
-                current->next = newRecord;
+        position = changesTrimmed + i;
+        return complete;
+    }
+
+    // Log position just past the changes of version and the ones before it
+    uint64_t changesPosition(uint64_t version) const {
+        lock_guard<mutex> lock(changeMutex);
+        // Some of what came after it may have been trimmed; 0 makes the next
+        // changesUpTo fail
+        if (trimmedUpToVersion > version) return 0;
+        size_t i = 0;
+        while (i < changes.size() && changes[i].version <= version) i++;
+        return changesTrimmed + i;
+    }
+
+    bool sharedOwnerAlive() const {
+        return !shared || shared->header()->ownerAlive.load() != 0;
+    }
+
+    // For stock changed directly on the cells, such as by a StockTransaction
+    void stockChanged(const vector<int>& ids) const {
+        Snapshot view(this);
+        for (int id : ids) {
+            if (const Record* record = view.find(id)) queueMoved(*record);
+        }
+    }
+
+    int nextIdHint() const {
+        return Snapshot(this).nextId();
+    }
+
+    // Copy of all records in id order
+    vector<Record> snapshot() const {
+        Snapshot view = pin();
+        vector<Record> result;
+        result.reserve(view.size());
+        view.forEach([&](const Record& record) { result.push_back(record); });
+        return result;
+    }
+
+    bool find(int id, Record& out) const {
+        Snapshot view = pin();
+        const Record* record = view.find(id);
+        if (record == nullptr) return false;
+        out = *record;
+        return true;
+    }
+
+    bool empty() const {
+        return pin().empty();
+    }
+
+    // Adds delta to a record's quantity without taking any lock (see
+    // adjustCell); the next snapshot publishes the new quantity. Only
+    // records added or deleted by other processes are caught up with first.
+    OpResult adjust(int id, int delta) const {
+        if (shared && shared->header()->generation.load() != syncedGeneration.load()) refreshIfStale();
+        Snapshot view(this);
+        const Record* record = view.find(id);
+        if (record == nullptr) return OP_NOT_FOUND;
+        OpResult result = adjustCell(*record->stock, delta);
+        if (result == OP_OK) queueMoved(*record);
+        return result;
+    }
+
+    // Takes n units only if all n are available
+    OpResult tryReserve(int id, int n) const {
+        if (n <= 0) return OP_INVALID_VALUE;
+        return adjust(id, -n);
+    }
+
+    bool nameExists(const string& name) const {
+        refreshIfStale();
+        lock_guard<mutex> lock(writerMutex);
+        return nameTakenLocked(name);
+    }
+
+    // Adds a record under the next free id; fails if uniqueName is set and the name is taken
+    OpResult insert(const string& name, int quantity, double price, bool uniqueName, int& newId) {
+        lock_guard<mutex> lock(writerMutex);
+        if (shared) return insertSharedLocked(name, quantity, price, uniqueName, newId);
+        if (uniqueName && nameTakenLocked(name)) return OP_DUPLICATE_NAME;
+
+        publish([&](StoreEdit& edit) {
+            newId = edit.nextId()++;
+            edit.set(newId, new Record(newId, name, quantity, price));
+            return true;
+        });
+        idsByNameHash.emplace(hash<string>()(name), newId);
+        return OP_OK;
+    }
+
+    OpResult insertSharedLocked(const string& name, int quantity, double price, bool uniqueName, int& newId) {
+        if (!SharedSegment::fitsName(name)) return OP_INVALID_NAME;
+        SharedSegmentHeader* h = shared->header();
+
+        shared->lock();
+        for (uint32_t i = 0; uniqueName && i < h->usedSlots; i++) {
+            SharedRecordSlot* s = shared->slot(i);
+            if (s->inUse && name == s->name) {
+                shared->unlock();
+                return OP_DUPLICATE_NAME;
             }
         }
-        file.close();
+        uint32_t index = shared->allocateSlot();
+        if (index == UINT32_MAX) {
+            shared->unlock();
+            return OP_STORE_FULL;
+        }
+
+        // A reused slot carries on counting versions, so an edit based on the
+        // record that was deleted from it can't match the new one. Slots
+        // never used are still zero-filled from ftruncate.
+        SharedRecordSlot* s = shared->slot(index);
+        uint32_t version = StockCell::versionOf(s->stock.state.load());
+        new (s) SharedRecordSlot();
+        newId = h->nextId++;
+        s->stock.state.store(StockCell::pack(version + 1, quantity));
+        s->id = newId;
+        s->price = price;
+        memcpy(s->name, name.c_str(), name.size());
+        s->inUse = 1;
+        markSharedChanged(newId);
+        shared->unlock();
+
+        shared_ptr<StockCell> cell(shared, &s->stock);
+        publish([&](StoreEdit& edit) {
+            edit.nextId() = max(edit.nextId(), newId + 1);
+            edit.set(newId, new Record(newId, name, price, cell));
+            return true;
+        });
+        idsByNameHash.emplace(hash<string>()(name), newId);
+        return OP_OK;
     }
 
-    void saveToFile() {
-        ofstream file(filename);
-        if (!file.is_open()) {
-            cout << "Error: Could not open file for saving." << endl;
-            return;
+    // Replaces the whole contents in one version. Used when loading from file,
+    // where ids are already assigned; a later duplicate id wins. Only valid
+    // before the store is attached to a shared segment.
+    void replaceAll(vector<Record> records) {
+        lock_guard<mutex> lock(writerMutex);
+        publish([&](StoreEdit& edit) {
+            edit.clear();
+            edit.nextId() = 1;
+            for (const Record& record : records) {
+                edit.set(record.id, new Record(record));
+                if (record.id >= edit.nextId()) edit.nextId() = record.id + 1;
+            }
+            return true;
+        });
+        rebuildNamesLocked();
+    }
+
+    // Applies an edit only if the record is still at expectedVersion, so an
+    // edit based on a stale read is rejected instead of overwriting someone
+    // else's change. newQuantity < 0 keeps the quantity; change, if given,
+    // may update the name and price of the new copy of the record.
+    // previousQuantity is set to the quantity the update replaced
+    OpResult compareAndUpdate(int id, uint32_t expectedVersion, int newQuantity,
+                              const function<void(Record&)>& change, int& previousQuantity) {
+        lock_guard<mutex> lock(writerMutex);
+        if (sharedIsStale()) refreshLocked();
+        Snapshot view(this);
+        const Record* record = view.find(id);
+        if (record == nullptr) return OP_NOT_FOUND;
+
+        Record updated(*record);
+        if (change) change(updated);
+        if (shared && !SharedSegment::fitsName(updated.name)) return OP_INVALID_NAME;
+
+        // The cell stays locked until the new version is out, so the new
+        // quantity, name and price appear together, and a stock movement
+        // that comes after the version check waits instead of being lost
+        StockCell& cell = *record->stock;
+        uint64_t word = cell.loadUnlocked();
+        while (true) {
+            if (StockCell::versionOf(word) != expectedVersion) return OP_CONFLICT;
+            if (cell.state.compare_exchange_weak(word, word | StockCell::LOCK_BIT)) break;
+            if (StockCell::isLocked(word)) word = cell.loadUnlocked();
         }
-        
-        Record* current = head;
-        while (current != nullptr) {
-            file << current->id << " " << current->name << "|"
-                 << current->quantity << " " << current->price << endl;
-            current = current->next;
+        previousQuantity = StockCell::quantityOf(word);
+        updated.qty = newQuantity >= 0 ? newQuantity : previousQuantity;
+        updated.ver = expectedVersion + 1;
+
+        if (shared && change) {
+            SharedRecordSlot* s = slotOf(record);
+            shared->lock();
+            memset(s->name, 0, sizeof(s->name));
+            memcpy(s->name, updated.name.c_str(), updated.name.size());
+            s->price = updated.price;
+            markSharedChanged(id);
+            shared->unlock();
         }
-        file.close();
+        publish([&](StoreEdit& edit) {
+            edit.set(id, new Record(updated));
+            return true;
+        });
+        // Storing the new word also releases the lock
+        cell.state.store(StockCell::pack(updated.ver, updated.qty), memory_order_release);
+        if (shared && !change) shared->noteChange(id);
+        if (updated.name != record->name) {
+            forgetNameLocked(record->name, id);
+            idsByNameHash.emplace(hash<string>()(updated.name), id);
+        }
+        return OP_OK;
+    }
+
+    // removedQuantity is set to the stock the record held when it was removed
+    bool remove(int id, int& removedQuantity) {
+        lock_guard<mutex> lock(writerMutex);
+        if (sharedIsStale()) refreshLocked();
+        Snapshot view(this);
+        const Record* record = view.find(id);
+        if (record == nullptr) return false;
+
+        // Locked while the record is taken out, so no stock movement lands
+        // between reading the last quantity and the removal
+        StockCell& cell = *record->stock;
+        uint64_t word = cell.loadUnlocked();
+        while (!cell.state.compare_exchange_weak(word, word | StockCell::LOCK_BIT)) {
+            if (StockCell::isLocked(word)) word = cell.loadUnlocked();
+        }
+        removedQuantity = StockCell::quantityOf(word);
+        publish([&](StoreEdit& edit) {
+            edit.set(id, nullptr);
+            return true;
+        });
+        cell.state.store(StockCell::pack(StockCell::versionOf(word) + 1, removedQuantity), memory_order_release);
+        forgetNameLocked(record->name, id);
+
+        if (shared) {
+            shared->lock();
+            shared->freeSlot(shared->indexOf(slotOf(record)));
+            markSharedChanged(id);
+            shared->unlock();
+        }
+        return true;
     }
+};
+
+// Changes the quantities of several stock cells, possibly in different
+// stores, as one unit: either every change is applied or none is. Cells are
+// locked in address order, so two transactions can't deadlock, and plain
+// adjustments of a locked cell wait until the transaction is done.
+class StockTransaction {
+private:
+    struct Change {
+        shared_ptr<StockCell> cell;
+        long long value;  // delta, or the new quantity when absolute
+        bool absolute;
+        int tag;          // caller's label for the change, reported on failure
+    };
+    vector<Change> changes;
+    vector<pair<int, long long>> appliedChanges;
 
 public:
-    Inventory(const string& file, unique_ptr<InventoryType> strat, bool admin = false) 
-        : head(nullptr), nextId(1), filename(file), isAdmin(admin), strategy(move(strat)) {
-        strategy->onModified = [this]() { this->saveToFile(); };
-        loadFromFile();
+    void add(shared_ptr<StockCell> cell, long long delta, int tag) {
+        changes.push_back({move(cell), delta, false, tag});
     }
 
-    ~Inventory() {
-        saveToFile();
-        Record* current = head;
-        while (current != nullptr) {
-            Record* temp = current;
-            current = current->next;
-            delete temp;
+    // Sets the quantity outright, whatever it is when the transaction commits
+    void set(shared_ptr<StockCell> cell, int quantity, int tag) {
+        changes.push_back({move(cell), quantity, true, tag});
+    }
+
+    size_t size() const { return changes.size(); }
+
+    // After a successful commit: (tag, quantity change) for every cell that
+    // changed. Merged changes report the tag of the last one.
+    const vector<pair<int, long long>>& applied() const { return appliedChanges; }
+
+    // On OP_INSUFFICIENT_STOCK, failedTag and shortBy say which change would
+    // have taken a quantity below zero and by how much
+    OpResult commit(int& failedTag, long long& shortBy) {
+        stable_sort(changes.begin(), changes.end(),
+                    [](const Change& a, const Change& b) { return a.cell.get() < b.cell.get(); });
+
+        // Changes to the same cell are merged in the order they were added: a
+        // set replaces everything before it, a delta adds to what is there
+        vector<Change> merged;
+        for (Change& change : changes) {
+            if (!merged.empty() && merged.back().cell == change.cell) {
+                Change& into = merged.back();
+                if (change.absolute) {
+                    into.value = change.value;
+                    into.absolute = true;
+                } else {
+                    into.value += change.value;
+                }
+                if (change.absolute || change.value < 0) into.tag = change.tag;
+            } else {
+                merged.push_back(move(change));
+            }
+        }
+        changes.clear();
+        appliedChanges.clear();
+
+        vector<uint64_t> before(merged.size());
+        for (size_t i = 0; i < merged.size(); i++) {
+            atomic<uint64_t>& state = merged[i].cell->state;
+            uint64_t word = merged[i].cell->loadUnlocked();
+            while (!state.compare_exchange_weak(word, word | StockCell::LOCK_BIT)) {
+                if (StockCell::isLocked(word)) word = merged[i].cell->loadUnlocked();
+            }
+            before[i] = word;
+        }
+
+        OpResult result = OP_OK;
+        vector<long long> after(merged.size());
+        for (size_t i = 0; i < merged.size() && result == OP_OK; i++) {
+            long long next = merged[i].absolute ? merged[i].value
+                                                : StockCell::quantityOf(before[i]) + merged[i].value;
+            after[i] = next;
+            if (next < 0) {
+                result = OP_INSUFFICIENT_STOCK;
+                failedTag = merged[i].tag;
+                shortBy = -next;
+            } else if (next > INT_MAX) {
+                result = OP_INVALID_VALUE;
+                failedTag = merged[i].tag;
+            }
+        }
+
+        // Storing the new word also releases the lock
+        for (size_t i = 0; i < merged.size(); i++) {
+            uint64_t word = before[i];
+            if (result == OP_OK && after[i] != StockCell::quantityOf(word)) {
+                appliedChanges.push_back({merged[i].tag, after[i] - StockCell::quantityOf(word)});
+                word = StockCell::pack(StockCell::versionOf(word) + 1, (int)after[i]);
+            }
+            merged[i].cell->state.store(word, memory_order_release);
         }
+        return result;
     }
+};
+
+// Which inventory a journalled change belongs to
+enum InventoryKind : uint8_t {
+    INVENTORY_RAW,
+    INVENTORY_PRODUCT
+};
 
-    void setAdminStatus(bool admin) {
-        isAdmin = admin;
+enum UndoField : uint8_t {
+    FIELD_QUANTITY,
+    FIELD_PRICE,
+    FIELD_NAME
+};
+
+// One field of one record before and after a change. Only the difference
+// of a quantity matters, so stock movements store 0 and the delta; location
+// says at which warehouse (0 is the home location). Prices
+// are kept as the bit pattern of the double and names as indexes into the
+// journal's name list, so every change is the same 24 bytes.
+struct FieldChange {
+    int32_t recordId;
+    InventoryKind inventory;
+    UndoField field;
+    uint16_t location;
+    int64_t before;
+    int64_t after;
+
+    static FieldChange quantity(InventoryKind inventory, int id, long long before, long long after,
+                                size_t location = 0) {
+        return {id, inventory, FIELD_QUANTITY, (uint16_t)location, before, after};
     }
 
-    void displayMenu() {
-        strategy->displayMenu(head, nextId, isAdmin);
-        saveToFile();
+    static FieldChange price(InventoryKind inventory, int id, double before, double after) {
+        return {id, inventory, FIELD_PRICE, 0, bit_cast<int64_t>(before), bit_cast<int64_t>(after)};
     }
 };
 
-// ================= REPORT MANAGER (SINGLETON) =================
+static_assert(sizeof(FieldChange) == 24, "FieldChange should stay compact");
 
-class ReportManager {
-private:
-    static ReportManager* instance;
-    
-    // Private constructor for Singleton
-    ReportManager() {}
-    
+// Per-session undo/redo history. Every operation is a group of field
+// changes, newest last; the cursor splits the ones that can be undone from
+// the ones that can be redone, and recording a new operation drops the redo
+// side. The oldest operations are forgotten once there are more than
+// MAX_OPERATIONS or their changes add up to more than MAX_CHANGES.
+//
+// The journal only remembers; InventoryManager::undo applies the inverse
+// changes and then moves the cursor with step, so a failed undo leaves the
+// history as it was.
+class UndoJournal {
 public:
-    // Delete copy constructor and assignment operator
-    ReportManager(const ReportManager&) = delete;
-    ReportManager& operator=(const ReportManager&) = delete;
-    
-    // Get singleton instance
-    static ReportManager* getInstance() {
-        if (!instance) {
-            instance = new ReportManager();
+    static const size_t MAX_OPERATIONS = 100;
+    static const size_t MAX_CHANGES = 1 << 20;
+
+    // What an operation was, for showing it before it is undone
+    struct Summary {
+        MovementReason reason;
+        size_t changes;
+    };
+
+private:
+    struct Operation {
+        MovementReason reason;
+        size_t changes;
+    };
+    deque<Operation> operations;
+    deque<FieldChange> changes;
+    deque<string> names;        // before and after of each name change, in change order
+    vector<string> pendingNames;  // names of the operation being built
+    size_t cursor = 0;          // operations before it are done, the rest undone
+    size_t changesDone = 0;     // changes of the operations before the cursor
+    int64_t namesDropped = 0;   // index of names.front()
+
+    void dropOldest() {
+        size_t n = operations.front().changes;
+        for (size_t i = 0; i < n; i++) {
+            if (changes.front().field == FIELD_NAME) {
+                names.pop_front();
+                names.pop_front();
+                namesDropped += 2;
+            }
+            changes.pop_front();
+        }
+        operations.pop_front();
+        if (cursor > 0) {
+            cursor--;
+            changesDone -= n;
         }
-        return instance;
     }
-    
-    // Cleanup singleton
-    static void destroyInstance() {
-        if (instance) {
-            delete instance;
-            instance = nullptr;
+
+    void dropRedo() {
+        while (operations.size() > cursor) {
+            for (size_t i = 0; i < operations.back().changes; i++) {
+                if (changes.back().field == FIELD_NAME) {
+                    names.pop_back();
+                    names.pop_back();
+                }
+                changes.pop_back();
+            }
+            operations.pop_back();
         }
     }
 
-    void displayRawMatReport() {
-        struct ReportRecord {
-            int id;
-            string name;
-            int quantity;
-            double price;
-        };
-        
-        ifstream file("rawmaterial.txt");
-        if (!file.is_open()) {
-            cout << "Error: Could not open rawmaterial.txt for reading." << endl;
+public:
+    // A name change for the operation passed to the next record call; the
+    // journal keeps its own copy of both names
+    FieldChange name(InventoryKind inventory, int id, const string& before, const string& after) {
+        int64_t index = (int64_t)pendingNames.size();
+        pendingNames.push_back(before);
+        pendingNames.push_back(after);
+        return {id, inventory, FIELD_NAME, 0, index, index + 1};
+    }
+
+    // Adds an operation that was just done and drops whatever could be
+    // redone. An operation too large to keep clears the journal, since the
+    // ones before it could no longer be undone in order.
+    void record(MovementReason reason, const vector<FieldChange>& operationChanges) {
+        vector<string> pending = move(pendingNames);
+        pendingNames.clear();
+        if (operationChanges.empty()) return;
+        dropRedo();
+        if (operationChanges.size() > MAX_CHANGES) {
+            clear();
             return;
         }
-        
-        time_t now = time(0);
-        char* dt = ctime(&now);
-        
-        cout << "\n" << string(70, '=') << endl;
-        cout << setw(45) << "RAW MATERIAL INVENTORY REPORT" << endl;
-        cout << "Generated on: " << dt;
-        cout << string(70, '=') << endl;
-        cout << left << setw(5) << "ID"
-             << setw(25) << "Product Name"
-             << setw(10) << "Quantity"
-             << setw(15) << "Unit Price"
-             << setw(15) << "Value" << endl;
-        cout << string(70, '-') << endl;
-        
-        int totalQuantity = 0;
-        double totalValue = 0.0;
-        string line;
-        
-        while (getline(file, line)) {
-            stringstream ss(line);
-            ReportRecord record;
-            ss >> record.id;
-            ss.ignore();
-            getline(ss, record.name, '|');
-            ss >> record.quantity >> record.price;
-            
-            double value = record.quantity * record.price;
-            totalQuantity += record.quantity;
-            totalValue += value;
-            
-            cout << left << setw(5) << record.id
-                 << setw(25) << record.name
-                 << setw(10) << record.quantity
-                 << "$" << setw(14) << fixed << setprecision(2) << record.price
-                 << "$" << setw(14) << fixed << setprecision(2) << value << endl;
+        while (!operations.empty() &&
+               (operations.size() >= MAX_OPERATIONS || changes.size() + operationChanges.size() > MAX_CHANGES)) {
+            dropOldest();
         }
-        
-        file.close();
-        
-        cout << string(70, '-') << endl;
-        cout << left << setw(30) << "TOTAL:"
-             << setw(10) << totalQuantity
-             << setw(15) << ""
-             << "$" << fixed << setprecision(2) << totalValue << endl;
-        cout << string(70, '=') << endl;
+
+        int64_t firstName = namesDropped + (int64_t)names.size();
+        for (FieldChange change : operationChanges) {
+            if (change.field == FIELD_NAME) {
+                change.before += firstName;
+                change.after += firstName;
+            }
+            changes.push_back(change);
+        }
+        for (string& text : pending) names.push_back(move(text));
+        operations.push_back({reason, operationChanges.size()});
+        cursor = operations.size();
+        changesDone = changes.size();
     }
 
-    void displayProductReport() {
-        struct ReportRecord {
-            int id;
-            string name;
-            int quantity;
-            double price;
-        };
-        
-        ifstream file("product.txt");
-        if (!file.is_open()) {
-            cout << "Error: Could not open product.txt for reading." << endl;
-            return;
+    void clear() {
+        operations.clear();
+        changes.clear();
+        namesDropped += (int64_t)names.size();
+        names.clear();
+        cursor = 0;
+        changesDone = 0;
+    }
+
+    bool canUndo() const { return cursor > 0; }
+    bool canRedo() const { return cursor < operations.size(); }
+
+    // The operation undo (redo = false) or redo would act on; call only when
+    // canUndo or canRedo says there is one
+    Summary next(bool redo) const {
+        const Operation& operation = operations[redo ? cursor : cursor - 1];
+        return {operation.reason, operation.changes};
+    }
+
+    vector<FieldChange> nextChanges(bool redo) const {
+        const Operation& operation = operations[redo ? cursor : cursor - 1];
+        size_t first = redo ? changesDone : changesDone - operation.changes;
+        return vector<FieldChange>(changes.begin() + first, changes.begin() + first + operation.changes);
+    }
+
+    const string& nameAt(int64_t index) const { return names[index - namesDropped]; }
+
+    // Marks the next operation as undone or redone
+    void step(bool redo) {
+        if (redo) {
+            changesDone += operations[cursor].changes;
+            cursor++;
+        } else {
+            cursor--;
+            changesDone -= operations[cursor].changes;
+        }
+    }
+
+    size_t size() const { return operations.size(); }
+};
+
+// Who is making a change: the user named in the stock ledger and, when the
+// change can be undone, the journal of that user's session
+struct ChangeContext {
+    string user;
+    UndoJournal* journal;
+};
+
+// A record whose name is close to a searched one: the edits to the closest
+// part of the name, and to the whole name
+struct NameMatch {
+    int id;
+    int distance;
+    int wholeDistance;
+};
+
+// Strategy interface for inventory operations
+class InventoryType {
+public:
+    std::function<void(MutationKind, int)> onModified; // Callback to notify modifications (kind, record id)
+    // Callback for the stock ledger (record id, quantity delta, reason, user)
+    std::function<void(int, int, MovementReason, const string&)> onStockMoved;
+    // Callback for the names closest to a misspelt one (name, most matches)
+    std::function<vector<NameMatch>(const string&, size_t)> onFindSimilar;
+    virtual ~InventoryType() = default;
+
+    void stockMoved(int id, int delta, MovementReason reason, const string& user) {
+        if (delta != 0 && onStockMoved) onStockMoved(id, delta, reason, user);
+    }
+
+    // Offered when an id isn't found: lists the records whose names are
+    // closest to one the user types and returns the id chosen, or 0
+    int pickByName(const RecordStore& store, const string& noun) {
+        const size_t maxShown = 10;
+        if (!onFindSimilar || !getConfirmation("Search by name instead?")) return 0;
+        string name;
+        cout << "Enter " << noun << " name: ";
+        getline(cin, name);
+        vector<NameMatch> matches = onFindSimilar(name, maxShown);
+        if (matches.empty()) {
+            cout << "No " << noun << " has a name close to \"" << name << "\"." << endl;
+            return 0;
+        }
+        cout << left << setw(5) << "ID" << setw(20) << "Name" << setw(10) << "Quantity" << "Edits" << endl;
+        cout << string(50, '-') << endl;
+        for (const NameMatch& match : matches) {
+            Record record(0, "", 0, 0);
+            if (!store.find(match.id, record)) continue;
+            cout << left << setw(5) << record.id << setw(20) << record.name << setw(10) << record.quantity()
+                 << match.distance << endl;
+        }
+        cout << string(50, '-') << endl;
+        return getValidIntInput("Enter ID from the list (0 to cancel): ", 0);
+    }
+
+    // Why an add or edit made from the menus changed nothing. The names were
+    // already checked, so a name rejected here is too long for shared memory.
+    static void reportFailure(OpResult result) {
+        if (result == OP_INVALID_NAME) {
+            cout << "Names in a shared inventory can be at most " << SHARED_NAME_SIZE - 1
+                 << " characters. No changes saved." << endl;
+        } else {
+            cout << describeResult(result) << ". No changes saved." << endl;
+        }
+    }
+
+    // Whether add rejects a name that is already in use
+    virtual bool requiresUniqueNames() const { return false; }
+
+    virtual InventoryKind kind() const = 0;
+
+    // Non-interactive operations shared by the menus and server sessions.
+    // Admins may change everything; employees may only change quantities.
+    // context is who made the change, for the stock ledger; edits and stock
+    // movements go to its undo journal when it has one. Adding and deleting
+    // records can't be undone.
+    OpResult add(RecordStore& store, const string& name, int quantity, double price, bool isAdmin,
+                 const ChangeContext& context, int& newId) {
+        if (!isAdmin) return OP_DENIED;
+        if (!isValidRecordName(name)) return OP_INVALID_NAME;
+        if (quantity < 1 || price <= 0) return OP_INVALID_VALUE;
+        OpResult result = store.insert(name, quantity, price, requiresUniqueNames(), newId);
+        if (result != OP_OK) return result;
+        stockMoved(newId, quantity, MOVE_ADD, context.user);
+        if (onModified) onModified(MUTATION_ADD, newId);
+        return result;
+    }
+
+    // An empty name, zero quantity or zero price keeps the current value.
+    // expectedVersion is the version the caller saw when it read the record.
+    OpResult edit(RecordStore& store, int id, uint32_t expectedVersion, const string& newName,
+                  int newQuantity, double newPrice, bool isAdmin, const ChangeContext& context) {
+        if (!isAdmin && (!newName.empty() || newPrice != 0)) return OP_DENIED;
+        if (!newName.empty() && !isValidRecordName(newName)) return OP_INVALID_NAME;
+        if (newQuantity < 0 || newPrice < 0) return OP_INVALID_VALUE;
+
+        function<void(Record&)> change;
+        string previousName;
+        double previousPrice = 0;
+        if (!newName.empty() || newPrice > 0) {
+            change = [&](Record& record) {
+                previousName = record.name;
+                previousPrice = record.price;
+                if (!newName.empty()) record.name = newName;
+                if (newPrice > 0) record.price = newPrice;
+            };
+        }
+        int previousQuantity = 0;
+        OpResult result = store.compareAndUpdate(id, expectedVersion, newQuantity > 0 ? newQuantity : -1,
+                                                 change, previousQuantity);
+        if (result != OP_OK) return result;
+        if (newQuantity > 0) stockMoved(id, newQuantity - previousQuantity, MOVE_EDIT, context.user);
+        if (context.journal) {
+            vector<FieldChange> changes;
+            if (newQuantity > 0 && newQuantity != previousQuantity) {
+                changes.push_back(FieldChange::quantity(kind(), id, previousQuantity, newQuantity));
+            }
+            if (!newName.empty() && newName != previousName) {
+                changes.push_back(context.journal->name(kind(), id, previousName, newName));
+            }
+            if (newPrice > 0 && newPrice != previousPrice) {
+                changes.push_back(FieldChange::price(kind(), id, previousPrice, newPrice));
+            }
+            context.journal->record(MOVE_EDIT, changes);
+        }
+        if (onModified) onModified(MUTATION_EDIT, id);
+        return result;
+    }
+
+    // Stock movements are allowed for every role, like quantity edits
+    OpResult adjust(RecordStore& store, int id, int delta, const ChangeContext& context) {
+        OpResult result = store.adjust(id, delta);
+        if (result != OP_OK) return result;
+        stockMoved(id, delta, MOVE_ADJUST, context.user);
+        if (context.journal) context.journal->record(MOVE_ADJUST, {FieldChange::quantity(kind(), id, 0, delta)});
+        if (onModified) onModified(MUTATION_STOCK, id);
+        return result;
+    }
+
+    OpResult reserve(RecordStore& store, int id, int n, const ChangeContext& context) {
+        OpResult result = store.tryReserve(id, n);
+        if (result != OP_OK) return result;
+        stockMoved(id, -n, MOVE_RESERVE, context.user);
+        if (context.journal) context.journal->record(MOVE_RESERVE, {FieldChange::quantity(kind(), id, 0, -n)});
+        if (onModified) onModified(MUTATION_STOCK, id);
+        return result;
+    }
+
+    OpResult remove(RecordStore& store, int id, bool isAdmin, const ChangeContext& context) {
+        if (!isAdmin) return OP_DENIED;
+        int removedQuantity = 0;
+        if (!store.remove(id, removedQuantity)) return OP_NOT_FOUND;
+        stockMoved(id, -removedQuantity, MOVE_DELETE, context.user);
+        if (onModified) onModified(MUTATION_DELETE, id);
+        return OP_OK;
+    }
+
+    virtual void addRecord(RecordStore& store, bool isAdmin, const ChangeContext& context) = 0;
+    virtual void editRecord(RecordStore& store, bool isAdmin, const ChangeContext& context) = 0;
+    virtual void deleteRecord(RecordStore& store, bool isAdmin, const ChangeContext& context) = 0;
+    virtual void displayInventory(const RecordStore& store) = 0;
+    virtual void displayMenu(RecordStore& store, bool isAdmin, const ChangeContext& context) = 0;
+};
+
+// Concrete class for Raw Material inventory
+class RawMaterialInventory : public InventoryType {
+public:
+    bool requiresUniqueNames() const override { return true; }
+    InventoryKind kind() const override { return INVENTORY_RAW; }
+
+    void addRecord(RecordStore& store, bool isAdmin, const ChangeContext& context) override {
+        if (!isAdmin) {
+            cout << "Access denied. Only administrators can add new raw materials." << endl;
+            return;
         }
         
-        time_t now = time(0);
-        char* dt = ctime(&now);
-        
-        cout << "\n" << string(70, '=') << endl;
-        cout << setw(45) << "PRODUCT INVENTORY REPORT" << endl;
-        cout << "Generated on: " << dt;
-        cout << string(70, '=') << endl;
-        cout << left << setw(5) << "ID"
-             << setw(25) << "Product Name"
-             << setw(10) << "Quantity"
-             << setw(15) << "Unit Price"
-             << setw(15) << "Value" << endl;
-        cout << string(70, '-') << endl;
-        
-        int totalQuantity = 0;
-        double totalValue = 0.0;
-        string line;
+        string name;
+        cout << "Enter raw material name: ";
+        cin.ignore();
+        getline(cin, name);
         
-        while (getline(file, line)) {
-            stringstream ss(line);
-            ReportRecord record;
-            ss >> record.id;
-            ss.ignore();
-            getline(ss, record.name, '|');
-            ss >> record.quantity >> record.price;
+        // Check for duplicate name
+        if (store.nameExists(name)) {
+            cout << "A raw material with this name already exists!" << endl;
+            return;
+        }
+        
+        if (!isValidRecordName(name)) {
+            cout << "Invalid name. Name should not be empty or contain numbers." << endl;
+            return;
+        }
+
+        int quantity = getValidIntInput("Enter quantity: ", 1);
+        
+        double price = 0;
+        bool isValidPrice = false;
+        do {
+            cout << "Enter unit price: ";
+            if (cin >> price) {
+                if (price > 0) {
+                    isValidPrice = true;
+                } else {
+                    cout << "Invalid price. Price must be positive." << endl;
+                }
+            } else {
+                cout << "Invalid input. Please enter a number." << endl;
+                cin.clear();
+                clearInputBuffer();
+            }
+        } while (!isValidPrice);
+        
+        if (!getConfirmation("Are you sure you want to add this raw material?")) {
+            cout << "Operation cancelled." << endl;
+            return;
+        }
+        
+        int newId;
+        OpResult result = add(store, name, quantity, price, isAdmin, context, newId);
+        if (result == OP_DUPLICATE_NAME) {
+            cout << "A raw material with this name already exists!" << endl;
+            return;
+        }
+        if (result != OP_OK) {
+            reportFailure(result);
+            return;
+        }
+        
+        cout << "Raw material added successfully." << endl;
+    }
+
+    void editRecord(RecordStore& store, bool isAdmin, const ChangeContext& context) override {
+        if (store.empty()) {
+            cout << "No raw materials available to edit." << endl;
+            return;
+        }
+        
+        displayInventory(store);
+        int idToEdit = getValidIntInput("Enter ID of raw material to edit: ", 1);
+        
+        Record current(0, "", 0, 0);
+        if (!store.find(idToEdit, current)) {
+            cout << "Raw material with ID " << idToEdit << " not found." << endl;
+            idToEdit = pickByName(store, "raw material");
+            if (idToEdit == 0 || !store.find(idToEdit, current)) return;
+        }
+        // The stock cell is live, so remember which version these prompts are based on
+        uint32_t versionRead = current.version();
+
+        cout << "Editing raw material with ID: " << idToEdit << endl;
+        cout << "Current name: " << current.name << endl;
+        cout << "Current quantity: " << current.quantity() << endl;
+        cout << "Current unit price: $" << fixed << setprecision(2) << current.price << endl;
+        
+        string newName;
+        if (isAdmin) {
+            cout << "Enter new name (or press Enter to keep current): ";
+            cin.ignore();
+            getline(cin, newName);
             
-            double value = record.quantity * record.price;
-            totalQuantity += record.quantity;
-            totalValue += value;
+            if (!newName.empty() && !isValidRecordName(newName)) {
+                cout << "Invalid name. Name should not contain numbers. Name not updated." << endl;
+                newName.clear();
+            }
+        }
+        
+        cout << "Enter new quantity (or 0 to keep current): ";
+        int newQuantity;
+        cin >> newQuantity;
+        
+        if (newQuantity < 0) {
+            cout << "Invalid quantity. Quantity must be positive. Quantity not updated." << endl;
+            newQuantity = 0;
+        }
+        
+        double newPrice = 0;
+        if (isAdmin) {
+            cout << "Enter new unit price (or 0 to keep current): ";
+            cin >> newPrice;
             
+            if (newPrice < 0) {
+                cout << "Invalid price. Price must be positive. Price not updated." << endl;
+                newPrice = 0;
+            }
+        }
+        
+        if (!getConfirmation("Save these changes?")) {
+            cout << "Operation cancelled. No changes saved." << endl;
+            return;
+        }
+        
+        OpResult result = edit(store, idToEdit, versionRead, newName, newQuantity, newPrice, isAdmin, context);
+        if (result == OP_NOT_FOUND) {
+            cout << "Raw material with ID " << idToEdit << " no longer exists." << endl;
+            return;
+        }
+        if (result == OP_CONFLICT) {
+            cout << "This raw material was changed by another user while you were editing. No changes saved." << endl;
+            return;
+        }
+        if (result != OP_OK) {
+            reportFailure(result);
+            return;
+        }
+
+        cout << "Raw material updated successfully." << endl;
+    }
+
+    void deleteRecord(RecordStore& store, bool isAdmin, const ChangeContext& context) override {
+        if (!isAdmin) {
+            cout << "Access denied. Only administrators can delete raw materials." << endl;
+            return;
+        }
+        
+        if (store.empty()) {
+            cout << "No raw materials available to delete." << endl;
+            return;
+        }
+        
+        displayInventory(store);
+        int idToDelete = getValidIntInput("Enter ID of raw material to delete: ", 1);
+        Record current(0, "", 0, 0);
+        if (!store.find(idToDelete, current)) {
+            cout << "Raw material with ID " << idToDelete << " not found." << endl;
+            idToDelete = pickByName(store, "raw material");
+            if (idToDelete == 0) return;
+        }
+
+        if (!getConfirmation("Are you sure you want to delete this raw material?")) {
+            cout << "Operation cancelled." << endl;
+            return;
+        }
+        
+        if (remove(store, idToDelete, isAdmin, context) == OP_NOT_FOUND) {
+            cout << "Raw material with ID " << idToDelete << " not found." << endl;
+            return;
+        }
+        
+        cout << "Raw material deleted successfully." << endl;
+    }
+
+    void displayInventory(const RecordStore& store) override {
+        // Pinned so concurrent edits can't change the listing halfway through
+        RecordStore::Snapshot records = store.pin();
+        if (records.empty()) {
+            cout << "No raw materials available." << endl;
+            return;
+        }
+        
+        cout << "\n------ Raw Material Inventory ------" << endl;
+        cout << left << setw(5) << "ID"
+             << setw(20) << "Name"
+             << setw(10) << "Quantity"
+             << "Price" << endl;
+        cout << string(50, '-') << endl;
+        
+        records.forEach([](const Record& record) {
             cout << left << setw(5) << record.id
-                 << setw(25) << record.name
-                 << setw(10) << record.quantity
-                 << "$" << setw(14) << fixed << setprecision(2) << record.price
-                 << "$" << setw(14) << fixed << setprecision(2) << value << endl;
+                 << setw(20) << record.name
+                 << setw(10) << record.quantity()
+                 << "$" << fixed << setprecision(2) << record.price << endl;
+        });
+        
+        cout << string(50, '-') << endl;
+    }
+
+    void displayMenu(RecordStore& store, bool isAdmin, const ChangeContext& context) override {
+        bool running = true;
+        while (running) {
+            cout << "\n" << string(30, '=') << endl;
+            cout << setw(25) << "Raw Material Inventory Menu" << endl;
+            cout << string(30, '=') << endl;
+            
+            if (isAdmin) {
+                cout << "1. Add Raw Material" << endl;
+                cout << "2. Edit Raw Material" << endl;
+                cout << "3. Delete Raw Material" << endl;
+                cout << "4. Display Raw Materials" << endl;
+                cout << "5. Return to Previous Menu" << endl;
+                
+                int choice = getValidIntInput("Enter your choice (1-5): ", 1);
+                switch (choice) {
+                    case 1: addRecord(store, isAdmin, context); break;
+                    case 2: editRecord(store, isAdmin, context); break;
+                    case 3: deleteRecord(store, isAdmin, context); break;
+                    case 4: displayInventory(store); break;
+                    case 5:
+                        if (getConfirmation("Are you sure you want to return to the previous menu?")) 
+                            running = false;
+                        break;
+                    default: cout << "Invalid choice. Please try again." << endl;
+                }
+            } else {
+                cout << "1. Edit Raw Material Quantity" << endl;
+                cout << "2. Display Raw Materials" << endl;
+                cout << "3. Return to Previous Menu" << endl;
+                
+                int choice = getValidIntInput("Enter your choice (1-3): ", 1);
+                switch (choice) {
+                    case 1: editRecord(store, isAdmin, context); break;
+                    case 2: displayInventory(store); break;
+                    case 3:
+                        if (getConfirmation("Are you sure you want to return to the previous menu?")) 
+                            running = false;
+                        break;
+                    default: cout << "Invalid choice. Please try again." << endl;
+                }
+            }
+        }
+    }
+};
+
+// Concrete class for Product inventory
+class ProductInventory : public InventoryType {
+public:
+    InventoryKind kind() const override { return INVENTORY_PRODUCT; }
+
+    void addRecord(RecordStore& store, bool isAdmin, const ChangeContext& context) override {
+        if (!isAdmin) {
+            cout << "Access denied. Only administrators can add new products." << endl;
+            return;
+        }
+        
+        string name;
+        cout << "Enter product name: ";
+        cin.ignore();
+        getline(cin, name);
+        
+        if (!isValidRecordName(name)) {
+            cout << "Invalid name. Name should not be empty or contain numbers." << endl;
+            return;
+        }
+        
+        int quantity = getValidIntInput("Enter quantity: ", 1);
+        
+        double price = 0;
+        bool isValidPrice = false;
+        do {
+            cout << "Enter unit price: ";
+            if (cin >> price) {
+                if (price > 0) {
+                    isValidPrice = true;
+                } else {
+                    cout << "Invalid price. Price must be positive." << endl;
+                }
+            } else {
+                cout << "Invalid input. Please enter a number." << endl;
+                cin.clear();
+                clearInputBuffer();
+            }
+        } while (!isValidPrice);
+        
+        if (!getConfirmation("Are you sure you want to add this product?")) {
+            cout << "Operation cancelled." << endl;
+            return;
+        }
+        
+        int newId;
+        OpResult result = add(store, name, quantity, price, isAdmin, context, newId);
+        if (result != OP_OK) {
+            reportFailure(result);
+            return;
+        }
+        cout << "Product added successfully." << endl;
+    }
+
+    void editRecord(RecordStore& store, bool isAdmin, const ChangeContext& context) override {
+        if (store.empty()) {
+            cout << "No products available to edit." << endl;
+            return;
+        }
+        
+        displayInventory(store);
+        int idToEdit = getValidIntInput("Enter ID of product to edit: ", 1);
+        
+        Record current(0, "", 0, 0);
+        if (!store.find(idToEdit, current)) {
+            cout << "Product with ID " << idToEdit << " not found." << endl;
+            idToEdit = pickByName(store, "product");
+            if (idToEdit == 0 || !store.find(idToEdit, current)) return;
+        }
+        // The stock cell is live, so remember which version these prompts are based on
+        uint32_t versionRead = current.version();
+
+        cout << "Editing product with ID: " << idToEdit << endl;
+        cout << "Current name: " << current.name << endl;
+        cout << "Current quantity: " << current.quantity() << endl;
+        cout << "Current unit price: $" << fixed << setprecision(2) << current.price << endl;
+        
+        string newName;
+        if (isAdmin) {
+            cout << "Enter new name (or press Enter to keep current): ";
+            cin.ignore();
+            getline(cin, newName);
+            
+            if (!newName.empty() && !isValidRecordName(newName)) {
+                cout << "Invalid name. Name should not contain numbers. Name not updated." << endl;
+                newName.clear();
+            }
+        }
+        
+        cout << "Enter new quantity (or 0 to keep current): ";
+        int newQuantity;
+        cin >> newQuantity;
+        
+        if (newQuantity < 0) {
+            cout << "Invalid quantity. Quantity must be positive. Quantity not updated." << endl;
+            newQuantity = 0;
+        }
+        
+        double newPrice = 0;
+        if (isAdmin) {
+            cout << "Enter new unit price (or 0 to keep current): ";
+            cin >> newPrice;
+            
+            if (newPrice < 0) {
+                cout << "Invalid price. Price must be positive. Price not updated." << endl;
+                newPrice = 0;
+            }
+        }
+        
+        if (!getConfirmation("Save these changes?")) {
+            cout << "Operation cancelled. No changes saved." << endl;
+            return;
+        }
+        
+        OpResult result = edit(store, idToEdit, versionRead, newName, newQuantity, newPrice, isAdmin, context);
+        if (result == OP_NOT_FOUND) {
+            cout << "Product with ID " << idToEdit << " no longer exists." << endl;
+            return;
+        }
+        if (result == OP_CONFLICT) {
+            cout << "This product was changed by another user while you were editing. No changes saved." << endl;
+            return;
+        }
+        if (result != OP_OK) {
+            reportFailure(result);
+            return;
+        }
+
+        cout << "Product updated successfully." << endl;
+    }
+
+    void deleteRecord(RecordStore& store, bool isAdmin, const ChangeContext& context) override {
+        if (!isAdmin) {
+            cout << "Access denied. Only administrators can delete products." << endl;
+            return;
+        }
+        
+        if (store.empty()) {
+            cout << "No products available to delete." << endl;
+            return;
+        }
+        
+        displayInventory(store);
+        int idToDelete = getValidIntInput("Enter ID of product to delete: ", 1);
+        Record current(0, "", 0, 0);
+        if (!store.find(idToDelete, current)) {
+            cout << "Product with ID " << idToDelete << " not found." << endl;
+            idToDelete = pickByName(store, "product");
+            if (idToDelete == 0) return;
+        }
+
+        if (!getConfirmation("Are you sure you want to delete this product?")) {
+            cout << "Operation cancelled." << endl;
+            return;
+        }
+        
+        if (remove(store, idToDelete, isAdmin, context) == OP_NOT_FOUND) {
+            cout << "Product with ID " << idToDelete << " not found." << endl;
+            return;
+        }
+        
+        cout << "Product deleted successfully." << endl;
+    }
+
+    void displayInventory(const RecordStore& store) override {
+        // Pinned so concurrent edits can't change the listing halfway through
+        RecordStore::Snapshot records = store.pin();
+        if (records.empty()) {
+            cout << "No products available." << endl;
+            return;
+        }
+        
+        cout << "\n------ Product Inventory ------" << endl;
+        cout << left << setw(5) << "ID"
+             << setw(20) << "Name"
+             << setw(10) << "Quantity"
+             << "Price" << endl;
+        cout << string(50, '-') << endl;
+        
+        records.forEach([](const Record& record) {
+            cout << left << setw(5) << record.id
+                 << setw(20) << record.name
+                 << setw(10) << record.quantity()
+                 << "$" << fixed << setprecision(2) << record.price << endl;
+        });
+        
+        cout << string(50, '-') << endl;
+    }
+
+    void displayMenu(RecordStore& store, bool isAdmin, const ChangeContext& context) override {
+        bool running = true;
+        while (running) {
+            cout << "\n" << string(30, '=') << endl;
+            cout << setw(22) << "Product Inventory Menu" << endl;
+            cout << string(30, '=') << endl;
+            
+            if (isAdmin) {
+                cout << "1. Add Product" << endl;
+                cout << "2. Edit Product" << endl;
+                cout << "3. Delete Product" << endl;
+                cout << "4. Display Products" << endl;
+                cout << "5. Return to Previous Menu" << endl;
+                
+                int choice = getValidIntInput("Enter your choice (1-5): ", 1);
+                switch (choice) {
+                    case 1: addRecord(store, isAdmin, context); break;
+                    case 2: editRecord(store, isAdmin, context); break;
+                    case 3: deleteRecord(store, isAdmin, context); break;
+                    case 4: displayInventory(store); break;
+                    case 5:
+                        if (getConfirmation("Are you sure you want to return to the previous menu?")) 
+                            running = false;
+                        break;
+                    default: cout << "Invalid choice. Please try again." << endl;
+                }
+            } else {
+                cout << "1. Edit Product Quantity" << endl;
+                cout << "2. Display Products" << endl;
+                cout << "3. Return to Previous Menu" << endl;
+                
+                int choice = getValidIntInput("Enter your choice (1-3): ", 1);
+                switch (choice) {
+                    case 1: editRecord(store, isAdmin, context); break;
+                    case 2: displayInventory(store); break;
+                    case 3:
+                        if (getConfirmation("Are you sure you want to return to the previous menu?")) 
+                            running = false;
+                        break;
+                    default: cout << "Invalid choice. Please try again." << endl;
+                }
+            }
+        }
+    }
+};
+
+// ================= STOCK LEDGER =================
+
+// One stock movement as stored on disk. Entries have a fixed size, so entry n
+// is at a known offset. Usernames longer than the field are cut short.
+struct LedgerEntry {
+    int64_t timestampMicros;  // since the Unix epoch
+    int32_t recordId;
+    int32_t delta;
+    int32_t reason;           // MovementReason
+    char user[28];
+};
+
+static_assert(sizeof(LedgerEntry) == 48, "ledger entries are written as raw bytes");
+
+struct LedgerStats {
+    uint64_t entries;
+    uint64_t snapshotEntries;  // entries covered by the latest snapshot
+    uint64_t replayedAtOpen;   // entries replayed on top of it at startup
+    uint64_t reconciled;       // corrections appended at startup
+};
+
+string formatTimestamp(int64_t micros) {
+    time_t seconds = (time_t)(micros / 1000000);
+    char text[32];
+    strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", localtime(&seconds));
+    return text;
+}
+
+// Accepts local times as "YYYY-MM-DD", "YYYY-MM-DD HH:MM[:SS]" or with a 'T'
+// between date and time
+bool parseTimestamp(const string& text, int64_t& micros) {
+    tm parts = {};
+    int matched = sscanf(text.c_str(), "%d-%d-%d%*c%d:%d:%d", &parts.tm_year, &parts.tm_mon,
+                         &parts.tm_mday, &parts.tm_hour, &parts.tm_min, &parts.tm_sec);
+    if (matched != 3 && matched < 5) return false;
+    parts.tm_year -= 1900;
+    parts.tm_mon -= 1;
+    parts.tm_isdst = -1;
+    time_t seconds = mktime(&parts);
+    if (seconds == (time_t)-1) return false;
+    micros = (int64_t)seconds * 1000000;
+    return true;
+}
+
+// Append-only binary log of every stock movement of one inventory, kept next
+// to its file as <stem>.ledger. Replaying it from the latest snapshot
+// (<stem>.ledger.snap, refreshed by the save thread every SNAPSHOT_INTERVAL
+// entries) gives each record's quantity. Entries are buffered and written with
+// one append per batch, so processes sharing an inventory can append to the
+// same log. Queries by record or time use in-memory indexes that are built on
+// first use and then extended with whatever has been appended since.
+class StockLedger {
+private:
+    static const uint32_t LOG_MAGIC = 0x4C534D49;       // "IMSL"
+    static const uint32_t SNAPSHOT_MAGIC = 0x53534D49;  // "IMSS"
+    static const uint64_t SNAPSHOT_INTERVAL = 100000;
+    static const size_t HEADER_SIZE = 16;               // magic, entry size, reserved
+    static const size_t BLOCK_ENTRIES = 1024;           // entries per time index block
+    static const size_t FLUSH_BYTES = 64 * 1024;
+
+    struct SnapshotRow {
+        int32_t recordId;
+        int32_t reserved;
+        int64_t quantity;
+    };
+
+    // Timestamp range of one block of entries. Entries from one process are in
+    // time order, but several processes may interleave, so blocks keep both ends.
+    struct TimeBlock {
+        int64_t earliest;
+        int64_t latest;
+    };
+
+    string path;
+    string snapshotPath;
+
+    mutex appendMutex;  // guards the log stream, the pending buffer and lastTimestamp
+    ofstream log;
+    string pending;
+    int64_t lastTimestamp;
+
+    mutex indexMutex;  // guards the query indexes
+    uint64_t indexedEntries;
+    unordered_map<int, vector<uint32_t>> byRecord;  // entry numbers per record
+    vector<TimeBlock> blocks;
+
+    atomic<uint64_t> snapshotEntries;
+    uint64_t replayedAtOpen;
+    uint64_t reconciled;
+
+    // Caller holds appendMutex
+    void writePendingLocked() {
+        if (pending.empty() || !log.is_open()) return;
+        log.write(pending.data(), (streamsize)pending.size());
+        log.flush();
+        pending.clear();
+    }
+
+    uint64_t entriesOnDisk() const {
+        ifstream file(path, ios::binary | ios::ate);
+        if (!file.is_open()) return 0;
+        streamoff size = file.tellg();
+        return size > (streamoff)HEADER_SIZE ? (uint64_t)(size - HEADER_SIZE) / sizeof(LedgerEntry) : 0;
+    }
+
+    // Reads entries [first, first + count) into out; returns how many were read
+    size_t readEntries(ifstream& file, uint64_t first, size_t count, vector<LedgerEntry>& out) const {
+        out.resize(count);
+        file.clear();
+        file.seekg((streamoff)(HEADER_SIZE + first * sizeof(LedgerEntry)));
+        file.read(reinterpret_cast<char*>(out.data()), (streamsize)(count * sizeof(LedgerEntry)));
+        size_t read = (size_t)file.gcount() / sizeof(LedgerEntry);
+        out.resize(read);
+        return read;
+    }
+
+    bool loadSnapshot(unordered_map<int, long long>& balances, uint64_t& covered) const {
+        ifstream file(snapshotPath, ios::binary);
+        uint32_t header[2] = {0, 0};
+        uint64_t counts[2] = {0, 0};  // entries covered, rows
+        if (!file.read(reinterpret_cast<char*>(header), sizeof(header)) || header[0] != SNAPSHOT_MAGIC ||
+            !file.read(reinterpret_cast<char*>(counts), sizeof(counts))) {
+            return false;
+        }
+        vector<SnapshotRow> rows((size_t)counts[1]);
+        if (!file.read(reinterpret_cast<char*>(rows.data()), (streamsize)(rows.size() * sizeof(SnapshotRow)))) {
+            return false;
+        }
+        for (const SnapshotRow& row : rows) balances[row.recordId] = row.quantity;
+        covered = counts[0];
+        return true;
+    }
+
+    // Same temp-file-and-rename scheme as the inventory files
+    void saveSnapshot(const unordered_map<int, long long>& balances, uint64_t covered) const {
+        vector<SnapshotRow> rows;
+        rows.reserve(balances.size());
+        for (const auto& balance : balances) {
+            if (balance.second != 0) rows.push_back({balance.first, 0, balance.second});
+        }
+        sort(rows.begin(), rows.end(), [](const SnapshotRow& a, const SnapshotRow& b) {
+            return a.recordId < b.recordId;
+        });
+
+        string tempPath = snapshotPath + ".tmp";
+        ofstream file(tempPath, ios::binary | ios::trunc);
+        if (!file.is_open()) return;
+        uint32_t header[2] = {SNAPSHOT_MAGIC, 0};
+        uint64_t counts[2] = {covered, rows.size()};
+        file.write(reinterpret_cast<const char*>(header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(counts), sizeof(counts));
+        file.write(reinterpret_cast<const char*>(rows.data()), (streamsize)(rows.size() * sizeof(SnapshotRow)));
+        file.close();
+        if (rename(tempPath.c_str(), snapshotPath.c_str()) != 0) {
+            cout << "Error: Could not replace " << snapshotPath << "." << endl;
+        }
+    }
+
+    // Extends the indexes with entries appended since the last query. Caller holds indexMutex.
+    void catchUpLocked() {
+        ifstream file(path, ios::binary);
+        vector<LedgerEntry> chunk;
+        while (readEntries(file, indexedEntries, 4096, chunk) > 0) {
+            for (const LedgerEntry& entry : chunk) {
+                uint64_t number = indexedEntries++;
+                byRecord[entry.recordId].push_back((uint32_t)number);
+                size_t block = (size_t)(number / BLOCK_ENTRIES);
+                if (block == blocks.size()) {
+                    blocks.push_back({entry.timestampMicros, entry.timestampMicros});
+                } else {
+                    blocks[block].earliest = min(blocks[block].earliest, entry.timestampMicros);
+                    blocks[block].latest = max(blocks[block].latest, entry.timestampMicros);
+                }
+            }
+        }
+    }
+
+public:
+    explicit StockLedger(const string& inventoryFile)
+        : lastTimestamp(0), indexedEntries(0), snapshotEntries(0), replayedAtOpen(0), reconciled(0) {
+        string stem = inventoryFile.substr(0, inventoryFile.find_last_of('.'));
+        path = stem + ".ledger";
+        snapshotPath = path + ".snap";
+
+        ifstream existing(path, ios::binary);
+        uint32_t header[4] = {0, 0, 0, 0};
+        bool fresh = !existing.read(reinterpret_cast<char*>(header), sizeof(header));
+        existing.close();
+        if (!fresh && (header[0] != LOG_MAGIC || header[1] != sizeof(LedgerEntry))) {
+            cout << "Warning: " << path << " is not a ledger file; stock movements won't be recorded." << endl;
+            return;
+        }
+
+        log.open(path, ios::binary | ios::app);
+        if (fresh && log.is_open()) {
+            header[0] = LOG_MAGIC;
+            header[1] = sizeof(LedgerEntry);
+            log.write(reinterpret_cast<const char*>(header), sizeof(header));
+            log.flush();
+        }
+    }
+
+    StockLedger(const StockLedger&) = delete;
+    StockLedger& operator=(const StockLedger&) = delete;
+
+    ~StockLedger() {
+        flush();
+    }
+
+    bool isOpen() const {
+        return log.is_open();
+    }
+
+    void append(int recordId, int delta, MovementReason reason, const string& user) {
+        appendBatch({recordId}, {delta}, reason, user);
+    }
+
+    // All entries of a batch get one timestamp and reach the file in one write
+    void appendBatch(const vector<int>& recordIds, const vector<int>& deltas, MovementReason reason,
+                     const string& user) {
+        if (!log.is_open()) return;
+        LedgerEntry entry = {};
+        entry.reason = reason;
+        strncpy(entry.user, user.c_str(), sizeof(entry.user) - 1);
+
+        lock_guard<mutex> lock(appendMutex);
+        int64_t now = chrono::duration_cast<chrono::microseconds>(
+            chrono::system_clock::now().time_since_epoch()).count();
+        lastTimestamp = max(lastTimestamp, now);
+        entry.timestampMicros = lastTimestamp;
+        for (size_t i = 0; i < recordIds.size(); i++) {
+            entry.recordId = recordIds[i];
+            entry.delta = deltas[i];
+            pending.append(reinterpret_cast<const char*>(&entry), sizeof(entry));
+        }
+        if (pending.size() >= FLUSH_BYTES) writePendingLocked();
+    }
+
+    // Writes buffered entries to the file
+    void flush() {
+        lock_guard<mutex> lock(appendMutex);
+        writePendingLocked();
+    }
+
+    // Rebuilds every record's quantity: the latest snapshot plus the entries
+    // after it. Returns the number of entries replayed.
+    uint64_t replay(unordered_map<int, long long>& balances, uint64_t& covered) {
+        flush();
+        balances.clear();
+        covered = 0;
+        if (!loadSnapshot(balances, covered)) {
+            balances.clear();
+            covered = 0;
+        }
+
+        ifstream file(path, ios::binary);
+        vector<LedgerEntry> chunk;
+        uint64_t next = covered;
+        while (readEntries(file, next, 4096, chunk) > 0) {
+            for (const LedgerEntry& entry : chunk) balances[entry.recordId] += entry.delta;
+            next += chunk.size();
+        }
+        return next - covered;
+    }
+
+    // Run once at startup, before anyone changes stock: appends a correction
+    // for every record whose replayed quantity differs from the loaded file
+    // (edited by hand, or a crash between a ledger write and a save), so that
+    // replaying the ledger always gives the inventory's quantities.
+    void reconcile(const RecordStore::Snapshot& records) {
+        if (!log.is_open()) return;
+        unordered_map<int, long long> balances;
+        uint64_t covered = 0;
+        replayedAtOpen = replay(balances, covered);
+        snapshotEntries = covered;
+
+        vector<int> ids, deltas;
+        records.forEach([&](const Record& record) {
+            auto balance = balances.find(record.id);
+            long long expected = balance == balances.end() ? 0 : balance->second;
+            if (balance != balances.end()) balances.erase(balance);
+            if (record.quantity() != expected) {
+                ids.push_back(record.id);
+                deltas.push_back((int)(record.quantity() - expected));
+            }
+        });
+        for (const auto& balance : balances) {
+            if (balance.second != 0) {
+                ids.push_back(balance.first);
+                deltas.push_back((int)-balance.second);
+            }
+        }
+        reconciled = ids.size();
+        if (!ids.empty()) {
+            appendBatch(ids, deltas, MOVE_RECONCILE, "system");
+            flush();
+        }
+    }
+
+    // Called from the save thread: writes the buffered entries and, once
+    // enough have piled up since the last snapshot, a new snapshot
+    void checkpoint() {
+        flush();
+        if (!log.is_open() || entriesOnDisk() - snapshotEntries < SNAPSHOT_INTERVAL) return;
+        unordered_map<int, long long> balances;
+        uint64_t covered = 0;
+        uint64_t replayed = replay(balances, covered);
+        saveSnapshot(balances, covered + replayed);
+        snapshotEntries = covered + replayed;
+    }
+
+    // Movements of one record, oldest first; at most the latest limit
+    vector<LedgerEntry> history(int recordId, size_t limit) {
+        flush();
+        lock_guard<mutex> lock(indexMutex);
+        catchUpLocked();
+        vector<LedgerEntry> result;
+        auto found = byRecord.find(recordId);
+        if (found == byRecord.end()) return result;
+
+        const vector<uint32_t>& numbers = found->second;
+        ifstream file(path, ios::binary);
+        vector<LedgerEntry> one;
+        for (size_t i = numbers.size() > limit ? numbers.size() - limit : 0; i < numbers.size(); i++) {
+            if (readEntries(file, numbers[i], 1, one) == 1) result.push_back(one[0]);
+        }
+        return result;
+    }
+
+    // Movements with fromMicros <= timestamp < toMicros, in log order; at most limit
+    vector<LedgerEntry> between(int64_t fromMicros, int64_t toMicros, size_t limit) {
+        flush();
+        lock_guard<mutex> lock(indexMutex);
+        catchUpLocked();
+        vector<LedgerEntry> result;
+        ifstream file(path, ios::binary);
+        vector<LedgerEntry> chunk;
+        for (size_t b = 0; b < blocks.size() && result.size() < limit; b++) {
+            if (blocks[b].latest < fromMicros || blocks[b].earliest >= toMicros) continue;
+            readEntries(file, (uint64_t)b * BLOCK_ENTRIES, BLOCK_ENTRIES, chunk);
+            for (const LedgerEntry& entry : chunk) {
+                if (entry.timestampMicros >= fromMicros && entry.timestampMicros < toMicros) {
+                    result.push_back(entry);
+                    if (result.size() == limit) break;
+                }
+            }
+        }
+        return result;
+    }
+
+    LedgerStats stats() const {
+        LedgerStats result;
+        result.entries = entriesOnDisk();
+        result.snapshotEntries = snapshotEntries.load();
+        result.replayedAtOpen = replayedAtOpen;
+        result.reconciled = reconciled;
+        return result;
+    }
+};
+
+// ================= LOT TRACKING =================
+
+// Units of one raw material received together at one unit cost
+struct Lot {
+    int64_t receivedMicros;  // 0 for opening stock of unknown age
+    double unitCost;
+    int32_t quantity;
+};
+
+// Open lots of one record, oldest first, in a ring buffer: consuming from
+// the front and receiving at the back never move the other lots, and a scan
+// walks one contiguous array. Running totals make the FIFO value O(1).
+class LotQueue {
+private:
+    vector<Lot> ring;      // size is zero or a power of two
+    uint32_t head = 0;
+    uint32_t count = 0;
+    long long units = 0;
+    double cost = 0;
+    long long owed = 0;    // units consumed before the lot they came from was received
+
+    void grow() {
+        vector<Lot> larger(ring.empty() ? 4 : ring.size() * 2);
+        for (uint32_t i = 0; i < count; i++) larger[i] = at(i);
+        ring.swap(larger);
+        head = 0;
+    }
+
+public:
+    // i-th open lot, 0 being the oldest
+    const Lot& at(uint32_t i) const { return ring[(head + i) & (ring.size() - 1)]; }
+    uint32_t size() const { return count; }
+    long long quantity() const { return units; }
+    double value() const { return cost; }
+
+    // A lot received at the same time and cost as the newest one joins it
+    void receive(long long quantity, double unitCost, int64_t receivedMicros) {
+        long long repaid = min(owed, quantity);
+        owed -= repaid;
+        quantity -= repaid;
+        if (quantity <= 0) return;
+        units += quantity;
+        cost += quantity * unitCost;
+        if (count > 0) {
+            Lot& newest = ring[(head + count - 1) & (ring.size() - 1)];
+            if (newest.unitCost == unitCost && newest.receivedMicros == receivedMicros &&
+                newest.quantity + quantity <= INT_MAX) {
+                newest.quantity += (int32_t)quantity;
+                return;
+            }
+        }
+        while (quantity > 0) {
+            if (count == ring.size()) grow();
+            int32_t part = (int32_t)min<long long>(quantity, INT_MAX);
+            ring[(head + count) & (ring.size() - 1)] = {receivedMicros, unitCost, part};
+            count++;
+            quantity -= part;
+        }
+    }
+
+    // Takes units from the oldest lots first and returns what they cost.
+    // Only the lots it empties or takes from are touched.
+    double consume(long long quantity) {
+        double taken = 0;
+        while (quantity > 0 && count > 0) {
+            Lot& oldest = ring[head];
+            long long part = min<long long>(quantity, oldest.quantity);
+            oldest.quantity -= (int32_t)part;
+            taken += part * oldest.unitCost;
+            units -= part;
+            quantity -= part;
+            if (oldest.quantity == 0) {
+                head = (head + 1) & (ring.size() - 1);
+                count--;
+            }
+        }
+        owed += quantity;
+        cost = count == 0 ? 0 : cost - taken;
+        return taken;
+    }
+
+    // consume, returning the lots the units came from; a lot only partly
+    // taken is split. Fewer units come back when the queue runs out.
+    vector<Lot> take(long long quantity) {
+        vector<Lot> taken;
+        long long left = quantity;
+        for (uint32_t i = 0; i < count && left > 0; i++) {
+            Lot lot = at(i);
+            lot.quantity = (int32_t)min<long long>(left, lot.quantity);
+            left -= lot.quantity;
+            taken.push_back(lot);
+        }
+        consume(quantity);
+        return taken;
+    }
+
+    // Adds lots that keep their own age, such as stock coming back from
+    // another location, so the queue stays in order of receipt
+    void merge(const vector<Lot>& arriving) {
+        vector<Lot> all;
+        all.reserve(count + arriving.size());
+        for (uint32_t i = 0; i < count; i++) all.push_back(at(i));
+        all.insert(all.end(), arriving.begin(), arriving.end());
+        stable_sort(all.begin(), all.end(),
+                    [](const Lot& a, const Lot& b) { return a.receivedMicros < b.receivedMicros; });
+        head = 0;
+        count = 0;
+        units = 0;
+        cost = 0;
+        for (const Lot& lot : all) receive(lot.quantity, lot.unitCost, lot.receivedMicros);
+    }
+};
+
+// Lot queues of every record of one inventory, saved as <stem>.lots with
+// one "id quantity unitCost receivedMicros [location]" line per lot, oldest
+// first; the location is left out for the home location. Stock at the other
+// locations keeps the lots it was transferred with, so it still costs the
+// same when it comes back. Queues are spread over stripes with their own
+// locks, so movements of different records rarely wait for each other.
+class LotBook {
+private:
+    static const size_t STRIPES = 64;
+
+    struct alignas(64) Stripe {
+        mutex lock;
+        unordered_map<uint64_t, LotQueue> queues;  // by keyOf(id, location)
+    };
+    unique_ptr<Stripe[]> stripes;
+    string filename;
+
+    // Every location of a record shares its stripe
+    Stripe& stripeFor(int id) const { return stripes[(uint32_t)id % STRIPES]; }
+
+    static uint64_t keyOf(int id, size_t location) { return (uint64_t)location << 32 | (uint32_t)id; }
+    static int idOf(uint64_t key) { return (int)(uint32_t)key; }
+    static size_t locationOf(uint64_t key) { return (size_t)(key >> 32); }
+
+public:
+    explicit LotBook(const string& inventoryFile)
+        : stripes(new Stripe[STRIPES]), filename(inventoryFile.substr(0, inventoryFile.rfind('.')) + ".lots") {
+        ifstream file(filename);
+        string line;
+        while (getline(file, line)) {
+            stringstream ss(line);
+            int id;
+            long long quantity;
+            double unitCost;
+            int64_t receivedMicros;
+            size_t location = 0;
+            if (!(ss >> id >> quantity >> unitCost >> receivedMicros)) continue;
+            ss >> location;
+            stripeFor(id).queues[keyOf(id, location)].receive(quantity, unitCost, receivedMicros);
+        }
+    }
+
+    void receive(int id, long long quantity, double unitCost, int64_t receivedMicros, size_t location = 0) {
+        Stripe& stripe = stripeFor(id);
+        lock_guard<mutex> lock(stripe.lock);
+        stripe.queues[keyOf(id, location)].receive(quantity, unitCost, receivedMicros);
+    }
+
+    double consume(int id, long long quantity, size_t location = 0) {
+        Stripe& stripe = stripeFor(id);
+        lock_guard<mutex> lock(stripe.lock);
+        return stripe.queues[keyOf(id, location)].consume(quantity);
+    }
+
+    // Moves the oldest lots of quantity units from one location to the
+    // other, where they join the lots already there in order of age. Units
+    // the source has no lots for arrive at fallbackCost.
+    void transfer(int id, size_t from, size_t to, long long quantity, double fallbackCost) {
+        Stripe& stripe = stripeFor(id);
+        lock_guard<mutex> lock(stripe.lock);
+        vector<Lot> moving = stripe.queues[keyOf(id, from)].take(quantity);
+        for (const Lot& lot : moving) quantity -= lot.quantity;
+        if (quantity > 0) moving.push_back({0, fallbackCost, (int32_t)min<long long>(quantity, INT_MAX)});
+        stripe.queues[keyOf(id, to)].merge(moving);
+    }
+
+    // Drops the lots of a deleted record at every location
+    void erase(int id, size_t locationCount) {
+        Stripe& stripe = stripeFor(id);
+        lock_guard<mutex> lock(stripe.lock);
+        for (size_t location = 0; location < locationCount; location++) stripe.queues.erase(keyOf(id, location));
+    }
+
+    // FIFO value of a record's open lots at the home location
+    double value(int id) const {
+        Stripe& stripe = stripeFor(id);
+        lock_guard<mutex> lock(stripe.lock);
+        auto it = stripe.queues.find(keyOf(id, 0));
+        return it == stripe.queues.end() ? 0 : it->second.value();
+    }
+
+    // Open lots of a record at the home location, oldest first
+    vector<Lot> lots(int id, size_t limit) const {
+        Stripe& stripe = stripeFor(id);
+        lock_guard<mutex> lock(stripe.lock);
+        vector<Lot> open;
+        auto it = stripe.queues.find(keyOf(id, 0));
+        if (it == stripe.queues.end()) return open;
+        for (uint32_t i = 0; i < it->second.size() && open.size() < limit; i++) open.push_back(it->second.at(i));
+        return open;
+    }
+
+    // Makes the lots of every record add up to its quantity at each
+    // location, e.g. on the first start or after the inventory file was
+    // edited by hand: missing units become opening stock at the record's
+    // price, extra ones are consumed. elsewhere[i] is the (id, quantity)
+    // stock of location i + 1. Queues of records that no longer exist, or of
+    // locations that were removed, are dropped.
+    void reconcile(const RecordStore::Snapshot& view, const vector<vector<pair<int, int>>>& elsewhere = {}) {
+        vector<unordered_map<int, int>> wanted(elsewhere.size() + 1);
+        view.forEach([&](const Record& record) { wanted[0][record.id] = record.quantity(); });
+        for (size_t i = 0; i < elsewhere.size(); i++) {
+            for (const pair<int, int>& stock : elsewhere[i]) wanted[i + 1][stock.first] = stock.second;
+        }
+        for (size_t s = 0; s < STRIPES; s++) {
+            lock_guard<mutex> lock(stripes[s].lock);
+            for (auto it = stripes[s].queues.begin(); it != stripes[s].queues.end();) {
+                size_t location = locationOf(it->first);
+                if (location >= wanted.size() || wanted[0].count(idOf(it->first)) == 0) {
+                    it = stripes[s].queues.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        view.forEach([&](const Record& record) {
+            Stripe& stripe = stripeFor(record.id);
+            lock_guard<mutex> lock(stripe.lock);
+            for (size_t location = 0; location < wanted.size(); location++) {
+                auto target = wanted[location].find(record.id);
+                long long quantity = target == wanted[location].end() ? 0 : target->second;
+                auto existing = stripe.queues.find(keyOf(record.id, location));
+                if (existing == stripe.queues.end() && quantity == 0 && location > 0) continue;
+                LotQueue& queue = stripe.queues[keyOf(record.id, location)];
+                long long difference = quantity - queue.quantity();
+                if (difference > 0) queue.receive(difference, record.price, 0);
+                if (difference < 0) queue.consume(-difference);
+            }
+        });
+    }
+
+    void save() {
+        string tempFilename = filename + ".tmp";
+        ofstream file(tempFilename);
+        if (!file.is_open()) {
+            cout << "Error: Could not open " << tempFilename << " for saving." << endl;
+            return;
+        }
+        file << setprecision(17);
+        for (size_t s = 0; s < STRIPES; s++) {
+            ostringstream part;
+            part << setprecision(17);
+            {
+                lock_guard<mutex> lock(stripes[s].lock);
+                for (const auto& entry : stripes[s].queues) {
+                    for (uint32_t i = 0; i < entry.second.size(); i++) {
+                        const Lot& lot = entry.second.at(i);
+                        part << idOf(entry.first) << " " << lot.quantity << " " << lot.unitCost << " "
+                             << lot.receivedMicros;
+                        if (locationOf(entry.first) > 0) part << " " << locationOf(entry.first);
+                        part << '\n';
+                    }
+                }
+            }
+            file << part.str();
+        }
+        file.close();
+        if (rename(tempFilename.c_str(), filename.c_str()) != 0) {
+            cout << "Error: Could not replace " << filename << "." << endl;
+        }
+    }
+};
+
+// ================= DEMAND FORECASTING =================
+
+// Exponentially weighted daily demand of one record. Issues add to the open
+// day; once a later day starts, the finished day and any days without
+// issues are folded into the mean and variance, so each movement is O(1).
+struct DemandState {
+    static constexpr double ALPHA = 0.2;      // weight of the newest day
+
+    int64_t day = -1;           // day the open total belongs to; -1 before the first issue
+    long long openDemand = 0;
+    double mean = 0;
+    double variance = 0;
+    int32_t foldedDays = 0;
+    int32_t leadTimeDays = 0;   // 0 uses DemandForecast::DEFAULT_LEAD_TIME_DAYS
+
+    void fold(double demand) {
+        if (foldedDays++ == 0) {
+            mean = demand;
+            return;
+        }
+        double difference = demand - mean;
+        double increment = ALPHA * difference;
+        mean += increment;
+        variance = (1 - ALPHA) * (variance + difference * increment);
+    }
+
+    // Folds k days without demand at once. Each one scales the mean by
+    // 1 - ALPHA; with d = (1 - ALPHA)^k that sums to mean * d and
+    // d * (variance + mean^2 * (1 - d)), exactly what k fold(0) calls give.
+    void decay(int64_t idleDays) {
+        if (idleDays <= 0 || foldedDays == 0) return;
+        double d = pow(1 - ALPHA, (double)idleDays);
+        variance = d * (variance + mean * mean * (1 - d));
+        mean *= d;
+        foldedDays = (int32_t)min<int64_t>(INT32_MAX, foldedDays + idleDays);
+    }
+
+    void rollTo(int64_t today) {
+        if (day < 0) day = today;
+        if (today <= day) return;
+        fold((double)openDemand);
+        openDemand = 0;
+        decay(today - day - 1);
+        day = today;
+    }
+};
+
+// Reorder point of one record from its demand history: enough stock to
+// cover the expected demand over the lead time plus safety stock for its
+// variation
+struct DemandForecastResult {
+    double dailyDemand;
+    double deviation;      // standard deviation of daily demand
+    int leadTimeDays;
+    double safetyStock;
+    double reorderPoint;
+    int daysObserved;
+};
+
+// Demand statistics of every record of one inventory, saved as
+// <stem>.demand. Production, reservations and stock taken out by
+// adjustments count as demand; corrections, transfers and deletes don't.
+// Striped like LotBook, so movements of different records rarely contend.
+class DemandForecast {
+public:
+    static constexpr int DEFAULT_LEAD_TIME_DAYS = 7;
+    static constexpr double SERVICE_FACTOR = 1.65;  // covers about 95% of lead-time demand
+
+private:
+    static const size_t STRIPES = 64;
+
+    struct alignas(64) Stripe {
+        mutex lock;
+        unordered_map<int, DemandState> items;
+    };
+    unique_ptr<Stripe[]> stripes;
+    string filename;
+    bool restored;
+
+    Stripe& stripeFor(int id) const { return stripes[(uint32_t)id % STRIPES]; }
+
+public:
+    static int64_t dayOf(int64_t micros) { return micros / (86400LL * 1000000); }
+
+    static int64_t nowMicros() {
+        return chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    static bool isDemand(MovementReason reason, int delta) {
+        return delta < 0 && (reason == MOVE_PRODUCTION || reason == MOVE_RESERVE || reason == MOVE_ADJUST);
+    }
+
+    explicit DemandForecast(const string& inventoryFile)
+        : stripes(new Stripe[STRIPES]),
+          filename(inventoryFile.substr(0, inventoryFile.rfind('.')) + ".demand"), restored(false) {
+        ifstream file(filename);
+        int id;
+        DemandState state;
+        while (file >> id >> state.day >> state.openDemand >> state.mean >> state.variance >> state.foldedDays >>
+               state.leadTimeDays) {
+            stripeFor(id).items[id] = state;
+            restored = true;
+        }
+    }
+
+    // False when there was no saved state to start from
+    bool wasRestored() const { return restored; }
+
+    void record(int id, int delta, MovementReason reason, int64_t micros) {
+        if (!isDemand(reason, delta)) return;
+        Stripe& stripe = stripeFor(id);
+        lock_guard<mutex> lock(stripe.lock);
+        DemandState& state = stripe.items[id];
+        state.rollTo(dayOf(micros));
+        state.openDemand -= delta;
+    }
+
+    // Rebuilds the statistics from past movements, oldest first
+    void warmUp(const vector<LedgerEntry>& entries) {
+        for (const LedgerEntry& entry : entries) {
+            record(entry.recordId, entry.delta, (MovementReason)entry.reason, entry.timestampMicros);
+        }
+    }
+
+    OpResult setLeadTime(int id, int days) {
+        if (days < 1) return OP_INVALID_VALUE;
+        Stripe& stripe = stripeFor(id);
+        lock_guard<mutex> lock(stripe.lock);
+        stripe.items[id].leadTimeDays = days;
+        return OP_OK;
+    }
+
+    // Statistics as of today; the stored state is only read
+    DemandForecastResult forecast(int id, int64_t micros) const {
+        DemandState state;
+        {
+            Stripe& stripe = stripeFor(id);
+            lock_guard<mutex> lock(stripe.lock);
+            auto it = stripe.items.find(id);
+            if (it != stripe.items.end()) state = it->second;
+        }
+        if (state.day >= 0) state.rollTo(dayOf(micros));
+        DemandForecastResult result;
+        result.dailyDemand = state.mean;
+        result.deviation = sqrt(max(0.0, state.variance));
+        result.leadTimeDays = state.leadTimeDays > 0 ? state.leadTimeDays : DEFAULT_LEAD_TIME_DAYS;
+        result.safetyStock = SERVICE_FACTOR * result.deviation * sqrt((double)result.leadTimeDays);
+        result.reorderPoint = result.dailyDemand * result.leadTimeDays + result.safetyStock;
+        result.daysObserved = state.foldedDays;
+        return result;
+    }
+
+    void save() {
+        string tempFilename = filename + ".tmp";
+        ofstream file(tempFilename);
+        if (!file.is_open()) {
+            cout << "Error: Could not open " << tempFilename << " for saving." << endl;
+            return;
+        }
+        for (size_t s = 0; s < STRIPES; s++) {
+            ostringstream part;
+            part << setprecision(17);
+            {
+                lock_guard<mutex> lock(stripes[s].lock);
+                for (const auto& item : stripes[s].items) {
+                    const DemandState& state = item.second;
+                    part << item.first << " " << state.day << " " << state.openDemand << " " << state.mean << " "
+                         << state.variance << " " << state.foldedDays << " " << state.leadTimeDays << '\n';
+                }
+            }
+            file << part.str();
+        }
+        file.close();
+        if (rename(tempFilename.c_str(), filename.c_str()) != 0) {
+            cout << "Error: Could not replace " << filename << "." << endl;
+        }
+    }
+};
+
+// ================= TASK SCHEDULER (SINGLETON) =================
+
+// Work-stealing thread pool shared by batch jobs: file loading, saving and
+// reports. Each worker owns a deque; it pushes and pops its own tasks at the
+// back (newest first, while their data is still in cache) and, when it runs
+// out, steals the oldest task from the front of another worker's deque.
+// Tasks submitted from outside the pool go to a shared injection queue.
+class TaskScheduler {
+public:
+    struct WorkerStats {
+        uint64_t tasksRun;
+        uint64_t tasksStolen;
+        double busySeconds;
+        double utilization;  // busy time over the scheduler's lifetime
+    };
+
+    // A set of tasks that can be waited for together. A thread waiting on a
+    // group runs queued tasks itself, so groups can nest inside tasks.
+    class TaskGroup {
+    private:
+        TaskScheduler& scheduler;
+        atomic<size_t> pending;
+        mutex doneMutex;
+        condition_variable done;
+
+    public:
+        explicit TaskGroup(TaskScheduler& _scheduler) : scheduler(_scheduler), pending(0) {}
+
+        TaskGroup(const TaskGroup&) = delete;
+        TaskGroup& operator=(const TaskGroup&) = delete;
+
+        ~TaskGroup() {
+            wait();
+        }
+
+        void run(function<void()> task) {
+            pending++;
+            scheduler.submit([this, task = move(task)]() {
+                task();
+                // Decremented under the lock so wait() can't return, and the
+                // group be destroyed, while this task still touches it
+                lock_guard<mutex> lock(doneMutex);
+                if (--pending == 0) done.notify_all();
+            });
+        }
+
+        void wait() {
+            while (pending.load() > 0) {
+                if (scheduler.runPendingTask()) continue;
+                unique_lock<mutex> lock(doneMutex);
+                done.wait_for(lock, chrono::milliseconds(1), [this]() { return pending.load() == 0; });
+            }
+            lock_guard<mutex> lock(doneMutex);
+        }
+    };
+
+private:
+    struct alignas(64) Worker {
+        mutex dequeMutex;
+        deque<function<void()>> tasks;
+        atomic<uint64_t> tasksRun;
+        atomic<uint64_t> tasksStolen;
+        atomic<uint64_t> busyNanos;
+
+        Worker() : tasksRun(0), tasksStolen(0), busyNanos(0) {}
+    };
+
+    static TaskScheduler* instance;
+    static mutex instanceMutex;
+    static size_t configuredWorkers;
+
+    // Index of the calling thread's worker, or -1 outside the pool
+    static thread_local int currentWorker;
+    static thread_local const TaskScheduler* currentScheduler;
+
+    vector<unique_ptr<Worker>> workers;
+    vector<thread> threads;
+    mutex injectionMutex;
+    deque<function<void()>> injected;
+
+    atomic<size_t> queuedTasks;
+    atomic<bool> stopping;
+    mutex sleepMutex;
+    condition_variable wake;
+    chrono::steady_clock::time_point startedAt;
+
+    explicit TaskScheduler(size_t workerCount)
+        : queuedTasks(0), stopping(false), startedAt(chrono::steady_clock::now()) {
+        for (size_t i = 0; i < workerCount; i++) workers.push_back(make_unique<Worker>());
+        for (size_t i = 0; i < workerCount; i++) {
+            threads.emplace_back([this, i]() { workerLoop((int)i); });
+        }
+    }
+
+    int workerIndex() const {
+        return currentScheduler == this ? currentWorker : -1;
+    }
+
+    // Own deque first, then the injection queue, then the other workers
+    bool takeTask(int self, function<void()>& task) {
+        if (self >= 0) {
+            Worker& own = *workers[self];
+            lock_guard<mutex> lock(own.dequeMutex);
+            if (!own.tasks.empty()) {
+                task = move(own.tasks.back());
+                own.tasks.pop_back();
+                queuedTasks--;
+                return true;
+            }
+        }
+        {
+            lock_guard<mutex> lock(injectionMutex);
+            if (!injected.empty()) {
+                task = move(injected.front());
+                injected.pop_front();
+                queuedTasks--;
+                return true;
+            }
+        }
+        size_t count = workers.size();
+        size_t start = self >= 0 ? (size_t)self + 1 : 0;
+        for (size_t k = 0; k < count; k++) {
+            size_t victim = (start + k) % count;
+            if ((int)victim == self) continue;
+            Worker& other = *workers[victim];
+            lock_guard<mutex> lock(other.dequeMutex);
+            if (!other.tasks.empty()) {
+                task = move(other.tasks.front());
+                other.tasks.pop_front();
+                queuedTasks--;
+                if (self >= 0) workers[self]->tasksStolen++;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void runTask(int self, function<void()>& task) {
+        auto start = chrono::steady_clock::now();
+        task();
+        if (self >= 0) {
+            Worker& worker = *workers[self];
+            worker.busyNanos += (uint64_t)chrono::duration_cast<chrono::nanoseconds>(
+                chrono::steady_clock::now() - start).count();
+            worker.tasksRun++;
+        }
+    }
+
+    void workerLoop(int self) {
+        currentWorker = self;
+        currentScheduler = this;
+        function<void()> task;
+        while (true) {
+            if (takeTask(self, task)) {
+                runTask(self, task);
+                task = nullptr;
+                continue;
+            }
+            unique_lock<mutex> lock(sleepMutex);
+            if (stopping && queuedTasks.load() == 0) return;
+            wake.wait(lock, [this]() { return queuedTasks.load() > 0 || stopping; });
+        }
+    }
+
+public:
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    // Finishes every queued task, then joins the workers
+    ~TaskScheduler() {
+        {
+            lock_guard<mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (thread& worker : threads) worker.join();
+    }
+
+    // Must be called before the first getInstance(); 0 means one per core
+    static void setWorkerCount(size_t count) {
+        configuredWorkers = count;
+    }
+
+    static TaskScheduler* getInstance() {
+        lock_guard<mutex> lock(instanceMutex);
+        if (!instance) {
+            size_t count = configuredWorkers ? configuredWorkers : max(1u, thread::hardware_concurrency());
+            instance = new TaskScheduler(count);
+        }
+        return instance;
+    }
+
+    static void destroyInstance() {
+        lock_guard<mutex> lock(instanceMutex);
+        if (instance) {
+            delete instance;
+            instance = nullptr;
+        }
+    }
+
+    size_t workerCount() const {
+        return workers.size();
+    }
+
+    void submit(function<void()> task) {
+        int self = workerIndex();
+        if (self >= 0) {
+            Worker& own = *workers[self];
+            lock_guard<mutex> lock(own.dequeMutex);
+            own.tasks.push_back(move(task));
+        } else {
+            lock_guard<mutex> lock(injectionMutex);
+            injected.push_back(move(task));
+        }
+        queuedTasks++;
+        lock_guard<mutex> lock(sleepMutex);
+        wake.notify_one();
+    }
+
+    // Runs one queued task on the calling thread; false if there was none
+    bool runPendingTask() {
+        int self = workerIndex();
+        function<void()> task;
+        if (!takeTask(self, task)) return false;
+        runTask(self, task);
+        return true;
+    }
+
+    // Calls body(begin, end) over [0, count) in chunks of at least grain
+    // items and returns when all are done. Small ranges run inline.
+    void parallelFor(size_t count, size_t grain, const function<void(size_t, size_t)>& body) {
+        if (count == 0) return;
+        size_t chunk = max(grain, (count + workers.size() * 4 - 1) / (workers.size() * 4));
+        if (chunk >= count || workers.size() == 1) {
+            body(0, count);
+            return;
+        }
+        TaskGroup group(*this);
+        for (size_t begin = 0; begin < count; begin += chunk) {
+            size_t end = min(count, begin + chunk);
+            group.run([&body, begin, end]() { body(begin, end); });
+        }
+        group.wait();
+    }
+
+    vector<WorkerStats> stats() const {
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - startedAt).count();
+        vector<WorkerStats> result;
+        for (const unique_ptr<Worker>& worker : workers) {
+            WorkerStats entry;
+            entry.tasksRun = worker->tasksRun.load();
+            entry.tasksStolen = worker->tasksStolen.load();
+            entry.busySeconds = worker->busyNanos.load() / 1e9;
+            entry.utilization = elapsed > 0 ? entry.busySeconds / elapsed : 0;
+            result.push_back(entry);
+        }
+        return result;
+    }
+
+    void displayStats(ostream& out) const {
+        vector<WorkerStats> all = stats();
+        out << left << setw(8) << "Worker" << setw(12) << "Tasks" << setw(12) << "Stolen"
+            << setw(12) << "Busy (s)" << "Utilization" << endl;
+        for (size_t i = 0; i < all.size(); i++) {
+            out << left << setw(8) << i << setw(12) << all[i].tasksRun << setw(12) << all[i].tasksStolen
+                << setw(12) << fixed << setprecision(3) << all[i].busySeconds
+                << setprecision(1) << all[i].utilization * 100 << "%" << endl;
+        }
+    }
+};
+
+TaskScheduler* TaskScheduler::instance = nullptr;
+mutex TaskScheduler::instanceMutex;
+size_t TaskScheduler::configuredWorkers = 0;
+thread_local int TaskScheduler::currentWorker = -1;
+thread_local const TaskScheduler* TaskScheduler::currentScheduler = nullptr;
+
+// ================= FUZZY NAME SEARCH =================
+
+// Names of one store, lowercased and packed back to back, for finding the
+// names closest to a misspelt one. Every name carries a 64-bit signature of
+// its character pairs and a 32-bit set of its letters. An edit destroys at
+// most three of the pattern's pairs and one of its letters, so a name that
+// lacks more than that per allowed edit can't match and is skipped without
+// reading it; so is a name too short to hold the pattern. The rest are
+// scored with a bit-parallel edit distance. For exact substrings, every
+// trigram of the lowercased names maps to the ids of the names holding it.
+class FuzzyNameIndex {
+public:
+    static const size_t MAX_PATTERN = 64;  // one machine word of pattern positions
+
+private:
+    struct Slot {
+        uint64_t pairs;  // signature of the character pairs
+        uint32_t letters;  // a-z, other characters folded into the top bits
+        uint32_t offset;  // into text
+        uint32_t length;
+        int id;
+    };
+
+    vector<Slot> slots;
+    string text;  // lowercased names
+    size_t garbage = 0;  // bytes of text no slot refers to any more
+    unordered_map<int, uint32_t> slotOf;
+    unordered_map<uint32_t, vector<int>> trigrams;  // in id order
+
+    static string lowered(const string& name) {
+        string result(name);
+        for (char& c : result) c = (char)tolower((unsigned char)c);
+        return result;
+    }
+
+    static uint64_t pairsOf(const char* s, size_t length) {
+        uint64_t pairs = 0;
+        for (size_t i = 1; i < length; i++) {
+            uint32_t hash = (unsigned char)s[i - 1] * 0x9E3779B1u ^ (unsigned char)s[i] * 0x85EBCA77u;
+            pairs |= 1ULL << (hash >> 26);
+        }
+        return pairs;
+    }
+
+    // The distinct trigrams of s, three bytes packed into one word each
+    static vector<uint32_t> trigramsOf(const char* s, size_t length) {
+        vector<uint32_t> grams;
+        for (size_t i = 0; i + 3 <= length; i++) {
+            grams.push_back((uint32_t)(unsigned char)s[i] << 16 | (uint32_t)(unsigned char)s[i + 1] << 8 |
+                            (uint32_t)(unsigned char)s[i + 2]);
+        }
+        sort(grams.begin(), grams.end());
+        grams.erase(unique(grams.begin(), grams.end()), grams.end());
+        return grams;
+    }
+
+    static uint32_t lettersOf(const char* s, size_t length) {
+        uint32_t letters = 0;
+        for (size_t i = 0; i < length; i++) {
+            unsigned char c = (unsigned char)s[i];
+            letters |= 1u << (c >= 'a' && c <= 'z' ? c - 'a' : 26 + c % 6);
+        }
+        return letters;
+    }
+
+    // Drops the text of removed names once it is more than half the buffer
+    void compact() {
+        string packed;
+        packed.reserve(text.size() - garbage);
+        for (Slot& slot : slots) {
+            uint32_t offset = (uint32_t)packed.size();
+            packed.append(text, slot.offset, slot.length);
+            slot.offset = offset;
+        }
+        text.swap(packed);
+        garbage = 0;
+    }
+
+public:
+    // Edit distance between a pattern of at most 64 characters and text,
+    // after Myers (1999) with Hyyro's (2002) term for transpositions, so
+    // swapped neighbours ("Slik") count as one edit. Bit i of the vertical
+    // deltas describes row i + 1 of the distance matrix, so each character
+    // of text advances a whole column in a few word operations. peq[c] has
+    // bit i set where the pattern holds c. With whole, the pattern must
+    // match all of text; otherwise the best match with any substring of
+    // text is returned.
+    static int editDistance(const uint64_t* peq, size_t m, const char* s, size_t n, bool whole) {
+        const uint64_t last = 1ULL << (m - 1);
+        uint64_t pv = ~0ULL, mv = 0, d0 = 0, previousEq = 0;
+        int score = (int)m, best = (int)m;
+        for (size_t j = 0; j < n; j++) {
+            uint64_t eq = peq[(unsigned char)s[j]];
+            uint64_t swapped = ((~d0 & eq) << 1) & previousEq;
+            d0 = (((eq & pv) + pv) ^ pv) | eq | mv | swapped;
+            uint64_t ph = mv | ~(d0 | pv);
+            uint64_t mh = d0 & pv;
+            if (ph & last) {
+                score++;
+            } else if (mh & last) {
+                score--;
+            }
+            // In whole mode the top row grows by one per column; otherwise a
+            // match may start anywhere, so the top row stays zero
+            ph = (ph << 1) | (whole ? 1 : 0);
+            mh <<= 1;
+            pv = mh | ~(d0 | ph);
+            mv = ph & d0;
+            previousEq = eq;
+            best = min(best, score);
+        }
+        return whole ? score : best;
+    }
+
+    // Edits a pattern of this length may differ by and still match: one
+    // typo in a short name, more in longer ones. More would let the pair
+    // signature through for nearly every name.
+    static int allowedDistance(size_t length) {
+        return length < 3 ? 0 : length < 8 ? 1 : length < 16 ? 2 : 3;
+    }
+
+    size_t size() const { return slots.size(); }
+
+    void clear() {
+        slots.clear();
+        text.clear();
+        garbage = 0;
+        slotOf.clear();
+        trigrams.clear();
+    }
+
+    void reserve(size_t count) {
+        slots.reserve(count);
+        slotOf.reserve(count);
+    }
+
+    void insert(int id, const string& name) {
+        if (slotOf.count(id)) erase(id);
+        string key = lowered(name);
+        Slot slot = {pairsOf(key.data(), key.size()), lettersOf(key.data(), key.size()), (uint32_t)text.size(),
+                     (uint32_t)key.size(), id};
+        text += key;
+        slotOf[id] = (uint32_t)slots.size();
+        slots.push_back(slot);
+        for (uint32_t gram : trigramsOf(key.data(), key.size())) {
+            vector<int>& ids = trigrams[gram];
+            // Ids are mostly inserted in increasing order, so this is an append
+            if (ids.empty() || ids.back() < id) {
+                ids.push_back(id);
+            } else {
+                ids.insert(lower_bound(ids.begin(), ids.end(), id), id);
+            }
+        }
+    }
+
+    void erase(int id) {
+        auto it = slotOf.find(id);
+        if (it == slotOf.end()) return;
+        uint32_t index = it->second;
+        for (uint32_t gram : trigramsOf(text.data() + slots[index].offset, slots[index].length)) {
+            auto posting = trigrams.find(gram);
+            if (posting == trigrams.end()) continue;
+            vector<int>& ids = posting->second;
+            auto at = lower_bound(ids.begin(), ids.end(), id);
+            if (at != ids.end() && *at == id) ids.erase(at);
+            if (ids.empty()) trigrams.erase(posting);
+        }
+        garbage += slots[index].length;
+        slotOf.erase(it);
+        if (index + 1 != slots.size()) {
+            slots[index] = slots.back();
+            slotOf[slots[index].id] = index;
+        }
+        slots.pop_back();
+        if (garbage > 4096 && garbage * 2 > text.size()) compact();
+    }
+
+    // Ids of the names holding every trigram of text, in any case, in id
+    // order: all the names that contain text, and maybe some that don't.
+    // Returns at most how many there are, the length of the rarest trigram's
+    // list, and fills ids only if asked to. Text under three characters has
+    // no trigrams, so every name is a candidate.
+    size_t containing(const string& text, vector<int>* ids) const {
+        string key = lowered(text);
+        if (key.size() < 3) {
+            if (ids) {
+                size_t start = ids->size();
+                for (const Slot& slot : slots) ids->push_back(slot.id);
+                sort(ids->begin() + start, ids->end());
+            }
+            return slots.size();
+        }
+        vector<const vector<int>*> lists;
+        for (uint32_t gram : trigramsOf(key.data(), key.size())) {
+            auto posting = trigrams.find(gram);
+            if (posting == trigrams.end()) return 0;
+            lists.push_back(&posting->second);
+        }
+        // Rarest first, so the candidates only shrink from the shortest list
+        sort(lists.begin(), lists.end(),
+             [](const vector<int>* a, const vector<int>* b) { return a->size() < b->size(); });
+        if (!ids) return lists[0]->size();
+        vector<int> candidates(*lists[0]);
+        for (size_t i = 1; i < lists.size() && !candidates.empty(); i++) {
+            vector<int> next;
+            set_intersection(candidates.begin(), candidates.end(), lists[i]->begin(), lists[i]->end(),
+                             back_inserter(next));
+            candidates.swap(next);
+        }
+        ids->insert(ids->end(), candidates.begin(), candidates.end());
+        return lists[0]->size();
+    }
+
+    // The names within allowedDistance edits of pattern, or containing it
+    // with that many edits, closest first: by the distance to the closest
+    // part of the name, then to the whole name, then by id. Names are
+    // checked in parallel chunks.
+    vector<NameMatch> search(const string& pattern, size_t limit) const {
+        string key = lowered(pattern.substr(0, MAX_PATTERN));
+        const size_t m = key.size();
+        if (m == 0 || limit == 0) return {};
+        uint64_t peq[256] = {};
+        for (size_t i = 0; i < m; i++) peq[(unsigned char)key[i]] |= 1ULL << i;
+        const int maxDistance = allowedDistance(m);
+        const uint64_t wantedPairs = pairsOf(key.data(), m);
+        const uint32_t wantedLetters = lettersOf(key.data(), m);
+
+        const size_t rowsPerChunk = 4096;
+        size_t chunkCount = (slots.size() + rowsPerChunk - 1) / rowsPerChunk;
+        vector<vector<NameMatch>> found(chunkCount);
+        TaskScheduler::getInstance()->parallelFor(chunkCount, 1, [&](size_t first, size_t last) {
+            for (size_t c = first; c < last; c++) {
+                size_t end = min(slots.size(), (c + 1) * rowsPerChunk);
+                for (size_t i = c * rowsPerChunk; i < end; i++) {
+                    const Slot& slot = slots[i];
+                    if (slot.length + maxDistance < m) continue;
+                    if (popcount(wantedLetters & ~slot.letters) > maxDistance) continue;
+                    if (popcount(wantedPairs & ~slot.pairs) > 3 * maxDistance) continue;
+                    const char* name = text.data() + slot.offset;
+                    int distance = editDistance(peq, m, name, slot.length, false);
+                    if (distance > maxDistance) continue;
+                    found[c].push_back({slot.id, distance, editDistance(peq, m, name, slot.length, true)});
+                }
+            }
+        });
+
+        vector<NameMatch> matches;
+        for (const vector<NameMatch>& part : found) matches.insert(matches.end(), part.begin(), part.end());
+        auto closer = [](const NameMatch& a, const NameMatch& b) {
+            if (a.distance != b.distance) return a.distance < b.distance;
+            if (a.wholeDistance != b.wholeDistance) return a.wholeDistance < b.wholeDistance;
+            return a.id < b.id;
+        };
+        if (matches.size() > limit) {
+            partial_sort(matches.begin(), matches.begin() + limit, matches.end(), closer);
+            matches.resize(limit);
+        } else {
+            sort(matches.begin(), matches.end(), closer);
+        }
+        return matches;
+    }
+};
+
+// ================= SORTED VIEWS =================
+
+// Ordered (key, id) pairs that can also be addressed by position: the n-th
+// entry and the position of an entry are found in O(log n). A two-level
+// B+ tree: entries sit in sorted leaves of at most MAX_LEAF, found by binary
+// search over the last entry of every leaf, and a Fenwick tree over the leaf
+// sizes turns positions into leaves and back. Leaves are contiguous arrays,
+// so a lookup touches a handful of cache lines and a page is read in order.
+template <typename Key>
+class OrderStatisticTree {
+private:
+    static const size_t MAX_LEAF = 512;
+
+    struct Leaf {
+        vector<Key> keys;
+        vector<int> ids;
+    };
+
+    vector<Leaf> leaves;
+    vector<Key> lastKeys;  // last entry of every leaf
+    vector<int> lastIds;
+    vector<size_t> fenwick;  // leaf sizes
+    size_t count = 0;
+
+    static bool before(const Key& key, int id, const Key& otherKey, int otherId) {
+        return key < otherKey || (!(otherKey < key) && id < otherId);
+    }
+
+    // First leaf whose last entry is not before (key, id), or the last leaf
+    size_t leafFor(const Key& key, int id) const {
+        size_t low = 0, high = leaves.size();
+        while (low < high) {
+            size_t middle = (low + high) / 2;
+            if (before(lastKeys[middle], lastIds[middle], key, id)) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        return min(low, leaves.size() - 1);
+    }
+
+    static size_t positionIn(const Leaf& leaf, const Key& key, int id) {
+        size_t low = 0, high = leaf.keys.size();
+        while (low < high) {
+            size_t middle = (low + high) / 2;
+            if (before(leaf.keys[middle], leaf.ids[middle], key, id)) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        return low;
+    }
+
+    // Entries in the leaves before leaf
+    size_t prefix(size_t leaf) const {
+        size_t sum = 0;
+        for (size_t i = leaf; i > 0; i -= i & (~i + 1)) sum += fenwick[i - 1];
+        return sum;
+    }
+
+    void resize(size_t leaf, long delta) {
+        for (size_t i = leaf + 1; i <= fenwick.size(); i += i & (~i + 1)) fenwick[i - 1] += delta;
+    }
+
+    // Rebuilds the leaf index after leaves were split, merged or dropped
+    void reindex() {
+        size_t n = leaves.size();
+        lastKeys.resize(n);
+        lastIds.resize(n);
+        fenwick.assign(n, 0);
+        for (size_t i = 0; i < n; i++) {
+            lastKeys[i] = leaves[i].keys.back();
+            lastIds[i] = leaves[i].ids.back();
+            fenwick[i] += leaves[i].keys.size();
+            size_t parent = i + ((i + 1) & (~(i + 1) + 1));
+            if (parent < n) fenwick[parent] += fenwick[i];
+        }
+    }
+
+    // Moves the upper half of an overfull leaf into a new leaf after it
+    void splitLeaf(size_t leaf) {
+        Leaf upper;
+        size_t half = leaves[leaf].keys.size() / 2;
+        upper.keys.assign(make_move_iterator(leaves[leaf].keys.begin() + half),
+                          make_move_iterator(leaves[leaf].keys.end()));
+        upper.ids.assign(leaves[leaf].ids.begin() + half, leaves[leaf].ids.end());
+        leaves[leaf].keys.resize(half);
+        leaves[leaf].ids.resize(half);
+        leaves.insert(leaves.begin() + leaf + 1, move(upper));
+    }
+
+public:
+    size_t size() const { return count; }
+
+    void clear() {
+        leaves.clear();
+        lastKeys.clear();
+        lastIds.clear();
+        fenwick.clear();
+        count = 0;
+    }
+
+    // Replaces the contents with entries already in (key, id) order. Leaves
+    // start three quarters full, so inserts rarely split them.
+    void assign(vector<pair<Key, int>>&& sorted) {
+        clear();
+        const size_t fill = MAX_LEAF * 3 / 4;
+        for (size_t first = 0; first < sorted.size(); first += fill) {
+            Leaf leaf;
+            size_t last = min(sorted.size(), first + fill);
+            leaf.keys.reserve(MAX_LEAF + 1);
+            leaf.ids.reserve(MAX_LEAF + 1);
+            for (size_t i = first; i < last; i++) {
+                leaf.keys.push_back(move(sorted[i].first));
+                leaf.ids.push_back(sorted[i].second);
+            }
+            leaves.push_back(move(leaf));
+        }
+        count = sorted.size();
+        reindex();
+    }
+
+    void insert(const Key& key, int id) {
+        count++;
+        if (leaves.empty()) {
+            leaves.push_back({{key}, {id}});
+            reindex();
+            return;
+        }
+        size_t index = leafFor(key, id);
+        Leaf& leaf = leaves[index];
+        size_t position = positionIn(leaf, key, id);
+        leaf.keys.insert(leaf.keys.begin() + position, key);
+        leaf.ids.insert(leaf.ids.begin() + position, id);
+        if (leaf.keys.size() > MAX_LEAF) {
+            splitLeaf(index);
+            reindex();
+            return;
+        }
+        resize(index, 1);
+        if (position + 1 == leaf.keys.size()) {
+            lastKeys[index] = key;
+            lastIds[index] = id;
+        }
+    }
+
+    void erase(const Key& key, int id) {
+        if (leaves.empty()) return;
+        size_t index = leafFor(key, id);
+        Leaf& leaf = leaves[index];
+        size_t position = positionIn(leaf, key, id);
+        if (position == leaf.keys.size() || leaf.ids[position] != id || key < leaf.keys[position]) return;
+        leaf.keys.erase(leaf.keys.begin() + position);
+        leaf.ids.erase(leaf.ids.begin() + position);
+        count--;
+
+        if (leaf.keys.empty()) {
+            leaves.erase(leaves.begin() + index);
+            reindex();
+        } else if (leaf.keys.size() < MAX_LEAF / 4 && leaves.size() > 1) {
+            // Joins a small leaf to a neighbour, so deletes can't leave
+            // many nearly empty leaves behind
+            size_t left = index + 1 < leaves.size() ? index : index - 1;
+            Leaf& into = leaves[left];
+            Leaf& from = leaves[left + 1];
+            into.keys.insert(into.keys.end(), make_move_iterator(from.keys.begin()),
+                             make_move_iterator(from.keys.end()));
+            into.ids.insert(into.ids.end(), from.ids.begin(), from.ids.end());
+            leaves.erase(leaves.begin() + left + 1);
+            if (leaves[left].keys.size() > MAX_LEAF) splitLeaf(left);
+            reindex();
+        } else {
+            resize(index, -1);
+            if (position == leaf.keys.size()) {
+                lastKeys[index] = leaf.keys.back();
+                lastIds[index] = leaf.ids.back();
+            }
+        }
+    }
+
+    // Number of entries ordered before (key, id)
+    size_t rank(const Key& key, int id) const {
+        if (leaves.empty()) return 0;
+        size_t index = leafFor(key, id);
+        return prefix(index) + positionIn(leaves[index], key, id);
+    }
+
+    // Number of entries whose key is below bound, or not above it when
+    // inclusive. The bound may be of another type, such as a double for
+    // integer keys.
+    template <typename Bound>
+    size_t countBelow(const Bound& bound, bool inclusive) const {
+        auto below = [&](const Key& other) { return inclusive ? !(bound < other) : other < bound; };
+        size_t index = partition_point(lastKeys.begin(), lastKeys.end(), below) - lastKeys.begin();
+        if (index == leaves.size()) return count;
+        const vector<Key>& keys = leaves[index].keys;
+        return prefix(index) + (partition_point(keys.begin(), keys.end(), below) - keys.begin());
+    }
+
+    // Ids of the entries at positions [first, first + n), in order
+    void slice(size_t first, size_t n, vector<int>& ids) const {
+        if (first >= count) return;
+        // Fenwick descent to the leaf holding position first
+        size_t index = 0;
+        size_t step = 1;
+        while (step * 2 <= fenwick.size()) step *= 2;
+        for (; step > 0; step /= 2) {
+            if (index + step <= fenwick.size() && fenwick[index + step - 1] <= first) {
+                index += step;
+                first -= fenwick[index - 1];
+            }
+        }
+        for (; index < leaves.size() && n > 0; index++, first = 0) {
+            const vector<int>& leafIds = leaves[index].ids;
+            size_t take = min(n, leafIds.size() - first);
+            ids.insert(ids.end(), leafIds.begin() + first, leafIds.begin() + first + take);
+            n -= take;
+        }
+    }
+};
+
+enum SortColumn { SORT_NAME, SORT_QUANTITY, SORT_PRICE, SORT_VALUE };
+
+const char* describeSortColumn(SortColumn column) {
+    switch (column) {
+        case SORT_NAME: return "name";
+        case SORT_QUANTITY: return "quantity";
+        case SORT_PRICE: return "price";
+        case SORT_VALUE: return "value";
+    }
+    return "unknown";
+}
+
+bool parseSortColumn(const string& text, SortColumn& column) {
+    static const pair<const char*, SortColumn> names[] = {
+        {"name", SORT_NAME}, {"qty", SORT_QUANTITY}, {"quantity", SORT_QUANTITY},
+        {"price", SORT_PRICE}, {"value", SORT_VALUE}};
+    for (const auto& entry : names) {
+        if (text == entry.first) {
+            column = entry.second;
+            return true;
+        }
+    }
+    return false;
+}
+
+// The records of one store ordered by name, quantity, price and value, as
+// of one version of the store. Each read first catches up with the newest
+// version: the records the store logged as changed since are moved to
+// their new places, O(log n) each, so stock movements stay cheap and
+// paging and ranks are O(log n) without sorting the inventory. The views
+// are only sorted again when the log no longer covers the gap, such as
+// after a shared store was reloaded, or too much changed.
+class SortedViews {
+private:
+    struct Entry {
+        string name;
+        int quantity;
+        double price;
+    };
+
+    const RecordStore& store;
+
+    mutex viewMutex;  // guards everything below
+    unordered_map<int, Entry> entries;
+    OrderStatisticTree<string> byName;
+    OrderStatisticTree<int> byQuantity;
+    OrderStatisticTree<double> byPrice;
+    OrderStatisticTree<double> byValue;
+    FuzzyNameIndex names;
+    uint64_t reflected;    // the store version the views show
+    uint64_t logPosition;  // where the store's change log goes on from it
+
+    template <typename Key, typename KeyOf>
+    static void shift(OrderStatisticTree<Key>& tree, int id, const Entry* from, const Entry* to, KeyOf keyOf) {
+        if (from && to && keyOf(*from) == keyOf(*to)) return;
+        if (from) tree.erase(keyOf(*from), id);
+        if (to) tree.insert(keyOf(*to), id);
+    }
+
+    // Moves a record between its places in every view; only the views
+    // whose key changed are touched, so a stock movement updates two
+    void relocate(int id, const Entry* from, const Entry* to) {
+        shift(byName, id, from, to, [](const Entry& entry) -> const string& { return entry.name; });
+        shift(byQuantity, id, from, to, [](const Entry& entry) { return entry.quantity; });
+        shift(byPrice, id, from, to, [](const Entry& entry) { return entry.price; });
+        shift(byValue, id, from, to, [](const Entry& entry) { return entry.quantity * entry.price; });
+        if (!from || !to || from->name != to->name) {
+            if (from) names.erase(id);
+            if (to) names.insert(id, to->name);
+        }
+    }
+
+    template <typename Key, typename KeyOf>
+    static void assignSorted(OrderStatisticTree<Key>& tree, const unordered_map<int, Entry>& all, KeyOf keyOf) {
+        vector<pair<Key, int>> sorted;
+        sorted.reserve(all.size());
+        for (const auto& item : all) sorted.emplace_back(keyOf(item.second), item.first);
+        sort(sorted.begin(), sorted.end());
+        tree.assign(move(sorted));
+    }
+
+    // Caller holds viewMutex
+    void rebuildLocked(const RecordStore::Snapshot& view) {
+        entries.clear();
+        reflected = view.versionNumber();
+        logPosition = store.changesPosition(reflected);
+        entries.reserve(view.size());
+        view.forEach([&](const Record& record) {
+            entries.emplace(record.id, Entry{record.name, record.quantity(), record.price});
+        });
+        // The four sorts are independent
+        TaskScheduler::TaskGroup group(*TaskScheduler::getInstance());
+        group.run([this]() { assignSorted(byName, entries, [](const Entry& entry) { return entry.name; }); });
+        group.run([this]() { assignSorted(byQuantity, entries, [](const Entry& entry) { return entry.quantity; }); });
+        group.run([this]() { assignSorted(byPrice, entries, [](const Entry& entry) { return entry.price; }); });
+        group.run([this]() {
+            assignSorted(byValue, entries, [](const Entry& entry) { return entry.quantity * entry.price; });
+        });
+        group.run([this]() {
+            // In id order, so the trigram lists are only appended to
+            vector<int> ids;
+            ids.reserve(entries.size());
+            for (const auto& item : entries) ids.push_back(item.first);
+            sort(ids.begin(), ids.end());
+            names.clear();
+            names.reserve(entries.size());
+            for (int id : ids) names.insert(id, entries.find(id)->second.name);
+        });
+        group.wait();
+    }
+
+    // Moves the records changed since the version the views show to where
+    // they belong in the newest one, and returns that version pinned.
+    // Caller holds viewMutex.
+    RecordStore::Snapshot refreshLocked() {
+        RecordStore::Snapshot view = store.pin();
+        if (view.versionNumber() == reflected) return view;
+        vector<int> ids;
+        bool logged = store.changesUpTo(view.versionNumber(), logPosition, ids);
+        sort(ids.begin(), ids.end());
+        ids.erase(unique(ids.begin(), ids.end()), ids.end());
+        // Past entries / 4, sorting everything again is cheaper than moving each record
+        if (!logged || ids.size() > entries.size() / 4) {
+            rebuildLocked(view);
+            return view;
+        }
+        reflected = view.versionNumber();
+        for (int id : ids) {
+            const Record* record = view.find(id);
+            auto it = entries.find(id);
+            if (!record) {
+                if (it == entries.end()) continue;
+                relocate(id, &it->second, nullptr);
+                entries.erase(it);
+                continue;
+            }
+            if (it != entries.end() && it->second.name == record->name && it->second.price == record->price) {
+                // Only the stock moved, the usual case: two views change
+                // and the name isn't copied
+                Entry& entry = it->second;
+                int quantity = record->quantity();
+                if (quantity == entry.quantity) continue;
+                byQuantity.erase(entry.quantity, id);
+                byQuantity.insert(quantity, id);
+                byValue.erase(entry.quantity * entry.price, id);
+                byValue.insert(quantity * entry.price, id);
+                entry.quantity = quantity;
+                continue;
+            }
+            Entry now = {record->name, record->quantity(), record->price};
+            if (it == entries.end()) {
+                relocate(id, nullptr, &now);
+                entries.emplace(id, move(now));
+            } else {
+                relocate(id, &it->second, &now);
+                it->second = move(now);
+            }
+        }
+        return view;
+    }
+
+    // Position of an entry in a column, counted from the start of the order
+    size_t rankIn(SortColumn column, int id, const Entry& entry) const {
+        switch (column) {
+            case SORT_NAME: return byName.rank(entry.name, id);
+            case SORT_QUANTITY: return byQuantity.rank(entry.quantity, id);
+            case SORT_PRICE: return byPrice.rank(entry.price, id);
+            case SORT_VALUE: return byValue.rank(entry.quantity * entry.price, id);
+        }
+        return 0;
+    }
+
+    template <typename Key, typename Bound>
+    static pair<size_t, size_t> spanOf(const OrderStatisticTree<Key>& tree, const Bound& low, bool lowInclusive,
+                                       const Bound& high, bool highInclusive) {
+        size_t first = tree.countBelow(low, !lowInclusive);
+        size_t last = max(first, tree.countBelow(high, highInclusive));
+        return {first, last};
+    }
+
+    // Positions of the keys between low and high in a column's order.
+    // Caller holds viewMutex.
+    pair<size_t, size_t> spanIn(SortColumn column, double low, bool lowInclusive, double high,
+                                bool highInclusive) const {
+        switch (column) {
+            case SORT_QUANTITY: return spanOf(byQuantity, low, lowInclusive, high, highInclusive);
+            case SORT_PRICE: return spanOf(byPrice, low, lowInclusive, high, highInclusive);
+            case SORT_VALUE: return spanOf(byValue, low, lowInclusive, high, highInclusive);
+            case SORT_NAME: break;
+        }
+        return {0, 0};
+    }
+
+    void sliceOf(SortColumn column, size_t first, size_t count, vector<int>& ids) const {
+        switch (column) {
+            case SORT_NAME: byName.slice(first, count, ids); break;
+            case SORT_QUANTITY: byQuantity.slice(first, count, ids); break;
+            case SORT_PRICE: byPrice.slice(first, count, ids); break;
+            case SORT_VALUE: byValue.slice(first, count, ids); break;
+        }
+    }
+
+public:
+    explicit SortedViews(const RecordStore& _store) : store(_store), reflected(0), logPosition(0) {
+        lock_guard<mutex> lock(viewMutex);
+        rebuildLocked(store.pin());
+    }
+
+    // The newest version of the store, which the views now show
+    RecordStore::Snapshot pin() {
+        lock_guard<mutex> lock(viewMutex);
+        return refreshLocked();
+    }
+
+    // Ids of positions [first, first + count) in a column's order and the
+    // number of records in it
+    size_t page(SortColumn column, bool descending, size_t first, size_t count, vector<int>& ids) {
+        lock_guard<mutex> lock(viewMutex);
+        refreshLocked();
+        size_t total = entries.size();
+        if (first >= total) return total;
+        count = min(count, total - first);
+        if (!descending) {
+            sliceOf(column, first, count, ids);
+        } else {
+            size_t start = ids.size();
+            sliceOf(column, total - first - count, count, ids);
+            reverse(ids.begin() + start, ids.end());
+        }
+        return total;
+    }
+
+    // Ids of the records whose quantity, price or value lies between low and
+    // high, in that order, at most limit of them; returns how many there
+    // are. O(log n + k): two positions and one slice. Infinite bounds leave
+    // a side open. Given version, the views aren't caught up first, so they
+    // stay on what pin returned unless someone read them since, and version
+    // receives the store version the ids come from.
+    size_t range(SortColumn column, double low, bool lowInclusive, double high, bool highInclusive, size_t limit,
+                 vector<int>& ids, uint64_t* version = nullptr) {
+        lock_guard<mutex> lock(viewMutex);
+        if (version) {
+            *version = reflected;
+        } else {
+            refreshLocked();
+        }
+        pair<size_t, size_t> span = spanIn(column, low, lowInclusive, high, highInclusive);
+        sliceOf(column, span.first, min(limit, span.second - span.first), ids);
+        return span.second - span.first;
+    }
+
+    // Ids of the records whose name lies between low and high, in name
+    // order, like range; a null bound leaves that side open
+    size_t nameRange(const string* low, bool lowInclusive, const string* high, bool highInclusive, size_t limit,
+                     vector<int>& ids, uint64_t* version = nullptr) {
+        lock_guard<mutex> lock(viewMutex);
+        if (version) {
+            *version = reflected;
+        } else {
+            refreshLocked();
+        }
+        size_t first = low ? byName.countBelow(*low, !lowInclusive) : 0;
+        size_t last = high ? max(first, byName.countBelow(*high, highInclusive)) : byName.size();
+        byName.slice(first, min(limit, last - first), ids);
+        return last - first;
+    }
+
+    // Ids of the records whose names may contain text, in id order, and at
+    // most how many there are; see FuzzyNameIndex::containing. version as
+    // in range.
+    size_t nameCandidates(const string& text, vector<int>* ids, uint64_t* version = nullptr) {
+        lock_guard<mutex> lock(viewMutex);
+        if (version) {
+            *version = reflected;
+        } else {
+            refreshLocked();
+        }
+        return names.containing(text, ids);
+    }
+
+    // Records whose names are closest to text, closest first
+    vector<NameMatch> similarNames(const string& text, size_t limit) {
+        lock_guard<mutex> lock(viewMutex);
+        refreshLocked();
+        return names.search(text, limit);
+    }
+
+    // 1-based position of a record in a column's order; false if there is no such record
+    bool rank(SortColumn column, bool descending, int id, size_t& position, size_t& total) {
+        lock_guard<mutex> lock(viewMutex);
+        refreshLocked();
+        auto it = entries.find(id);
+        if (it == entries.end()) return false;
+        total = entries.size();
+        size_t ascending = rankIn(column, id, it->second);
+        position = descending ? total - ascending : ascending + 1;
+        return true;
+    }
+};
+
+// ================= RECORD QUERIES =================
+
+// Filters over an inventory, such as
+//     qty < 100 and price >= 300 and name ~ "Fabric"
+// Fields are id, name, qty (or quantity), price and value (qty x price).
+// Comparisons are = != < <= > >=, and name ~ "text" matches names that
+// contain the text in any case. Conditions combine with and, or, not and
+// parentheses. A query is parsed and compiled into predicates once and can
+// then run against any number of snapshots.
+enum QueryField { QUERY_ID, QUERY_NAME, QUERY_QUANTITY, QUERY_PRICE, QUERY_VALUE };
+enum QueryOp { QUERY_EQ, QUERY_NE, QUERY_LT, QUERY_LE, QUERY_GT, QUERY_GE, QUERY_CONTAINS };
+
+// How a query found its candidates: an id range of the snapshot, or a name,
+// price or quantity range in the inventory's sorted views, when a condition
+// that every match must meet bounds that key, or the names holding the
+// trigrams of a text every match's name contains; otherwise a scan of every
+// record
+enum QueryPath { QUERY_SCAN, QUERY_BY_ID, QUERY_BY_NAME, QUERY_BY_PRICE, QUERY_BY_QUANTITY, QUERY_BY_TEXT };
+
+struct QueryResult {
+    vector<Record> records;   // matches in id order, at most the limit
+    size_t matched = 0;       // all matches, even beyond the limit
+    size_t examined = 0;      // candidates the predicates were run on
+    QueryPath path = QUERY_SCAN;
+};
+
+const char* describeQueryPath(QueryPath path) {
+    switch (path) {
+        case QUERY_SCAN: return "full scan";
+        case QUERY_BY_ID: return "id range";
+        case QUERY_BY_NAME: return "name index";
+        case QUERY_BY_PRICE: return "price index";
+        case QUERY_BY_QUANTITY: return "quantity index";
+        case QUERY_BY_TEXT: return "name trigram index";
+    }
+    return "unknown";
+}
+
+// Bounds on one key collected from the conditions of a query
+template <typename Key>
+struct KeyRange {
+    bool hasLow = false, lowInclusive = false;
+    bool hasHigh = false, highInclusive = false;
+    Key low{}, high{};
+
+    // Narrows the range by "key op bound"; false for operators a range can't express
+    bool restrict(QueryOp op, const Key& bound) {
+        bool raisesLow = op == QUERY_EQ || op == QUERY_GT || op == QUERY_GE;
+        bool lowersHigh = op == QUERY_EQ || op == QUERY_LT || op == QUERY_LE;
+        if (!raisesLow && !lowersHigh) return false;
+        bool inclusive = op == QUERY_EQ || op == QUERY_GE || op == QUERY_LE;
+        if (raisesLow && (!hasLow || low < bound || (bound == low && !inclusive))) {
+            hasLow = true;
+            low = bound;
+            lowInclusive = inclusive;
+        }
+        if (lowersHigh && (!hasHigh || bound < high || (bound == high && !inclusive))) {
+            hasHigh = true;
+            high = bound;
+            highInclusive = inclusive;
+        }
+        return true;
+    }
+
+    bool bounded() const { return hasLow || hasHigh; }
+};
+
+class RecordQuery {
+public:
+    using Predicate = function<bool(const Record&)>;
+
+private:
+    struct Token {
+        enum Kind { WORD, NUMBER, TEXT, SYMBOL, END } kind;
+        string text;
+        double number;
+
+        // Keywords and field names are matched in any case
+        bool is(Kind expected, const string& lowerText) const {
+            return kind == expected && (kind == WORD ? lowered(text) : text) == lowerText;
+        }
+    };
+
+    struct Condition {
+        QueryField field;
+        QueryOp op;
+        double number;
+        string text;
+    };
+
+    string source;
+    vector<Token> tokens;
+    size_t position = 0;
+    string error;
+
+    // Filled by compile
+    Predicate matches;           // every condition
+    Predicate matchesInIdRange;  // what records in idRange still have to meet
+    KeyRange<double> idRange, priceRange, quantityRange;
+    KeyRange<string> nameRange;
+    string nameContains;  // the longest text every match's name contains, lowercased
+
+    static string lowered(string text) {
+        for (char& c : text) c = (char)tolower((unsigned char)c);
+        return text;
+    }
+
+    bool tokenize() {
+        tokens.clear();
+        size_t i = 0;
+        while (i < source.size()) {
+            char c = source[i];
+            if (isspace((unsigned char)c)) {
+                i++;
+            } else if (isalpha((unsigned char)c) || c == '_') {
+                size_t start = i;
+                while (i < source.size() && (isalnum((unsigned char)source[i]) || source[i] == '_')) i++;
+                tokens.push_back({Token::WORD, source.substr(start, i - start), 0});
+            } else if (isdigit((unsigned char)c) || c == '.' || c == '-') {
+                const char* start = source.c_str() + i;
+                char* end = nullptr;
+                double number = strtod(start, &end);
+                if (end == start || !isfinite(number)) {
+                    error = "Bad number at '" + source.substr(i, 10) + "'";
+                    return false;
+                }
+                tokens.push_back({Token::NUMBER, source.substr(i, end - start), number});
+                i += end - start;
+            } else if (c == '"' || c == '\'') {
+                size_t close = source.find(c, i + 1);
+                if (close == string::npos) {
+                    error = "Unterminated string";
+                    return false;
+                }
+                tokens.push_back({Token::TEXT, source.substr(i + 1, close - i - 1), 0});
+                i = close + 1;
+            } else {
+                static const char* symbols[] = {"<=", ">=", "!=", "==", "=", "<", ">", "~", "(", ")"};
+                size_t matched = 0;
+                for (const char* symbol : symbols) {
+                    size_t length = strlen(symbol);
+                    if (source.compare(i, length, symbol) == 0) {
+                        matched = length;
+                        break;
+                    }
+                }
+                if (matched == 0) {
+                    error = string("Unexpected '") + c + "'";
+                    return false;
+                }
+                tokens.push_back({Token::SYMBOL, source.substr(i, matched), 0});
+                i += matched;
+            }
+        }
+        tokens.push_back({Token::END, "", 0});
+        return true;
+    }
+
+    const Token& peek() const { return tokens[position]; }
+
+    bool accept(Token::Kind kind, const string& text) {
+        if (!peek().is(kind, text)) return false;
+        position++;
+        return true;
+    }
+
+    // The query as a tree of conditions; conjunctions keep their operands
+    // flat so the planner can see every condition a match has to meet
+    struct Node {
+        enum Kind { AND, OR, NOT, CONDITION } kind;
+        Condition condition;
+        vector<Node> children;
+    };
+
+    bool parseOr(Node& node) {
+        Node first;
+        if (!parseAnd(first)) return false;
+        if (!peek().is(Token::WORD, "or")) {
+            node = move(first);
+            return true;
+        }
+        node = {Node::OR, {}, {}};
+        node.children.push_back(move(first));
+        while (accept(Token::WORD, "or")) {
+            Node next;
+            if (!parseAnd(next)) return false;
+            node.children.push_back(move(next));
+        }
+        return true;
+    }
+
+    bool parseAnd(Node& node) {
+        Node first;
+        if (!parseFactor(first)) return false;
+        if (!peek().is(Token::WORD, "and")) {
+            node = move(first);
+            return true;
+        }
+        node = {Node::AND, {}, {}};
+        node.children.push_back(move(first));
+        while (accept(Token::WORD, "and")) {
+            Node next;
+            if (!parseFactor(next)) return false;
+            if (next.kind == Node::AND) {
+                for (Node& child : next.children) node.children.push_back(move(child));
+            } else {
+                node.children.push_back(move(next));
+            }
+        }
+        return true;
+    }
+
+    bool parseFactor(Node& node) {
+        if (accept(Token::WORD, "not")) {
+            node = {Node::NOT, {}, {}};
+            node.children.emplace_back();
+            return parseFactor(node.children.back());
+        }
+        if (accept(Token::SYMBOL, "(")) {
+            if (!parseOr(node)) return false;
+            if (accept(Token::SYMBOL, ")")) return true;
+            error = "Missing ')'";
+            return false;
+        }
+        return parseCondition(node);
+    }
+
+    bool parseCondition(Node& node) {
+        static const pair<const char*, QueryField> fields[] = {
+            {"id", QUERY_ID}, {"name", QUERY_NAME}, {"qty", QUERY_QUANTITY}, {"quantity", QUERY_QUANTITY},
+            {"price", QUERY_PRICE}, {"value", QUERY_VALUE}};
+        static const pair<const char*, QueryOp> ops[] = {
+            {"=", QUERY_EQ}, {"==", QUERY_EQ}, {"!=", QUERY_NE}, {"<", QUERY_LT}, {"<=", QUERY_LE},
+            {">", QUERY_GT}, {">=", QUERY_GE}, {"~", QUERY_CONTAINS}};
+
+        node = {Node::CONDITION, {}, {}};
+        Condition& condition = node.condition;
+        const Token& field = peek();
+        bool knownField = false;
+        for (const auto& entry : fields) {
+            if (field.is(Token::WORD, entry.first)) {
+                condition.field = entry.second;
+                knownField = true;
+            }
+        }
+        if (!knownField) {
+            error = field.kind == Token::END ? "Expected a field" : "Unknown field '" + field.text + "'";
+            return false;
+        }
+        position++;
+
+        const Token& op = peek();
+        bool knownOp = false;
+        for (const auto& entry : ops) {
+            if (op.is(Token::SYMBOL, entry.first)) {
+                condition.op = entry.second;
+                knownOp = true;
+            }
+        }
+        if (!knownOp) {
+            error = "Expected a comparison after '" + field.text + "'";
+            return false;
+        }
+        position++;
+
+        const Token& value = peek();
+        if (condition.field == QUERY_NAME) {
+            // Bare words are names too, so name = Cotton works without quotes
+            if (value.kind != Token::TEXT && value.kind != Token::WORD) {
+                error = "Expected a name after '" + op.text + "'";
+                return false;
+            }
+            condition.text = condition.op == QUERY_CONTAINS ? lowered(value.text) : value.text;
+        } else {
+            if (condition.op == QUERY_CONTAINS) {
+                error = "'~' only applies to name";
+                return false;
+            }
+            if (value.kind != Token::NUMBER) {
+                error = "Expected a number after '" + op.text + "'";
+                return false;
+            }
+            condition.number = value.number;
+        }
+        position++;
+        return true;
+    }
+
+    template <typename Value>
+    static bool compare(QueryOp op, const Value& value, const Value& bound) {
+        switch (op) {
+            case QUERY_EQ: return value == bound;
+            case QUERY_NE: return value != bound;
+            case QUERY_LT: return value < bound;
+            case QUERY_LE: return value <= bound;
+            case QUERY_GT: return value > bound;
+            case QUERY_GE: return value >= bound;
+            case QUERY_CONTAINS: return false;
+        }
+        return false;
+    }
+
+    static Predicate compileCondition(const Condition& condition) {
+        QueryOp op = condition.op;
+        double number = condition.number;
+        string text = condition.text;
+        switch (condition.field) {
+            case QUERY_ID:
+                return [op, number](const Record& record) { return compare(op, (double)record.id, number); };
+            case QUERY_QUANTITY:
+                return [op, number](const Record& record) { return compare(op, (double)record.quantity(), number); };
+            case QUERY_PRICE:
+                return [op, number](const Record& record) { return compare(op, record.price, number); };
+            case QUERY_VALUE:
+                return [op, number](const Record& record) {
+                    return compare(op, record.quantity() * record.price, number);
+                };
+            case QUERY_NAME:
+                if (op != QUERY_CONTAINS) {
+                    return [op, text](const Record& record) { return compare(op, record.name, text); };
+                }
+                return [text](const Record& record) {
+                    auto match = search(record.name.begin(), record.name.end(), text.begin(), text.end(),
+                                        [](char a, char b) { return tolower((unsigned char)a) == b; });
+                    return match != record.name.end() || text.empty();
+                };
+        }
+        return [](const Record&) { return false; };
+    }
+
+    static Predicate compileNode(const Node& node) {
+        if (node.kind == Node::CONDITION) return compileCondition(node.condition);
+        if (node.kind == Node::NOT) {
+            Predicate inner = compileNode(node.children[0]);
+            return [inner](const Record& record) { return !inner(record); };
+        }
+        vector<Predicate> parts;
+        for (const Node& child : node.children) parts.push_back(compileNode(child));
+        return conjoin(move(parts), node.kind == Node::AND);
+    }
+
+    static Predicate conjoin(vector<Predicate> parts, bool all) {
+        if (parts.empty()) return [](const Record&) { return true; };
+        if (parts.size() == 1) return parts[0];
+        return [parts, all](const Record& record) {
+            for (const Predicate& part : parts) {
+                if (part(record) != all) return !all;
+            }
+            return all;
+        };
+    }
+
+    // Turns the conditions every match must meet into key ranges and a text
+    // names must contain, and compiles the whole query as well as what an id
+    // range doesn't already guarantee. Candidates from the sorted views are
+    // checked against every condition: they meet one at most, and trigram
+    // candidates not even that.
+    void plan(const Node& root) {
+        vector<const Node*> required;
+        if (root.kind == Node::AND) {
+            for (const Node& child : root.children) required.push_back(&child);
+        } else {
+            required.push_back(&root);
+        }
+
+        vector<Predicate> all, afterIdRange;
+        for (const Node* node : required) {
+            Predicate part = compileNode(*node);
+            bool coveredById = false;
+            if (node->kind == Node::CONDITION) {
+                const Condition& condition = node->condition;
+                switch (condition.field) {
+                    case QUERY_ID: coveredById = idRange.restrict(condition.op, condition.number); break;
+                    case QUERY_NAME:
+                        if (condition.op != QUERY_CONTAINS) {
+                            nameRange.restrict(condition.op, condition.text);
+                        } else if (condition.text.size() > nameContains.size()) {
+                            nameContains = condition.text;
+                        }
+                        break;
+                    case QUERY_PRICE: priceRange.restrict(condition.op, condition.number); break;
+                    case QUERY_QUANTITY: quantityRange.restrict(condition.op, condition.number); break;
+                    case QUERY_VALUE: break;
+                }
+            }
+            if (!coveredById) afterIdRange.push_back(part);
+            all.push_back(move(part));
+        }
+        matches = conjoin(move(all), true);
+        matchesInIdRange = conjoin(move(afterIdRange), true);
+    }
+
+    // Positions in id order of the records in idRange
+    pair<size_t, size_t> idSpan(const RecordStore::Snapshot& view) const {
+        size_t first = 0, last = view.size();
+        if (idRange.hasLow) {
+            double low = idRange.lowInclusive ? ceil(idRange.low) : floor(idRange.low) + 1;
+            first = low > INT_MAX ? last : low <= INT_MIN ? 0 : view.rank((int)low);
+        }
+        if (idRange.hasHigh) {
+            // The first id past the range
+            double high = idRange.highInclusive ? floor(idRange.high) + 1 : ceil(idRange.high);
+            last = high > INT_MAX ? last : high <= INT_MIN ? 0 : view.rank((int)high);
+        }
+        return {first, max(first, last)};
+    }
+
+    // Ids of the records in range in a sorted view, at most limit of them,
+    // and the store version they were taken from; returns how many there are
+    static size_t inView(SortedViews& views, SortColumn column, const KeyRange<double>& range, size_t limit,
+                         vector<int>& ids, uint64_t& version) {
+        const double low = range.hasLow ? range.low : -HUGE_VAL;
+        const double high = range.hasHigh ? range.high : HUGE_VAL;
+        return views.range(column, low, range.lowInclusive || !range.hasLow, high,
+                           range.highInclusive || !range.hasHigh, limit, ids, &version);
+    }
+
+    static size_t inView(SortedViews& views, const KeyRange<string>& range, size_t limit, vector<int>& ids,
+                         uint64_t& version) {
+        return views.nameRange(range.hasLow ? &range.low : nullptr, range.lowInclusive,
+                               range.hasHigh ? &range.high : nullptr, range.highInclusive, limit, ids, &version);
+    }
+
+    size_t inView(SortedViews& views, QueryPath path, size_t limit, vector<int>& ids, uint64_t& version) const {
+        switch (path) {
+            case QUERY_BY_NAME: return inView(views, nameRange, limit, ids, version);
+            case QUERY_BY_PRICE: return inView(views, SORT_PRICE, priceRange, limit, ids, version);
+            case QUERY_BY_QUANTITY: return inView(views, SORT_QUANTITY, quantityRange, limit, ids, version);
+            // Every candidate; no more than the count that chose this path
+            case QUERY_BY_TEXT: return views.nameCandidates(nameContains, limit ? &ids : nullptr, &version);
+            default: return 0;
+        }
+    }
+
+public:
+    // Parses and compiles text; on failure returns false and sets errorMessage
+    bool compile(const string& text, string& errorMessage) {
+        source = text;
+        position = 0;
+        error.clear();
+        idRange = {};
+        priceRange = {};
+        quantityRange = {};
+        nameRange = {};
+        nameContains.clear();
+        Node root;
+        bool parsed = tokenize() && parseOr(root);
+        if (parsed && peek().kind != Token::END) {
+            error = "Unexpected '" + peek().text + "'";
+            parsed = false;
+        }
+        tokens.clear();
+        if (!parsed) {
+            errorMessage = error;
+            return false;
+        }
+        plan(root);
+        return true;
+    }
+
+    const string& text() const { return source; }
+
+    // Runs the query on one snapshot. Candidates come from whichever bounded
+    // key selects the fewest records: an id range is found by rank in the
+    // snapshot, and a name, price or quantity range in the inventory's
+    // sorted views, given them; without one every record is a candidate.
+    // Ids from the views are only used if the views show the snapshot's
+    // version (pin it with SortedViews::pin), otherwise the span is scanned.
+    // Candidates are checked in parallel chunks.
+    QueryResult run(const RecordStore::Snapshot& view, size_t limit, SortedViews* views = nullptr) const {
+        QueryResult result;
+        pair<size_t, size_t> span = {0, view.size()};
+        if (idRange.bounded()) {
+            span = idSpan(view);
+            result.path = QUERY_BY_ID;
+        }
+
+        // A view holds ids, and looking each one up in the snapshot costs
+        // several times a sequential check, so a view is only used when it
+        // selects far fewer records than the span in id order. Counting the
+        // records in a view's range is O(log n).
+        vector<int> ids;
+        uint64_t idsVersion = 0;
+        bool fromView = false;
+        if (views) {
+            QueryPath best = QUERY_SCAN;
+            size_t fewest = (span.second - span.first) / 8;
+            const pair<QueryPath, bool> candidates[] = {{QUERY_BY_NAME, nameRange.bounded()},
+                                                        {QUERY_BY_PRICE, priceRange.bounded()},
+                                                        {QUERY_BY_QUANTITY, quantityRange.bounded()},
+                                                        {QUERY_BY_TEXT, !nameContains.empty()}};
+            for (const auto& candidate : candidates) {
+                if (!candidate.second) continue;
+                size_t count = inView(*views, candidate.first, 0, ids, idsVersion);
+                if (count < fewest) {
+                    best = candidate.first;
+                    fewest = count;
+                }
+            }
+            if (best != QUERY_SCAN) {
+                inView(*views, best, fewest, ids, idsVersion);
+                if (idsVersion == view.versionNumber()) {
+                    result.path = best;
+                    fromView = true;
+                } else {
+                    ids.clear();  // ids of another version would drop or miss records
+                }
+            }
+        }
+
+        const Predicate& keep = result.path == QUERY_BY_ID ? matchesInIdRange : matches;
+        result.examined = fromView ? ids.size() : span.second - span.first;
+        const size_t rowsPerChunk = 4096;
+        size_t chunkCount = (result.examined + rowsPerChunk - 1) / rowsPerChunk;
+        vector<vector<const Record*>> found(chunkCount);
+        TaskScheduler::getInstance()->parallelFor(chunkCount, 1, [&](size_t first, size_t last) {
+            for (size_t c = first; c < last; c++) {
+                size_t begin = c * rowsPerChunk;
+                size_t end = min(result.examined, begin + rowsPerChunk);
+                auto check = [&](const Record& record) {
+                    if (keep(record)) found[c].push_back(&record);
+                };
+                if (!fromView) {
+                    view.forRange(span.first + begin, span.first + end, check);
+                    continue;
+                }
+                for (size_t i = begin; i < end; i++) {
+                    const Record* record = view.find(ids[i]);
+                    if (record) check(*record);
+                }
+            }
+        });
+        vector<const Record*> matched;
+        for (const vector<const Record*>& part : found) matched.insert(matched.end(), part.begin(), part.end());
+        if (fromView) {
+            sort(matched.begin(), matched.end(), [](const Record* a, const Record* b) { return a->id < b->id; });
+        }
+
+        result.matched = matched.size();
+        result.records.reserve(min(limit, matched.size()));
+        for (size_t i = 0; i < matched.size() && i < limit; i++) result.records.push_back(*matched[i]);
+        return result;
+    }
+};
+
+// ================= PERSISTENCE =================
+
+// Bounded multi-producer, multi-consumer queue without locks. Each slot carries
+// a sequence number that tells producers and consumers whose turn it is.
+template <typename T>
+class BoundedQueue {
+private:
+    struct Slot {
+        atomic<size_t> sequence;
+        T value;
+    };
+
+    vector<Slot> slots;
+    size_t mask;
+    alignas(64) atomic<size_t> enqueuePos;
+    alignas(64) atomic<size_t> dequeuePos;
+
+public:
+    // capacity is rounded up to a power of two
+    explicit BoundedQueue(size_t capacity) : enqueuePos(0), dequeuePos(0) {
+        size_t size = 2;
+        while (size < capacity) size *= 2;
+        slots = vector<Slot>(size);
+        mask = size - 1;
+        for (size_t i = 0; i < size; i++) slots[i].sequence.store(i, memory_order_relaxed);
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    // Returns false when the queue is full
+    bool tryPush(const T& value) {
+        size_t pos = enqueuePos.load(memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots[pos & mask];
+            size_t sequence = slot.sequence.load(memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    slot.value = value;
+                    slot.sequence.store(pos + 1, memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueuePos.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    // Returns false when the queue is empty
+    bool tryPop(T& value) {
+        size_t pos = dequeuePos.load(memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots[pos & mask];
+            size_t sequence = slot.sequence.load(memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (dequeuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    value = slot.value;
+                    slot.sequence.store(pos + mask + 1, memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = dequeuePos.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    // Approximate number of queued items
+    size_t size() const {
+        size_t head = dequeuePos.load(memory_order_relaxed);
+        size_t tail = enqueuePos.load(memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    size_t capacity() const { return mask + 1; }
+};
+
+struct MutationEvent {
+    MutationKind kind;
+    int recordId;
+    chrono::steady_clock::time_point queuedAt;
+};
+
+struct PersistenceStats {
+    size_t queueDepth;
+    size_t queueCapacity;
+    size_t maxQueueDepth;
+    uint64_t eventsQueued;
+    uint64_t eventsPersisted;
+    uint64_t fileWrites;
+    uint64_t backpressureWaits;
+    double lastWriteLagMs;  // time from the oldest event in a batch to its write finishing
+    double maxWriteLagMs;
+};
+
+// Dedicated thread that persists an inventory after mutations. Callers only
+// push an event; the writer coalesces everything queued since its last pass
+// into one file write. When the queue is full, callers wait for room instead
+// of dropping events.
+class BackgroundWriter {
+private:
+    BoundedQueue<MutationEvent> queue;
+    function<void()> writeFile;
+    thread worker;
+
+    atomic<bool> stopping;
+    atomic<bool> stopped;
+    atomic<bool> writerIdle;
+    mutex wakeMutex;
+    condition_variable wake;
+    condition_variable persistedChanged;
+
+    atomic<uint64_t> eventsQueued;
+    atomic<uint64_t> eventsPersisted;
+    atomic<uint64_t> fileWrites;
+    atomic<uint64_t> backpressureWaits;
+    atomic<size_t> maxQueueDepth;
+    atomic<double> lastWriteLagMs;
+    atomic<double> maxWriteLagMs;
+
+    void run() {
+        while (true) {
+            {
+                unique_lock<mutex> lock(wakeMutex);
+                writerIdle = true;
+                wake.wait_for(lock, chrono::milliseconds(100),
+                              [this]() { return queue.size() > 0 || stopping; });
+                writerIdle = false;
+            }
+
+            MutationEvent event;
+            uint64_t batch = 0;
+            auto oldest = chrono::steady_clock::time_point::max();
+            while (queue.tryPop(event)) {
+                oldest = min(oldest, event.queuedAt);
+                batch++;
+            }
+
+            if (batch > 0) {
+                writeFile();
+                double lagMs = chrono::duration<double, milli>(chrono::steady_clock::now() - oldest).count();
+                lastWriteLagMs = lagMs;
+                if (lagMs > maxWriteLagMs) maxWriteLagMs = lagMs;
+                fileWrites++;
+                {
+                    lock_guard<mutex> lock(wakeMutex);
+                    eventsPersisted += batch;
+                }
+                persistedChanged.notify_all();
+            } else if (stopping) {
+                {
+                    lock_guard<mutex> lock(wakeMutex);
+                    stopped = true;
+                }
+                persistedChanged.notify_all();
+                return;
+            }
+        }
+    }
+
+public:
+    BackgroundWriter(function<void()> write, size_t capacity = 1024)
+        : queue(capacity), writeFile(move(write)), stopping(false), stopped(false), writerIdle(false),
+          eventsQueued(0), eventsPersisted(0), fileWrites(0), backpressureWaits(0),
+          maxQueueDepth(0), lastWriteLagMs(0), maxWriteLagMs(0) {
+        worker = thread([this]() { run(); });
+    }
+
+    BackgroundWriter(const BackgroundWriter&) = delete;
+    BackgroundWriter& operator=(const BackgroundWriter&) = delete;
+
+    ~BackgroundWriter() {
+        stop();
+    }
+
+    void enqueue(MutationKind kind, int recordId) {
+        MutationEvent event = {kind, recordId, chrono::steady_clock::now()};
+        // Count before pushing so flush() never sees more persisted than queued
+        eventsQueued++;
+        bool waited = false;
+        while (!queue.tryPush(event)) {
+            // Queue full: hand the writer the CPU until it frees a slot
+            if (!waited) backpressureWaits++;
+            waited = true;
+            {
+                lock_guard<mutex> lock(wakeMutex);
+            }
+            wake.notify_one();
+            this_thread::sleep_for(chrono::microseconds(50));
+        }
+
+        size_t depth = queue.size();
+        size_t seen = maxQueueDepth.load();
+        while (depth > seen && !maxQueueDepth.compare_exchange_weak(seen, depth)) {}
+
+        if (writerIdle) {
+            lock_guard<mutex> lock(wakeMutex);
+            wake.notify_one();
+        }
+    }
+
+    // Blocks until every event queued before the call has been written
+    void flush() {
+        uint64_t target = eventsQueued.load();
+        unique_lock<mutex> lock(wakeMutex);
+        wake.notify_one();
+        persistedChanged.wait(lock, [&]() { return eventsPersisted.load() >= target || stopped; });
+    }
+
+    // Drains the queue, writes it out and stops the thread
+    void stop() {
+        if (!worker.joinable()) return;
+        {
+            lock_guard<mutex> lock(wakeMutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        worker.join();
+    }
+
+    PersistenceStats stats() const {
+        PersistenceStats result;
+        result.queueDepth = queue.size();
+        result.queueCapacity = queue.capacity();
+        result.maxQueueDepth = maxQueueDepth.load();
+        result.eventsQueued = eventsQueued.load();
+        result.eventsPersisted = eventsPersisted.load();
+        result.fileWrites = fileWrites.load();
+        result.backpressureWaits = backpressureWaits.load();
+        result.lastWriteLagMs = lastWriteLagMs.load();
+        result.maxWriteLagMs = maxWriteLagMs.load();
+        return result;
+    }
+};
+
+// Stock of one inventory at one warehouse other than the home one, whose
+// stock stays in the inventory file. Each shard has its own lock, file and
+// writer, so work at one location never waits on another. Cells are
+// created on first use; a StockTransaction can include them next to the
+// home location's cells, which is how transfers stay atomic.
+class StockShard {
+private:
+    string location;
+    string filename;
+    mutable mutex cellsMutex;  // guards the map only, not the quantities
+    unordered_map<int, shared_ptr<StockCell>> cells;
+    mutex saveMutex;
+    unique_ptr<BackgroundWriter> writer;
+
+    // "id quantity" lines
+    void loadFromFile() {
+        ifstream file(filename);
+        int id, quantity;
+        while (file >> id >> quantity) {
+            if (quantity > 0) cells[id] = make_shared<StockCell>(quantity);
+        }
+    }
+
+    void saveToFile() {
+        lock_guard<mutex> lock(saveMutex);
+        vector<pair<int, int>> stock = sortedStock();
+        string tempFilename = filename + ".tmp";
+        ofstream file(tempFilename);
+        if (!file.is_open()) {
+            cout << "Error: Could not open " << tempFilename << " for saving." << endl;
+            return;
+        }
+        for (const pair<int, int>& entry : stock) file << entry.first << " " << entry.second << '\n';
+        file.close();
+        if (rename(tempFilename.c_str(), filename.c_str()) != 0) {
+            cout << "Error: Could not replace " << filename << "." << endl;
+        }
+    }
+
+public:
+    StockShard(const string& _location, const string& _filename) : location(_location), filename(_filename) {
+        loadFromFile();
+        writer = make_unique<BackgroundWriter>([this]() { this->saveToFile(); });
+    }
+
+    StockShard(const StockShard&) = delete;
+    StockShard& operator=(const StockShard&) = delete;
+
+    ~StockShard() {
+        writer->stop();
+        saveToFile();
+    }
+
+    const string& name() const { return location; }
+
+    // The cell of a record, created empty if it has none yet
+    shared_ptr<StockCell> cellFor(int id) {
+        lock_guard<mutex> lock(cellsMutex);
+        shared_ptr<StockCell>& cell = cells[id];
+        if (!cell) cell = make_shared<StockCell>(0);
+        return cell;
+    }
+
+    int quantity(int id) const {
+        lock_guard<mutex> lock(cellsMutex);
+        auto it = cells.find(id);
+        return it == cells.end() ? 0 : StockCell::quantityOf(it->second->loadUnlocked());
+    }
+
+    OpResult adjust(int id, int delta) {
+        OpResult result = adjustCell(*cellFor(id), delta);
+        if (result == OP_OK) changed();
+        return result;
+    }
+
+    // Drops the stock of a deleted record
+    void erase(int id) {
+        lock_guard<mutex> lock(cellsMutex);
+        if (cells.erase(id) > 0) changed();
+    }
+
+    // Queues a save after cells were changed, e.g. by a transaction
+    void changed() {
+        writer->enqueue(MUTATION_STOCK, 0);
+    }
+
+    void flush() {
+        writer->flush();
+    }
+
+    // (id, quantity) of every record with stock here, by id
+    vector<pair<int, int>> sortedStock() const {
+        vector<pair<int, int>> stock;
+        {
+            lock_guard<mutex> lock(cellsMutex);
+            stock.reserve(cells.size());
+            for (const auto& entry : cells) {
+                int quantity = StockCell::quantityOf(entry.second->loadUnlocked());
+                if (quantity > 0) stock.push_back({entry.first, quantity});
+            }
+        }
+        sort(stock.begin(), stock.end());
+        return stock;
+    }
+};
+
+// Warehouse names from a file with one per line. The first is the home
+// location, whose stock is the quantity in the inventory files; without the
+// file there is only a home location called "Main". Names become part of
+// file names, so only letters, digits, '-' and '_' are allowed.
+vector<string> readLocations(const string& filename) {
+    vector<string> locations;
+    ifstream file(filename);
+    string line;
+    while (getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty()) continue;
+        bool valid = line.size() <= 32;
+        for (char c : line) valid = valid && (isalnum((unsigned char)c) || c == '-' || c == '_');
+        if (!valid || find(locations.begin(), locations.end(), line) != locations.end()) {
+            cout << "Warning: Skipping location '" << line << "' in " << filename << "." << endl;
+            continue;
+        }
+        locations.push_back(line);
+    }
+    if (locations.empty()) locations.push_back("Main");
+    return locations;
+}
+
+// How an Inventory holds its records. With the shared modes, one process
+// (the owner, which holds the data lock) loads the file into a shared-memory
+// segment and is the only one that saves; the others attach to the segment.
+enum StorageMode {
+    STORAGE_LOCAL,
+    STORAGE_SHARED_OWNER,
+    STORAGE_SHARED_ATTACH
+};
+
+// One line of a batch quantity update: set a record's quantity, or change it by a delta
+struct QuantityAdjustment {
+    int id;
+    bool absolute;  // value is the new quantity rather than a change
+    int value;
+};
+
+// What a batch update did, or why nothing was changed
+struct AdjustmentOutcome {
+    OpResult result;
+    string detail;          // which line caused a failure
+    size_t recordsChanged;
+    double applySeconds;    // validation, the transaction and queueing the save
+};
+
+// Inventory class that uses Strategy pattern
+class Inventory {
+private:
+    RecordStore store;
+    string filename;
+    unique_ptr<InventoryType> strategy;
+    mutex saveMutex;
+    unique_ptr<BackgroundWriter> writer;
+    unique_ptr<StockLedger> ledger;
+    unique_ptr<LotBook> lots;  // raw materials only
+    unique_ptr<DemandForecast> demand;
+    unique_ptr<SortedViews> views;
+    StorageMode mode;
+    vector<string> locationNames;
+    vector<unique_ptr<StockShard>> shards;  // locations after the home one
+    shared_ptr<SharedSegment> segment;      // shared modes only
+
+    // Owner only: notices changes made by attached processes, applies their
+    // stock movements to the lots and demand statistics, and queues a save
+    thread sharedWatcher;
+    atomic<bool> stopWatcher;
+    uint64_t movementsLostSeen = 0;
+
+    void applyQueuedMovements() {
+        QueuedMovement movement;
+        while (segment->popMovement(movement)) {
+            trackMovement(movement.id, movement.delta, (MovementReason)movement.reason, movement.micros);
+        }
+        // The queue overflowed, so only the stock itself is known for sure
+        uint64_t lost = segment->header()->movementsLost.load();
+        if (lost != movementsLostSeen) {
+            movementsLostSeen = lost;
+            if (lots) lots->reconcile(store.pin());
+        }
+    }
+
+    void watchSharedChanges() {
+        uint64_t seen = store.sharedChangeCounter();
+        while (!stopWatcher) {
+            this_thread::sleep_for(chrono::milliseconds(200));
+            applyQueuedMovements();
+            uint64_t counter = store.sharedChangeCounter();
+            if (counter != seen) {
+                seen = counter;
+                writer->enqueue(MUTATION_STOCK, 0);
+            }
+        }
+    }
+
+    void startSharedOwner() {
+        vector<Record> records = store.snapshot();
+        for (const Record& record : records) {
+            if (SharedSegment::fitsName(record.name)) continue;
+            cout << "Warning: " << filename << " record " << record.id << " has a name longer than "
+                 << SHARED_NAME_SIZE - 1 << " characters, which shared memory can't hold; other processes won't see "
+                 << "this inventory." << endl;
+            mode = STORAGE_LOCAL;
+            return;
+        }
+        uint32_t capacity = (uint32_t)max<size_t>(4096, records.size() * 2);
+        segment = SharedSegment::create(SharedSegment::segmentNameFor(filename), capacity, records,
+                                        store.nextIdHint());
+        if (!segment) {
+            cout << "Warning: Could not create shared inventory for " << filename
+                 << "; other processes won't see it." << endl;
+            mode = STORAGE_LOCAL;
+            return;
+        }
+        store.attachShared(segment);
+    }
+
+    // Parses "id name|quantity price" lines from [begin, end)
+    static void parseRecords(const char* begin, const char* end, vector<Record>& out) {
+        istringstream lines(string(begin, end));
+        string line;
+        while (getline(lines, line)) {
+            stringstream ss(line);
+            int id = 0;
+            string name;
+            int quantity = 0;
+            double price = 0;
+            ss >> id;
+            ss.ignore();
+            getline(ss, name, '|');
+            ss >> quantity >> price;
+            
+            out.emplace_back(id, name, quantity, price);
+        }
+    }
+
+    // Large files are cut into chunks at line boundaries and parsed on the
+    // task scheduler; the chunks are then joined in file order
+    void loadFromFile() {
+        ifstream file(filename, ios::binary);
+        if (!file.is_open()) return;
+        string text((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+        file.close();
+
+        const size_t minChunkBytes = 256 * 1024;
+        TaskScheduler* scheduler = TaskScheduler::getInstance();
+        size_t pieces = max<size_t>(1, min(scheduler->workerCount() * 4, text.size() / minChunkBytes));
+
+        vector<size_t> bounds = {0};
+        for (size_t i = 1; i < pieces; i++) {
+            size_t cut = text.find('\n', max(bounds.back(), text.size() * i / pieces));
+            if (cut == string::npos) break;
+            bounds.push_back(cut + 1);
+        }
+        bounds.push_back(text.size());
+
+        vector<vector<Record>> parsed(bounds.size() - 1);
+        scheduler->parallelFor(parsed.size(), 1, [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; i++) {
+                parseRecords(text.data() + bounds[i], text.data() + bounds[i + 1], parsed[i]);
+            }
+        });
+
+        vector<Record> records;
+        size_t total = 0;
+        for (const vector<Record>& part : parsed) total += part.size();
+        records.reserve(total);
+        for (vector<Record>& part : parsed) {
+            move(part.begin(), part.end(), back_inserter(records));
+        }
+
+        store.replaceAll(move(records));
+    }
+
+    // Writes to a temporary file and renames it over the original, so a
+    // reader never sees a half-written inventory file
+    void saveToFile() {
+        lock_guard<mutex> lock(saveMutex);
+        // The ledger goes first, so it is never behind the file it explains
+        ledger->checkpoint();
+        string tempFilename = filename + ".tmp";
+        ofstream file(tempFilename);
+        if (!file.is_open()) {
+            cout << "Error: Could not open file for saving." << endl;
+            return;
+        }
+        
+        // Every save rewrites (compacts) the whole file; the text is built in
+        // chunks on the task scheduler and written out in order
+        RecordStore::Snapshot view = store.pin();
+        const size_t rowsPerChunk = 16384;
+        vector<string> chunks((view.size() + rowsPerChunk - 1) / rowsPerChunk);
+        TaskScheduler::getInstance()->parallelFor(chunks.size(), 1, [&](size_t first, size_t last) {
+            for (size_t c = first; c < last; c++) {
+                ostringstream out;
+                size_t end = min(view.size(), (c + 1) * rowsPerChunk);
+                view.forRange(c * rowsPerChunk, end, [&](const Record& record) {
+                    out << record.id << " " << record.name << "|"
+                        << record.quantity() << " " << record.price << '\n';
+                });
+                chunks[c] = out.str();
+            }
+        });
+        for (const string& chunk : chunks) file << chunk;
+        file.close();
+
+        if (rename(tempFilename.c_str(), filename.c_str()) != 0) {
+            cout << "Error: Could not replace " << filename << "." << endl;
+        }
+        if (lots) lots->save();
+        if (demand) demand->save();
+    }
+
+    // Keeps the lots and demand statistics in step with a movement at the
+    // home location. An attached process has neither, so it queues the
+    // movement for the owner of the shared inventory instead.
+    void trackMovement(int id, int delta, MovementReason reason, int64_t micros) {
+        if (mode == STORAGE_SHARED_ATTACH) {
+            if (segment) segment->pushMovement({id, delta, (int)reason, micros});
+            return;
+        }
+        if (reason != MOVE_TRANSFER) lotsMoved(id, delta);
+        if (demand) demand->record(id, delta, reason, micros);
+    }
+
+    // Keeps the lots in step with a location's stock. Stock that arrives
+    // without a lot, such as an adjustment or a finished production run, is
+    // received at the record's price. Transfers move their lots themselves.
+    void lotsMoved(int id, int delta, size_t location = 0) {
+        if (!lots || delta == 0) return;
+        if (delta < 0) {
+            lots->consume(id, -delta, location);
+            return;
+        }
+        Record record(0, "", 0, 0);
+        double price = store.find(id, record) ? record.price : 0;
+        lots->receive(id, delta, price,
+                      chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count(),
+                      location);
+    }
+
+public:
+    std::function<void(int)> onDeleted; // Called with the id of every deleted record
+
+    // locations are the warehouse names from readLocations. Only a local
+    // inventory has the other locations: with shared memory every process
+    // works on the home location.
+    Inventory(const string& file, unique_ptr<InventoryType> strat, StorageMode storage = STORAGE_LOCAL,
+              const vector<string>& locations = {"Main"})
+        : filename(file), strategy(move(strat)), mode(storage), stopWatcher(false) {
+        locationNames = mode == STORAGE_LOCAL ? locations : vector<string>{locations[0]};
+        string stem = filename.substr(0, filename.rfind('.'));
+        for (size_t i = 1; i < locationNames.size(); i++) {
+            shards.push_back(make_unique<StockShard>(locationNames[i], stem + "." + locationNames[i] + ".stock"));
+        }
+        ledger = make_unique<StockLedger>(filename);
+        strategy->onStockMoved = [this](int id, int delta, MovementReason reason, const string& user) {
+            ledger->append(id, delta, reason, user);
+            trackMovement(id, delta, reason, DemandForecast::nowMicros());
+        };
+        strategy->onFindSimilar = [this](const string& name, size_t limit) {
+            return views->similarNames(name, limit);
+        };
+        if (mode == STORAGE_SHARED_ATTACH) {
+            // The owner loaded the file and saves every change, including ours;
+            // our movements go to the same ledger file
+            segment = SharedSegment::attach(SharedSegment::segmentNameFor(filename));
+            if (segment) store.attachShared(segment);
+            views = make_unique<SortedViews>(store);
+            strategy->onModified = [this](MutationKind kind, int id) {
+                if (kind == MUTATION_DELETE && onDeleted) onDeleted(id);
+            };
+            return;
+        }
+
+        loadFromFile();
+        ledger->reconcile(store.pin());
+        if (strategy->kind() == INVENTORY_RAW) {
+            lots = make_unique<LotBook>(filename);
+            vector<vector<pair<int, int>>> elsewhere;
+            for (unique_ptr<StockShard>& shard : shards) elsewhere.push_back(shard->sortedStock());
+            lots->reconcile(store.pin(), elsewhere);
+        }
+        demand = make_unique<DemandForecast>(filename);
+        if (!demand->wasRestored()) {
+            const int64_t warmUpDays = 365;
+            int64_t now = DemandForecast::nowMicros();
+            demand->warmUp(ledger->between(now - warmUpDays * 86400LL * 1000000, INT64_MAX, SIZE_MAX));
+        }
+        if (mode == STORAGE_SHARED_OWNER) startSharedOwner();
+        views = make_unique<SortedViews>(store);
+        // Saving happens on the writer thread, so edits don't wait on disk I/O
+        writer = make_unique<BackgroundWriter>([this]() { this->saveToFile(); });
+        // Every delete path ends here, so a deleted record's stock at the
+        // other locations is dropped here too; a reused id starts with none
+        strategy->onModified = [this](MutationKind kind, int id) {
+            if (kind == MUTATION_DELETE) {
+                for (unique_ptr<StockShard>& shard : shards) shard->erase(id);
+                if (lots) lots->erase(id, locationNames.size());
+                if (onDeleted) onDeleted(id);
+            }
+            writer->enqueue(kind, id);
+        };
+        if (mode == STORAGE_SHARED_OWNER) {
+            sharedWatcher = thread([this]() { watchSharedChanges(); });
+        }
+    }
+
+    ~Inventory() {
+        strategy->onStockMoved = nullptr;
+        if (!writer) return;
+        stopWatcher = true;
+        if (sharedWatcher.joinable()) sharedWatcher.join();
+        if (segment && segment->isOwner()) applyQueuedMovements();
+        strategy->onModified = nullptr;
+        writer->stop();
+        saveToFile();
+    }
+
+    // False for an attached inventory whose segment doesn't exist (no owner running)
+    bool isAvailable() const {
+        return mode != STORAGE_SHARED_ATTACH || store.isShared();
+    }
+
+    // False once the owner of a shared inventory has exited; changes made
+    // after that are no longer saved
+    bool sharedOwnerAlive() const {
+        return store.sharedOwnerAlive();
+    }
+
+    void displayMenu(bool isAdmin, const ChangeContext& context) {
+        strategy->displayMenu(store, isAdmin, context);
+    }
+
+    // Writes the whole file now, as the writer thread does after changes
+    void saveNow() {
+        saveToFile();
+    }
+
+    // Waits until every change made so far is on disk
+    void flushPersistence() {
+        if (writer) writer->flush();
+        for (unique_ptr<StockShard>& shard : shards) shard->flush();
+    }
+
+    PersistenceStats persistenceStats() const {
+        if (writer) return writer->stats();
+        PersistenceStats none = {};
+        return none;
+    }
+
+    // Non-interactive access for reports and server sessions
+    RecordStore::Snapshot pinSnapshot() const {
+        return store.pin();
+    }
+
+    vector<Record> listRecords() const {
+        return store.snapshot();
+    }
+
+    // Positions [first, first + count) of the records sorted by a column;
+    // total is set to the number of records. See SortedViews.
+    vector<Record> sortedPage(SortColumn column, bool descending, size_t first, size_t count, size_t& total) const {
+        vector<int> ids;
+        total = views->page(column, descending, first, count, ids);
+        RecordStore::Snapshot view = store.pin();
+        vector<Record> page;
+        for (int id : ids) {
+            const Record* record = view.find(id);
+            if (record) page.push_back(*record);
+        }
+        return page;
+    }
+
+    // Records whose names are closest to name, closest first
+    vector<NameMatch> similarNames(const string& name, size_t limit) const {
+        return views->similarNames(name, limit);
+    }
+
+    // Records whose quantity, price or value lies in [low, high], in that
+    // order, at most limit of them; total is set to how many there are
+    vector<Record> recordsInRange(SortColumn column, double low, double high, size_t limit, size_t& total) const {
+        vector<int> ids;
+        total = views->range(column, low, true, high, true, limit, ids);
+        RecordStore::Snapshot view = store.pin();
+        vector<Record> records;
+        for (int id : ids) {
+            const Record* record = view.find(id);
+            if (record) records.push_back(*record);
+        }
+        return records;
+    }
+
+    // 1-based position of a record when sorted by a column
+    bool recordRank(SortColumn column, bool descending, int id, size_t& position, size_t& total) const {
+        return views->rank(column, descending, id, position, total);
+    }
+
+    // Records matching a compiled query, in id order; see RecordQuery
+    QueryResult findRecords(const RecordQuery& query, size_t limit) const {
+        RecordStore::Snapshot view = views->pin();
+        return query.run(view, limit, views.get());
+    }
+
+    bool findRecord(int id, Record& out) const {
+        return store.find(id, out);
+    }
+
+    OpResult addRecord(const string& name, int quantity, double price, bool isAdmin,
+                       const ChangeContext& context, int& newId) {
+        return strategy->add(store, name, quantity, price, isAdmin, context, newId);
+    }
+
+    OpResult editRecord(int id, uint32_t expectedVersion, const string& newName, int newQuantity,
+                        double newPrice, bool isAdmin, const ChangeContext& context) {
+        return strategy->edit(store, id, expectedVersion, newName, newQuantity, newPrice, isAdmin, context);
+    }
+
+    // Also drops the record's stock at the other locations
+    OpResult deleteRecord(int id, bool isAdmin, const ChangeContext& context) {
+        return strategy->remove(store, id, isAdmin, context);
+    }
+
+    OpResult adjustStock(int id, int delta, const ChangeContext& context) {
+        return strategy->adjust(store, id, delta, context);
+    }
+
+    OpResult reserveStock(int id, int n, const ChangeContext& context) {
+        return strategy->reserve(store, id, n, context);
+    }
+
+    // Stock cells of the given records at a location, for a
+    // StockTransaction; false with missingId set if a record doesn't exist
+    bool stockCells(const vector<int>& ids, vector<shared_ptr<StockCell>>& cells, int& missingId,
+                    size_t location = 0) const {
+        RecordStore::Snapshot view = store.pin();
+        cells.clear();
+        cells.reserve(ids.size());
+        for (int id : ids) {
+            const Record* record = view.find(id);
+            if (record == nullptr) {
+                missingId = id;
+                return false;
+            }
+            cells.push_back(location == 0 ? record->stock : shards[location - 1]->cellFor(id));
+        }
+        return true;
+    }
+
+    // Records the movements of a transaction that changed stock directly and
+    // queues one save for all of them. The ledger follows the inventory file,
+    // so only movements at the home location are recorded in it.
+    void stockChanged(const vector<int>& ids, const vector<int>& deltas, MovementReason reason,
+                      const string& user, size_t location = 0) {
+        if (location > 0) {
+            shards[location - 1]->changed();
+            if (reason == MOVE_TRANSFER) return;
+            for (size_t i = 0; i < ids.size(); i++) lotsMoved(ids[i], deltas[i], location);
+            return;
+        }
+        ledger->appendBatch(ids, deltas, reason, user);
+        int64_t now = DemandForecast::nowMicros();
+        for (size_t i = 0; i < ids.size(); i++) {
+            trackMovement(ids[i], deltas[i], reason, now);
+        }
+        store.stockChanged(ids);
+        if (strategy->onModified) strategy->onModified(MUTATION_STOCK, 0);
+    }
+
+    // Lots are tracked for the home location's raw materials; every other
+    // inventory values stock at the record's price
+    bool tracksLots() const {
+        return lots != nullptr;
+    }
+
+    // Stock arriving at a known unit cost; it becomes the record's newest lot
+    OpResult receiveLot(int id, int quantity, double unitCost, const ChangeContext& context) {
+        if (!lots) return OP_DENIED;
+        if (quantity <= 0 || unitCost <= 0) return OP_INVALID_VALUE;
+        OpResult result = store.adjust(id, quantity);
+        if (result != OP_OK) return result;
+        lots->receive(id, quantity, unitCost,
+                      chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count());
+        ledger->append(id, quantity, MOVE_RECEIVE, context.user);
+        if (context.journal) {
+            context.journal->record(MOVE_RECEIVE, {FieldChange::quantity(strategy->kind(), id, 0, quantity)});
+        }
+        if (strategy->onModified) strategy->onModified(MUTATION_STOCK, id);
+        return OP_OK;
+    }
+
+    // FIFO value of a record's stock: what its open lots cost
+    double lotValue(int id) const {
+        return lots ? lots->value(id) : 0;
+    }
+
+    vector<Lot> openLots(int id, size_t limit) const {
+        return lots ? lots->lots(id, limit) : vector<Lot>();
+    }
+
+    // Demand statistics and reorder point of a record. Without a forecaster
+    // (an attached shared inventory) there is no demand history.
+    DemandForecastResult demandForecast(int id) const {
+        if (demand) return demand->forecast(id, DemandForecast::nowMicros());
+        return {0, 0, DemandForecast::DEFAULT_LEAD_TIME_DAYS, 0, 0, 0};
+    }
+
+    // Replenishment lead time used for a record's reorder point
+    OpResult setLeadTime(int id, int days, bool isAdmin) {
+        if (!isAdmin) return OP_DENIED;
+        Record record(0, "", 0, 0);
+        if (!store.find(id, record)) return OP_NOT_FOUND;
+        if (!demand) return OP_DENIED;
+        OpResult result = demand->setLeadTime(id, days);
+        if (result == OP_OK && strategy->onModified) strategy->onModified(MUTATION_EDIT, id);
+        return result;
+    }
+
+    // Warehouse locations; 0 is the home location, whose stock is the
+    // quantity of the record itself
+    size_t locationCount() const {
+        return locationNames.size();
+    }
+
+    const string& locationName(size_t location) const {
+        return locationNames[location];
+    }
+
+    // -1 if there is no such location
+    int findLocation(const string& name) const {
+        for (size_t i = 0; i < locationNames.size(); i++) {
+            if (locationNames[i] == name) return (int)i;
+        }
+        return -1;
+    }
+
+    // False if the record doesn't exist
+    bool quantityAt(size_t location, int id, int& quantity) const {
+        Record record(0, "", 0, 0);
+        if (!store.find(id, record)) return false;
+        quantity = location == 0 ? record.quantity() : shards[location - 1]->quantity(id);
+        return true;
+    }
+
+    // (id, quantity) of every record with stock at a location, by id
+    vector<pair<int, int>> stockAtLocation(size_t location) const {
+        if (location > 0) return shards[location - 1]->sortedStock();
+        vector<pair<int, int>> stock;
+        RecordStore::Snapshot view = store.pin();
+        view.forEach([&](const Record& record) {
+            if (record.quantity() > 0) stock.push_back({record.id, record.quantity()});
+        });
+        return stock;
+    }
+
+    // adjustStock and reserveStock at any location. Like them, the change
+    // goes to the session's undo journal.
+    OpResult adjustAt(size_t location, int id, int delta, const ChangeContext& context) {
+        if (location == 0) return adjustStock(id, delta, context);
+        if (location >= locationCount()) return OP_NOT_FOUND;
+        Record record(0, "", 0, 0);
+        if (!store.find(id, record)) return OP_NOT_FOUND;
+        OpResult result = shards[location - 1]->adjust(id, delta);
+        if (result == OP_OK) lotsMoved(id, delta, location);
+        if (result == OP_OK && context.journal) {
+            context.journal->record(MOVE_ADJUST, {FieldChange::quantity(strategy->kind(), id, 0, delta, location)});
+        }
+        return result;
+    }
+
+    OpResult reserveAt(size_t location, int id, int n, const ChangeContext& context) {
+        if (location == 0) return reserveStock(id, n, context);
+        if (n <= 0) return OP_INVALID_VALUE;
+        if (location >= locationCount()) return OP_NOT_FOUND;
+        Record record(0, "", 0, 0);
+        if (!store.find(id, record)) return OP_NOT_FOUND;
+        OpResult result = shards[location - 1]->adjust(id, -n);
+        if (result == OP_OK) lotsMoved(id, -n, location);
+        if (result == OP_OK && context.journal) {
+            context.journal->record(MOVE_RESERVE, {FieldChange::quantity(strategy->kind(), id, 0, -n, location)});
+        }
+        return result;
+    }
+
+    // Moves n units of a record from one location to another in one
+    // StockTransaction: no one ever sees them at both or at neither. The
+    // units take their lots with them, so they keep their cost.
+    OpResult transfer(int id, size_t from, size_t to, int n, const ChangeContext& context) {
+        if (n <= 0 || from == to) return OP_INVALID_VALUE;
+        if (from >= locationCount() || to >= locationCount()) return OP_NOT_FOUND;
+        vector<shared_ptr<StockCell>> source, destination;
+        int missingId = 0;
+        if (!stockCells({id}, source, missingId, from) || !stockCells({id}, destination, missingId, to)) {
+            return OP_NOT_FOUND;
+        }
+        StockTransaction transaction;
+        transaction.add(source[0], -n, 0);
+        transaction.add(destination[0], n, 1);
+        int failedTag = 0;
+        long long shortBy = 0;
+        OpResult result = transaction.commit(failedTag, shortBy);
+        if (result != OP_OK) return result;
+        if (lots) {
+            Record record(0, "", 0, 0);
+            lots->transfer(id, from, to, n, store.find(id, record) ? record.price : 0);
+        }
+        stockChanged({id}, {-n}, MOVE_TRANSFER, context.user, from);
+        stockChanged({id}, {n}, MOVE_TRANSFER, context.user, to);
+        if (context.journal) {
+            context.journal->record(MOVE_TRANSFER, {FieldChange::quantity(strategy->kind(), id, 0, -n, from),
+                                                    FieldChange::quantity(strategy->kind(), id, 0, n, to)});
+        }
+        return OP_OK;
+    }
+
+    // Applies a whole list of quantity changes as one transaction: every
+    // line is checked first (the record exists, a set isn't negative), then
+    // all are applied together, or none if any would take stock below zero.
+    // The batch is one ledger write and one save, however long it is.
+    AdjustmentOutcome applyAdjustments(const vector<QuantityAdjustment>& adjustments, const ChangeContext& context) {
+        auto start = chrono::steady_clock::now();
+        AdjustmentOutcome outcome = {OP_OK, "", 0, 0};
+        RecordStore::Snapshot view = store.pin();
+        StockTransaction transaction;
+        for (size_t i = 0; i < adjustments.size(); i++) {
+            const QuantityAdjustment& line = adjustments[i];
+            const Record* record = view.find(line.id);
+            if (record == nullptr) {
+                outcome.result = OP_NOT_FOUND;
+            } else if (line.absolute && line.value < 0) {
+                outcome.result = OP_INVALID_VALUE;
+            }
+            if (outcome.result != OP_OK) {
+                outcome.detail = "Line " + to_string(i + 1) + ": record " + to_string(line.id);
+                return outcome;
+            }
+            if (line.absolute) {
+                transaction.set(record->stock, line.value, (int)i);
+            } else {
+                transaction.add(record->stock, line.value, (int)i);
+            }
+        }
+
+        int failedLine = 0;
+        long long shortBy = 0;
+        outcome.result = transaction.commit(failedLine, shortBy);
+        if (outcome.result != OP_OK) {
+            outcome.detail = "Line " + to_string(failedLine + 1) + ": record " +
+                             to_string(adjustments[failedLine].id);
+            if (outcome.result == OP_INSUFFICIENT_STOCK) outcome.detail += " is short by " + to_string(shortBy);
+            return outcome;
+        }
+
+        vector<int> ids, deltas;
+        for (const pair<int, long long>& change : transaction.applied()) {
+            ids.push_back(adjustments[change.first].id);
+            deltas.push_back((int)change.second);
+        }
+        outcome.recordsChanged = ids.size();
+        if (!ids.empty()) stockChanged(ids, deltas, MOVE_BATCH, context.user);
+        if (context.journal) {
+            vector<FieldChange> changes;
+            changes.reserve(ids.size());
+            for (size_t i = 0; i < ids.size(); i++) {
+                changes.push_back(FieldChange::quantity(strategy->kind(), ids[i], 0, deltas[i]));
+            }
+            context.journal->record(MOVE_BATCH, changes);
+        }
+        outcome.applySeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return outcome;
+    }
+
+    // Stock ledger queries; see StockLedger
+    vector<LedgerEntry> ledgerHistory(int id, size_t limit) const {
+        return ledger->history(id, limit);
+    }
+
+    vector<LedgerEntry> ledgerBetween(int64_t fromMicros, int64_t toMicros, size_t limit) const {
+        return ledger->between(fromMicros, toMicros, limit);
+    }
+
+    LedgerStats ledgerStats() const {
+        return ledger->stats();
+    }
+
+    // Replays the ledger and lists the records whose live quantity differs
+    // from it as (id, replayed quantity). Movements made while this runs can
+    // show up as differences.
+    vector<pair<int, long long>> verifyLedger() const {
+        unordered_map<int, long long> balances;
+        uint64_t covered = 0;
+        ledger->replay(balances, covered);
+        vector<pair<int, long long>> mismatches;
+        RecordStore::Snapshot view = store.pin();
+        view.forEach([&](const Record& record) {
+            auto balance = balances.find(record.id);
+            long long replayed = balance == balances.end() ? 0 : balance->second;
+            if (balance != balances.end()) balances.erase(balance);
+            if (replayed != record.quantity()) mismatches.push_back({record.id, replayed});
+        });
+        for (const auto& balance : balances) {
+            if (balance.second != 0) mismatches.push_back({balance.first, balance.second});
+        }
+        sort(mismatches.begin(), mismatches.end());
+        return mismatches;
+    }
+};
+
+
+// ================= BILL OF MATERIALS =================
+
+// One component of a product: quantityPerUnit units of a raw material
+struct BomLine {
+    int rawMaterialId;
+    int quantityPerUnit;
+};
+
+// Immutable bill-of-materials table in compressed sparse row layout. Only
+// products with a bill of materials have a row, in product id order; the
+// components of the product in row r are entries rowStart[r] ..
+// rowStart[r + 1] - 1 of the two flat arrays, so exploding an order walks
+// contiguous memory, and the table's size follows the number of lines
+// rather than the ids. Raw materials are numbered the same way, so totals
+// per material can be kept in a dense buffer indexed by column.
+struct BomTable {
+    vector<int> products;         // product id of each row, ascending
+    vector<uint32_t> rowStart{0}; // indexed by row, one extra entry at the end
+    vector<int> materials;        // raw material id of each entry
+    vector<uint32_t> columns;     // column of each entry's raw material
+    vector<int> quantities;       // units needed per unit of product
+    vector<int> materialIds;      // raw material id of each column, ascending
+
+    // Row of a product, or -1 if it has no bill of materials
+    int rowOf(int productId) const {
+        auto it = lower_bound(products.begin(), products.end(), productId);
+        return (it != products.end() && *it == productId) ? (int)(it - products.begin()) : -1;
+    }
+
+    bool hasProduct(int productId) const { return rowOf(productId) >= 0; }
+
+    uint32_t begin(int productId) const {
+        int row = rowOf(productId);
+        return row >= 0 ? rowStart[row] : 0;
+    }
+
+    uint32_t end(int productId) const {
+        int row = rowOf(productId);
+        return row >= 0 ? rowStart[row + 1] : 0;
+    }
+};
+
+// Bills of materials for every product, persisted to their own file next to
+// the inventory files as "productId rawMaterialId quantityPerUnit" lines.
+// Readers take the current table without copying it; edits are rare and
+// rebuild the table, then swap it in.
+class BomStore {
+public:
+    // Whether a product and a raw material both exist, for checking loaded lines
+    using LineCheck = function<bool(int productId, int rawMaterialId)>;
+
+private:
+    string filename;
+    mutable mutex tableMutex;  // guards the table pointer only
+    shared_ptr<const BomTable> table;
+    mutex writerMutex;         // serializes edits and saves
+
+    static shared_ptr<const BomTable> build(const map<int, vector<BomLine>>& byProduct) {
+        shared_ptr<BomTable> built = make_shared<BomTable>();
+        built->products.reserve(byProduct.size());
+        built->rowStart.reserve(byProduct.size() + 1);
+        for (const auto& product : byProduct) {
+            built->products.push_back(product.first);
+            for (const BomLine& line : product.second) {
+                built->materials.push_back(line.rawMaterialId);
+                built->quantities.push_back(line.quantityPerUnit);
+            }
+            built->rowStart.push_back((uint32_t)built->materials.size());
+        }
+
+        vector<int>& ids = built->materialIds;
+        ids = built->materials;
+        sort(ids.begin(), ids.end());
+        ids.erase(unique(ids.begin(), ids.end()), ids.end());
+        built->columns.reserve(built->materials.size());
+        for (int material : built->materials) {
+            built->columns.push_back((uint32_t)(lower_bound(ids.begin(), ids.end(), material) - ids.begin()));
+        }
+        return built;
+    }
+
+    static map<int, vector<BomLine>> expand(const BomTable& source) {
+        map<int, vector<BomLine>> byProduct;
+        for (size_t row = 0; row < source.products.size(); row++) {
+            for (uint32_t i = source.rowStart[row]; i < source.rowStart[row + 1]; i++) {
+                byProduct[source.products[row]].push_back({source.materials[i], source.quantities[i]});
+            }
+        }
+        return byProduct;
+    }
+
+    // Lines naming a product or raw material that doesn't exist are skipped
+    void load(const LineCheck& exists) {
+        map<int, vector<BomLine>> byProduct;
+        ifstream file(filename);
+        string line;
+        while (getline(file, line)) {
+            stringstream ss(line);
+            int productId, rawMaterialId, quantityPerUnit;
+            if (!(ss >> productId >> rawMaterialId >> quantityPerUnit)) continue;
+            if (productId <= 0 || rawMaterialId <= 0 || quantityPerUnit <= 0) continue;
+            if (!exists(productId, rawMaterialId)) continue;
+
+            vector<BomLine>& lines = byProduct[productId];
+            auto existing = find_if(lines.begin(), lines.end(),
+                                    [&](const BomLine& l) { return l.rawMaterialId == rawMaterialId; });
+            if (existing != lines.end()) {
+                existing->quantityPerUnit = quantityPerUnit;
+            } else {
+                lines.push_back({rawMaterialId, quantityPerUnit});
+            }
+        }
+        table = build(byProduct);
+    }
+
+    // Swaps in a rebuilt table and saves it. Caller holds writerMutex.
+    void publish(shared_ptr<const BomTable> rebuilt) {
+        {
+            lock_guard<mutex> swapLock(tableMutex);
+            table = rebuilt;
+        }
+        save(*rebuilt);
+    }
+
+    // Same temp-file-and-rename scheme as the inventory files. Caller holds writerMutex.
+    void save(const BomTable& source) {
+        string tempFilename = filename + ".tmp";
+        ofstream file(tempFilename);
+        if (!file.is_open()) {
+            cout << "Error: Could not open file for saving." << endl;
+            return;
+        }
+        for (size_t row = 0; row < source.products.size(); row++) {
+            for (uint32_t i = source.rowStart[row]; i < source.rowStart[row + 1]; i++) {
+                file << source.products[row] << " " << source.materials[i] << " " << source.quantities[i] << '\n';
+            }
+        }
+        file.close();
+        if (rename(tempFilename.c_str(), filename.c_str()) != 0) {
+            cout << "Error: Could not replace " << filename << "." << endl;
+        }
+    }
+
+public:
+    BomStore(const string& file, const LineCheck& exists) : filename(file) {
+        load(exists);
+    }
+
+    BomStore(const BomStore&) = delete;
+    BomStore& operator=(const BomStore&) = delete;
+
+    shared_ptr<const BomTable> current() const {
+        lock_guard<mutex> lock(tableMutex);
+        return table;
+    }
+
+    vector<BomLine> linesFor(int productId) const {
+        shared_ptr<const BomTable> view = current();
+        vector<BomLine> lines;
+        for (uint32_t i = view->begin(productId), end = view->end(productId); i < end; i++) {
+            lines.push_back({view->materials[i], view->quantities[i]});
+        }
+        return lines;
+    }
+
+    // Sets how many units of a raw material one unit of the product uses;
+    // 0 removes the component. Ids are checked by the caller.
+    OpResult setLine(int productId, int rawMaterialId, int quantityPerUnit) {
+        if (productId <= 0 || rawMaterialId <= 0 || quantityPerUnit < 0) return OP_INVALID_VALUE;
+
+        lock_guard<mutex> lock(writerMutex);
+        map<int, vector<BomLine>> byProduct = expand(*current());
+        vector<BomLine>& lines = byProduct[productId];
+        auto existing = find_if(lines.begin(), lines.end(),
+                                [&](const BomLine& l) { return l.rawMaterialId == rawMaterialId; });
+        if (quantityPerUnit == 0) {
+            if (existing == lines.end()) return OP_NOT_FOUND;
+            lines.erase(existing);
+        } else if (existing != lines.end()) {
+            existing->quantityPerUnit = quantityPerUnit;
+        } else {
+            lines.push_back({rawMaterialId, quantityPerUnit});
+        }
+        if (lines.empty()) byProduct.erase(productId);
+
+        publish(build(byProduct));
+        return OP_OK;
+    }
+
+    // Drops the components of a deleted product, so a product that later
+    // gets its id doesn't inherit them
+    void removeProduct(int productId) {
+        lock_guard<mutex> lock(writerMutex);
+        shared_ptr<const BomTable> view = current();
+        if (view->begin(productId) == view->end(productId)) return;
+        map<int, vector<BomLine>> byProduct = expand(*view);
+        byProduct.erase(productId);
+        publish(build(byProduct));
+    }
+
+    // Drops a deleted raw material from every product that used it
+    void removeMaterial(int rawMaterialId) {
+        lock_guard<mutex> lock(writerMutex);
+        shared_ptr<const BomTable> view = current();
+        if (find(view->materials.begin(), view->materials.end(), rawMaterialId) == view->materials.end()) return;
+        map<int, vector<BomLine>> byProduct = expand(*view);
+        for (auto it = byProduct.begin(); it != byProduct.end();) {
+            vector<BomLine>& lines = it->second;
+            lines.erase(remove_if(lines.begin(), lines.end(),
+                                  [&](const BomLine& l) { return l.rawMaterialId == rawMaterialId; }),
+                        lines.end());
+            it = lines.empty() ? byProduct.erase(it) : next(it);
+        }
+        publish(build(byProduct));
+    }
+};
+
+// One line of a production plan: make units of a product from its components
+struct ProductionLine {
+    int productId;
+    int units;
+};
+
+// What a production run did, or why nothing was changed
+struct ProductionOutcome {
+    OpResult result;
+    string detail;          // which line or record caused a failure
+    long long unitsProduced;
+    size_t componentsUsed;  // distinct raw materials consumed
+};
+
+// What an undo or redo did (detail describes the change), or why it couldn't
+struct UndoOutcome {
+    OpResult result;
+    string detail;
+};
+
+// Reads a production plan or demand file: one "productId units" line per
+// entry, blank lines and lines starting with '#' ignored. Parsed straight
+// from one buffer, since demand files can run to millions of lines.
+bool readProductionPlan(const string& filename, vector<ProductionLine>& plan, string& error) {
+    ifstream file(filename, ios::binary);
+    if (!file.is_open()) {
+        error = "Could not open " + filename;
+        return false;
+    }
+    string text((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+
+    const char* cursor = text.c_str();
+    size_t lineNumber = 0;
+    while (*cursor) {
+        lineNumber++;
+        const char* lineEnd = strchr(cursor, '\n');
+        if (!lineEnd) lineEnd = cursor + strlen(cursor);
+
+        while (cursor < lineEnd && isspace((unsigned char)*cursor)) cursor++;
+        if (cursor < lineEnd && *cursor != '#') {
+            char* parsedEnd;
+            long productId = strtol(cursor, &parsedEnd, 10);
+            bool valid = parsedEnd != cursor;
+            cursor = parsedEnd;
+            long units = strtol(cursor, &parsedEnd, 10);
+            valid = valid && parsedEnd != cursor && parsedEnd <= lineEnd &&
+                    productId >= INT_MIN && productId <= INT_MAX && units >= INT_MIN && units <= INT_MAX;
+            cursor = parsedEnd;
+            while (valid && cursor < lineEnd && isspace((unsigned char)*cursor)) cursor++;
+            if (!valid || cursor != lineEnd) {
+                error = "Line " + to_string(lineNumber) + " is not \"productId units\"";
+                return false;
+            }
+            plan.push_back({(int)productId, (int)units});
+        }
+        cursor = *lineEnd ? lineEnd + 1 : lineEnd;
+    }
+    return true;
+}
+
+// Reads a batch quantity update: one "id quantity" line sets a quantity,
+// "id +n" or "id -n" changes it by n. Blank lines and lines starting with '#'
+// are ignored.
+bool readAdjustments(const string& filename, vector<QuantityAdjustment>& adjustments, string& error) {
+    ifstream file(filename, ios::binary);
+    if (!file.is_open()) {
+        error = "Could not open " + filename;
+        return false;
+    }
+    string text((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+
+    const char* cursor = text.c_str();
+    size_t lineNumber = 0;
+    while (*cursor) {
+        lineNumber++;
+        const char* lineEnd = strchr(cursor, '\n');
+        if (!lineEnd) lineEnd = cursor + strlen(cursor);
+
+        while (cursor < lineEnd && isspace((unsigned char)*cursor)) cursor++;
+        if (cursor < lineEnd && *cursor != '#') {
+            char* parsedEnd;
+            long id = strtol(cursor, &parsedEnd, 10);
+            bool valid = parsedEnd != cursor;
+            cursor = parsedEnd;
+            while (cursor < lineEnd && (*cursor == ' ' || *cursor == '\t')) cursor++;
+            bool relative = cursor < lineEnd && (*cursor == '+' || *cursor == '-');
+            long value = strtol(cursor, &parsedEnd, 10);
+            valid = valid && parsedEnd != cursor && parsedEnd <= lineEnd && id >= INT_MIN && id <= INT_MAX &&
+                    value >= INT_MIN && value <= INT_MAX;
+            cursor = parsedEnd;
+            while (valid && cursor < lineEnd && isspace((unsigned char)*cursor)) cursor++;
+            if (!valid || cursor != lineEnd) {
+                error = "Line " + to_string(lineNumber) + " is not \"id quantity\", \"id +n\" or \"id -n\"";
+                return false;
+            }
+            adjustments.push_back({(int)id, !relative, (int)value});
+        }
+        cursor = *lineEnd ? lineEnd + 1 : lineEnd;
+    }
+    return true;
+}
+
+// ================= MATERIAL REQUIREMENTS PLANNING =================
+
+// What a demand needs of one raw material. Gross is the total the demand
+// consumes; net is the part that current stock does not cover.
+struct MaterialRequirement {
+    int rawMaterialId;
+    string name;       // empty if the BOM names a raw material that no longer exists
+    double price;
+    long long gross;
+    long long onHand;
+    long long net;
+};
+
+struct MrpResult {
+    vector<MaterialRequirement> requirements;  // every material with gross > 0, by id
+    size_t demandLines;
+    size_t linesWithoutBom;  // products with no bill of materials contribute nothing
+    size_t invalidLines;     // units of 0 or less
+    long long snapshotVersion;
+    double seconds;
+};
+
+// Explodes demand per product through the bills of materials into gross
+// requirements per raw material, then nets them against a snapshot of raw
+// material stock. The demand is split into one slice per scheduler worker;
+// each slice accumulates into its own dense buffer indexed by the table's
+// material columns, so the hot loop shares nothing, and the buffers are
+// summed at the end.
+class MrpEngine {
+public:
+    static MrpResult plan(const BomTable& table, const vector<ProductionLine>& demand,
+                          const RecordStore::Snapshot& rawMaterials) {
+        auto start = chrono::steady_clock::now();
+        MrpResult result;
+        result.demandLines = demand.size();
+        result.linesWithoutBom = 0;
+        result.invalidLines = 0;
+        result.snapshotVersion = rawMaterials.versionNumber();
+
+        TaskScheduler* scheduler = TaskScheduler::getInstance();
+        const size_t linesPerSlice = 65536;
+        size_t width = table.materialIds.size();
+        size_t slices = max((size_t)1, min(scheduler->workerCount(), demand.size() / linesPerSlice));
+
+        vector<vector<long long>> buffers(slices);
+        vector<size_t> withoutBom(slices, 0), invalid(slices, 0);
+        {
+            TaskScheduler::TaskGroup group(*scheduler);
+            for (size_t s = 0; s < slices; s++) {
+                group.run([&, s]() {
+                    vector<long long>& gross = buffers[s];
+                    gross.assign(width, 0);
+                    size_t first = demand.size() * s / slices;
+                    size_t last = demand.size() * (s + 1) / slices;
+                    for (size_t i = first; i < last; i++) {
+                        const ProductionLine& line = demand[i];
+                        if (line.units <= 0) {
+                            invalid[s]++;
+                            continue;
+                        }
+                        uint32_t end = table.end(line.productId);
+                        uint32_t e = table.begin(line.productId);
+                        if (e == end) withoutBom[s]++;
+                        for (; e < end; e++) {
+                            gross[table.columns[e]] += (long long)line.units * table.quantities[e];
+                        }
+                    }
+                });
+            }
+            group.wait();
+        }
+
+        // Sum the slices into the first buffer, one range of materials per task
+        vector<long long>& gross = buffers[0];
+        scheduler->parallelFor(width, 4096, [&](size_t first, size_t last) {
+            for (size_t s = 1; s < slices; s++) {
+                for (size_t column = first; column < last; column++) gross[column] += buffers[s][column];
+            }
+        });
+        for (size_t s = 0; s < slices; s++) {
+            result.linesWithoutBom += withoutBom[s];
+            result.invalidLines += invalid[s];
+        }
+
+        for (size_t column = 0; column < width; column++) {
+            if (gross[column] == 0) continue;
+            int id = table.materialIds[column];
+            MaterialRequirement requirement = {id, "", 0, gross[column], 0, gross[column]};
+            if (const Record* record = rawMaterials.find(id)) {
+                requirement.name = record->name;
+                requirement.price = record->price;
+                requirement.onHand = record->quantity();
+                requirement.net = max(0LL, gross[column] - requirement.onHand);
+            }
+            result.requirements.push_back(requirement);
+        }
+
+        result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return result;
+    }
+};
+
+// ================= REPORT MANAGER (SINGLETON) =================
+
+class ReportManager {
+private:
+    static ReportManager* instance;
+    
+    // Private constructor for Singleton
+    ReportManager() {}
+    
+public:
+    // Delete copy constructor and assignment operator
+    ReportManager(const ReportManager&) = delete;
+    ReportManager& operator=(const ReportManager&) = delete;
+    
+    // Get singleton instance
+    static ReportManager* getInstance() {
+        if (!instance) {
+            instance = new ReportManager();
+        }
+        return instance;
+    }
+    
+    // Cleanup singleton
+    static void destroyInstance() {
+        if (instance) {
+            delete instance;
+            instance = nullptr;
+        }
+    }
+
+    // Both reports read one pinned snapshot, so edits made while a report is
+    // printing can't leave it with a mix of old and new values. Inventories
+    // with lots are valued FIFO, at what their open lots cost.
+    void displayInventoryReport(const string& title, const Inventory& inventory, ostream& out) {
+        RecordStore::Snapshot records = inventory.pinSnapshot();
+        bool fifo = inventory.tracksLots();
+        
+        time_t now = time(0);
+        char* dt = ctime(&now);
+        
+        out << "\n" << string(70, '=') << endl;
+        out << setw(45) << title << endl;
+        out << "Generated on: " << dt;
+        out << "Snapshot version: " << records.versionNumber() << endl;
+        out << string(70, '=') << endl;
+        out << left << setw(5) << "ID"
+             << setw(25) << "Product Name"
+             << setw(10) << "Quantity"
+             << setw(15) << "Unit Price"
+             << setw(15) << (fifo ? "FIFO Value" : "Value") << endl;
+        out << string(70, '-') << endl;
+        
+        // Rows are formatted in chunks on the task scheduler, each with its
+        // own subtotals, and printed in id order
+        const size_t rowsPerChunk = 4096;
+        size_t chunkCount = (records.size() + rowsPerChunk - 1) / rowsPerChunk;
+        vector<string> rows(chunkCount);
+        vector<long long> quantities(chunkCount, 0);
+        vector<double> values(chunkCount, 0.0);
+        
+        TaskScheduler::getInstance()->parallelFor(chunkCount, 1, [&](size_t first, size_t last) {
+            for (size_t c = first; c < last; c++) {
+                ostringstream part;
+                size_t end = min(records.size(), (c + 1) * rowsPerChunk);
+                records.forRange(c * rowsPerChunk, end, [&](const Record& record) {
+                    int quantity = record.quantity();
+                    double value = fifo ? inventory.lotValue(record.id) : quantity * record.price;
+                    quantities[c] += quantity;
+                    values[c] += value;
+                    
+                    part << left << setw(5) << record.id
+                         << setw(25) << record.name
+                         << setw(10) << quantity
+                         << "$" << setw(14) << fixed << setprecision(2) << record.price
+                         << "$" << setw(14) << fixed << setprecision(2) << value << endl;
+                });
+                rows[c] = part.str();
+            }
+        });
+        
+        long long totalQuantity = 0;
+        double totalValue = 0.0;
+        for (size_t c = 0; c < chunkCount; c++) {
+            out << rows[c];
+            totalQuantity += quantities[c];
+            totalValue += values[c];
+        }
+        
+        out << string(70, '-') << endl;
+        out << left << setw(30) << "TOTAL:"
+             << setw(10) << totalQuantity
+             << setw(15) << ""
+             << "$" << fixed << setprecision(2) << totalValue << endl;
+        out << string(70, '=') << endl;
+    }
+
+    void displayRawMatReport(const Inventory& rawMaterials, ostream& out = cout) {
+        displayInventoryReport("RAW MATERIAL INVENTORY REPORT", rawMaterials, out);
+    }
+
+    void displayProductReport(const Inventory& products, ostream& out = cout) {
+        displayInventoryReport("PRODUCT INVENTORY REPORT", products, out);
+    }
+
+    // Stock of every record at every warehouse location, with totals. The
+    // location shards are read in parallel and merged in parallel: each
+    // chunk of records finds where it starts in every location's list by
+    // binary search, then walks all of them in step with the records.
+    void displayLocationReport(const string& title, const Inventory& inventory, ostream& out = cout) {
+        RecordStore::Snapshot records = inventory.pinSnapshot();
+        size_t locationCount = inventory.locationCount();
+        TaskScheduler* scheduler = TaskScheduler::getInstance();
+        vector<vector<pair<int, int>>> stock(locationCount);  // [0] stays empty: the records have it
+        scheduler->parallelFor(locationCount - 1, 1, [&](size_t first, size_t last) {
+            for (size_t l = first; l < last; l++) stock[l + 1] = inventory.stockAtLocation(l + 1);
+        });
+
+        time_t now = time(0);
+        char* dt = ctime(&now);
+        size_t width = 30 + 12 * (locationCount + 1) + 15;
+
+        out << "\n" << string(width, '=') << endl;
+        out << setw(45) << title << endl;
+        out << "Generated on: " << dt;
+        out << "Snapshot version: " << records.versionNumber() << endl;
+        out << string(width, '=') << endl;
+        out << left << setw(5) << "ID" << setw(25) << "Name";
+        for (size_t l = 0; l < locationCount; l++) out << setw(12) << inventory.locationName(l).substr(0, 11);
+        out << setw(12) << "Total" << setw(15) << "Value" << endl;
+        out << string(width, '-') << endl;
+
+        const size_t rowsPerChunk = 4096;
+        size_t chunkCount = (records.size() + rowsPerChunk - 1) / rowsPerChunk;
+        vector<string> rows(chunkCount);
+        vector<vector<long long>> quantities(chunkCount, vector<long long>(locationCount + 1, 0));
+        vector<double> values(chunkCount, 0.0);
+
+        scheduler->parallelFor(chunkCount, 1, [&](size_t first, size_t last) {
+            for (size_t c = first; c < last; c++) {
+                ostringstream part;
+                size_t begin = c * rowsPerChunk;
+                size_t end = min(records.size(), begin + rowsPerChunk);
+                vector<size_t> next;
+                records.forRange(begin, end, [&](const Record& record) {
+                    if (next.empty()) {
+                        next.assign(locationCount, 0);
+                        for (size_t l = 1; l < locationCount; l++) {
+                            next[l] = lower_bound(stock[l].begin(), stock[l].end(), make_pair(record.id, INT_MIN)) -
+                                      stock[l].begin();
+                        }
+                    }
+                    part << left << setw(5) << record.id << setw(25) << record.name;
+                    long long total = 0;
+                    for (size_t l = 0; l < locationCount; l++) {
+                        int quantity = 0;
+                        if (l == 0) {
+                            quantity = record.quantity();
+                        } else {
+                            const vector<pair<int, int>>& at = stock[l];
+                            while (next[l] < at.size() && at[next[l]].first < record.id) next[l]++;
+                            if (next[l] < at.size() && at[next[l]].first == record.id) quantity = at[next[l]].second;
+                        }
+                        quantities[c][l] += quantity;
+                        total += quantity;
+                        part << setw(12) << quantity;
+                    }
+                    double value = total * record.price;
+                    quantities[c][locationCount] += total;
+                    values[c] += value;
+                    part << setw(12) << total << "$" << fixed << setprecision(2) << value << endl;
+                });
+                rows[c] = part.str();
+            }
+        });
+
+        vector<long long> totals(locationCount + 1, 0);
+        double totalValue = 0.0;
+        for (size_t c = 0; c < chunkCount; c++) {
+            out << rows[c];
+            for (size_t l = 0; l <= locationCount; l++) totals[l] += quantities[c][l];
+            totalValue += values[c];
+        }
+        out << string(width, '-') << endl;
+        out << left << setw(30) << "TOTAL:";
+        for (long long total : totals) out << setw(12) << total;
+        out << "$" << fixed << setprecision(2) << totalValue << endl;
+        out << string(width, '=') << endl;
+    }
+
+    // Records whose stock is at or below their reorder point. Reads the demand
+    // statistics the inventory keeps up to date; nothing is recomputed from
+    // the movement history.
+    void displayReorderReport(const string& title, const Inventory& inventory, ostream& out = cout) {
+        RecordStore::Snapshot records = inventory.pinSnapshot();
+
+        time_t now = time(0);
+        char* dt = ctime(&now);
+
+        out << "\n" << string(96, '=') << endl;
+        out << setw(55) << title << endl;
+        out << "Generated on: " << dt;
+        out << "Snapshot version: " << records.versionNumber() << endl;
+        out << string(96, '=') << endl;
+        out << left << setw(5) << "ID"
+             << setw(25) << "Name"
+             << setw(10) << "On Hand"
+             << setw(12) << "Daily Use"
+             << setw(10) << "Std Dev"
+             << setw(11) << "Lead Days"
+             << setw(11) << "Safety"
+             << setw(12) << "Reorder At" << endl;
+        out << string(96, '-') << endl;
+
+        const size_t rowsPerChunk = 4096;
+        size_t chunkCount = (records.size() + rowsPerChunk - 1) / rowsPerChunk;
+        vector<string> rows(chunkCount);
+        vector<size_t> due(chunkCount, 0);
+        TaskScheduler::getInstance()->parallelFor(chunkCount, 1, [&](size_t first, size_t last) {
+            for (size_t c = first; c < last; c++) {
+                ostringstream part;
+                size_t end = min(records.size(), (c + 1) * rowsPerChunk);
+                records.forRange(c * rowsPerChunk, end, [&](const Record& record) {
+                    DemandForecastResult forecast = inventory.demandForecast(record.id);
+                    int quantity = record.quantity();
+                    if (forecast.dailyDemand <= 0 || quantity > forecast.reorderPoint) return;
+                    due[c]++;
+                    part << left << setw(5) << record.id
+                         << setw(25) << record.name
+                         << setw(10) << quantity
+                         << fixed << setprecision(1)
+                         << setw(12) << forecast.dailyDemand
+                         << setw(10) << forecast.deviation
+                         << setw(11) << forecast.leadTimeDays
+                         << setprecision(0)
+                         << setw(11) << ceil(forecast.safetyStock)
+                         << setw(12) << ceil(forecast.reorderPoint) << endl;
+                });
+                rows[c] = part.str();
+            }
+        });
+
+        size_t totalDue = 0;
+        for (size_t c = 0; c < chunkCount; c++) {
+            out << rows[c];
+            totalDue += due[c];
+        }
+        out << string(96, '-') << endl;
+        out << totalDue << " of " << records.size() << " record(s) at or below their reorder point" << endl;
+        out << string(96, '=') << endl;
+    }
+
+    void displayQueryResult(const string& title, const RecordQuery& query, const QueryResult& result,
+                            ostream& out = cout) {
+        out << "\n" << string(70, '=') << endl;
+        out << setw(45) << title << endl;
+        out << "Query: " << query.text() << endl;
+        out << string(70, '=') << endl;
+        out << left << setw(8) << "ID"
+             << setw(25) << "Name"
+             << setw(12) << "Quantity"
+             << setw(12) << "Price"
+             << "Value" << endl;
+        out << string(70, '-') << endl;
+        for (const Record& record : result.records) {
+            int quantity = record.quantity();
+            out << left << setw(8) << record.id
+                 << setw(25) << record.name
+                 << setw(12) << quantity
+                 << fixed << setprecision(2)
+                 << setw(12) << record.price
+                 << quantity * record.price << endl;
+        }
+        out << string(70, '-') << endl;
+        out << result.matched << " match(es)";
+        if (result.records.size() < result.matched) out << ", first " << result.records.size() << " shown";
+        out << "; " << describeQueryPath(result.path) << ", " << result.examined << " record(s) examined" << endl;
+    }
+
+    // Records whose names are closest to a searched name, closest first
+    void displaySimilarNames(const string& title, const string& name, const Inventory& inventory,
+                             const vector<NameMatch>& matches, ostream& out = cout) {
+        out << "\n" << string(70, '=') << endl;
+        out << setw(45) << title << endl;
+        out << "Names close to \"" << name << "\"" << endl;
+        out << string(70, '=') << endl;
+        out << left << setw(8) << "ID"
+             << setw(25) << "Name"
+             << setw(12) << "Quantity"
+             << setw(12) << "Price"
+             << "Edits" << endl;
+        out << string(70, '-') << endl;
+        for (const NameMatch& match : matches) {
+            Record record(0, "", 0, 0);
+            if (!inventory.findRecord(match.id, record)) continue;
+            out << left << setw(8) << record.id
+                 << setw(25) << record.name
+                 << setw(12) << record.quantity()
+                 << fixed << setprecision(2)
+                 << setw(12) << record.price
+                 << match.distance << endl;
+        }
+        out << string(70, '-') << endl;
+        out << matches.size() << " close name(s)" << endl;
+    }
+
+    // One page of a sorted listing; firstPosition is the 1-based rank of its first record
+    void displaySortedPage(const string& title, SortColumn column, bool descending, const vector<Record>& page,
+                           size_t firstPosition, size_t total, ostream& out = cout) {
+        out << "\n" << string(78, '=') << endl;
+        out << setw(45) << title << endl;
+        out << "Sorted by " << describeSortColumn(column) << (descending ? ", descending" : ", ascending") << endl;
+        out << string(78, '=') << endl;
+        out << left << setw(8) << "Rank"
+             << setw(8) << "ID"
+             << setw(25) << "Name"
+             << setw(12) << "Quantity"
+             << setw(12) << "Price"
+             << "Value" << endl;
+        out << string(78, '-') << endl;
+        for (size_t i = 0; i < page.size(); i++) {
+            const Record& record = page[i];
+            int quantity = record.quantity();
+            out << left << setw(8) << firstPosition + i
+                 << setw(8) << record.id
+                 << setw(25) << record.name
+                 << setw(12) << quantity
+                 << fixed << setprecision(2)
+                 << setw(12) << record.price
+                 << quantity * record.price << endl;
+        }
+        out << string(78, '-') << endl;
+        if (page.empty()) {
+            out << "No records at this position; there are " << total << "." << endl;
+        } else {
+            out << "Records " << firstPosition << "-" << firstPosition + page.size() - 1 << " of " << total << endl;
+        }
+    }
+
+    // Records whose quantity, price or value lies in [low, high], in that
+    // order. Found through the inventory's sorted views, so the cost follows
+    // the number of records listed rather than the size of the inventory.
+    void displayRangeReport(const string& title, const Inventory& inventory, SortColumn column, double low,
+                            double high, ostream& out = cout) {
+        size_t total = 0;
+        vector<Record> records = inventory.recordsInRange(column, low, high, SIZE_MAX, total);
+
+        time_t now = time(0);
+        char* dt = ctime(&now);
+
+        out << "\n" << string(70, '=') << endl;
+        out << setw(45) << title << endl;
+        out << "Generated on: " << dt;
+        out << fixed << setprecision(2);
+        out << describeSortColumn(column) << " from " << low << " to " << high << endl;
+        out << string(70, '=') << endl;
+        out << left << setw(8) << "ID"
+             << setw(25) << "Name"
+             << setw(12) << "Quantity"
+             << setw(12) << "Price"
+             << "Value" << endl;
+        out << string(70, '-') << endl;
+        double totalValue = 0;
+        long long totalQuantity = 0;
+        for (const Record& record : records) {
+            int quantity = record.quantity();
+            totalQuantity += quantity;
+            totalValue += quantity * record.price;
+            out << left << setw(8) << record.id
+                 << setw(25) << record.name
+                 << setw(12) << quantity
+                 << setw(12) << record.price
+                 << quantity * record.price << endl;
+        }
+        out << string(70, '-') << endl;
+        out << left << setw(33) << "TOTAL:" << setw(24) << totalQuantity << "$" << totalValue << endl;
+        out << total << " record(s) in range" << endl;
+        out << string(70, '=') << endl;
+    }
+
+    void rangeUI(const Inventory& rawMaterials, const Inventory& products) {
+        int which = getValidIntInput("Inventory (1 = raw materials, 2 = products): ", 1);
+        int key = getValidIntInput("Range on (1 = quantity, 2 = price, 3 = value): ", 1);
+        SortColumn column = key == 2 ? SORT_PRICE : key == 3 ? SORT_VALUE : SORT_QUANTITY;
+        double low = getValidDoubleInput("Lowest value: ", 0);
+        double high = getValidDoubleInput("Highest value: ", 0);
+        if (high < low) swap(low, high);
+        if (which == 2) {
+            displayRangeReport("PRODUCT RANGE REPORT", products, column, low, high);
+        } else {
+            displayRangeReport("RAW MATERIAL RANGE REPORT", rawMaterials, column, low, high);
+        }
+    }
+
+    void reorderUI(Inventory& rawMaterials, Inventory& products) {
+        cout << "\n ----- Reorder Points ----- " << endl;
+        cout << "1. Reorder Report" << endl;
+        cout << "2. Demand Forecast of a Record" << endl;
+        cout << "3. Set Lead Time of a Record" << endl;
+        cout << "4. Return to Previous Menu" << endl;
+
+        int choice = getValidIntInput("Enter your choice (1-4): ", 1);
+        if (choice < 1 || choice > 3) return;
+        int which = getValidIntInput("Inventory (1 = raw materials, 2 = products): ", 1);
+        Inventory& inventory = which == 2 ? products : rawMaterials;
+
+        if (choice == 1) {
+            displayReorderReport(which == 2 ? "PRODUCT REORDER REPORT" : "RAW MATERIAL REORDER REPORT", inventory);
+            return;
+        }
+        int id = getValidIntInput("Enter record ID: ", 1);
+        Record record(0, "", 0, 0);
+        if (!inventory.findRecord(id, record)) {
+            cout << "Record not found." << endl;
+            return;
+        }
+        if (choice == 3) {
+            int days = getValidIntInput("Lead time in days: ", 1);
+            OpResult result = inventory.setLeadTime(id, days, true);
+            cout << (result == OP_OK ? "Lead time updated." : describeResult(result)) << endl;
+            return;
+        }
+        DemandForecastResult forecast = inventory.demandForecast(id);
+        cout << fixed << setprecision(2);
+        cout << record.name << " (" << forecast.daysObserved << " day(s) of history)" << endl;
+        cout << "Daily demand:   " << forecast.dailyDemand << " +/- " << forecast.deviation << endl;
+        cout << "Lead time:      " << forecast.leadTimeDays << " day(s)" << endl;
+        cout << "Safety stock:   " << forecast.safetyStock << endl;
+        cout << "Reorder point:  " << forecast.reorderPoint << endl;
+        cout << "On hand:        " << record.quantity() << endl;
+    }
+
+    // Requirements of a demand against one snapshot of raw material stock.
+    // Every material the demand uses is listed; short ones are marked.
+    void displayShortageReport(const vector<ProductionLine>& demand, const BomStore& bom,
+                               const Inventory& rawMaterials, ostream& out = cout) {
+        RecordStore::Snapshot records = rawMaterials.pinSnapshot();
+        MrpResult result = MrpEngine::plan(*bom.current(), demand, records);
+        
+        time_t now = time(0);
+        char* dt = ctime(&now);
+        
+        out << "\n" << string(90, '=') << endl;
+        out << setw(55) << "MATERIAL SHORTAGE REPORT" << endl;
+        out << "Generated on: " << dt;
+        out << "Snapshot version: " << result.snapshotVersion << endl;
+        out << "Demand lines: " << result.demandLines;
+        if (result.linesWithoutBom > 0) out << " (" << result.linesWithoutBom << " without a bill of materials)";
+        if (result.invalidLines > 0) out << " (" << result.invalidLines << " with invalid units, skipped)";
+        out << endl;
+        out << string(90, '=') << endl;
+        out << left << setw(5) << "ID"
+             << setw(25) << "Raw Material"
+             << setw(14) << "Gross"
+             << setw(14) << "On Hand"
+             << setw(14) << "Net Shortage"
+             << setw(18) << "Shortage Cost" << endl;
+        out << string(90, '-') << endl;
+        
+        size_t shortMaterials = 0;
+        double totalCost = 0.0;
+        for (const MaterialRequirement& requirement : result.requirements) {
+            double cost = requirement.net * requirement.price;
+            if (requirement.net > 0) shortMaterials++;
+            totalCost += cost;
+            out << left << setw(5) << requirement.rawMaterialId
+                 << setw(25) << (requirement.name.empty() ? "(missing)" : requirement.name)
+                 << setw(14) << requirement.gross
+                 << setw(14) << requirement.onHand
+                 << setw(14) << requirement.net
+                 << "$" << fixed << setprecision(2) << cost
+                 << (requirement.net > 0 ? "  SHORT" : "") << endl;
+        }
+        
+        out << string(90, '-') << endl;
+        out << shortMaterials << " of " << result.requirements.size() << " required material(s) short, "
+             << "total shortage cost $" << fixed << setprecision(2) << totalCost << endl;
+        out << "Planned in " << setprecision(3) << result.seconds * 1000 << " ms." << endl;
+        out << string(90, '=') << endl;
+    }
+
+    void displayLedgerEntries(const string& title, const vector<LedgerEntry>& entries, ostream& out = cout) {
+        out << "\n" << string(80, '=') << endl;
+        out << setw(50) << title << endl;
+        out << string(80, '=') << endl;
+        out << left << setw(22) << "Time"
+             << setw(18) << "User"
+             << setw(8) << "ID"
+             << setw(12) << "Change"
+             << "Reason" << endl;
+        out << string(80, '-') << endl;
+        for (const LedgerEntry& entry : entries) {
+            out << left << setw(22) << formatTimestamp(entry.timestampMicros)
+                 << setw(18) << string(entry.user, strnlen(entry.user, sizeof(entry.user)))
+                 << setw(8) << entry.recordId
+                 << setw(12) << showpos << entry.delta << noshowpos
+                 << describeReason(entry.reason) << endl;
+        }
+        out << string(80, '-') << endl;
+        out << entries.size() << " movement(s)" << endl;
+    }
+
+    void ledgerUI(const Inventory& rawMaterials, const Inventory& products) {
+        const size_t maxShown = 1000;
+        cout << "\n ----- Stock Movement Ledger ----- " << endl;
+        cout << "1. Movements of a Record" << endl;
+        cout << "2. Movements in a Time Range" << endl;
+        cout << "3. Verify Ledger Against Inventory" << endl;
+        cout << "4. Return to Previous Menu" << endl;
+
+        int choice = getValidIntInput("Enter your choice (1-4): ", 1);
+        if (choice < 1 || choice > 3) return;
+        int which = getValidIntInput("Inventory (1 = raw materials, 2 = products): ", 1);
+        const Inventory& inventory = which == 2 ? products : rawMaterials;
+        string name = which == 2 ? "PRODUCT" : "RAW MATERIAL";
+
+        if (choice == 1) {
+            int id = getValidIntInput("Enter record ID: ", 1);
+            displayLedgerEntries(name + " " + to_string(id) + " MOVEMENTS", inventory.ledgerHistory(id, maxShown));
+        } else if (choice == 2) {
+            string fromText, toText;
+            int64_t fromMicros = 0, toMicros = 0;
+            cout << "From (YYYY-MM-DD [HH:MM[:SS]]): ";
+            getline(cin, fromText);
+            cout << "To, exclusive (YYYY-MM-DD [HH:MM[:SS]]): ";
+            getline(cin, toText);
+            if (!parseTimestamp(fromText, fromMicros) || !parseTimestamp(toText, toMicros)) {
+                cout << "Invalid time. Use YYYY-MM-DD or YYYY-MM-DD HH:MM:SS." << endl;
+                return;
+            }
+            vector<LedgerEntry> entries = inventory.ledgerBetween(fromMicros, toMicros, maxShown);
+            displayLedgerEntries(name + " MOVEMENTS", entries);
+            if (entries.size() == maxShown) cout << "Only the first " << maxShown << " are shown." << endl;
+        } else {
+            LedgerStats stats = inventory.ledgerStats();
+            vector<pair<int, long long>> mismatches = inventory.verifyLedger();
+            cout << stats.entries << " ledger entries, " << stats.snapshotEntries << " covered by the snapshot." << endl;
+            if (mismatches.empty()) {
+                cout << "Replaying the ledger gives every current quantity." << endl;
+            }
+            for (const pair<int, long long>& mismatch : mismatches) {
+                cout << "Record " << mismatch.first << ": ledger gives " << mismatch.second << endl;
+            }
+        }
+    }
+
+    void reportUI(Inventory& rawMaterials, Inventory& products, const BomStore& bom) {
+        cout << "\n--------------------------------" << endl;
+        cout << "|       REPORTS DASHBOARD      |" << endl;
+        cout << "--------------------------------" << endl;
+        cout << "1. Product Inventory Report" << endl;
+        cout << "2. Raw Material Inventory Report" << endl;
+        cout << "3. Material Shortage Report" << endl;
+        cout << "4. Stock Movement Ledger" << endl;
+        cout << "5. Worker Utilization" << endl;
+        cout << "6. Stock by Location" << endl;
+        cout << "7. Reorder Points" << endl;
+        cout << "8. Range Report" << endl;
+        cout << "9. Return to Previous Menu" << endl;
+        
+        int choice = getValidIntInput("Enter your choice (1-9): ", 1);
+        switch (choice) {
+            case 1: displayProductReport(products); break;
+            case 2: displayRawMatReport(rawMaterials); break;
+            case 3: {
+                cout << "Enter demand file name (productId units per line): ";
+                string demandFile;
+                cin >> demandFile;
+                vector<ProductionLine> demand;
+                string error;
+                if (!readProductionPlan(demandFile, demand, error)) {
+                    cout << "Error: " << error << "." << endl;
+                    break;
+                }
+                displayShortageReport(demand, bom, rawMaterials);
+                break;
+            }
+            case 4: ledgerUI(rawMaterials, products); break;
+            case 5: TaskScheduler::getInstance()->displayStats(cout); break;
+            case 6: {
+                int which = getValidIntInput("Inventory (1 = raw materials, 2 = products): ", 1);
+                if (which == 2) {
+                    displayLocationReport("PRODUCT STOCK BY LOCATION", products);
+                } else {
+                    displayLocationReport("RAW MATERIAL STOCK BY LOCATION", rawMaterials);
+                }
+                break;
+            }
+            case 7: reorderUI(rawMaterials, products); break;
+            case 8: rangeUI(rawMaterials, products); break;
+            case 9: cout << "Returning to previous menu..." << endl; break;
+            default: cout << "Invalid choice. Please try again." << endl; break;
+        }
+    }
+};
+
+// Initialize static member
+ReportManager* ReportManager::instance = nullptr;
+
+// ================= INVENTORY MANAGER (SINGLETON) =================
+
+class InventoryManager {
+private:
+    unique_ptr<Inventory> rawMaterials;
+    unique_ptr<Inventory> products;
+    unique_ptr<BomStore> bom;
+    
+    static InventoryManager* instance;
+    static StorageMode storageMode;
+    
+    // Private constructor for Singleton. The role is not stored here: each
+    // menu or server session passes its own, so sessions can't overwrite it.
+    InventoryManager() {
+        vector<string> locations = readLocations("locations.txt");
+        rawMaterials = make_unique<Inventory>("rawmaterial.txt", make_unique<RawMaterialInventory>(), storageMode,
+                                              locations);
+        products = make_unique<Inventory>("product.txt", make_unique<ProductInventory>(), storageMode, locations);
+        bom = make_unique<BomStore>("bom.txt", [this](int productId, int rawMaterialId) {
+            Record record(0, "", 0, 0);
+            return products->findRecord(productId, record) && rawMaterials->findRecord(rawMaterialId, record);
+        });
+        // Bills of materials never refer to deleted records
+        rawMaterials->onDeleted = [this](int id) { bom->removeMaterial(id); };
+        products->onDeleted = [this](int id) { bom->removeProduct(id); };
+        // An attached process never touches the files; the owner already loaded them
+        if (storageMode != STORAGE_SHARED_ATTACH) initializeSampleData();
+    }
+    
+    void initializeSampleData() {
+        ifstream rmCheck("rawmaterial.txt");
+        bool rmFileEmpty = !rmCheck || rmCheck.peek() == ifstream::traits_type::eof();
+        rmCheck.close();
+        
+        ifstream prodCheck("product.txt");
+        bool prodFileEmpty = !prodCheck || prodCheck.peek() == ifstream::traits_type::eof();
+        prodCheck.close();
+        
+        if (rmFileEmpty) {
+            ofstream rmFile("rawmaterial.txt");
+            if (rmFile) {
+                rmFile << "1 Cotton Fabric|500 150.00" << endl;
+                rmFile << "2 Polyester Fabric|450 120.00" << endl;
+                rmFile << "3 Denim|300 200.00" << endl;
+                rmFile << "4 Silk Fabric|150 350.00" << endl;
+                rmFile << "5 Wool Fabric|200 250.00" << endl;
+                rmFile << "6 Thread|1000 10.00" << endl;
+                rmFile << "7 Buttons|2500 5.00" << endl;
+                rmFile << "8 Zippers|1200 15.00" << endl;
+                rmFile << "9 Elastic Bands|800 8.00" << endl;
+                rmFile << "10 Labels/Tags|1200 3.00" << endl;
+                rmFile.close();
+                cout << "Initialized sample raw materials data." << endl;
+            }
+        }
+        
+        if (prodFileEmpty) {
+            ofstream prodFile("product.txt");
+            if (prodFile) {
+                prodFile << "1 Men's T-Shirts|200 220.00" << endl;
+                prodFile << "2 Women's Blouses|180 320.00" << endl;
+                prodFile << "3 Denim Jeans|150 650.00" << endl;
+                prodFile << "4 Hoodies|120 750.00" << endl;
+                prodFile << "5 Jackets|100 750.00" << endl;
+                prodFile << "6 Formal Trousers|90 340.00" << endl;
+                prodFile << "7 Skirts|110 490.00" << endl;
+                prodFile << "8 Dresses|85 300.00" << endl;
+                prodFile << "9 Shorts|95 270.00" << endl;
+                prodFile << "10 Polo Shirts|130 270.00" << endl;
+                prodFile.close();
+                cout << "Initialized sample products data." << endl;
+            }
+        }
+    }
+    
+public:
+    // Delete copy constructor and assignment operator
+    InventoryManager(const InventoryManager&) = delete;
+    InventoryManager& operator=(const InventoryManager&) = delete;
+    
+    // Get singleton instance
+    static InventoryManager* getInstance() {
+        if (!instance) {
+            instance = new InventoryManager();
+        }
+        return instance;
+    }
+
+    // Must be called before the first getInstance()
+    static void setStorageMode(StorageMode mode) {
+        storageMode = mode;
+    }
+
+    // Whether both inventories could be set up in the chosen storage mode
+    bool isAvailable() const {
+        return rawMaterials->isAvailable() && products->isAvailable();
+    }
+
+    bool sharedOwnerAlive() const {
+        return rawMaterials->sharedOwnerAlive() && products->sharedOwnerAlive();
+    }
+    
+    // Cleanup singleton. Pending background saves are written out first.
+    static void destroyInstance() {
+        if (instance) {
+            instance->rawMaterials->flushPersistence();
+            instance->products->flushPersistence();
+            delete instance;
+            instance = nullptr;
+        }
+    }
+    
+    // Looks up an inventory by its protocol name ("raw" or "product")
+    Inventory* getInventory(const string& kind) {
+        if (kind == "raw") return rawMaterials.get();
+        if (kind == "product") return products.get();
+        return nullptr;
+    }
+    
+    BomStore& getBom() {
+        return *bom;
+    }
+
+    // Sets one component of a product's bill of materials; quantityPerUnit 0 removes it
+    OpResult setBomLine(int productId, int rawMaterialId, int quantityPerUnit, bool isAdmin) {
+        if (!isAdmin) return OP_DENIED;
+        Record record(0, "", 0, 0);
+        if (!products->findRecord(productId, record)) return OP_NOT_FOUND;
+        if (quantityPerUnit > 0 && !rawMaterials->findRecord(rawMaterialId, record)) return OP_NOT_FOUND;
+        return bom->setLine(productId, rawMaterialId, quantityPerUnit);
+    }
+
+    // Makes every line of the plan in one transaction across both
+    // inventories: raw materials go down by what the bills of materials
+    // require and products go up, or, if anything is missing or short,
+    // nothing changes. The plan is read once, and each inventory is saved
+    // once for the whole plan.
+    ProductionOutcome producePlan(const vector<ProductionLine>& plan, const ChangeContext& context) {
+        ProductionOutcome outcome = {OP_OK, "", 0, 0};
+        if (plan.empty()) {
+            outcome.result = OP_INVALID_VALUE;
+            outcome.detail = "The production plan is empty";
+            return outcome;
+        }
+
+        shared_ptr<const BomTable> table = bom->current();
+        vector<long long> required(table->materialIds.size(), 0);  // by the table's material column
+        vector<long long> made(table->products.size(), 0);         // by the table's product row
+        for (size_t i = 0; i < plan.size(); i++) {
+            const ProductionLine& line = plan[i];
+            if (line.units <= 0) {
+                outcome.result = OP_INVALID_VALUE;
+                outcome.detail = "Line " + to_string(i + 1) + ": units must be 1 or more";
+                return outcome;
+            }
+            int row = table->rowOf(line.productId);
+            if (row < 0 || table->rowStart[row] == table->rowStart[row + 1]) {
+                outcome.result = OP_NO_BOM;
+                outcome.detail = "Line " + to_string(i + 1) + ": product " + to_string(line.productId);
+                return outcome;
+            }
+            made[row] += line.units;
+            for (uint32_t e = table->rowStart[row]; e < table->rowStart[row + 1]; e++) {
+                required[table->columns[e]] += (long long)line.units * table->quantities[e];
+            }
+        }
+
+        // Rows and columns are in id order, so both lists come out sorted
+        vector<int> materialIds, productIds;
+        vector<long long> materialTotals, productTotals;
+        for (size_t column = 0; column < required.size(); column++) {
+            if (required[column] == 0) continue;
+            materialIds.push_back(table->materialIds[column]);
+            materialTotals.push_back(required[column]);
+        }
+        for (size_t row = 0; row < made.size(); row++) {
+            if (made[row] == 0) continue;
+            productIds.push_back(table->products[row]);
+            productTotals.push_back(made[row]);
+        }
+
+        vector<shared_ptr<StockCell>> materialCells, productCells;
+        int missingId = 0;
+        if (!rawMaterials->stockCells(materialIds, materialCells, missingId)) {
+            outcome.result = OP_NOT_FOUND;
+            outcome.detail = "Raw material " + to_string(missingId);
+            return outcome;
+        }
+        if (!products->stockCells(productIds, productCells, missingId)) {
+            outcome.result = OP_NOT_FOUND;
+            outcome.detail = "Product " + to_string(missingId);
+            return outcome;
+        }
+
+        StockTransaction transaction;
+        for (size_t i = 0; i < materialIds.size(); i++) {
+            transaction.add(materialCells[i], -materialTotals[i], materialIds[i]);
+        }
+        for (size_t i = 0; i < productIds.size(); i++) {
+            transaction.add(productCells[i], productTotals[i], -productIds[i]);
+        }
+
+        int failedTag = 0;
+        long long shortBy = 0;
+        outcome.result = transaction.commit(failedTag, shortBy);
+        if (outcome.result == OP_INSUFFICIENT_STOCK) {
+            Record material(0, "", 0, 0);
+            rawMaterials->findRecord(failedTag, material);
+            outcome.detail = "Raw material " + to_string(failedTag) + " (" + material.name +
+                             ") is short by " + to_string(shortBy);
+            return outcome;
+        }
+        if (outcome.result != OP_OK) {
+            outcome.detail = "Product " + to_string(-failedTag) + " would exceed the maximum quantity";
+            return outcome;
+        }
+
+        vector<int> materialDeltas, productDeltas;
+        for (long long total : materialTotals) materialDeltas.push_back((int)-total);
+        for (long long total : productTotals) productDeltas.push_back((int)total);
+        rawMaterials->stockChanged(materialIds, materialDeltas, MOVE_PRODUCTION, context.user);
+        products->stockChanged(productIds, productDeltas, MOVE_PRODUCTION, context.user);
+        if (context.journal) {
+            vector<FieldChange> changes;
+            for (size_t i = 0; i < materialIds.size(); i++) {
+                changes.push_back(FieldChange::quantity(INVENTORY_RAW, materialIds[i], 0, materialDeltas[i]));
+            }
+            for (size_t i = 0; i < productIds.size(); i++) {
+                changes.push_back(FieldChange::quantity(INVENTORY_PRODUCT, productIds[i], 0, productDeltas[i]));
+            }
+            context.journal->record(MOVE_PRODUCTION, changes);
+        }
+        for (long long total : productTotals) outcome.unitsProduced += total;
+        outcome.componentsUsed = materialIds.size();
+        return outcome;
+    }
+
+    ProductionOutcome produce(int productId, int units, const ChangeContext& context) {
+        return producePlan({{productId, units}}, context);
+    }
+
+    void displayProductionOutcome(const ProductionOutcome& outcome) {
+        if (outcome.result == OP_OK) {
+            cout << "Produced " << outcome.unitsProduced << " unit(s) using "
+                 << outcome.componentsUsed << " raw material(s)." << endl;
+        } else {
+            cout << "Production failed: " << describeResult(outcome.result)
+                 << (outcome.detail.empty() ? "" : " - " + outcome.detail) << endl;
+        }
+    }
+
+    // One line for an undo journal operation, e.g. "edit of raw material 3:
+    // quantity 10 -> 20, price $2.00 -> $3.00"
+    string describeOperation(MovementReason reason, const vector<FieldChange>& changes,
+                             const UndoJournal& journal) {
+        bool oneRecord = true;
+        for (const FieldChange& change : changes) {
+            oneRecord = oneRecord && change.recordId == changes[0].recordId &&
+                        change.inventory == changes[0].inventory;
+        }
+        string text = describeReason(reason);
+        if (!oneRecord) return text + " of " + to_string(changes.size()) + " records";
+
+        text += changes[0].inventory == INVENTORY_RAW ? " of raw material " : " of product ";
+        text += to_string(changes[0].recordId) + ":";
+        for (size_t i = 0; i < changes.size(); i++) {
+            const FieldChange& change = changes[i];
+            ostringstream field;
+            field << (i == 0 ? " " : ", ");
+            if (change.field == FIELD_NAME) {
+                field << "name " << journal.nameAt(change.before) << " -> " << journal.nameAt(change.after);
+            } else if (change.field == FIELD_PRICE) {
+                field << fixed << setprecision(2) << "price $" << bit_cast<double>(change.before)
+                      << " -> $" << bit_cast<double>(change.after);
+            } else if (reason == MOVE_EDIT) {
+                field << "quantity " << change.before << " -> " << change.after;
+            } else {
+                field << "quantity " << showpos << change.after - change.before << noshowpos;
+            }
+            const Inventory& inventory = change.inventory == INVENTORY_RAW ? *rawMaterials : *products;
+            if (change.field == FIELD_QUANTITY && inventory.locationCount() > 1 &&
+                change.location < inventory.locationCount()) {
+                field << " at " << inventory.locationName(change.location);
+            }
+            text += field.str();
+        }
+        return text;
+    }
+
+    // Sets a name or price to value while it still holds expected. Another
+    // user's quantity change only moves the version, so that is retried.
+    OpResult restoreField(const FieldChange& change, const UndoJournal& journal, int64_t expected, int64_t value,
+                          const string& user) {
+        Inventory* inventory = change.inventory == INVENTORY_RAW ? rawMaterials.get() : products.get();
+        ChangeContext untracked = {user, nullptr};
+        OpResult result = OP_CONFLICT;
+        for (int attempt = 0; attempt < 3 && result == OP_CONFLICT; attempt++) {
+            Record record(0, "", 0, 0);
+            if (!inventory->findRecord(change.recordId, record)) return OP_NOT_FOUND;
+            if (change.field == FIELD_NAME ? record.name != journal.nameAt(expected)
+                                           : bit_cast<int64_t>(record.price) != expected) {
+                return OP_CONFLICT;
+            }
+            result = inventory->editRecord(change.recordId, record.version(),
+                                           change.field == FIELD_NAME ? journal.nameAt(value) : "", 0,
+                                           change.field == FIELD_PRICE ? bit_cast<double>(value) : 0, true,
+                                           untracked);
+        }
+        return result;
+    }
+
+    // Takes back the newest change in the session's undo journal, or makes
+    // the newest undone one again. Quantities move by the difference, all in
+    // one transaction, so stock that other users moved since is kept. A name
+    // or price is only put back while it still holds the value the change
+    // gave it. Either every change is made and the journal moves on, or the
+    // ones already made are put back and the journal stays where it was.
+    UndoOutcome undo(const ChangeContext& context, bool redo) {
+        UndoOutcome outcome = {OP_OK, ""};
+        UndoJournal* journal = context.journal;
+        if (journal == nullptr || !(redo ? journal->canRedo() : journal->canUndo())) {
+            outcome.result = OP_NOT_FOUND;
+            outcome.detail = redo ? "Nothing to redo" : "Nothing to undo";
+            return outcome;
+        }
+        vector<FieldChange> changes = journal->nextChanges(redo);
+        outcome.detail = describeOperation(journal->next(redo).reason, changes, *journal);
+        Inventory* inventories[2] = {rawMaterials.get(), products.get()};
+
+        vector<size_t> fields;                      // indexes of the name and price changes
+        map<pair<int, int>, vector<size_t>> groups;  // quantity changes by (inventory, location)
+        for (size_t i = 0; i < changes.size(); i++) {
+            const FieldChange& change = changes[i];
+            int64_t from = redo ? change.before : change.after;
+            if (change.field == FIELD_QUANTITY) {
+                groups[{change.inventory, change.location}].push_back(i);
+                continue;
+            }
+            Record record(0, "", 0, 0);
+            if (!inventories[change.inventory]->findRecord(change.recordId, record)) {
+                outcome.result = OP_NOT_FOUND;
+            } else if (change.field == FIELD_NAME ? record.name != journal->nameAt(from)
+                                                  : bit_cast<int64_t>(record.price) != from) {
+                outcome.result = OP_CONFLICT;
+            }
+            if (outcome.result != OP_OK) {
+                outcome.detail = "Record " + to_string(change.recordId) + " was changed or deleted since";
+                return outcome;
+            }
+            fields.push_back(i);
+        }
+
+        // Tags are indexes into changes
+        StockTransaction transaction;
+        for (const auto& group : groups) {
+            Inventory* inventory = inventories[group.first.first];
+            size_t location = (size_t)group.first.second;
+            if (location >= inventory->locationCount()) {
+                outcome.result = OP_NOT_FOUND;
+                outcome.detail = "Location " + to_string(location + 1) + " no longer exists";
+                return outcome;
+            }
+            vector<int> ids;
+            for (size_t i : group.second) ids.push_back(changes[i].recordId);
+            vector<shared_ptr<StockCell>> cells;
+            int missingId = 0;
+            if (!inventory->stockCells(ids, cells, missingId, location)) {
+                outcome.result = OP_NOT_FOUND;
+                outcome.detail = "Record " + to_string(missingId) + " was deleted since";
+                return outcome;
+            }
+            for (size_t j = 0; j < cells.size(); j++) {
+                const FieldChange& change = changes[group.second[j]];
+                transaction.add(cells[j], redo ? change.after - change.before : change.before - change.after,
+                                (int)group.second[j]);
+            }
+        }
+
+        // Names and prices go first: they are what another user's edit can
+        // get in the way of, and unlike stock they can simply be put back
+        // if anything after them fails. The journal only holds changes this
+        // session was allowed to make.
+        vector<size_t> fieldsSet;
+        auto putFieldsBack = [&]() {
+            for (size_t i : fieldsSet) {
+                const FieldChange& change = changes[i];
+                restoreField(change, *journal, redo ? change.after : change.before,
+                             redo ? change.before : change.after, context.user);
+            }
+        };
+        for (size_t i : fields) {
+            const FieldChange& change = changes[i];
+            OpResult result = restoreField(change, *journal, redo ? change.before : change.after,
+                                           redo ? change.after : change.before, context.user);
+            if (result != OP_OK) {
+                putFieldsBack();
+                outcome.result = result;
+                outcome.detail = "Record " + to_string(change.recordId) + " was changed or deleted since";
+                return outcome;
+            }
+            fieldsSet.push_back(i);
+        }
+
+        int failedTag = 0;
+        long long shortBy = 0;
+        outcome.result = transaction.commit(failedTag, shortBy);
+        if (outcome.result != OP_OK) {
+            putFieldsBack();
+            outcome.detail = "Record " + to_string(changes[failedTag].recordId);
+            if (outcome.result == OP_INSUFFICIENT_STOCK) outcome.detail += " is short by " + to_string(shortBy);
+            return outcome;
+        }
+        MovementReason reason = redo ? MOVE_REDO : MOVE_UNDO;
+        map<pair<int, int>, pair<vector<int>, vector<int>>> applied;  // ids and deltas by group
+        for (const pair<int, long long>& change : transaction.applied()) {
+            const FieldChange& done = changes[change.first];
+            pair<vector<int>, vector<int>>& group = applied[{done.inventory, done.location}];
+            group.first.push_back(done.recordId);
+            group.second.push_back((int)change.second);
+        }
+        for (const auto& group : applied) {
+            inventories[group.first.first]->stockChanged(group.second.first, group.second.second, reason,
+                                                         context.user, (size_t)group.first.second);
+        }
+        journal->step(redo);
+        return outcome;
+    }
+
+    void runUndoMenu(const ChangeContext& context) {
+        bool menu = true;
+        while (menu) {
+            UndoJournal& journal = *context.journal;
+            cout << "\n ----- Undo / Redo ----- " << endl;
+            cout << "Last change: "
+                 << (journal.canUndo() ? describeOperation(journal.next(false).reason, journal.nextChanges(false), journal)
+                                       : "none") << endl;
+            cout << "Last undone: "
+                 << (journal.canRedo() ? describeOperation(journal.next(true).reason, journal.nextChanges(true), journal)
+                                       : "none") << endl;
+            cout << "1. Undo" << endl;
+            cout << "2. Redo" << endl;
+            cout << "3. Return to Previous Menu" << endl;
+
+            int choice = getValidIntInput("Enter your choice (1-3): ", 1);
+            if (choice == 1 || choice == 2) {
+                bool redo = choice == 2;
+                if (!(redo ? journal.canRedo() : journal.canUndo())) {
+                    cout << (redo ? "Nothing to redo." : "Nothing to undo.") << endl;
+                    continue;
+                }
+                UndoOutcome outcome = undo(context, redo);
+                if (outcome.result == OP_OK) {
+                    cout << (redo ? "Redone: " : "Undone: ") << outcome.detail << endl;
+                } else {
+                    cout << (redo ? "Redo" : "Undo") << " failed: " << describeResult(outcome.result)
+                         << " - " << outcome.detail << endl;
+                }
+            } else if (choice == 3) {
+                menu = false;
+            } else {
+                cout << "Invalid choice. Please try again." << endl;
+            }
+        }
+    }
+
+    // Asks for a location by its number in the list; -1 if there is none
+    int chooseLocation(const Inventory& inventory, const string& prompt) {
+        for (size_t i = 0; i < inventory.locationCount(); i++) {
+            cout << "  " << i + 1 << ". " << inventory.locationName(i) << (i == 0 ? " (home)" : "") << endl;
+        }
+        int choice = getValidIntInput(prompt, 1);
+        if (choice < 1 || (size_t)choice > inventory.locationCount()) {
+            cout << "No such location." << endl;
+            return -1;
+        }
+        return choice - 1;
+    }
+
+    // Stock by warehouse location. Stock movements are allowed for every
+    // role, so employees can transfer too.
+    void runWarehouseMenu(const ChangeContext& context) {
+        int which = getValidIntInput("Inventory (1 = raw materials, 2 = products): ", 1);
+        Inventory& inventory = which == 2 ? *products : *rawMaterials;
+        bool menu = true;
+        while (menu) {
+            cout << "\n ----- Warehouse Stock ----- " << endl;
+            cout << "1. Stock of a Record by Location" << endl;
+            cout << "2. Adjust Stock at a Location" << endl;
+            cout << "3. Transfer Between Locations" << endl;
+            cout << "4. Return to Previous Menu" << endl;
+
+            int choice = getValidIntInput("Enter your choice (1-4): ", 1);
+            if (choice == 4) {
+                menu = false;
+                continue;
+            }
+            if (choice < 1 || choice > 4) {
+                cout << "Invalid choice. Please try again." << endl;
+                continue;
+            }
+            int id = getValidIntInput("Enter record ID: ", 1);
+            int quantity = 0;
+            if (!inventory.quantityAt(0, id, quantity)) {
+                cout << "Record not found." << endl;
+                continue;
+            }
+
+            OpResult result = OP_OK;
+            if (choice == 1) {
+                long long total = 0;
+                for (size_t i = 0; i < inventory.locationCount(); i++) {
+                    inventory.quantityAt(i, id, quantity);
+                    total += quantity;
+                    cout << left << setw(20) << inventory.locationName(i) << quantity << endl;
+                }
+                cout << left << setw(20) << "Total" << total << endl;
+            } else if (choice == 2) {
+                int location = chooseLocation(inventory, "Location: ");
+                if (location < 0) continue;
+                int delta = getValidIntInput("Change (negative to remove stock): ", INT_MIN);
+                result = inventory.adjustAt((size_t)location, id, delta, context);
+            } else {
+                int from = chooseLocation(inventory, "From location: ");
+                if (from < 0) continue;
+                int to = chooseLocation(inventory, "To location: ");
+                if (to < 0) continue;
+                int units = getValidIntInput("Units to transfer: ", 1);
+                result = inventory.transfer(id, (size_t)from, (size_t)to, units, context);
+            }
+            if (result != OP_OK) {
+                cout << "Error: " << describeResult(result) << "." << endl;
+            } else if (choice != 1) {
+                cout << "Stock updated." << endl;
+            }
+        }
+    }
+
+    // Reads a query and shows the records of one inventory that match it
+    void runQuery(Inventory& inventory, bool isProduct) {
+        const size_t maxShown = 1000;
+        cout << "Fields: id, name, qty, price, value. Compare with = != < <= > >=, or name ~ \"text\"" << endl;
+        cout << "to match part of a name. Combine with and, or, not and parentheses." << endl;
+        cout << "Query: ";
+        string text;
+        getline(cin, text);
+
+        RecordQuery query;
+        string error;
+        if (!query.compile(text, error)) {
+            cout << "Invalid query: " << error << "." << endl;
+            return;
+        }
+        QueryResult result = inventory.findRecords(query, maxShown);
+        ReportManager::getInstance()->displayQueryResult(isProduct ? "PRODUCT SEARCH" : "RAW MATERIAL SEARCH",
+                                                         query, result);
+    }
+
+    static SortColumn chooseSortColumn(bool& descending) {
+        int column = getValidIntInput("Sort by (1 = name, 2 = quantity, 3 = price, 4 = value): ", 1);
+        descending = getValidIntInput("Order (1 = ascending, 2 = descending): ", 1) == 2;
+        switch (column) {
+            case 2: return SORT_QUANTITY;
+            case 3: return SORT_PRICE;
+            case 4: return SORT_VALUE;
+        }
+        return SORT_NAME;
+    }
+
+    void runSearchMenu() {
+        const size_t pageSize = 20;
+        bool menu = true;
+        while (menu) {
+            cout << "\n ----- Search and Sort Records ----- " << endl;
+            cout << "1. Search with a Query" << endl;
+            cout << "2. Sorted Listing" << endl;
+            cout << "3. Rank of a Record" << endl;
+            cout << "4. Find by Similar Name" << endl;
+            cout << "5. Return to Previous Menu" << endl;
+
+            int choice = getValidIntInput("Enter your choice (1-5): ", 1);
+            if (choice < 1 || choice > 4) {
+                menu = choice != 5;
+                if (menu) cout << "Invalid choice. Please try again." << endl;
+                continue;
+            }
+            int which = getValidIntInput("Inventory (1 = raw materials, 2 = products): ", 1);
+            Inventory& inventory = which == 2 ? *products : *rawMaterials;
+            string title = which == 2 ? "PRODUCTS" : "RAW MATERIALS";
+
+            if (choice == 1) {
+                runQuery(inventory, which == 2);
+            } else if (choice == 2) {
+                bool descending = false;
+                SortColumn column = chooseSortColumn(descending);
+                int page = getValidIntInput("Page (" + to_string(pageSize) + " records each): ", 1);
+                while (page > 0) {
+                    size_t total = 0;
+                    size_t first = (size_t)(page - 1) * pageSize;
+                    vector<Record> records = inventory.sortedPage(column, descending, first, pageSize, total);
+                    ReportManager::getInstance()->displaySortedPage(title, column, descending, records, first + 1,
+                                                                    total);
+                    page = getValidIntInput("Another page (0 to stop): ", 0);
+                }
+            } else if (choice == 4) {
+                const size_t maxShown = 20;
+                string name;
+                cout << "Enter a name, misspelt or partial: ";
+                getline(cin, name);
+                ReportManager::getInstance()->displaySimilarNames(title, name, inventory,
+                                                                  inventory.similarNames(name, maxShown));
+            } else {
+                bool descending = false;
+                SortColumn column = chooseSortColumn(descending);
+                int id = getValidIntInput("Enter record ID: ", 1);
+                size_t position = 0, total = 0;
+                if (!inventory.recordRank(column, descending, id, position, total)) {
+                    cout << "Record not found." << endl;
+                } else {
+                    cout << "Record " << id << " is number " << position << " of " << total << " by "
+                         << describeSortColumn(column) << (descending ? ", descending." : ", ascending.") << endl;
+                }
+            }
+        }
+    }
+
+    // Receiving raw materials at their actual cost, and the lots still open.
+    // Issues of any kind take units from the oldest lots.
+    void runLotMenu(const ChangeContext& context) {
+        const size_t maxShown = 1000;
+        if (!rawMaterials->tracksLots()) {
+            // Attached to a shared inventory: stock movements made here still
+            // reach the owner's lots, but receiving and listing them is done there
+            cout << "Lots are kept by the IMS process that owns the shared inventory; use it to receive or list lots." << endl;
+            return;
+        }
+        bool menu = true;
+        while (menu) {
+            cout << "\n ----- Raw Material Lots ----- " << endl;
+            cout << "1. Receive a Lot" << endl;
+            cout << "2. Open Lots of a Raw Material" << endl;
+            cout << "3. Return to Previous Menu" << endl;
+
+            int choice = getValidIntInput("Enter your choice (1-3): ", 1);
+            if (choice == 3) {
+                menu = false;
+            } else if (choice == 1) {
+                int id = getValidIntInput("Enter raw material ID: ", 1);
+                int quantity = getValidIntInput("Quantity received: ", 1);
+                double unitCost;
+                cout << "Unit cost: ";
+                if (!(cin >> unitCost)) {
+                    cin.clear();
+                    unitCost = 0;
+                }
+                clearInputBuffer();
+                OpResult result = rawMaterials->receiveLot(id, quantity, unitCost, context);
+                if (result == OP_OK) {
+                    cout << "Lot received." << endl;
+                } else {
+                    cout << "Error: " << describeResult(result) << "." << endl;
+                }
+            } else if (choice == 2) {
+                int id = getValidIntInput("Enter raw material ID: ", 1);
+                Record record(0, "", 0, 0);
+                if (!rawMaterials->findRecord(id, record)) {
+                    cout << "Record not found." << endl;
+                    continue;
+                }
+                vector<Lot> lots = rawMaterials->openLots(id, maxShown);
+                cout << left << setw(22) << "Received" << setw(12) << "Quantity" << "Unit Cost" << endl;
+                for (const Lot& lot : lots) {
+                    cout << left << setw(22) << (lot.receivedMicros == 0 ? "opening stock" : formatTimestamp(lot.receivedMicros))
+                         << setw(12) << lot.quantity << "$" << fixed << setprecision(2) << lot.unitCost << endl;
+                }
+                cout << lots.size() << " open lot(s) of " << record.name << ", FIFO value $" << fixed
+                     << setprecision(2) << rawMaterials->lotValue(id) << endl;
+                if (lots.size() == maxShown) cout << "Only the oldest " << maxShown << " are shown." << endl;
+            } else {
+                cout << "Invalid choice. Please try again." << endl;
+            }
+        }
+    }
+
+    // Applies a file of quantity changes, such as an end-of-shift stock count.
+    // Admins only: one file can rewrite every quantity in an inventory.
+    void runBatchUpdate(bool isAdmin, const ChangeContext& context) {
+        if (!isAdmin) {
+            cout << "Access denied. Only administrators can apply batch updates." << endl;
+            return;
+        }
+        int which = getValidIntInput("Inventory (1 = raw materials, 2 = products): ", 1);
+        Inventory& inventory = which == 2 ? *products : *rawMaterials;
+        cout << "Enter update file name (\"id quantity\", \"id +n\" or \"id -n\" per line): ";
+        string updateFile;
+        cin >> updateFile;
+        vector<QuantityAdjustment> adjustments;
+        string error;
+        if (!readAdjustments(updateFile, adjustments, error)) {
+            cout << "Error: " << error << "." << endl;
+            return;
+        }
+        if (adjustments.empty()) {
+            cout << "The file has no updates." << endl;
+            return;
+        }
+        if (!getConfirmation("Apply " + to_string(adjustments.size()) + " update(s) to " +
+                             (which == 2 ? "products" : "raw materials") + "?")) {
+            cout << "Operation cancelled." << endl;
+            return;
+        }
+
+        AdjustmentOutcome outcome = inventory.applyAdjustments(adjustments, context);
+        if (outcome.result != OP_OK) {
+            cout << "Nothing was changed: " << describeResult(outcome.result) << " - " << outcome.detail << endl;
+            return;
+        }
+        cout << "Applied " << adjustments.size() << " update(s), " << outcome.recordsChanged
+             << " record(s) changed, in " << fixed << setprecision(3) << outcome.applySeconds * 1000
+             << " ms." << endl;
+    }
+
+    void runProductionMenu(const ChangeContext& context) {
+        bool menu = true;
+        while (menu) {
+            cout << "\n ----- Production Menu ----- " << endl;
+            cout << "1. Produce a Product" << endl;
+            cout << "2. Run Production Plan File" << endl;
+            cout << "3. Return to Previous Menu" << endl;
+
+            int choice = getValidIntInput("Enter your choice (1-3): ", 1);
+            if (choice == 1) {
+                int productId = getValidIntInput("Enter product ID: ", 1);
+                displayBom(productId);
+                if (bom->linesFor(productId).empty()) continue;
+                int units = getValidIntInput("Enter units to produce: ", 1);
+                if (!getConfirmation("Are you sure you want to run this production?")) {
+                    cout << "Operation cancelled." << endl;
+                    continue;
+                }
+                displayProductionOutcome(produce(productId, units, context));
+            } else if (choice == 2) {
+                cout << "Enter plan file name: ";
+                string planFile;
+                cin >> planFile;
+                vector<ProductionLine> plan;
+                string error;
+                if (!readProductionPlan(planFile, plan, error)) {
+                    cout << "Error: " << error << "." << endl;
+                    continue;
+                }
+
+                auto start = chrono::steady_clock::now();
+                ProductionOutcome outcome = producePlan(plan, context);
+                double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+                displayProductionOutcome(outcome);
+                cout << plan.size() << " plan line(s) processed in " << fixed << setprecision(3)
+                     << ms << " ms." << endl;
+            } else if (choice == 3) {
+                menu = false;
+            } else {
+                cout << "Invalid choice. Please try again." << endl;
+            }
+        }
+    }
+
+    void displayBom(int productId) {
+        Record product(0, "", 0, 0);
+        if (!products->findRecord(productId, product)) {
+            cout << "Product with ID " << productId << " not found." << endl;
+            return;
+        }
+
+        vector<BomLine> lines = bom->linesFor(productId);
+        cout << "\n------ Bill of Materials: " << product.name << " ------" << endl;
+        if (lines.empty()) {
+            cout << "No components defined for this product." << endl;
+            return;
+        }
+        cout << left << setw(8) << "Raw ID" << setw(25) << "Raw Material" << "Qty per Unit" << endl;
+        cout << string(50, '-') << endl;
+        for (const BomLine& line : lines) {
+            Record material(0, "", 0, 0);
+            string name = rawMaterials->findRecord(line.rawMaterialId, material) ? material.name : "(deleted)";
+            cout << left << setw(8) << line.rawMaterialId << setw(25) << name << line.quantityPerUnit << endl;
+        }
+        cout << string(50, '-') << endl;
+    }
+
+    void runBomMenu(bool isAdmin) {
+        bool menu = true;
+        while (menu) {
+            cout << "\n ----- Bill of Materials Menu ----- " << endl;
+            cout << "1. View Product Components" << endl;
+            if (isAdmin) {
+                cout << "2. Set Component Quantity" << endl;
+                cout << "3. Return to Previous Menu" << endl;
+            } else {
+                cout << "2. Return to Previous Menu" << endl;
+            }
+
+            int choice = getValidIntInput(isAdmin ? "Enter your choice (1-3): " : "Enter your choice (1-2): ", 1);
+            if (choice == 1) {
+                displayBom(getValidIntInput("Enter product ID: ", 1));
+            } else if (isAdmin && choice == 2) {
+                int productId = getValidIntInput("Enter product ID: ", 1);
+                int rawMaterialId = getValidIntInput("Enter raw material ID: ", 1);
+                int quantity = getValidIntInput("Enter units used per product (0 removes it): ", 0);
+                OpResult result = setBomLine(productId, rawMaterialId, quantity, isAdmin);
+                if (result == OP_OK) {
+                    cout << "Bill of materials updated." << endl;
+                    displayBom(productId);
+                } else {
+                    cout << describeResult(result) << endl;
+                }
+            } else if (choice == (isAdmin ? 3 : 2)) {
+                menu = false;
+            } else {
+                cout << "Invalid choice. Please try again." << endl;
+            }
+        }
+    }
+    
+    void runInventoryMenu(bool isAdmin, const ChangeContext& context) {
+        bool menu = true;
+        while (menu) {
+            cout << "\n ----- Inventory Management Menu ----- " << endl;
+            cout << "1. Raw Material Inventory" << endl;
+            cout << "2. Product Inventory" << endl;
+            cout << "3. Bills of Materials" << endl;
+            cout << "4. Production" << endl;
+            if (isAdmin) cout << "5. Batch Quantity Update" << endl;
+            cout << "6. Undo / Redo" << endl;
+            cout << "7. Warehouse Stock and Transfers" << endl;
+            cout << "8. Raw Material Lots" << endl;
+            cout << "9. Search and Sort Records" << endl;
+            cout << "10. Return to Main Menu" << endl;
+
+            int choice = getValidIntInput("Enter your choice (1-10): ", 1);
+            switch (choice) {
+                case 1: rawMaterials->displayMenu(isAdmin, context); break;
+                case 2: products->displayMenu(isAdmin, context); break;
+                case 3: runBomMenu(isAdmin); break;
+                case 4: runProductionMenu(context); break;
+                case 5: runBatchUpdate(isAdmin, context); break;
+                case 6: runUndoMenu(context); break;
+                case 7: runWarehouseMenu(context); break;
+                case 8: runLotMenu(context); break;
+                case 9: runSearchMenu(); break;
+                case 10:
+                    if (getConfirmation("Are you sure you want to return to the main menu?")) 
+                        menu = false;
+                    break;
+                default: cout << "Invalid choice. Please try again." << endl;
+            }
+        }
+    }
+};
+
+// Initialize static member
+InventoryManager* InventoryManager::instance = nullptr;
+StorageMode InventoryManager::storageMode = STORAGE_LOCAL;
+
+// ================= MENU SYSTEM =================
+
+void adminUserManagementMenu() {
+    UserManager* userManager = UserManager::getInstance();
+    
+    while (true) {
+        cout << "\n--- Admin User Management ---\n";
+        cout << "1. List Admins\n2. List Employees\n3. Add Admin\n4. Add Employee\n";
+        cout << "5. Edit Admin\n6. Edit Employee\n7. Delete Admin\n8. Delete Employee\n0. Back\nChoice: ";
+        
+        int choice;
+        cin >> choice;
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        
+        switch (choice) {
+            case 1: userManager->listUsers(true); break;
+            case 2: userManager->listUsers(false); break;
+            case 3: userManager->addUser(true); break;
+            case 4: userManager->addUser(false); break;
+            case 5: userManager->editUser(true); break;
+            case 6: userManager->editUser(false); break;
+            case 7: userManager->deleteUser(true); break;
+            case 8: userManager->deleteUser(false); break;
+            case 0: return;
+            default: cout << "Invalid choice.\n";
+        }
+    }
+}
+
+void adminMenu(const string& username) {
+    InventoryManager* inventoryManager = InventoryManager::getInstance();
+    ReportManager* reportManager = ReportManager::getInstance();
+    UndoJournal journal;  // lives as long as the login
+    ChangeContext context = {username, &journal};
+    
+    bool adminSession = true;
+    while (adminSession) {
+        cout << "\n--------------------------------" << endl;
+        cout << "|       ADMIN DASHBOARD        |" << endl;
+        cout << "--------------------------------" << endl;
+        cout << "1. Manage Inventory" << endl;
+        cout << "2. Manage Users" << endl;
+        cout << "3. Reports" << endl;
+        cout << "4. Logout" << endl;
+        
+        int adminChoice = getValidIntInput("Enter your choice (1-4): ", 1);
+        switch (adminChoice) {
+            case 1: inventoryManager->runInventoryMenu(true, context); break;
+            case 2: adminUserManagementMenu(); break;
+            case 3:
+                reportManager->reportUI(*inventoryManager->getInventory("raw"),
+                                        *inventoryManager->getInventory("product"),
+                                        inventoryManager->getBom());
+                break;
+            case 4:
+                if (getConfirmation("Are you sure you want to logout?")) {
+                    cout << "Logging out from admin account..." << endl;
+                    adminSession = false;
+                }
+                break;
+            default: cout << "Invalid choice. Please try again." << endl; break;
+        }
+    }
+}
+
+void employeeMenu(const string& username) {
+    InventoryManager* inventoryManager = InventoryManager::getInstance();
+    UndoJournal journal;
+    ChangeContext context = {username, &journal};
+    
+    bool empSession = true;
+    while (empSession) {
+        cout << "\n--------------------------------" << endl;
+        cout << "|      EMPLOYEE DASHBOARD      |" << endl;
+        cout << "--------------------------------" << endl;
+        cout << "1. Manage Inventory" << endl;
+        cout << "2. Logout" << endl;
+        
+        int empChoice = getValidIntInput("Enter your choice (1-2): ", 1);
+        switch (empChoice) {
+            case 1: inventoryManager->runInventoryMenu(false, context); break;
+            case 2:
+                if (getConfirmation("Are you sure you want to logout?")) {
+                    cout << "Logging out from employee account..." << endl;
+                    empSession = false;
+                }
+                break;
+            default: cout << "Invalid choice. Please try again." << endl; break;
+        }
+    }
+}
+
+// ================= SERVER MODE =================
+//
+// "try --server [socket]" runs a daemon that owns both inventories and serves
+// clients over a Unix socket; "try --connect [socket]" is a line client for it.
+// Every session logs in separately and keeps its own role, so admins and
+// employees get the same permissions they have in the menus.
+//
+// Requests are single lines; every response is "OK ...", "ERR ..." or
+// "MORE ...", optionally followed by data lines, and always terminated by a
+// "." line. "MORE <prompt>" means a guided flow wants the next answer.
+//
+// Sessions are coroutines on one epoll loop; commands run on a worker pool.
+// A session waiting for its client holds no thread.
+//
+//   LOGIN <username> <password>
+//   LOGOUT
+//   LIST <raw|product>                                  id|name|quantity|price|version lines
+//   FIND <raw|product> <query>                          the same lines for records matching a query,
+//                                                       e.g. qty < 100 and name ~ "Fabric"; replies
+//                                                       with the number of matches
+//   SIMILAR <raw|product> <name>                        distance|id|name|quantity|price|version lines
+//                                                       for the 20 names closest to a misspelt one
+//   PAGE <raw|product> <column> <asc|desc> <page> [size]
+//                                                       record lines of one page sorted by name,
+//                                                       qty, price or value; 20 per page by default;
+//                                                       replies with the number of records
+//   RANK <raw|product> <column> <asc|desc> <id>         "<position> <total>" of a record in that order
+//   RANGE <raw|product> <qty|price|value> <low> <high>  record lines with the key in [low, high], in
+//                                                       key order; replies with the number of them
+//   GET <raw|product> <id>
+//   ADD <raw|product> <quantity> <price> <name>         admin only
+//   ADD <raw|product>                                   guided: prompts for each field and a y/n
+//   EDIT <raw|product> <id> <version> <quantity> <price> [name]
+//                                                       version is the one GET/LIST returned;
+//                                                       0 keeps the current value;
+//                                                       employees may only change quantity
+//   EDIT <raw|product> <id>                             guided: shows the record, prompts for
+//                                                       new values and a y/n
+//   ADJUST <raw|product> <id> <delta> [location]        add or remove stock; never below zero
+//   RESERVE <raw|product> <id> <n> [location]           take n units only if all are available;
+//                                                       both default to the home location
+//   TRANSFER <raw|product> <id> <from> <to> <n>         move n units between locations atomically
+//   STOCK <raw|product> <id>                            location|quantity lines and the total
+//   LOCATIONS                                           warehouse names, the home location first
+//   RECEIVE <raw id> <quantity> <unit cost>             raw material stock arriving as a new lot
+//   LOTS <raw id>                                       received|quantity|unit_cost lines, oldest first
+//   FORECAST <raw|product> <id>                         daily_demand|deviation|safety_stock|
+//                                                       reorder_point|lead_days|days_observed
+//   LEADTIME <raw|product> <id> <days>                  replenishment lead time; admin only
+//   DELETE <raw|product> <id>                           admin only
+//   BATCH <raw|product> <id> <quantity|+n|-n> [...]     sets or changes many quantities at once,
+//                                                       all or nothing; replies with records changed
+//   REPORT <raw|product>                                admin only
+//   REPORT shortage <product id> <units> [...]          raw material requirements of a demand; admin only
+//   REPORT locations <raw|product>                      stock at every location; admin only
+//   REPORT reorder <raw|product>                        records at or below their reorder point;
+//                                                       admin only
+//   REPORT range <raw|product> <qty|price|value> <low> <high>
+//                                                       records with the key in [low, high]; admin only
+//   LEDGER <raw|product> <id>                           time|user|id|delta|reason lines for a record;
+//                                                       admin only
+//   LEDGER <raw|product> <from> <to>                    movements in [from, to); times as
+//                                                       YYYY-MM-DD or YYYY-MM-DDTHH:MM:SS; admin only
+//   STATS <raw|product>                                 persistence queue metrics, admin only
+//   STATS workers                                       task scheduler utilization, admin only
+//   BOM <product id>                                    raw_id|qty_per_unit lines
+//   BOM <product id> <raw id> <qty per unit>            set a component, 0 removes it; admin only
+//   PRODUCE <product id> <units> [<product id> <units> ...]
+//                                                       consumes raw materials per the BOMs and
+//                                                       adds the products, all or nothing
+//   UNDO                                                takes back this session's last edit or stock
+//                                                       change; replies with what it was
+//   REDO                                                makes the last undone change again
+//   HELP
+//   QUIT
+
+const char* DEFAULT_SOCKET_PATH = "ims.sock";
+const char* DATA_LOCK_FILE = "ims.lock";
+
+#ifndef _WIN32
+
+// Takes an exclusive lock on the data directory so only one process (either
+// an interactive IMS or a server) owns the inventory files at a time
+bool acquireDataLock() {
+    int fd = open(DATA_LOCK_FILE, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return false;
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        close(fd);
+        return false;
+    }
+    // Deliberately kept open: the lock is released when the process exits
+    return true;
+}
+
+#else
+
+bool acquireDataLock() {
+    return true;
+}
+
+#endif
+
+#ifdef __linux__
+
+// Fixed-size pool of threads that runs submitted jobs in FIFO order
+class WorkerPool {
+private:
+    vector<thread> workers;
+    queue<function<void()>> jobs;
+    mutex queueMutex;
+    condition_variable jobAvailable;
+    bool stopping;
+
+    void workerLoop() {
+        while (true) {
+            function<void()> job;
+            {
+                unique_lock<mutex> lock(queueMutex);
+                jobAvailable.wait(lock, [this]() { return stopping || !jobs.empty(); });
+                if (jobs.empty()) return;
+                job = move(jobs.front());
+                jobs.pop();
+            }
+            job();
+        }
+    }
+
+public:
+    explicit WorkerPool(size_t count) : stopping(false) {
+        for (size_t i = 0; i < count; i++) {
+            workers.emplace_back([this]() { workerLoop(); });
+        }
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // Runs whatever is still queued, then joins the workers
+    ~WorkerPool() {
+        {
+            lock_guard<mutex> lock(queueMutex);
+            stopping = true;
+        }
+        jobAvailable.notify_all();
+        for (thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    void submit(function<void()> job) {
+        {
+            lock_guard<mutex> lock(queueMutex);
+            jobs.push(move(job));
+        }
+        jobAvailable.notify_one();
+    }
+};
+
+// ---- Coroutine plumbing ----
+
+// Promise parts shared by every Task
+struct TaskPromiseBase {
+    coroutine_handle<> continuation;
+
+    // Hands control straight back to whoever awaited the finished task
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+
+        template <typename Promise>
+        coroutine_handle<> await_suspend(coroutine_handle<Promise> finished) noexcept {
+            coroutine_handle<> next = finished.promise().continuation;
+            return next ? next : noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { terminate(); }
+};
+
+template <typename T>
+struct TaskResult {
+    optional<T> value;
+    void return_value(T result) { value = move(result); }
+    T take() { return move(*value); }
+};
+
+template <>
+struct TaskResult<void> {
+    void return_void() {}
+    void take() {}
+};
+
+// Lazily started coroutine. Awaiting a Task runs it and resumes the awaiting
+// coroutine with its result; the Task owns the frame and frees it.
+template <typename T = void>
+class Task {
+public:
+    struct promise_type : TaskPromiseBase, TaskResult<T> {
+        Task get_return_object() {
+            return Task(coroutine_handle<promise_type>::from_promise(*this));
+        }
+    };
+
+    Task() : handle(nullptr) {}
+    Task(Task&& other) noexcept : handle(exchange(other.handle, nullptr)) {}
+
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            reset();
+            handle = exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() {
+        reset();
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    coroutine_handle<> await_suspend(coroutine_handle<> awaiting) noexcept {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+
+    T await_resume() {
+        return handle.promise().take();
+    }
+
+    // For a top-level task driven by the event loop
+    void start() { handle.resume(); }
+    bool done() const { return !handle || handle.done(); }
+
+private:
+    coroutine_handle<promise_type> handle;
+
+    explicit Task(coroutine_handle<promise_type> h) : handle(h) {}
+
+    void reset() {
+        if (handle) {
+            handle.destroy();
+            handle = nullptr;
+        }
+    }
+};
+
+// ---- Protocol ----
+
+// State of one logged-in (or not yet logged-in) client
+struct Session {
+    int fd;
+    string username;
+    bool loggedIn;
+    bool isAdmin;
+    UndoJournal journal;  // cleared by LOGOUT with the rest of the session
+
+    explicit Session(int _fd) : fd(_fd), loggedIn(false), isAdmin(false) {}
+
+    ChangeContext context() { return {username, &journal}; }
+};
+
+mutex serverLogMutex;
+atomic<bool> serverLogEnabled(true);
+
+void serverLog(const string& message) {
+    if (!serverLogEnabled) return;
+    lock_guard<mutex> lock(serverLogMutex);
+    cout << message << endl;
+}
+
+// Blocking helpers for the client side of the protocol
+bool writeAll(int fd, const string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        sent += (size_t)n;
+    }
+    return true;
+}
+
+// Reads one '\n'-terminated line, keeping any extra bytes in buffer for the next call
+bool readLine(int fd, string& buffer, string& line) {
+    while (true) {
+        size_t newline = buffer.find('\n');
+        if (newline != string::npos) {
+            line = buffer.substr(0, newline);
+            buffer.erase(0, newline + 1);
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            return true;
+        }
+        char chunk[4096];
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) return false;
+        buffer.append(chunk, (size_t)n);
+    }
+}
+
+string okResponse(const string& text = "", const string& body = "") {
+    return "OK" + (text.empty() ? "" : " " + text) + "\n" + body + ".\n";
+}
+
+string errResponse(const string& text) {
+    return "ERR " + text + "\n.\n";
+}
+
+// Asks the client for the next step of a guided flow
+string promptResponse(const string& text, const string& body = "") {
+    return "MORE " + text + "\n" + body + ".\n";
+}
+
+string formatRecordLine(const Record& record) {
+    stringstream ss;
+    ss << record.id << "|" << record.name << "|" << record.quantity() << "|"
+       << fixed << setprecision(2) << record.price << "|" << record.version() << "\n";
+    return ss.str();
+}
+
+// Rest of the line after the stream's current position, minus the separating space
+string restOfLine(stringstream& ss) {
+    string rest;
+    getline(ss, rest);
+    size_t first = rest.find_first_not_of(' ');
+    return first == string::npos ? "" : rest.substr(first);
+}
+
+// Parses a whole answer as one number; trailing text makes it invalid
+template <typename T>
+bool parseAnswer(const string& text, T& value) {
+    stringstream ss(text);
+    string rest;
+    return (ss >> value) && !(ss >> rest);
+}
+
+bool isYes(const string& answer) {
+    return answer == "y" || answer == "Y" || answer == "yes";
+}
+
+// Executes one protocol command for a session and returns the full response
+string handleCommand(Session& session, const string& line) {
+    stringstream ss(line);
+    string command;
+    ss >> command;
+    for (char& c : command) c = (char)toupper((unsigned char)c);
+
+    if (command.empty()) return errResponse("Empty command");
+
+    if (command == "HELP") {
+        return okResponse("", "LOGIN LOGOUT LIST FIND SIMILAR PAGE RANK RANGE GET ADD EDIT ADJUST RESERVE DELETE REPORT STATS LEDGER BATCH TRANSFER STOCK LOCATIONS RECEIVE LOTS FORECAST LEADTIME BOM PRODUCE UNDO REDO HELP QUIT\n");
+    }
+
+    if (command == "LOGIN") {
+        string username, password;
+        ss >> username >> password;
+        string userType = UserManager::getInstance()->checkCredentials(username, password);
+        if (userType.empty()) return errResponse("Invalid username or password");
+        session.username = username;
+        session.loggedIn = true;
+        session.isAdmin = (userType == "admin");
+        return okResponse(userType);
+    }
+
+    if (!session.loggedIn) return errResponse("Not logged in");
+
+    if (command == "LOGOUT") {
+        session = Session(session.fd);
+        return okResponse();
+    }
+
+    if (command == "UNDO" || command == "REDO") {
+        bool redo = command == "REDO";
+        if (!(redo ? session.journal.canRedo() : session.journal.canUndo())) {
+            return errResponse(redo ? "Nothing to redo" : "Nothing to undo");
+        }
+        UndoOutcome outcome = InventoryManager::getInstance()->undo(session.context(), redo);
+        if (outcome.result != OP_OK) {
+            return errResponse(string(describeResult(outcome.result)) + ": " + outcome.detail);
+        }
+        return okResponse(outcome.detail);
+    }
+
+    if (command == "RECEIVE") {
+        int id, quantity;
+        double unitCost;
+        if (!(ss >> id >> quantity >> unitCost)) return errResponse("Usage: RECEIVE <raw id> <quantity> <unit cost>");
+        Inventory* rawMaterials = InventoryManager::getInstance()->getInventory("raw");
+        OpResult result = rawMaterials->receiveLot(id, quantity, unitCost, session.context());
+        if (result != OP_OK) return errResponse(describeResult(result));
+        Record record(0, "", 0, 0);
+        rawMaterials->findRecord(id, record);
+        return okResponse(to_string(record.quantity()));
+    }
+
+    if (command == "LOTS") {
+        const size_t maxLines = 10000;
+        int id;
+        if (!(ss >> id)) return errResponse("Usage: LOTS <raw id>");
+        Inventory* rawMaterials = InventoryManager::getInstance()->getInventory("raw");
+        Record record(0, "", 0, 0);
+        if (!rawMaterials->findRecord(id, record)) return errResponse(describeResult(OP_NOT_FOUND));
+        string body;
+        vector<Lot> lots = rawMaterials->openLots(id, maxLines);
+        for (const Lot& lot : lots) {
+            ostringstream line;
+            line << (lot.receivedMicros == 0 ? "opening" : formatTimestamp(lot.receivedMicros)) << "|" << lot.quantity
+                 << "|" << fixed << setprecision(2) << lot.unitCost << "\n";
+            body += line.str();
+        }
+        return okResponse(to_string(lots.size()), body);
+    }
+
+    if (command == "LOCATIONS") {
+        const Inventory* inventory = InventoryManager::getInstance()->getInventory("raw");
+        string body;
+        for (size_t i = 0; i < inventory->locationCount(); i++) body += inventory->locationName(i) + "\n";
+        return okResponse(to_string(inventory->locationCount()), body);
+    }
+
+    if (command == "BOM") {
+        int productId, rawMaterialId, quantityPerUnit;
+        if (!(ss >> productId)) return errResponse("Usage: BOM <product id> [<raw id> <qty per unit>]");
+        InventoryManager* manager = InventoryManager::getInstance();
+        if (ss >> rawMaterialId >> quantityPerUnit) {
+            OpResult result = manager->setBomLine(productId, rawMaterialId, quantityPerUnit, session.isAdmin);
+            if (result != OP_OK) return errResponse(describeResult(result));
+            return okResponse();
+        }
+        Record record(0, "", 0, 0);
+        if (!manager->getInventory("product")->findRecord(productId, record)) {
+            return errResponse(describeResult(OP_NOT_FOUND));
+        }
+        string body;
+        for (const BomLine& line : manager->getBom().linesFor(productId)) {
+            body += to_string(line.rawMaterialId) + "|" + to_string(line.quantityPerUnit) + "\n";
+        }
+        return okResponse("", body);
+    }
+
+    if (command == "PRODUCE") {
+        vector<int> numbers;
+        int number;
+        while (ss >> number) numbers.push_back(number);
+        vector<ProductionLine> plan;
+        for (size_t i = 0; i + 1 < numbers.size(); i += 2) plan.push_back({numbers[i], numbers[i + 1]});
+        if (plan.empty() || !ss.eof() || numbers.size() % 2 != 0) return errResponse("Usage: PRODUCE <product id> <units> [<product id> <units> ...]");
+        ProductionOutcome outcome = InventoryManager::getInstance()->producePlan(plan, session.context());
+        if (outcome.result != OP_OK) {
+            return errResponse(string(describeResult(outcome.result)) + (outcome.detail.empty() ? "" : ": " + outcome.detail));
+        }
+        return okResponse(to_string(outcome.unitsProduced));
+    }
+
+    string kind;
+    ss >> kind;
+
+    if (command == "REPORT" && kind == "shortage") {
+        if (!session.isAdmin) return errResponse(describeResult(OP_DENIED));
+        vector<int> numbers;
+        int number;
+        while (ss >> number) numbers.push_back(number);
+        vector<ProductionLine> demand;
+        for (size_t i = 0; i + 1 < numbers.size(); i += 2) demand.push_back({numbers[i], numbers[i + 1]});
+        if (demand.empty() || !ss.eof() || numbers.size() % 2 != 0) {
+            return errResponse("Usage: REPORT shortage <product id> <units> [<product id> <units> ...]");
+        }
+        InventoryManager* manager = InventoryManager::getInstance();
+        stringstream report;
+        ReportManager::getInstance()->displayShortageReport(demand, manager->getBom(),
+                                                            *manager->getInventory("raw"), report);
+        return okResponse("", report.str());
+    }
+
+    if (command == "REPORT" && kind == "locations") {
+        if (!session.isAdmin) return errResponse(describeResult(OP_DENIED));
+        string which;
+        ss >> which;
+        Inventory* inventory = InventoryManager::getInstance()->getInventory(which);
+        if (inventory == nullptr) return errResponse("Usage: REPORT locations <raw|product>");
+        stringstream report;
+        ReportManager::getInstance()->displayLocationReport(which == "raw" ? "RAW MATERIAL STOCK BY LOCATION"
+                                                                           : "PRODUCT STOCK BY LOCATION",
+                                                            *inventory, report);
+        return okResponse("", report.str());
+    }
+
+    if (command == "REPORT" && kind == "reorder") {
+        if (!session.isAdmin) return errResponse(describeResult(OP_DENIED));
+        string which;
+        ss >> which;
+        Inventory* inventory = InventoryManager::getInstance()->getInventory(which);
+        if (inventory == nullptr) return errResponse("Usage: REPORT reorder <raw|product>");
+        stringstream report;
+        ReportManager::getInstance()->displayReorderReport(which == "raw" ? "RAW MATERIAL REORDER REPORT"
+                                                                          : "PRODUCT REORDER REPORT",
+                                                           *inventory, report);
+        return okResponse("", report.str());
+    }
+
+    if (command == "REPORT" && kind == "range") {
+        if (!session.isAdmin) return errResponse(describeResult(OP_DENIED));
+        string which, columnName;
+        SortColumn column;
+        double low, high;
+        ss >> which >> columnName;
+        Inventory* inventory = InventoryManager::getInstance()->getInventory(which);
+        if (inventory == nullptr || !parseSortColumn(columnName, column) || column == SORT_NAME ||
+            !(ss >> low >> high)) {
+            return errResponse("Usage: REPORT range <raw|product> <qty|price|value> <low> <high>");
+        }
+        stringstream report;
+        ReportManager::getInstance()->displayRangeReport(which == "raw" ? "RAW MATERIAL RANGE REPORT"
+                                                                        : "PRODUCT RANGE REPORT",
+                                                         *inventory, column, low, high, report);
+        return okResponse("", report.str());
+    }
+
+    if (command == "STATS" && kind == "workers") {
+        if (!session.isAdmin) return errResponse(describeResult(OP_DENIED));
+        stringstream body;
+        TaskScheduler::getInstance()->displayStats(body);
+        return okResponse("", body.str());
+    }
+
+    Inventory* inventory = InventoryManager::getInstance()->getInventory(kind);
+    if (inventory == nullptr) return errResponse("Unknown inventory '" + kind + "' (use raw or product)");
+
+    if (command == "LIST") {
+        string body;
+        for (const Record& record : inventory->listRecords()) {
+            body += formatRecordLine(record);
+        }
+        return okResponse("", body);
+    }
+
+    if (command == "GET") {
+        int id;
+        Record record(0, "", 0, 0);
+        if (!(ss >> id)) return errResponse("Usage: GET <raw|product> <id>");
+        if (!inventory->findRecord(id, record)) return errResponse(describeResult(OP_NOT_FOUND));
+        return okResponse("", formatRecordLine(record));
+    }
+
+    if (command == "ADD") {
+        int quantity;
+        double price;
+        if (!(ss >> quantity >> price)) return errResponse("Usage: ADD <raw|product> <quantity> <price> <name>");
+        int newId = 0;
+        OpResult result = inventory->addRecord(restOfLine(ss), quantity, price, session.isAdmin, session.context(), newId);
+        if (result != OP_OK) return errResponse(describeResult(result));
+        return okResponse(to_string(newId));
+    }
+
+    if (command == "EDIT") {
+        int id, quantity;
+        uint32_t version;
+        double price;
+        if (!(ss >> id >> version >> quantity >> price)) {
+            return errResponse("Usage: EDIT <raw|product> <id> <version> <quantity> <price> [name]");
+        }
+        OpResult result = inventory->editRecord(id, version, restOfLine(ss), quantity, price, session.isAdmin,
+                                                 session.context());
+        if (result != OP_OK) return errResponse(describeResult(result));
+        Record record(0, "", 0, 0);
+        inventory->findRecord(id, record);
+        return okResponse(to_string(record.version()));
+    }
+
+    if (command == "ADJUST" || command == "RESERVE") {
+        int id, amount;
+        if (!(ss >> id >> amount)) return errResponse("Usage: " + command + " <raw|product> <id> <amount> [location]");
+        string locationName;
+        int location = ss >> locationName ? inventory->findLocation(locationName) : 0;
+        if (location < 0) return errResponse("Unknown location '" + locationName + "'");
+        OpResult result = (command == "ADJUST") ? inventory->adjustAt(location, id, amount, session.context())
+                                                : inventory->reserveAt(location, id, amount, session.context());
+        if (result != OP_OK) return errResponse(describeResult(result));
+        int quantity = 0;
+        inventory->quantityAt(location, id, quantity);
+        return okResponse(to_string(quantity));
+    }
+
+    if (command == "TRANSFER") {
+        int id, units;
+        string fromName, toName;
+        if (!(ss >> id >> fromName >> toName >> units)) {
+            return errResponse("Usage: TRANSFER <raw|product> <id> <from> <to> <n>");
+        }
+        int from = inventory->findLocation(fromName);
+        int to = inventory->findLocation(toName);
+        if (from < 0 || to < 0) return errResponse("Unknown location '" + (from < 0 ? fromName : toName) + "'");
+        OpResult result = inventory->transfer(id, from, to, units, session.context());
+        if (result != OP_OK) return errResponse(describeResult(result));
+        return okResponse();
+    }
+
+    if (command == "FIND") {
+        const size_t maxLines = 10000;
+        RecordQuery query;
+        string error;
+        if (!query.compile(restOfLine(ss), error)) return errResponse("Invalid query: " + error);
+        QueryResult result = inventory->findRecords(query, maxLines);
+        string body;
+        for (const Record& record : result.records) body += formatRecordLine(record);
+        return okResponse(to_string(result.matched), body);
+    }
+
+    if (command == "SIMILAR") {
+        const size_t maxLines = 20;
+        string name = restOfLine(ss);
+        if (name.empty()) return errResponse("Usage: SIMILAR <raw|product> <name>");
+        string body;
+        vector<NameMatch> matches = inventory->similarNames(name, maxLines);
+        for (const NameMatch& match : matches) {
+            Record record(0, "", 0, 0);
+            if (!inventory->findRecord(match.id, record)) continue;
+            body += to_string(match.distance) + "|" + formatRecordLine(record);
+        }
+        return okResponse(to_string(matches.size()), body);
+    }
+
+    if (command == "PAGE" || command == "RANK") {
+        const size_t maxPageSize = 10000;
+        string columnName, order;
+        SortColumn column;
+        ss >> columnName >> order;
+        bool descending = order == "desc";
+        bool valid = parseSortColumn(columnName, column) && (descending || order == "asc");
+        if (command == "RANK") {
+            int id;
+            size_t position = 0, total = 0;
+            if (!valid || !(ss >> id)) return errResponse("Usage: RANK <raw|product> <column> <asc|desc> <id>");
+            if (!inventory->recordRank(column, descending, id, position, total)) {
+                return errResponse(describeResult(OP_NOT_FOUND));
+            }
+            return okResponse(to_string(position) + " " + to_string(total));
+        }
+        int page;
+        size_t pageSize = 20;
+        if (!valid || !(ss >> page) || page < 1 || (ss >> pageSize && (pageSize < 1 || pageSize > maxPageSize))) {
+            return errResponse("Usage: PAGE <raw|product> <column> <asc|desc> <page> [size]");
+        }
+        size_t total = 0;
+        string body;
+        for (const Record& record : inventory->sortedPage(column, descending, (page - 1) * pageSize, pageSize, total)) {
+            body += formatRecordLine(record);
+        }
+        return okResponse(to_string(total), body);
+    }
+
+    if (command == "RANGE") {
+        const size_t maxLines = 10000;
+        string columnName;
+        SortColumn column;
+        double low, high;
+        ss >> columnName;
+        if (!parseSortColumn(columnName, column) || column == SORT_NAME || !(ss >> low >> high)) {
+            return errResponse("Usage: RANGE <raw|product> <qty|price|value> <low> <high>");
+        }
+        size_t total = 0;
+        string body;
+        for (const Record& record : inventory->recordsInRange(column, low, high, maxLines, total)) {
+            body += formatRecordLine(record);
+        }
+        return okResponse(to_string(total), body);
+    }
+
+    if (command == "STOCK") {
+        int id, quantity = 0;
+        if (!(ss >> id)) return errResponse("Usage: STOCK <raw|product> <id>");
+        string body;
+        long long total = 0;
+        for (size_t i = 0; i < inventory->locationCount(); i++) {
+            if (!inventory->quantityAt(i, id, quantity)) return errResponse(describeResult(OP_NOT_FOUND));
+            body += inventory->locationName(i) + "|" + to_string(quantity) + "\n";
+            total += quantity;
+        }
+        return okResponse(to_string(total), body);
+    }
+
+    if (command == "FORECAST") {
+        int id;
+        Record record(0, "", 0, 0);
+        if (!(ss >> id)) return errResponse("Usage: FORECAST <raw|product> <id>");
+        if (!inventory->findRecord(id, record)) return errResponse(describeResult(OP_NOT_FOUND));
+        DemandForecastResult forecast = inventory->demandForecast(id);
+        ostringstream line;
+        line << fixed << setprecision(2) << forecast.dailyDemand << "|" << forecast.deviation << "|"
+             << forecast.safetyStock << "|" << forecast.reorderPoint << "|" << forecast.leadTimeDays << "|"
+             << forecast.daysObserved << "\n";
+        return okResponse("", line.str());
+    }
+
+    if (command == "LEADTIME") {
+        int id, days;
+        if (!(ss >> id >> days) || days < 1) return errResponse("Usage: LEADTIME <raw|product> <id> <days>");
+        OpResult result = inventory->setLeadTime(id, days, session.isAdmin);
+        if (result != OP_OK) return errResponse(describeResult(result));
+        return okResponse();
+    }
+
+    if (command == "DELETE") {
+        int id;
+        if (!(ss >> id)) return errResponse("Usage: DELETE <raw|product> <id>");
+        OpResult result = inventory->deleteRecord(id, session.isAdmin, session.context());
+        if (result != OP_OK) return errResponse(describeResult(result));
+        return okResponse();
+    }
+
+    if (command == "BATCH") {
+        if (!session.isAdmin) return errResponse(describeResult(OP_DENIED));
+        vector<QuantityAdjustment> adjustments;
+        int id;
+        string value;
+        while (ss >> id >> value) {
+            QuantityAdjustment line = {id, value[0] != '+' && value[0] != '-', 0};
+            if (!parseAnswer(value, line.value)) break;
+            adjustments.push_back(line);
+        }
+        if (adjustments.empty() || !ss.eof()) {
+            return errResponse("Usage: BATCH <raw|product> <id> <quantity|+n|-n> [<id> <quantity|+n|-n> ...]");
+        }
+        AdjustmentOutcome outcome = inventory->applyAdjustments(adjustments, session.context());
+        if (outcome.result != OP_OK) {
+            return errResponse(string(describeResult(outcome.result)) + ": " + outcome.detail);
+        }
+        return okResponse(to_string(outcome.recordsChanged));
+    }
+
+    if (command == "LEDGER") {
+        if (!session.isAdmin) return errResponse(describeResult(OP_DENIED));
+        const size_t maxLines = 10000;
+        string first, second;
+        ss >> first >> second;
+        vector<LedgerEntry> entries;
+        int id;
+        int64_t fromMicros, toMicros;
+        if (second.empty() && parseAnswer(first, id)) {
+            entries = inventory->ledgerHistory(id, maxLines);
+        } else if (parseTimestamp(first, fromMicros) && parseTimestamp(second, toMicros)) {
+            entries = inventory->ledgerBetween(fromMicros, toMicros, maxLines);
+        } else {
+            return errResponse("Usage: LEDGER <raw|product> <id> | LEDGER <raw|product> <from> <to>");
+        }
+        string body;
+        for (const LedgerEntry& entry : entries) {
+            body += formatTimestamp(entry.timestampMicros) + "|" +
+                    string(entry.user, strnlen(entry.user, sizeof(entry.user))) + "|" +
+                    to_string(entry.recordId) + "|" + to_string(entry.delta) + "|" +
+                    describeReason(entry.reason) + "\n";
+        }
+        return okResponse(to_string(entries.size()), body);
+    }
+
+    if (command == "REPORT") {
+        if (!session.isAdmin) return errResponse(describeResult(OP_DENIED));
+        stringstream report;
+        if (kind == "raw") {
+            ReportManager::getInstance()->displayRawMatReport(*inventory, report);
+        } else {
+            ReportManager::getInstance()->displayProductReport(*inventory, report);
+        }
+        return okResponse("", report.str());
+    }
+
+    if (command == "STATS") {
+        if (!session.isAdmin) return errResponse(describeResult(OP_DENIED));
+        PersistenceStats stats = inventory->persistenceStats();
+        stringstream body;
+        body << "queue_depth " << stats.queueDepth << "\n"
+             << "queue_capacity " << stats.queueCapacity << "\n"
+             << "max_queue_depth " << stats.maxQueueDepth << "\n"
+             << "events_queued " << stats.eventsQueued << "\n"
+             << "events_persisted " << stats.eventsPersisted << "\n"
+             << "file_writes " << stats.fileWrites << "\n"
+             << "backpressure_waits " << stats.backpressureWaits << "\n"
+             << fixed << setprecision(3)
+             << "last_write_lag_ms " << stats.lastWriteLagMs << "\n"
+             << "max_write_lag_ms " << stats.maxWriteLagMs << "\n";
+        return okResponse("", body.str());
+    }
+
+    return errResponse("Unknown command '" + command + "'");
+}
+
+// ---- Event loop ----
+
+// One client socket. Its session coroutine is the only code that reads or
+// writes it; the event loop just moves bytes and resumes the coroutine.
+struct Connection {
+    int fd;
+    string input;                   // received, not yet consumed
+    string output;                  // waiting for the socket to take it
+    bool closed;                    // client hung up or the socket failed
+    bool registered;                // still in the epoll set
+    uint32_t armedEvents;
+    coroutine_handle<> readerWaiting;
+    coroutine_handle<> writerWaiting;
+    Task<> session;
+
+    explicit Connection(int _fd) : fd(_fd), closed(false), registered(true), armedEvents(0) {}
+};
+
+// Single-threaded epoll loop. Sessions are coroutines that suspend while
+// waiting for input, for socket space or for a command running on the worker
+// pool, so an idle client costs a coroutine frame and two buffers, not a thread.
+class ImsServer {
+private:
+    static const size_t MAX_LINE = 64 * 1024;
+    static const size_t OUTPUT_HIGH_WATER = 256 * 1024;
+
+    string socketPath;
+    int listenFd;
+    int epollFd;
+    int wakeFd;     // eventfd the worker pool uses to hand finished commands back
+    unique_ptr<WorkerPool> pool;
+    unordered_map<int, unique_ptr<Connection>> connections;
+    atomic<size_t> activeSessions;
+
+    // Coroutines whose pool job finished, waiting to be resumed on the loop
+    mutex readyMutex;
+    vector<pair<int, coroutine_handle<>>> ready;
+
+    static atomic<bool> stopRequested;
+
+    static void onSignal(int) {
+        stopRequested = true;
+    }
+
+    void updateInterest(Connection& conn) {
+        if (!conn.registered) return;
+        uint32_t wanted = (conn.readerWaiting ? (uint32_t)EPOLLIN : 0) | (conn.output.empty() ? 0 : (uint32_t)EPOLLOUT);
+        if (wanted == conn.armedEvents) return;
+        epoll_event event = {};
+        event.events = wanted;
+        event.data.fd = conn.fd;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, conn.fd, &event);
+        conn.armedEvents = wanted;
+    }
+
+    void receive(Connection& conn) {
+        char chunk[4096];
+        while (!conn.closed) {
+            ssize_t n = recv(conn.fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+            if (n > 0) {
+                conn.input.append(chunk, (size_t)n);
+            } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else {
+                conn.closed = true;
+            }
+        }
+        // A client that never ends its line is dropped rather than buffered forever
+        if (conn.input.size() > MAX_LINE && conn.input.find('\n') == string::npos) conn.closed = true;
+    }
+
+    void flushOutput(Connection& conn) {
+        while (!conn.output.empty() && !conn.closed) {
+            ssize_t n = ::send(conn.fd, conn.output.data(), conn.output.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n > 0) {
+                conn.output.erase(0, (size_t)n);
+            } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else {
+                conn.closed = true;
+            }
+        }
+        if (conn.closed) conn.output.clear();
+    }
+
+    // Called after a session's coroutine ran: frees it if it finished,
+    // otherwise arms the events it now waits for
+    void settle(Connection& conn) {
+        if (conn.session.done()) {
+            int fd = conn.fd;
+            if (conn.registered) epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+            connections.erase(fd);
+            close(fd);
+            activeSessions--;
+            return;
+        }
+        if (conn.closed && conn.registered) {
+            // Nothing more will arrive; the session finds out on its next read
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, conn.fd, nullptr);
+            conn.registered = false;
+        }
+        updateInterest(conn);
+    }
+
+    // Resumes the coroutine waiting on conn if what it waits for is there
+    void wakeSession(Connection& conn) {
+        coroutine_handle<> next;
+        if (conn.readerWaiting && (conn.closed || conn.input.find('\n') != string::npos)) {
+            next = exchange(conn.readerWaiting, nullptr);
+        } else if (conn.writerWaiting && (conn.closed || conn.output.size() < OUTPUT_HIGH_WATER)) {
+            next = exchange(conn.writerWaiting, nullptr);
+        }
+        if (next) next.resume();
+        settle(conn);
+    }
+
+    void acceptClients() {
+        while (true) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) return;
+
+            epoll_event event = {};
+            event.events = 0;
+            event.data.fd = fd;
+            if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+                close(fd);
+                continue;
+            }
+            Connection& conn = *(connections[fd] = make_unique<Connection>(fd));
+            activeSessions++;
+            conn.session = serveSession(conn);
+            conn.session.start();
+            settle(conn);
+        }
+    }
+
+    void resumeFinishedJobs() {
+        uint64_t count;
+        while (read(wakeFd, &count, sizeof(count)) > 0) {}
+
+        vector<pair<int, coroutine_handle<>>> batch;
+        {
+            lock_guard<mutex> lock(readyMutex);
+            batch.swap(ready);
+        }
+        for (auto& [fd, handle] : batch) {
+            auto it = connections.find(fd);
+            if (it == connections.end()) continue;
+            handle.resume();
+            settle(*it->second);
+        }
+    }
+
+    // ---- Awaitables used by session coroutines ----
+
+    // co_await nextLine(conn): the next request line, or nothing once the client is gone
+    struct LineAwaiter {
+        Connection& conn;
+
+        bool await_ready() const {
+            return conn.closed || conn.input.find('\n') != string::npos;
+        }
+
+        void await_suspend(coroutine_handle<> handle) {
+            conn.readerWaiting = handle;
+        }
+
+        optional<string> await_resume() {
+            size_t newline = conn.input.find('\n');
+            if (newline == string::npos) return nullopt;
+            string line = conn.input.substr(0, newline);
+            conn.input.erase(0, newline + 1);
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            return line;
+        }
+    };
+
+    // co_await send(conn, text): queues text, suspending while the client is
+    // too far behind; false once the client is gone
+    struct SendAwaiter {
+        Connection& conn;
+
+        bool await_ready() const {
+            return conn.closed || conn.output.size() < OUTPUT_HIGH_WATER;
+        }
+
+        void await_suspend(coroutine_handle<> handle) {
+            conn.writerWaiting = handle;
+        }
+
+        bool await_resume() const {
+            return !conn.closed;
+        }
+    };
+
+    // co_await onPool(conn, job): runs job on a worker thread so a slow
+    // command doesn't stall the loop, then resumes the session on the loop
+    struct PoolAwaiter {
+        ImsServer& server;
+        Connection& conn;
+        const function<string()>& job;
+        string result;
+
+        bool await_ready() const { return false; }
+
+        void await_suspend(coroutine_handle<> handle) {
+            int fd = conn.fd;
+            server.pool->submit([this, handle, fd]() {
+                result = job();
+                ImsServer& owner = server;
+                {
+                    lock_guard<mutex> lock(owner.readyMutex);
+                    owner.ready.emplace_back(fd, handle);
+                }
+                uint64_t one = 1;
+                ssize_t written = write(owner.wakeFd, &one, sizeof(one));
+                (void)written;
+            });
+        }
+
+        string await_resume() {
+            return move(result);
+        }
+    };
+
+    LineAwaiter nextLine(Connection& conn) {
+        return LineAwaiter{conn};
+    }
+
+    SendAwaiter send(Connection& conn, const string& text) {
+        if (!conn.closed) {
+            conn.output += text;
+            flushOutput(conn);
+        }
+        return SendAwaiter{conn};
+    }
+
+    // Takes job by reference: it must outlive the co_await, so pass a named
+    // local rather than a temporary lambda
+    PoolAwaiter onPool(Connection& conn, const function<string()>& job) {
+        return PoolAwaiter{*this, conn, job, ""};
+    }
+
+    Task<optional<string>> ask(Connection& conn, string prompt, string body = "") {
+        // Awaits are kept out of conditions and return statements: GCC 12
+        // miscompiles both forms
+        bool sent = co_await send(conn, promptResponse(prompt, body));
+        if (!sent) co_return nullopt;
+        optional<string> answer = co_await nextLine(conn);
+        co_return answer;
+    }
+
+    // ---- Session coroutines ----
+
+    // "ADD <kind>" with nothing else: asks for each field, then for confirmation
+    Task<> guidedAdd(Connection& conn, Session& session, Inventory* inventory) {
+        if (!session.isAdmin) {
+            co_await send(conn, errResponse(describeResult(OP_DENIED)));
+            co_return;
+        }
+
+        optional<string> name = co_await ask(conn, "Name:");
+        if (!name) co_return;
+
+        int quantity = 0;
+        string prompt = "Quantity:";
+        while (true) {
+            optional<string> answer = co_await ask(conn, prompt);
+            if (!answer) co_return;
+            if (parseAnswer(*answer, quantity) && quantity > 0) break;
+            prompt = "Invalid quantity; enter a whole number of 1 or more. Quantity:";
+        }
+
+        double price = 0;
+        prompt = "Unit price:";
+        while (true) {
+            optional<string> answer = co_await ask(conn, prompt);
+            if (!answer) co_return;
+            if (parseAnswer(*answer, price) && price > 0) break;
+            prompt = "Invalid price; enter a positive number. Unit price:";
+        }
+
+        stringstream summary;
+        summary << "Add '" << *name << "', quantity " << quantity << ", price "
+                << fixed << setprecision(2) << price << "? (y/n)";
+        optional<string> confirm = co_await ask(conn, summary.str());
+        if (!confirm) co_return;
+        if (!isYes(*confirm)) {
+            co_await send(conn, okResponse("Cancelled"));
+            co_return;
+        }
+
+        function<string()> apply = [inventory, name, quantity, price, &session]() {
+            int newId = 0;
+            OpResult result = inventory->addRecord(*name, quantity, price, session.isAdmin, session.context(), newId);
+            return result == OP_OK ? okResponse(to_string(newId)) : errResponse(describeResult(result));
+        };
+        string reply = co_await onPool(conn, apply);
+        co_await send(conn, reply);
+    }
+
+    // "EDIT <kind> <id>": shows the record, asks for new values and applies
+    // them against the version shown, so a change made meanwhile is reported
+    Task<> guidedEdit(Connection& conn, Session& session, Inventory* inventory, int id) {
+        Record current(0, "", 0, 0);
+        if (!inventory->findRecord(id, current)) {
+            co_await send(conn, errResponse(describeResult(OP_NOT_FOUND)));
+            co_return;
+        }
+        uint32_t versionRead = current.version();
+
+        int quantity = 0;
+        string prompt = "New quantity (empty or 0 keeps " + to_string(current.quantity()) + "):";
+        string body = formatRecordLine(current);
+        while (true) {
+            optional<string> answer = co_await ask(conn, prompt, body);
+            if (!answer) co_return;
+            if (answer->empty()) {
+                quantity = 0;
+                break;
+            }
+            if (parseAnswer(*answer, quantity) && quantity >= 0) break;
+            prompt = "Invalid quantity; enter a whole number of 0 or more. New quantity:";
+            body = "";
+        }
+
+        double price = 0;
+        string name;
+        if (session.isAdmin) {
+            prompt = "New price (empty or 0 keeps the current one):";
+            while (true) {
+                optional<string> answer = co_await ask(conn, prompt);
+                if (!answer) co_return;
+                if (answer->empty()) {
+                    price = 0;
+                    break;
+                }
+                if (parseAnswer(*answer, price) && price >= 0) break;
+                prompt = "Invalid price; enter 0 or a positive number. New price:";
+            }
+
+            optional<string> answer = co_await ask(conn, "New name (empty keeps '" + current.name + "'):");
+            if (!answer) co_return;
+            name = *answer;
+        }
+
+        optional<string> confirm = co_await ask(conn, "Apply the changes? (y/n)");
+        if (!confirm) co_return;
+        if (!isYes(*confirm)) {
+            co_await send(conn, okResponse("Cancelled"));
+            co_return;
+        }
+
+        function<string()> apply = [inventory, id, versionRead, name, quantity, price, &session]() {
+            OpResult result = inventory->editRecord(id, versionRead, name, quantity, price, session.isAdmin,
+                                                      session.context());
+            if (result != OP_OK) return errResponse(describeResult(result));
+            Record record(0, "", 0, 0);
+            inventory->findRecord(id, record);
+            return okResponse(to_string(record.version()));
+        };
+        string reply = co_await onPool(conn, apply);
+        co_await send(conn, reply);
+    }
+
+    // Serves one client until it quits or disconnects. Commands run one at a
+    // time per session, so replies stay in request order.
+    Task<> serveSession(Connection& conn) {
+        Session session(conn.fd);
+        serverLog("Session " + to_string(conn.fd) + " connected.");
+
+        while (true) {
+            optional<string> line = co_await nextLine(conn);
+            if (!line) break;
+
+            stringstream ss(*line);
+            vector<string> words;
+            for (string word; ss >> word;) words.push_back(word);
+            string command = words.empty() ? "" : words[0];
+            for (char& c : command) c = (char)toupper((unsigned char)c);
+
+            if (command == "QUIT") {
+                co_await send(conn, okResponse("Goodbye"));
+                break;
+            }
+
+            // Guided flows: ADD <kind> and EDIT <kind> <id> without the values
+            Inventory* inventory = (session.loggedIn && words.size() >= 2)
+                ? InventoryManager::getInstance()->getInventory(words[1]) : nullptr;
+            int id;
+            if (inventory && command == "ADD" && words.size() == 2) {
+                co_await guidedAdd(conn, session, inventory);
+            } else if (inventory && command == "EDIT" && words.size() == 3 && parseAnswer(words[2], id)) {
+                co_await guidedEdit(conn, session, inventory, id);
+            } else {
+                string request = *line;
+                function<string()> run = [&session, request]() { return handleCommand(session, request); };
+                string reply = co_await onPool(conn, run);
+                bool sent = co_await send(conn, reply);
+                if (!sent) break;
+            }
+        }
+
+        serverLog("Session " + to_string(conn.fd) + (session.loggedIn ? " (" + session.username + ")" : "") + " closed.");
+    }
+
+public:
+    ImsServer(const string& path, size_t workerCount)
+        : socketPath(path), listenFd(-1), epollFd(-1), wakeFd(-1),
+          pool(make_unique<WorkerPool>(workerCount)), activeSessions(0) {}
+
+    ImsServer(const ImsServer&) = delete;
+    ImsServer& operator=(const ImsServer&) = delete;
+
+    static void requestStop() {
+        stopRequested = true;
+    }
+
+    size_t sessionCount() const {
+        return activeSessions.load();
+    }
+
+    int run() {
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (socketPath.size() >= sizeof(address.sun_path)) {
+            cout << "Error: Socket path is too long." << endl;
+            return 1;
+        }
+        strcpy(address.sun_path, socketPath.c_str());
+
+        listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listenFd < 0) {
+            cout << "Error: Could not create socket." << endl;
+            return 1;
+        }
+        // We hold the data lock, so a leftover socket file is stale
+        unlink(socketPath.c_str());
+        if (bind(listenFd, (sockaddr*)&address, sizeof(address)) != 0 || listen(listenFd, SOMAXCONN) != 0) {
+            cout << "Error: Could not listen on " << socketPath << "." << endl;
+            close(listenFd);
+            return 1;
+        }
+
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        for (int fd : {listenFd, wakeFd}) {
+            epoll_event event = {};
+            event.events = EPOLLIN;
+            event.data.fd = fd;
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+        }
+
+        signal(SIGINT, onSignal);
+        signal(SIGTERM, onSignal);
+        serverLog("IMS server listening on " + socketPath + ". Press Ctrl+C to stop.");
+
+        epoll_event events[128];
+        while (!stopRequested) {
+            int count = epoll_wait(epollFd, events, 128, 500);
+            for (int i = 0; i < count; i++) {
+                int fd = events[i].data.fd;
+                if (fd == listenFd) {
+                    acceptClients();
+                } else if (fd == wakeFd) {
+                    resumeFinishedJobs();
+                } else {
+                    auto it = connections.find(fd);
+                    if (it == connections.end()) continue;
+                    Connection& conn = *it->second;
+                    if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) receive(conn);
+                    if (events[i].events & EPOLLOUT) flushOutput(conn);
+                    wakeSession(conn);
+                }
+            }
+        }
+
+        serverLog("Shutting down...");
+        close(listenFd);
+        unlink(socketPath.c_str());
+
+        // Let commands already on the pool finish before their sessions go away
+        pool.reset();
+        serverLog("Closing " + to_string(connections.size()) + " open session(s).");
+        for (auto& entry : connections) close(entry.first);
+        connections.clear();
+        close(wakeFd);
+        close(epollFd);
+        return 0;
+    }
+};
+
+atomic<bool> ImsServer::stopRequested(false);
+
+int runServer(const string& socketPath) {
+    if (!acquireDataLock()) {
+        cout << "Error: Another IMS process is already using these inventory files." << endl;
+        return 1;
+    }
+
+    // Create the singletons up front so sessions never race to construct them
+    UserManager::getInstance()->createDefaultCredentialsIfNeeded();
+    InventoryManager::getInstance();
+    ReportManager::getInstance();
+
+    size_t workerCount = max(2u, thread::hardware_concurrency());
+    int status;
+    {
+        ImsServer server(socketPath, workerCount);
+        status = server.run();
+    }
+
+    UserManager::destroyInstance();
+    InventoryManager::destroyInstance();
+    ReportManager::destroyInstance();
+    TaskScheduler::destroyInstance();
+    return status;
+}
+
+// Minimal interactive client: sends each typed line and prints the response
+int runClient(const string& socketPath) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+        cout << "Error: Could not connect to IMS server at " << socketPath << "." << endl;
+        if (fd >= 0) close(fd);
+        return 1;
+    }
+
+    cout << "Connected to " << socketPath << ". Type HELP for commands." << endl;
+    string buffer, input, line;
+    while (true) {
+        cout << "ims> " << flush;
+        if (!getline(cin, input)) input = "QUIT";
+        if (!writeAll(fd, input + "\n")) break;
+
+        bool connected = true;
+        while ((connected = readLine(fd, buffer, line)) && line != ".") {
+            cout << line << endl;
+        }
+        if (!connected || input == "QUIT" || input == "quit") break;
+    }
+    close(fd);
+    return 0;
+}
+
+#else
+
+int runServer(const string&) {
+    cout << "Server mode is only available on Linux." << endl;
+    return 1;
+}
+
+int runClient(const string&) {
+    cout << "Server mode is only available on Linux." << endl;
+    return 1;
+}
+
+#endif
+
+// ================= SAMPLE DATA GENERATOR =================
+
+// Draws 1..n with probability proportional to 1 / k^exponent, in constant
+// time and memory, by rejection-inversion (Hormann and Derflinger, 1996).
+// The exponent must be positive.
+class ZipfDistribution {
+private:
+    double n, exponent;
+    double integralOfFirst, integralToN, squeeze;
+
+    // (e^x - 1) / x, accurate near zero
+    static double expm1Over(double x) {
+        return fabs(x) > 1e-8 ? expm1(x) / x : 1 + x / 2 * (1 + x / 3 * (1 + x / 4));
+    }
+
+    // log(1 + x) / x, accurate near zero
+    static double log1pOver(double x) {
+        return fabs(x) > 1e-8 ? log1p(x) / x : 1 - x * (1.0 / 2 - x * (1.0 / 3 - x / 4));
+    }
+
+    double weight(double x) const { return exp(-exponent * log(x)); }
+
+    double integral(double x) const {
+        double logX = log(x);
+        return expm1Over((1 - exponent) * logX) * logX;
+    }
+
+    double inverseIntegral(double x) const {
+        double t = max(-1.0, x * (1 - exponent));
+        return exp(log1pOver(t) * x);
+    }
+
+public:
+    ZipfDistribution(size_t count, double _exponent) : n((double)max<size_t>(1, count)), exponent(_exponent) {
+        integralOfFirst = integral(1.5) - 1;
+        integralToN = integral(n + 0.5);
+        squeeze = 2 - inverseIntegral(integral(2.5) - weight(2));
+    }
+
+    template <typename Engine>
+    size_t operator()(Engine& engine) const {
+        while (true) {
+            double uniform = (engine() >> 11) * 0x1.0p-53;
+            double u = integralToN + uniform * (integralOfFirst - integralToN);
+            double x = inverseIntegral(u);
+            double k = min(n, max(1.0, floor(x + 0.5)));
+            if (k - x <= squeeze || u >= integral(k + 0.5) - weight(k)) return (size_t)k;
+        }
+    }
+};
+
+// What generateDataset writes. Each file comes from the seed alone, so the
+// same options give the same bytes whatever the number of workers.
+struct DatasetOptions {
+    uint64_t seed = 1;
+    size_t rawMaterials = 10;
+    size_t products = 10;
+    size_t admins = 1;
+    size_t employees = 2;
+    bool billsOfMaterials = true;
+    double duplicateRate = 0;  // extra lines repeating an earlier line of the same file
+    double malformedRate = 0;  // lines damaged so they no longer parse as a record
+};
+
+struct DatasetSummary {
+    size_t lines = 0;
+    size_t duplicates = 0;
+    size_t malformed = 0;
+    size_t bytes = 0;
+};
+
+namespace dataset {
+
+const char* const rawColours[] = {"Natural", "White", "Black", "Navy", "Grey", "Red", "Indigo", "Olive", "Beige",
+                                  "Charcoal", "Ivory", "Khaki", "Burgundy", "Teal", "Mustard", "Sky Blue",
+                                  "Forest Green", "Rust", "Lavender", "Coral", "Sand", "Plum", "Mint", "Copper"};
+const char* const rawMaterials[] = {"Cotton", "Polyester", "Denim", "Silk", "Wool", "Linen", "Nylon", "Rayon",
+                                    "Viscose", "Spandex", "Leather", "Fleece", "Velvet", "Satin", "Chiffon",
+                                    "Corduroy", "Jersey", "Bamboo", "Hemp", "Cashmere", "Acrylic", "Modal",
+                                    "Tencel", "Organza"};
+const char* const rawForms[] = {"Fabric", "Twill", "Thread", "Yarn", "Poplin", "Canvas", "Knit", "Lining",
+                                "Ribbing", "Webbing", "Tape", "Lace", "Mesh", "Felt", "Batting", "Interfacing",
+                                "Buttons", "Zippers", "Elastic", "Labels"};
+const char* const productColours[] = {"Black", "White", "Navy", "Grey", "Blue", "Red", "Olive", "Beige", "Pink",
+                                      "Khaki", "Burgundy", "Cream", "Brown", "Green", "Yellow", "Purple"};
+const char* const productStyles[] = {"Classic", "Slim", "Relaxed", "Oversized", "Cropped", "Men's", "Women's",
+                                     "Kids'", "Vintage", "Essential", "Premium", "Athletic", "Casual", "Formal",
+                                     "Summer", "Winter"};
+const char* const productGarments[] = {"T-Shirt", "Blouse", "Jeans", "Hoodie", "Jacket", "Trousers", "Skirt",
+                                       "Dress", "Shorts", "Polo Shirt", "Sweater", "Cardigan", "Coat", "Vest",
+                                       "Leggings", "Joggers", "Shirt", "Blazer", "Jumpsuit", "Tank Top", "Pyjamas",
+                                       "Scarf", "Socks", "Overalls"};
+const char* const firstNames[] = {"maria", "john", "wei", "fatima", "james", "ana", "mohammed", "li", "sarah",
+                                  "david", "priya", "carlos", "emma", "juan", "aisha", "michael", "yuki", "olga",
+                                  "ahmed", "laura", "chen", "grace", "pedro", "nadia", "tom", "sofia", "raj",
+                                  "elena", "kwame", "hana", "ivan", "lucy"};
+const char* const lastNames[] = {"smith", "garcia", "wang", "khan", "lopez", "kim", "nguyen", "patel", "silva",
+                                 "brown", "muller", "rossi", "tanaka", "ivanov", "cohen", "okafor", "jones",
+                                 "martin", "santos", "ali", "park", "novak", "costa", "singh", "wilson", "lee",
+                                 "haddad", "berg", "moreau", "ortiz", "sato", "mensah"};
+
+template <size_t N>
+constexpr size_t countOf(const char* const (&)[N]) {
+    return N;
+}
+
+// Independent, reproducible stream of random numbers for one part of a file
+mt19937_64 streamFor(uint64_t seed, uint64_t file, uint64_t stream, uint64_t chunk) {
+    uint64_t x = seed ^ (file << 56) ^ (stream << 48) ^ chunk;
+    // splitmix64 finalizer, so neighbouring chunks get unrelated seeds
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return mt19937_64(x ^ (x >> 31));
+}
+
+double uniform(mt19937_64& engine) {
+    return (engine() >> 11) * 0x1.0p-53;
+}
+
+void appendNumber(string& out, long long value) {
+    char digits[24];
+    out.append(digits, to_chars(digits, digits + sizeof(digits), value).ptr);
+}
+
+void appendPrice(string& out, long long cents) {
+    appendNumber(out, cents / 100);
+    out += '.';
+    out += (char)('0' + cents / 10 % 10);
+    out += (char)('0' + cents % 10);
+}
+
+// Capitalized letters for a repeat count, so repeated names stay unique
+// without digits, which record names may not contain
+void appendRepeatSuffix(string& out, uint32_t repeat) {
+    out += ' ';
+    string letters;
+    for (uint32_t rest = repeat; rest > 0; rest /= 26) letters += (char)('a' + rest % 26);
+    letters.back() = (char)toupper(letters.back());
+    out.append(letters.rbegin(), letters.rend());
+}
+
+// Damages a line so it no longer parses as what it was. Inventory lines
+// lose their separator or name, or get a word or negative number for the
+// quantity; any line may be cut short.
+void damage(string& line, bool isInventory, mt19937_64& engine) {
+    size_t bar = line.find('|');
+    switch (isInventory && bar != string::npos ? engine() % 5 : 0) {
+        case 0: line.resize(line.size() / 2); break;
+        case 1: line.erase(bar, 1); break;
+        case 2: line.erase(line.find(' ') + 1, bar - line.find(' ') - 1); break;
+        case 3: line.replace(bar + 1, line.find(' ', bar) - bar - 1, "many"); break;
+        default: line.insert(bar + 1, "-"); break;
+    }
+}
+
+// Writes what makeLine(index, engine, line) produces for each of rows
+// records to path, chunk by chunk on the task scheduler, adding duplicate
+// and malformed lines at the configured rates
+DatasetSummary writeLines(const string& path, uint64_t file, size_t rows, const DatasetOptions& options,
+                          bool isInventory, const function<void(size_t, mt19937_64&, string&)>& makeLine) {
+    const size_t rowsPerChunk = 65536;
+    DatasetSummary summary;
+    string tempPath = path + ".tmp";
+    ofstream out(tempPath, ios::binary);
+    if (!out) {
+        cout << "Error: Could not open " << tempPath << " for writing." << endl;
+        return summary;
+    }
+
+    TaskScheduler* scheduler = TaskScheduler::getInstance();
+    size_t chunkCount = (rows + rowsPerChunk - 1) / rowsPerChunk;
+    size_t chunksPerBatch = max<size_t>(1, scheduler->workerCount() * 4);
+    vector<string> texts(chunksPerBatch);
+    vector<DatasetSummary> parts(chunksPerBatch);
+    for (size_t batch = 0; batch < chunkCount; batch += chunksPerBatch) {
+        size_t batchChunks = min(chunksPerBatch, chunkCount - batch);
+        scheduler->parallelFor(batchChunks, 1, [&](size_t first, size_t last) {
+            for (size_t c = first; c < last; c++) {
+                size_t chunk = batch + c;
+                mt19937_64 engine = streamFor(options.seed, file, 1, chunk);
+                mt19937_64 noise = streamFor(options.seed, file, 2, chunk);
+                string& text = texts[c];
+                DatasetSummary& part = parts[c];
+                text.clear();
+                part = DatasetSummary();
+                vector<size_t> lineStarts;
+                string line;
+                size_t end = min(rows, (chunk + 1) * rowsPerChunk);
+                for (size_t i = chunk * rowsPerChunk; i < end; i++) {
+                    line.clear();
+                    makeLine(i, engine, line);
+                    if (options.malformedRate > 0 && uniform(noise) < options.malformedRate) {
+                        damage(line, isInventory, noise);
+                        part.malformed++;
+                    }
+                    lineStarts.push_back(text.size());
+                    text += line;
+                    text += '\n';
+                    part.lines += 1 + count(line.begin(), line.end(), '\n');
+                    if (options.duplicateRate > 0 && uniform(noise) < options.duplicateRate) {
+                        size_t earlier = lineStarts[noise() % lineStarts.size()];
+                        size_t length = text.find('\n', earlier) - earlier + 1;
+                        text.append(text, earlier, length);
+                        part.lines++;
+                        part.duplicates++;
+                    }
+                }
+            }
+        });
+        for (size_t c = 0; c < batchChunks; c++) {
+            out.write(texts[c].data(), texts[c].size());
+            summary.lines += parts[c].lines;
+            summary.duplicates += parts[c].duplicates;
+            summary.malformed += parts[c].malformed;
+            summary.bytes += texts[c].size();
+        }
+    }
+    out.close();
+    if (!out || rename(tempPath.c_str(), path.c_str()) != 0) {
+        cout << "Error: Could not write " << path << "." << endl;
+    }
+    return summary;
+}
+
+// Zipf-distributed words for every row, then a suffix for each repeat of
+// the same words, so names are skewed like real catalogues but unique.
+// Returns the word choice of every row, packed, and its repeat number.
+void chooseNames(size_t count, uint64_t seed, uint64_t file, const size_t (&vocabulary)[3],
+                 vector<uint32_t>& combination, vector<uint32_t>& repeat) {
+    const size_t rowsPerChunk = 65536;
+    combination.resize(count);
+    repeat.resize(count);
+    ZipfDistribution first(vocabulary[0], 1.0), second(vocabulary[1], 1.0), third(vocabulary[2], 1.0);
+    size_t chunkCount = (count + rowsPerChunk - 1) / rowsPerChunk;
+    TaskScheduler::getInstance()->parallelFor(chunkCount, 1, [&](size_t firstChunk, size_t lastChunk) {
+        for (size_t c = firstChunk; c < lastChunk; c++) {
+            mt19937_64 engine = streamFor(seed, file, 0, c);
+            size_t end = min(count, (c + 1) * rowsPerChunk);
+            for (size_t i = c * rowsPerChunk; i < end; i++) {
+                combination[i] = (uint32_t)(((first(engine) - 1) * vocabulary[1] + second(engine) - 1) *
+                                                vocabulary[2] + third(engine) - 1);
+            }
+        }
+    });
+    vector<uint32_t> seen(vocabulary[0] * vocabulary[1] * vocabulary[2], 0);
+    for (size_t i = 0; i < count; i++) repeat[i] = seen[combination[i]]++;
+}
+
+}  // namespace dataset
+
+// The files generateDataset writes with these options
+vector<string> datasetFiles(const DatasetOptions& options) {
+    vector<string> files = {"rawmaterial.txt", "product.txt"};
+    if (options.billsOfMaterials) files.push_back("bom.txt");
+    files.push_back("admin.txt");
+    files.push_back("employee.txt");
+    return files;
+}
+
+// Writes rawmaterial.txt, product.txt, bom.txt, admin.txt and employee.txt
+// in the current directory. Names and quantities follow Zipf distributions:
+// a few materials, colours and garments are far more common than the rest,
+// and most stock levels are small. Bills of materials favour the popular
+// raw materials. Duplicate and malformed lines go into the inventory and
+// bill of materials files only, so every generated account can log in.
+map<string, DatasetSummary> generateDataset(const DatasetOptions& options) {
+    using namespace dataset;
+    map<string, DatasetSummary> written;
+    const size_t maxQuantity = 100000;
+    ZipfDistribution quantity(maxQuantity, 1.1);
+    vector<uint32_t> combination, repeat;
+
+    const size_t rawWords[3] = {countOf(rawColours), countOf(dataset::rawMaterials), countOf(rawForms)};
+    chooseNames(options.rawMaterials, options.seed, 1, rawWords, combination, repeat);
+    written["rawmaterial.txt"] = writeLines(
+        "rawmaterial.txt", 1, options.rawMaterials, options, true, [&](size_t i, mt19937_64& engine, string& line) {
+            uint32_t words = combination[i];
+            appendNumber(line, (long long)i + 1);
+            line += ' ';
+            line += rawColours[words / (rawWords[1] * rawWords[2])];
+            line += ' ';
+            line += dataset::rawMaterials[words / rawWords[2] % rawWords[1]];
+            line += ' ';
+            line += rawForms[words % rawWords[2]];
+            if (repeat[i] > 0) appendRepeatSuffix(line, repeat[i]);
+            line += '|';
+            appendNumber(line, (long long)quantity(engine));
+            line += ' ';
+            // Unit prices spread log-uniformly from $0.50 to $500
+            appendPrice(line, (long long)(50 * pow(1000.0, uniform(engine))));
+        });
+
+    const size_t productWords[3] = {countOf(productColours), countOf(productStyles), countOf(productGarments)};
+    chooseNames(options.products, options.seed, 2, productWords, combination, repeat);
+    written["product.txt"] = writeLines(
+        "product.txt", 2, options.products, options, true, [&](size_t i, mt19937_64& engine, string& line) {
+            uint32_t words = combination[i];
+            appendNumber(line, (long long)i + 1);
+            line += ' ';
+            line += productColours[words / (productWords[1] * productWords[2])];
+            line += ' ';
+            line += productStyles[words / productWords[2] % productWords[1]];
+            line += ' ';
+            line += productGarments[words % productWords[2]];
+            if (repeat[i] > 0) appendRepeatSuffix(line, repeat[i]);
+            line += '|';
+            appendNumber(line, (long long)quantity(engine));
+            line += ' ';
+            appendPrice(line, (long long)(500 * pow(200.0, uniform(engine))));
+        });
+    combination.clear();
+    combination.shrink_to_fit();
+    repeat.clear();
+    repeat.shrink_to_fit();
+
+    if (options.billsOfMaterials && options.rawMaterials > 0) {
+        // One to four components per product, as "productId rawId qty" lines
+        ZipfDistribution component(options.rawMaterials, 1.0);
+        ZipfDistribution perUnit(20, 1.5);
+        written["bom.txt"] = writeLines(
+            "bom.txt", 3, options.products, options, false, [&](size_t i, mt19937_64& engine, string& line) {
+                size_t components = 1 + engine() % 4;
+                size_t chosen[4];
+                for (size_t c = 0; c < components; c++) {
+                    chosen[c] = component(engine);
+                    if (find(chosen, chosen + c, chosen[c]) != chosen + c) break;
+                    if (c > 0) line += '\n';
+                    appendNumber(line, (long long)i + 1);
+                    line += ' ';
+                    appendNumber(line, (long long)chosen[c]);
+                    line += ' ';
+                    appendNumber(line, (long long)perUnit(engine));
+                }
+            });
+    }
+
+    // Admins come first in one sequence with the employees, so no username
+    // is used twice across the two files
+    ZipfDistribution firstName(countOf(firstNames), 1.0), lastName(countOf(lastNames), 1.0);
+    size_t accounts = options.admins + options.employees;
+    vector<uint32_t> names(accounts), repeats(accounts);
+    mt19937_64 engine = streamFor(options.seed, 4, 0, 0);
+    vector<uint32_t> seen(countOf(firstNames) * countOf(lastNames), 0);
+    for (size_t i = 0; i < accounts; i++) {
+        names[i] = (uint32_t)((firstName(engine) - 1) * countOf(lastNames) + lastName(engine) - 1);
+        repeats[i] = seen[names[i]]++;
+    }
+    DatasetOptions clean = options;
+    clean.duplicateRate = clean.malformedRate = 0;
+    auto account = [&](size_t offset) {
+        return [&, offset](size_t i, mt19937_64& random, string& line) {
+            uint32_t name = names[offset + i];
+            line += firstNames[name / countOf(lastNames)];
+            line += '.';
+            line += lastNames[name % countOf(lastNames)];
+            if (repeats[offset + i] > 0) appendNumber(line, repeats[offset + i] + 1);
+            line += ',';
+            static const char alphabet[] = "abcdefghijkmnpqrstuvwxyzABCDEFGHJKLMNPQRSTUVWXYZ23456789";
+            for (int c = 0; c < 10; c++) line += alphabet[random() % (sizeof(alphabet) - 1)];
+        };
+    };
+    written["admin.txt"] = writeLines("admin.txt", 5, options.admins, clean, false, account(0));
+    written["employee.txt"] = writeLines("employee.txt", 6, options.employees, clean, false, account(options.admins));
+    return written;
+}
+
+// Creates a directory if needed and makes it the working directory
+bool enterDirectory(const string& path) {
+#ifndef _WIN32
+    mkdir(path.c_str(), 0755);
+    return chdir(path.c_str()) == 0;
+#else
+    _mkdir(path.c_str());
+    return _chdir(path.c_str()) == 0;
+#endif
+}
+
+// "try --generate <scale> [--seed N] [--duplicates RATE] [--malformed RATE]
+// [--dir PATH] [--force]". Scale 1 is the size of the built-in sample data:
+// ten raw materials and ten products, one admin and two employees; every
+// count grows with it, so scale 1e6 writes ten million records per
+// inventory. Existing inventory files are only replaced with --force,
+// which also removes the ledgers, lots and forecasts that described them.
+int runGenerator(int argc, char* argv[]) {
+    double scale = argc > 0 ? atof(argv[0]) : 0;
+    DatasetOptions options;
+    string directory = ".";
+    bool force = false;
+    bool valid = scale > 0;
+    for (int i = 1; i < argc && valid; i++) {
+        string option = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (option == "--force") {
+            force = true;
+        } else if (option == "--seed" && hasValue) {
+            options.seed = strtoull(argv[++i], nullptr, 10);
+        } else if (option == "--duplicates" && hasValue) {
+            options.duplicateRate = atof(argv[++i]);
+        } else if (option == "--malformed" && hasValue) {
+            options.malformedRate = atof(argv[++i]);
+        } else if (option == "--dir" && hasValue) {
+            directory = argv[++i];
+        } else {
+            valid = false;
         }
-        
-        file.close();
-        
-        cout << string(70, '-') << endl;
-        cout << left << setw(30) << "TOTAL:"
-             << setw(10) << totalQuantity
-             << setw(15) << ""
-             << "$" << fixed << setprecision(2) << totalValue << endl;
-        cout << string(70, '=') << endl;
     }
+    if (!valid || options.duplicateRate < 0 || options.duplicateRate > 1 || options.malformedRate < 0 ||
+        options.malformedRate > 1) {
+        cout << "Usage: try --generate <scale> [--seed N] [--duplicates RATE] [--malformed RATE] [--dir PATH] [--force]"
+             << endl;
+        return 1;
+    }
+    options.rawMaterials = (size_t)llround(10 * scale);
+    options.products = (size_t)llround(10 * scale);
+    options.admins = max<size_t>(1, (size_t)llround(scale / 10));
+    options.employees = (size_t)llround(2 * scale);
 
-    void reportUI() {
-        cout << "\n--------------------------------" << endl;
-        cout << "|       REPORTS DASHBOARD      |" << endl;
-        cout << "--------------------------------" << endl;
-        cout << "1. Product Inventory Report" << endl;
-        cout << "2. Raw Material Inventory Report" << endl;
-        cout << "3. Return to Previous Menu" << endl;
-        
-        int choice = getValidIntInput("Enter your choice (1-3): ", 1);
-        switch (choice) {
-            case 1: displayProductReport(); break;
-            case 2: displayRawMatReport(); break;
-            case 3: cout << "Returning to previous menu..." << endl; break;
-            default: cout << "Invalid choice. Please try again." << endl; break;
+    if (!enterDirectory(directory)) {
+        cout << "Error: Could not use directory " << directory << "." << endl;
+        return 1;
+    }
+    if (!acquireDataLock()) {
+        cout << "Error: Another IMS process is using the files in " << directory << "." << endl;
+        return 1;
+    }
+    for (const string& file : datasetFiles(options)) {
+        if (!force && ifstream(file).good()) {
+            cout << "Error: " << directory << " already has " << file << "; use --force to replace it." << endl;
+            return 1;
         }
     }
-};
+    vector<string> locations = readLocations("locations.txt");
+    for (string stem : {"rawmaterial", "product"}) {
+        for (const char* suffix : {".ledger", ".ledger.snap", ".lots", ".demand"}) remove((stem + suffix).c_str());
+        for (size_t i = 1; i < locations.size(); i++) remove((stem + "." + locations[i] + ".stock").c_str());
+    }
 
-// Initialize static member
-ReportManager* ReportManager::instance = nullptr;
+    auto start = chrono::steady_clock::now();
+    map<string, DatasetSummary> written = generateDataset(options);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
 
-// ================= INVENTORY MANAGER (SINGLETON) =================
+    size_t totalLines = 0;
+    cout << left << setw(18) << "File" << setw(14) << "Lines" << setw(12) << "Duplicates" << setw(12) << "Malformed"
+         << "MB" << endl;
+    for (const auto& item : written) {
+        const DatasetSummary& summary = item.second;
+        totalLines += summary.lines;
+        cout << left << setw(18) << item.first << setw(14) << summary.lines << setw(12) << summary.duplicates
+             << setw(12) << summary.malformed << fixed << setprecision(1) << summary.bytes / 1e6 << endl;
+    }
+    cout << totalLines << " lines in " << setprecision(2) << seconds << " s ("
+         << setprecision(0) << totalLines / max(seconds, 1e-9) << " lines/s), seed " << options.seed << endl;
+    TaskScheduler::destroyInstance();
+    return 0;
+}
 
-class InventoryManager {
-private:
-    unique_ptr<Inventory> rawMaterials;
-    unique_ptr<Inventory> products;
-    bool isAdmin;
-    
-    static InventoryManager* instance;
-    
-    // Private constructor for Singleton
-    InventoryManager(bool admin = false) : isAdmin(admin) {
-        rawMaterials = make_unique<Inventory>("rawmaterial.txt", make_unique<RawMaterialInventory>(), admin);
-        products = make_unique<Inventory>("product.txt", make_unique<ProductInventory>(), admin);
-        initializeSampleData();
+// ================= BENCHMARKS =================
+
+// Contention benchmark for lock-free stock adjustments: "try --bench-stock [records]".
+// Threads split a fixed number of adjust/tryReserve calls over either every
+// record (low contention) or the first 8 (hot items). The same calls are then
+// repeated with a global mutex around each one for comparison.
+void benchmarkStockAdjust(int recordCount) {
+    const int totalOps = 2000000;
+    const int hotItems = 8;
+
+    RecordStore store;
+    vector<Record> records;
+    for (int id = 1; id <= recordCount; id++) {
+        records.emplace_back(id, "Item", 1000000, 1.0);
     }
-    
-    void initializeSampleData() {
-        ifstream rmCheck("rawmaterial.txt");
-        bool rmFileEmpty = !rmCheck || rmCheck.peek() == ifstream::traits_type::eof();
-        rmCheck.close();
-        
-        ifstream prodCheck("product.txt");
-        bool prodFileEmpty = !prodCheck || prodCheck.peek() == ifstream::traits_type::eof();
-        prodCheck.close();
-        
-        if (rmFileEmpty) {
-            ofstream rmFile("rawmaterial.txt");
-            if (rmFile) {
-                rmFile << "1 Cotton Fabric|500 150.00" << endl;
-                rmFile << "2 Polyester Fabric|450 120.00" << endl;
-                rmFile << "3 Denim|300 200.00" << endl;
-                rmFile << "4 Silk Fabric|150 350.00" << endl;
-                rmFile << "5 Wool Fabric|200 250.00" << endl;
-                rmFile << "6 Thread|1000 10.00" << endl;
-                rmFile << "7 Buttons|2500 5.00" << endl;
-                rmFile << "8 Zippers|1200 15.00" << endl;
-                rmFile << "9 Elastic Bands|800 8.00" << endl;
-                rmFile << "10 Labels/Tags|1200 3.00" << endl;
-                rmFile.close();
-                cout << "Initialized sample raw materials data." << endl;
-            }
-        }
-        
-        if (prodFileEmpty) {
-            ofstream prodFile("product.txt");
-            if (prodFile) {
-                prodFile << "1 Men's T-Shirts|200 220.00" << endl;
-                prodFile << "2 Women's Blouses|180 320.00" << endl;
-                prodFile << "3 Denim Jeans|150 650.00" << endl;
-                prodFile << "4 Hoodies|120 750.00" << endl;
-                prodFile << "5 Jackets|100 750.00" << endl;
-                prodFile << "6 Formal Trousers|90 340.00" << endl;
-                prodFile << "7 Skirts|110 490.00" << endl;
-                prodFile << "8 Dresses|85 300.00" << endl;
-                prodFile << "9 Shorts|95 270.00" << endl;
-                prodFile << "10 Polo Shirts|130 270.00" << endl;
-                prodFile.close();
-                cout << "Initialized sample products data." << endl;
-            }
+    store.replaceAll(records);
+
+    mutex globalMutex;
+
+    auto run = [&](int threadCount, int idRange, bool useMutex) {
+        auto start = chrono::steady_clock::now();
+        vector<thread> threads;
+        for (int t = 0; t < threadCount; t++) {
+            threads.emplace_back([&, t]() {
+                mt19937 rng(t + 1);
+                uniform_int_distribution<int> pick(1, idRange);
+                int ops = totalOps / threadCount;
+                for (int i = 0; i < ops; i++) {
+                    int id = pick(rng);
+                    if (useMutex) {
+                        lock_guard<mutex> lock(globalMutex);
+                        if (i & 1) {
+                            store.tryReserve(id, 1);
+                        } else {
+                            store.adjust(id, 1);
+                        }
+                    } else if (i & 1) {
+                        store.tryReserve(id, 1);
+                    } else {
+                        store.adjust(id, 1);
+                    }
+                }
+            });
         }
+        for (thread& worker : threads) worker.join();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return totalOps / seconds / 1e6;
+    };
+
+    cout << "Stock adjustment throughput, " << totalOps << " ops, " << recordCount << " records (Mops/s)" << endl;
+    cout << left << setw(10) << "Threads"
+         << setw(14) << "atomic/all" << setw(14) << "mutex/all"
+         << setw(14) << "atomic/hot" << setw(14) << "mutex/hot" << endl;
+    for (int threadCount = 1; threadCount <= 64; threadCount *= 2) {
+        cout << left << setw(10) << threadCount << fixed << setprecision(2)
+             << setw(14) << run(threadCount, recordCount, false)
+             << setw(14) << run(threadCount, recordCount, true)
+             << setw(14) << run(threadCount, min(hotItems, recordCount), false)
+             << setw(14) << run(threadCount, min(hotItems, recordCount), true) << endl;
     }
-    
-public:
-    // Delete copy constructor and assignment operator
-    InventoryManager(const InventoryManager&) = delete;
-    InventoryManager& operator=(const InventoryManager&) = delete;
-    
-    // Get singleton instance
-    static InventoryManager* getInstance(bool admin = false) {
-        if (!instance) {
-            instance = new InventoryManager(admin);
-        } else {
-            // Update admin status if needed
-            instance->setAdminStatus(admin);
-        }
-        return instance;
+}
+
+#ifdef __linux__
+
+// A "Field:  123 kB" line of /proc/self/status
+long procStatusKb(const char* field) {
+    ifstream status("/proc/self/status");
+    string line;
+    size_t length = strlen(field);
+    while (getline(status, line)) {
+        if (line.compare(0, length, field) == 0 && line[length] == ':') return atol(line.c_str() + length + 1);
     }
-    
-    // Cleanup singleton
-    static void destroyInstance() {
-        if (instance) {
-            delete instance;
-            instance = nullptr;
-        }
+    return 0;
+}
+
+// Resident set size of this process, from /proc
+long currentRssKb() {
+    return procStatusKb("VmRSS");
+}
+
+// Highest resident set size since the last resetPeakRss, or since the start
+long peakRssKb() {
+    return procStatusKb("VmHWM");
+}
+
+void resetPeakRss() {
+    ofstream clearRefs("/proc/self/clear_refs");
+    clearRefs << "5" << endl;
+}
+
+int connectToServer(const string& socketPath) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        fd = -1;
     }
-    
-    void setAdminStatus(bool admin) {
-        isAdmin = admin;
-        rawMaterials->setAdminStatus(admin);
-        products->setAdminStatus(admin);
+    return fd;
+}
+
+// Server pipeline benchmark: "try --bench-server [sessions]". Runs the server
+// in this process, opens that many idle sessions to measure the memory each
+// costs, then times request round trips (event loop -> worker pool -> event
+// loop) with several clients sending at once.
+void benchmarkServer(int idleCount) {
+    if (!acquireDataLock()) {
+        cout << "Error: Another IMS process is already using these inventory files." << endl;
+        return;
     }
-    
-    void runInventoryMenu() {
-        bool menu = true;
-        while (menu) {
-            cout << "\n ----- Inventory Management Menu ----- " << endl;
-            cout << "1. Raw Material Inventory" << endl;
-            cout << "2. Product Inventory" << endl;
-            cout << "3. Return to Main Menu" << endl;
-            
-            int choice = getValidIntInput("Enter your choice (1-3): ", 1);
-            switch (choice) {
-                case 1: rawMaterials->displayMenu(); break;
-                case 2: products->displayMenu(); break;
-                case 3:
-                    if (getConfirmation("Are you sure you want to return to the main menu?")) 
-                        menu = false;
-                    break;
-                default: cout << "Invalid choice. Please try again." << endl;
-            }
-        }
+
+    // Both ends of every session live in this process
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        idleCount = (int)min<rlim_t>((rlim_t)idleCount, (limit.rlim_cur - 64) / 2);
     }
-};
 
-// Initialize static member
-InventoryManager* InventoryManager::instance = nullptr;
+    UserManager::getInstance()->createDefaultCredentialsIfNeeded();
+    InventoryManager::getInstance();
+    ReportManager::getInstance();
+    serverLogEnabled = false;
 
-// ================= MENU SYSTEM =================
+    const string socketPath = "ims-bench.sock";
+    ImsServer server(socketPath, max(2u, thread::hardware_concurrency()));
+    thread serverThread([&server]() { server.run(); });
 
-void adminUserManagementMenu() {
-    UserManager* userManager = UserManager::getInstance();
-    
-    while (true) {
-        cout << "\n--- Admin User Management ---\n";
-        cout << "1. List Admins\n2. List Employees\n3. Add Admin\n4. Add Employee\n";
-        cout << "5. Edit Admin\n6. Edit Employee\n7. Delete Admin\n8. Delete Employee\n0. Back\nChoice: ";
-        
-        int choice;
-        cin >> choice;
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
-        
-        switch (choice) {
-            case 1: userManager->listUsers(true); break;
-            case 2: userManager->listUsers(false); break;
-            case 3: userManager->addUser(true); break;
-            case 4: userManager->addUser(false); break;
-            case 5: userManager->editUser(true); break;
-            case 6: userManager->editUser(false); break;
-            case 7: userManager->deleteUser(true); break;
-            case 8: userManager->deleteUser(false); break;
-            case 0: return;
-            default: cout << "Invalid choice.\n";
+    auto waitForSessions = [&server](size_t count) {
+        for (int i = 0; i < 2000 && server.sessionCount() != count; i++) {
+            this_thread::sleep_for(chrono::milliseconds(5));
         }
+    };
+
+    int probe = -1;
+    for (int i = 0; i < 200 && (probe = connectToServer(socketPath)) < 0; i++) {
+        this_thread::sleep_for(chrono::milliseconds(10));
     }
-}
+    if (probe < 0) {
+        cout << "Error: Benchmark server did not start." << endl;
+        ImsServer::requestStop();
+        serverThread.join();
+        return;
+    }
+    close(probe);
+    waitForSessions(0);
 
-void adminMenu() {
-    InventoryManager* inventoryManager = InventoryManager::getInstance(true);
-    ReportManager* reportManager = ReportManager::getInstance();
-    
-    bool adminSession = true;
-    while (adminSession) {
-        cout << "\n--------------------------------" << endl;
-        cout << "|       ADMIN DASHBOARD        |" << endl;
-        cout << "--------------------------------" << endl;
-        cout << "1. Manage Inventory" << endl;
-        cout << "2. Manage Users" << endl;
-        cout << "3. Reports" << endl;
-        cout << "4. Logout" << endl;
-        
-        int adminChoice = getValidIntInput("Enter your choice (1-4): ", 1);
-        switch (adminChoice) {
-            case 1: inventoryManager->runInventoryMenu(); break;
-            case 2: adminUserManagementMenu(); break;
-            case 3: reportManager->reportUI(); break;
-            case 4:
-                if (getConfirmation("Are you sure you want to logout?")) {
-                    cout << "Logging out from admin account..." << endl;
-                    adminSession = false;
+    long rssBefore = currentRssKb();
+    vector<int> idle;
+    for (int i = 0; i < idleCount; i++) {
+        int fd = connectToServer(socketPath);
+        if (fd < 0) break;
+        idle.push_back(fd);
+    }
+    waitForSessions(idle.size());
+    long rssAfter = currentRssKb();
+
+    cout << "Idle sessions: " << server.sessionCount() << " (server threads: "
+         << max(2u, thread::hardware_concurrency()) + 1 << ")" << endl;
+    cout << "Memory per idle session: " << fixed << setprecision(2)
+         << (idle.empty() ? 0.0 : (rssAfter - rssBefore) * 1024.0 / idle.size()) << " bytes RSS" << endl;
+
+    const int requestsPerClient = 20000;
+    cout << left << setw(10) << "Clients" << setw(16) << "Requests/s" << "Mean latency (us)" << endl;
+    for (int clients = 1; clients <= 64; clients *= 4) {
+        atomic<int> completed(0);
+        auto start = chrono::steady_clock::now();
+        vector<thread> threads;
+        for (int c = 0; c < clients; c++) {
+            threads.emplace_back([&]() {
+                int fd = connectToServer(socketPath);
+                if (fd < 0) return;
+                string buffer, line;
+                for (int i = 0; i < requestsPerClient / clients; i++) {
+                    if (!writeAll(fd, "HELP\n")) break;
+                    while (readLine(fd, buffer, line) && line != ".") {}
+                    completed++;
                 }
-                break;
-            default: cout << "Invalid choice. Please try again." << endl; break;
+                close(fd);
+            });
         }
+        for (thread& client : threads) client.join();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << left << setw(10) << clients << setw(16) << setprecision(0) << completed / seconds
+             << setprecision(1) << seconds * 1e6 * clients / max(1, completed.load()) << endl;
     }
+
+    for (int fd : idle) close(fd);
+    ImsServer::requestStop();
+    serverThread.join();
+    serverLogEnabled = true;
+
+    UserManager::destroyInstance();
+    InventoryManager::destroyInstance();
+    ReportManager::destroyInstance();
+    TaskScheduler::destroyInstance();
 }
 
-void employeeMenu() {
-    InventoryManager* inventoryManager = InventoryManager::getInstance(false);
-    
-    bool empSession = true;
-    while (empSession) {
-        cout << "\n--------------------------------" << endl;
-        cout << "|      EMPLOYEE DASHBOARD      |" << endl;
-        cout << "--------------------------------" << endl;
-        cout << "1. Manage Inventory" << endl;
-        cout << "2. Logout" << endl;
-        
-        int empChoice = getValidIntInput("Enter your choice (1-2): ", 1);
-        switch (empChoice) {
-            case 1: inventoryManager->runInventoryMenu(); break;
-            case 2:
-                if (getConfirmation("Are you sure you want to logout?")) {
-                    cout << "Logging out from employee account..." << endl;
-                    empSession = false;
-                }
-                break;
-            default: cout << "Invalid choice. Please try again." << endl; break;
+// Output that is thrown away, so report timings include the formatting but
+// not the terminal
+class DiscardBuffer : public streambuf {
+protected:
+    int overflow(int c) override { return traits_type::not_eof(c); }
+    streamsize xsputn(const char*, streamsize n) override { return n; }
+};
+
+// Core path benchmark: "try --bench-core [records ...]". For each size
+// (1e3, 1e5 and 1e7 records by default) a scratch directory gets a raw
+// material file and as many employee accounts from generateDataset, and
+// load, save, lookup, edit, report, delete and login are timed there. Each
+// operation repeats until it has its number of samples or has used its
+// time budget, and runs at least once. Prints one JSON object per operation
+// and size: median and 99th percentile latency in microseconds, throughput
+// (records per second for whole-file operations, calls per second
+// otherwise) and peak RSS while the operation ran.
+void benchmarkCore(const vector<long long>& sizes) {
+    const double budgetSeconds = 2.0;
+    const string directory = "ims-bench";
+    const char* scratchFiles[] = {"rawmaterial.txt", "rawmaterial.txt.tmp", "rawmaterial.ledger",
+                                  "rawmaterial.ledger.snap", "rawmaterial.lots", "rawmaterial.demand",
+                                  "product.txt", "admin.txt", "employee.txt"};
+    ChangeContext context = {"bench", nullptr};
+    DiscardBuffer discardBuffer;
+    ostream discard(&discardBuffer);
+
+    auto measure = [&](const char* operation, const char* unit, long long records, size_t maxSamples,
+                       size_t itemsPerSample, const function<void(size_t)>& setup,
+                       const function<void(size_t)>& sample) {
+        resetPeakRss();
+        vector<double> micros;
+        double elapsed = 0;
+        for (size_t i = 0; i < maxSamples && (i == 0 || elapsed < budgetSeconds); i++) {
+            if (setup) setup(i);
+            auto before = chrono::steady_clock::now();
+            sample(i);
+            double took = chrono::duration<double, micro>(chrono::steady_clock::now() - before).count();
+            micros.push_back(took);
+            elapsed += took / 1e6;
+        }
+        vector<double> sorted = micros;
+        sort(sorted.begin(), sorted.end());
+        auto percentile = [&](double p) {
+            size_t rank = (size_t)ceil(p * sorted.size());
+            return sorted[min(sorted.size(), max<size_t>(rank, 1)) - 1];
+        };
+        cout << "{\"operation\":\"" << operation << "\",\"records\":" << records
+             << ",\"samples\":" << sorted.size() << fixed << setprecision(2)
+             << ",\"median_us\":" << percentile(0.5) << ",\"p99_us\":" << percentile(0.99)
+             << ",\"throughput_per_s\":" << sorted.size() * itemsPerSample / max(elapsed, 1e-9)
+             << ",\"unit\":\"" << unit << "\",\"peak_rss_kb\":" << peakRssKb() << "}" << endl;
+    };
+
+    if (!enterDirectory(directory)) {
+        cerr << "Error: Could not enter " << directory << "." << endl;
+        return;
+    }
+    for (long long n : sizes) {
+        for (const char* file : scratchFiles) remove(file);
+        cerr << "Writing " << n << " records and accounts..." << endl;
+        DatasetOptions options;
+        options.seed = 42;
+        options.rawMaterials = options.employees = (size_t)n;
+        options.products = 0;
+        options.billsOfMaterials = false;
+        generateDataset(options);
+
+        mt19937 rng(7);
+        uniform_int_distribution<long long> pickId(1, n);
+        unique_ptr<Inventory> inventory;
+        Record record(0, "", 0, 0);
+
+        measure("load", "records", n, 5, n, [&](size_t) { inventory.reset(); }, [&](size_t) {
+            inventory = make_unique<Inventory>("rawmaterial.txt", make_unique<RawMaterialInventory>());
+        });
+        inventory->flushPersistence();
+
+        measure("save", "records", n, 5, n, nullptr, [&](size_t) { inventory->saveNow(); });
+
+        vector<int> ids(200000);
+        for (int& id : ids) id = (int)pickId(rng);
+        measure("lookup", "calls", n, ids.size(), 1, nullptr,
+                [&](size_t i) { inventory->findRecord(ids[i], record); });
+
+        measure("edit", "calls", n, 10000, 1, [&](size_t i) { inventory->findRecord(ids[i], record); },
+                [&](size_t i) {
+                    inventory->editRecord(ids[i], record.version(), "", record.quantity() + 1, record.price + 1, true,
+                                          context);
+                });
+        inventory->flushPersistence();
+
+        measure("report", "records", n, 5, n, nullptr,
+                [&](size_t) { ReportManager::getInstance()->displayRawMatReport(*inventory, discard); });
+
+        // Every sample deletes a different record
+        vector<int> victims;
+        unordered_set<int> chosen;
+        while (victims.size() < (size_t)min<long long>(10000, n / 2)) {
+            int id = (int)pickId(rng);
+            if (chosen.insert(id).second) victims.push_back(id);
+        }
+        measure("delete", "calls", n, victims.size(), 1, nullptr,
+                [&](size_t i) { inventory->deleteRecord(victims[i], true, context); });
+        inventory->flushPersistence();
+        inventory.reset();
+
+        UserManager::destroyInstance();
+        UserManager* users = UserManager::getInstance();
+        vector<pair<string, string>> accounts, logins(100000);
+        {
+            ifstream employees("employee.txt");
+            string line;
+            while (getline(employees, line)) {
+                size_t comma = line.find(',');
+                accounts.emplace_back(line.substr(0, comma), line.substr(comma + 1));
+            }
         }
+        for (auto& login : logins) login = accounts[pickId(rng) - 1];
+        measure("login", "calls", n, logins.size(), 1, nullptr,
+                [&](size_t i) { users->checkCredentials(logins[i].first, logins[i].second); });
+        UserManager::destroyInstance();
     }
+    for (const char* file : scratchFiles) remove(file);
+    if (chdir("..") == 0) rmdir(directory.c_str());
+
+    ReportManager::destroyInstance();
+    TaskScheduler::destroyInstance();
+}
+
+#else
+
+void benchmarkServer(int) {
+    cout << "Server mode is only available on Linux." << endl;
+}
+
+void benchmarkCore(const vector<long long>&) {
+    cout << "The core benchmark is only available on Linux." << endl;
 }
 
+#endif
+
 // ================= MAIN FUNCTION =================
 
-int main() {
+int main(int argc, char* argv[]) {
     string username, password;
     string userType;
     bool runProgram = true;
     
+    // "--workers N" sets the task scheduler size and may appear anywhere; it is
+    // taken out of the arguments before the other options are looked at
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--workers") != 0) continue;
+        TaskScheduler::setWorkerCount(max(1, atoi(argv[i + 1])));
+        for (int j = i; j + 2 <= argc; j++) argv[j] = argv[j + 2];
+        argc -= 2;
+        i--;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--server") == 0) {
+        return runServer(argc > 2 ? argv[2] : DEFAULT_SOCKET_PATH);
+    }
+    if (argc > 1 && strcmp(argv[1], "--connect") == 0) {
+        return runClient(argc > 2 ? argv[2] : DEFAULT_SOCKET_PATH);
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-server") == 0) {
+        benchmarkServer(argc > 2 ? max(1, atoi(argv[2])) : 10000);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-core") == 0) {
+        vector<long long> sizes;
+        for (int i = 2; i < argc; i++) sizes.push_back(max(1LL, (long long)atof(argv[i])));
+        if (sizes.empty()) sizes = {1000, 100000, 10000000};
+        benchmarkCore(sizes);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "--generate") == 0) {
+        return runGenerator(argc - 2, argv + 2);
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-stock") == 0) {
+        benchmarkStockAdjust(argc > 2 ? max(1, atoi(argv[2])) : 10000);
+        return 0;
+    }
+    
+    // --shm: the first process owns the files and shares the inventory through
+    // shared memory; later ones attach to it instead of being turned away
+    bool sharedMemory = argc > 1 && strcmp(argv[1], "--shm") == 0;
+    bool attached = false;
+    if (!acquireDataLock()) {
+        if (!sharedMemory) {
+            cout << "Another IMS process is already using these inventory files." << endl;
+            cout << "Run one instance with --server and connect to it with --connect to share them," << endl;
+            cout << "or start every instance with --shm." << endl;
+            return 1;
+        }
+        InventoryManager::setStorageMode(STORAGE_SHARED_ATTACH);
+        if (!InventoryManager::getInstance()->isAvailable()) {
+            cout << "The IMS process using these inventory files was not started with --shm." << endl;
+            InventoryManager::destroyInstance();
+            TaskScheduler::destroyInstance();
+            return 1;
+        }
+        attached = true;
+        cout << "Attached to the shared inventory of the running IMS process." << endl;
+    } else if (sharedMemory) {
+        InventoryManager::setStorageMode(STORAGE_SHARED_OWNER);
+        InventoryManager::getInstance();
+        cout << "Sharing the inventory with other IMS processes started with --shm." << endl;
+    }
+    
     // Initialize singletons
     UserManager* userManager = UserManager::getInstance();
     userManager->createDefaultCredentialsIfNeeded();
     
     while (runProgram) {
+        if (attached && !InventoryManager::getInstance()->sharedOwnerAlive()) {
+            cout << "The IMS process that owns the shared inventory has exited; changes can no longer be saved." << endl;
+            break;
+        }
+
         cout << "\n--------------------------------" << endl;
         cout << "|        LOGIN SYSTEM          |" << endl;
         cout << "--------------------------------" << endl;
@@ -1308,9 +10364,9 @@ int main() {
         if (!userType.empty()) {
             cout << "\nLogin successful! You are logged in as " << userType << "." << endl;
             if (userType == "admin") {
-                adminMenu();
+                adminMenu(username);
             } else {
-                employeeMenu();
+                employeeMenu(username);
             }
         } else {
             cout << "Login failed. Invalid username or password." << endl;
@@ -1325,6 +10381,7 @@ int main() {
     UserManager::destroyInstance();
     InventoryManager::destroyInstance();
     ReportManager::destroyInstance();
+    TaskScheduler::destroyInstance();
     
     return 0;
 }
\ No newline at end of file